@@ -38,6 +38,7 @@ typedef struct fz_style_context fz_style_context;
 typedef struct fz_tuning_context fz_tuning_context;
 typedef struct fz_store fz_store;
 typedef struct fz_glyph_cache fz_glyph_cache;
+typedef struct fz_glyph_cache_l1 fz_glyph_cache_l1;
 typedef struct fz_document_handler_context fz_document_handler_context;
 typedef struct fz_archive_handler_context fz_archive_handler_context;
 typedef struct fz_output fz_output;
@@ -579,6 +580,23 @@ float fz_graphics_min_line_width(fz_context *ctx);
 */
 void fz_set_graphics_min_line_width(fz_context *ctx, float min_line_width);
 
+/**
+	Enable or disable the vectorised (SIMD) compositing and image
+	scaling routines.
+
+	These are used by default whenever the CPU supports them. They
+	give the same results as the plain C routines, so this is
+	mainly useful for testing and benchmarking. Note that this
+	setting applies to all contexts.
+*/
+void fz_set_paint_simd(fz_context *ctx, int enable);
+
+/**
+	Return non-zero if the vectorised (SIMD) compositing and image
+	scaling routines are in use.
+*/
+int fz_paint_simd(fz_context *ctx);
+
 /**
 	Get the user stylesheet source text.
 */
@@ -820,6 +838,7 @@ struct fz_context
 	int icc_enabled;
 #endif
 	int throw_on_repair;
+	fz_glyph_cache_l1 *glyph_l1;
 
 	/* TODO: should these be unshared? */
 	fz_document_handler_context *handler;
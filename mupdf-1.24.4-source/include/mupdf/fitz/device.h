@@ -432,7 +432,10 @@ enum
 	/* Hints */
 	FZ_DONT_INTERPOLATE_IMAGES = 1,
 	FZ_NO_CACHE = 2,
-	FZ_DONT_DECODE_IMAGES = 4
+	FZ_DONT_DECODE_IMAGES = 4,
+	/* Draw filled images and image masks from coarse, quick to
+	 * decode pixmaps (see fz_get_coarse_pixmap_from_image). */
+	FZ_PREVIEW_IMAGES = 8
 };
 
 /**
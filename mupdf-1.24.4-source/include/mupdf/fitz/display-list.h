@@ -96,6 +96,58 @@ fz_device *fz_new_list_device(fz_context *ctx, fz_display_list *list);
 */
 void fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie);
 
+/**
+	Build a spatial index over the commands in a display list.
+
+	Once indexed, fz_run_display_list can jump over whole runs of
+	commands that lie outside the scissor rectangle, rather than
+	decoding and culling them one at a time. This makes rendering
+	small tiles of large, complex pages much cheaper. Clip, mask
+	and group nesting is preserved: a run is only skipped if it is
+	balanced and nothing within it is visible.
+
+	The index is optional and is used automatically when present.
+	If the list is added to after indexing, the stale index is
+	ignored until this is called again.
+
+	The index is stored in the list, so call this before sharing
+	the list between threads.
+*/
+void fz_index_display_list(fz_context *ctx, fz_display_list *list);
+
+/**
+	Write a display list to an output stream in a compact,
+	versioned binary form that can be read back with
+	fz_load_display_list, possibly by another process.
+
+	Images, fonts, shadings, colorspaces and transfer functions
+	are written once each, keyed by the MD5 of their serialized
+	form, and referred to by number from the drawing commands.
+	Images keep their compressed data where it is available.
+	Tint transforms and transfer functions are stored as sampled
+	tables.
+
+	The list is written by replaying it, so commands that would
+	never draw anything may be dropped.
+
+	Throws FZ_ERROR_UNSUPPORTED for resources that cannot be
+	represented (e.g. DeviceN colorspaces with more than 8
+	colorants).
+*/
+void fz_save_display_list(fz_context *ctx, fz_display_list *list, fz_output *out);
+
+/**
+	Read a display list written by fz_save_display_list.
+
+	The stream is read sequentially to the end of the list. Open
+	a file with fz_open_file to have it memory mapped, or use
+	fz_open_buffer for data already in memory.
+
+	Throws FZ_ERROR_FORMAT if the data is not a display list, is
+	of an unknown version, or is corrupt.
+*/
+fz_display_list *fz_load_display_list(fz_context *ctx, fz_stream *stm);
+
 /**
 	Increment the reference count for a display list. Returns the
 	same pointer.
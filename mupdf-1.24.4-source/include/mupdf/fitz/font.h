@@ -779,6 +779,10 @@ struct fz_font
 
 	/* Which font to use in a collection. */
 	int subfont;
+
+	/* Unique within the font context; lets the glyph cache recognise
+	 * a font without holding a reference to it. */
+	unsigned int id;
 };
 
 void fz_ft_lock(fz_context *ctx);
@@ -34,6 +34,37 @@
 */
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/**
+	Set the maximum number of bytes of rendered glyphs that the
+	glyph cache may hold (1MB by default). Least recently used
+	glyphs are evicted immediately if the cache is now too large.
+	Glyphs held by the per-context front caches count towards this
+	limit.
+*/
+void fz_set_glyph_cache_size(fz_context *ctx, size_t size);
+
+/**
+	Return the maximum size of the glyph cache in bytes.
+*/
+size_t fz_glyph_cache_size(fz_context *ctx);
+
+/**
+	Retrieve counters describing how well the glyph cache is
+	performing.
+
+	hits: The number of glyphs found in the cache. Glyphs found in
+	the per-context front cache are included once that context has
+	been dropped, or immediately for the calling context.
+
+	misses: The number of glyphs that had to be rendered.
+
+	evictions: The number of glyphs dropped to keep the cache
+	within its size limit.
+
+	Any of the pointers may be NULL.
+*/
+void fz_glyph_cache_stats(fz_context *ctx, size_t *hits, size_t *misses, size_t *evictions);
+
 /**
 	Create a pixmap containing a rendered glyph.
 
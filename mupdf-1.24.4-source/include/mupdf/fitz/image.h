@@ -66,6 +66,23 @@ typedef struct fz_pixmap_image fz_pixmap_image;
 */
 fz_pixmap *fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *w, int *h);
 
+/**
+	As fz_get_pixmap_from_image(), but decode the image coarsely, for
+	quick previews.
+
+	coarsen: How many more times to halve the resolution in each
+	direction than fz_get_pixmap_from_image() would (limited to the
+	usual maximum subsampling of 1/64, and to at least one pixel).
+	For a JPEG drawn at its natural size, 3 means decoding just the
+	DC coefficient of each block.
+
+	Coarse pixmaps are cached under their own subsampling factor, so
+	they are never returned in place of full resolution ones. A full
+	resolution pixmap already in the store is returned in preference
+	to decoding a coarse one.
+*/
+fz_pixmap *fz_get_coarse_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *w, int *h, int coarsen);
+
 /**
 	Calls fz_get_pixmap_from_image() with ctm, subarea, w and h all set to NULL.
 */
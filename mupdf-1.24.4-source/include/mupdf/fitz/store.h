@@ -410,6 +410,19 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 */
 void fz_debug_store(fz_context *ctx, fz_output *out);
 
+/**
+	Retrieve counters describing how well the store is performing.
+
+	hits, misses: The number of fz_find_item calls that did and did
+	not find an item since the store was created.
+
+	evictions: The number of items dropped from the store to make
+	room for others.
+
+	Any of the pointers may be NULL.
+*/
+void fz_store_stats(fz_context *ctx, size_t *hits, size_t *misses, size_t *evictions);
+
 /**
 	Increment the defer reap count.
 
@@ -64,6 +64,49 @@ fz_stream *fz_open_file(fz_context *ctx, const char *filename);
 */
 fz_stream *fz_try_open_file(fz_context *ctx, const char *name);
 
+/**
+	Hints given to the operating system about how a memory mapped
+	file will be read.
+*/
+enum
+{
+	FZ_ACCESS_NORMAL,
+	FZ_ACCESS_SEQUENTIAL,
+	FZ_ACCESS_RANDOM
+};
+
+/**
+	Open the named file and map it into memory, rather than reading
+	it through a buffer. The stream is then a window onto the whole
+	file, so reading and seeking cost no system calls or copies.
+
+	access: FZ_ACCESS_SEQUENTIAL if the file will be read from start
+	to end, FZ_ACCESS_RANDOM if it will be read in scattered pieces
+	(such as when parsing a PDF), or FZ_ACCESS_NORMAL for no hint.
+
+	Returns NULL if the file can be opened but not mapped (for
+	example if it is not a regular file, or memory mapping is not
+	available on this platform). Throws if it cannot be opened.
+
+	Note that if another process truncates the file while it is
+	mapped, reading from the stream may crash the process.
+*/
+fz_stream *fz_open_file_mapped(fz_context *ctx, const char *filename, int access);
+
+/**
+	Enable or disable memory mapping of files opened with
+	fz_open_file and fz_try_open_file.
+
+	This is enabled by default on platforms that support it. Note
+	that this setting applies to all contexts.
+*/
+void fz_set_file_mapping(fz_context *ctx, int enable);
+
+/**
+	Return non-zero if fz_open_file maps files into memory.
+*/
+int fz_file_mapping(fz_context *ctx);
+
 #ifdef _WIN32
 /**
 	Open the named file and wrap it in a stream.
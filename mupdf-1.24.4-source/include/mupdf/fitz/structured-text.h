@@ -249,6 +249,68 @@ void fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page
 */
 int fz_search_stext_page(fz_context *ctx, fz_stext_page *text, const char *needle, int *hit_mark, fz_quad *hit_bbox, int hit_max);
 
+/**
+	A set of needles compiled for searching for all of them in a
+	single pass over the text (Aho-Corasick).
+
+	Needles are matched exactly as by fz_search_stext_page: case
+	insensitively, with any run of white space (including line
+	breaks) matching any run of white space. Each needle finds the
+	same non-overlapping hits it would find on its own; hits of
+	different needles may overlap.
+*/
+typedef struct fz_search_needles fz_search_needles;
+
+/**
+	Compile n needles. Needles are identified by their index in
+	the array. Empty needles never match.
+*/
+fz_search_needles *fz_new_search_needles(fz_context *ctx, int n, const char * const *needles);
+fz_search_needles *fz_keep_search_needles(fz_context *ctx, fz_search_needles *needles);
+void fz_drop_search_needles(fz_context *ctx, fz_search_needles *needles);
+
+/**
+	Return the number of needles in the set.
+*/
+int fz_count_search_needles(fz_context *ctx, fz_search_needles *needles);
+
+/**
+	Search for all needles in a text page at once.
+
+	Returns the number of hit quads, as fz_search_stext_page does,
+	and stores the index of the needle each quad belongs to in
+	hit_needle (if not NULL). Hits are reported in the order in
+	which they end in the text.
+*/
+int fz_search_stext_page_needles(fz_context *ctx, fz_stext_page *text, fz_search_needles *needles, int *hit_needle, int *hit_mark, fz_quad *hit_bbox, int hit_max);
+
+/**
+	Callback for fz_match_stext_page_needles, called for every
+	character of every hit. is_at_start is set for the first
+	character of each hit.
+*/
+typedef void (fz_search_hit_char_fn)(fz_context *ctx, void *arg, int needle, fz_stext_line *line, fz_stext_char *ch, int is_at_start);
+
+/**
+	Search for all needles in a text page at once, reporting the
+	characters of each hit through a callback rather than as quads.
+
+	Characters that do not intersect area are ignored, as if they
+	were not on the page. Pass fz_infinite_rect to search all text.
+*/
+void fz_match_stext_page_needles(fz_context *ctx, fz_stext_page *text, fz_search_needles *needles, fz_rect area, fz_search_hit_char_fn *fn, void *arg);
+
+/**
+	Callback for fz_match_string_needles, called for every hit with
+	the byte offsets of its start and end in the string.
+*/
+typedef void (fz_search_hit_string_fn)(fz_context *ctx, void *arg, int needle, size_t start, size_t end);
+
+/**
+	Search for all needles in a UTF-8 string at once.
+*/
+void fz_match_string_needles(fz_context *ctx, fz_search_needles *needles, const char *text, fz_search_hit_string_fn *fn, void *arg);
+
 /**
 	Return a list of quads to highlight lines inside the selection
 	points.
@@ -314,6 +376,35 @@ fz_stext_options *fz_parse_stext_options(fz_context *ctx, fz_stext_options *opts
 */
 fz_device *fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options *options);
 
+/**
+	Callback for a streaming text device, called once for each line
+	as soon as it is complete.
+
+	block_num: The number of the block the line belongs to, counting
+	image blocks too (as they would appear in an fz_stext_page).
+
+	line: The finished line. Its bbox is set and visually ordered
+	bidi text has been reordered. The line and its chars are only
+	valid for the duration of the call.
+*/
+typedef void (fz_stext_line_fn)(fz_context *ctx, void *arg, int block_num, fz_stext_line *line);
+
+/**
+	Create a device to extract the text on a page line by line.
+
+	This works like fz_new_stext_device, but instead of gathering the
+	whole page, every line is passed to fn as soon as the next line
+	is started, and then freed. Memory use is thus bounded by the
+	size of one line rather than the size of the page. Lines are
+	delivered in the same order, and with the same contents, as they
+	would appear in the fz_stext_page created with the same options.
+
+	The final line is delivered by fz_close_device.
+
+	mediabox: The page area, as for fz_new_stext_page.
+*/
+fz_device *fz_new_stext_stream_device(fz_context *ctx, fz_rect mediabox, const fz_stext_options *options, fz_stext_line_fn *fn, void *arg);
+
 /**
 	Create a device to OCR the text on the page.
 
@@ -361,5 +452,48 @@ fz_device *fz_new_ocr_device(fz_context *ctx, fz_device *target, fz_matrix ctm,
 
 fz_document *fz_open_reflowed_document(fz_context *ctx, fz_document *underdoc, const fz_stext_options *opts);
 
+/**
+	A compact, read-only form of a text page.
+
+	All chars are held in one array with the chars of each line
+	contiguous, and refer to fonts by index instead of holding a
+	reference each. This takes less memory than an fz_stext_page and is
+	faster to create and drop, so it is suited for keeping the text of
+	many pages.
+*/
+typedef struct fz_compact_stext_page fz_compact_stext_page;
+
+enum
+{
+	/* Store char quads as half precision floats relative to the char
+	 * origin. This halves the memory for quads, at the cost of about
+	 * 1/2000 of the font size in precision. */
+	FZ_COMPACT_STEXT_QUANTIZE = 1
+};
+
+/**
+	Create a compact copy of a text page.
+
+	flags: 0 or FZ_COMPACT_STEXT_QUANTIZE.
+*/
+fz_compact_stext_page *fz_new_compact_stext_page(fz_context *ctx, fz_stext_page *page, int flags);
+
+fz_compact_stext_page *fz_keep_compact_stext_page(fz_context *ctx, fz_compact_stext_page *cpage);
+void fz_drop_compact_stext_page(fz_context *ctx, fz_compact_stext_page *cpage);
+
+/**
+	Return the number of bytes of memory used by a compact text page.
+*/
+size_t fz_compact_stext_page_size(fz_context *ctx, fz_compact_stext_page *cpage);
+
+/**
+	Create a text page from a compact text page, for use with all
+	functions taking an fz_stext_page.
+
+	The chars of each line are allocated as one array, so following
+	their next pointers walks through memory in order.
+*/
+fz_stext_page *fz_new_stext_page_from_compact(fz_context *ctx, fz_compact_stext_page *cpage);
+
 
 #endif
@@ -357,6 +357,14 @@ void pdf_set_layer_config_as_default(fz_context *ctx, pdf_document *doc);
 */
 int pdf_has_unsaved_changes(fz_context *ctx, pdf_document *doc);
 
+/*
+	Return a number that changes whenever an object of the document
+	is changed, replaced or deleted, including by undo and redo. Results
+	derived from the document's contents remain valid while it is the
+	same.
+*/
+int pdf_change_count(fz_context *ctx, pdf_document *doc);
+
 /*
 	Determine if this PDF has been repaired since opening.
 */
@@ -436,6 +444,7 @@ struct pdf_document
 	int repair_attempted;
 	int repair_in_progress;
 	int non_structural_change; /* True if we are modifying the document in a way that does not change the (page) structure */
+	int change_count; /* Incremented by every change to an object, see pdf_change_count() */
 
 	/* State indicating which file parsing method we are using */
 	int file_reading_linearly;
@@ -503,6 +512,12 @@ struct pdf_document
 	fz_xml_doc *xfa;
 
 	pdf_journal *journal;
+
+	struct {
+		int disabled;
+		int hits;
+		int misses;
+	} content_cache;
 };
 
 pdf_document *pdf_create_document(fz_context *ctx);
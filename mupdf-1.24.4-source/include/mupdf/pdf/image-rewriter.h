@@ -75,4 +75,32 @@ typedef struct
 */
 void pdf_rewrite_images(fz_context *ctx, pdf_document *doc, pdf_image_rewriter_options *opts);
 
+/*
+	pdf_rewrite_images in steps, so that the images can be recompressed
+	by several threads.
+
+	pdf_new_image_rewrite_jobs finds the images to rewrite: one job per
+	image, however often it is used. The options must stay valid until
+	the jobs are dropped.
+
+	pdf_load_image_rewrite_job loads the image for a job, and
+	pdf_run_image_rewrite_job decodes, resamples and recompresses it.
+	Running a job does not use the document, so different jobs may be
+	run at the same time by different threads, each with its own
+	cloned context. All other calls use the document, and must be
+	made by one thread at a time. Load jobs a few at a time to limit
+	the memory held by the original images.
+
+	pdf_commit_image_rewrite_jobs then replaces the images in the
+	document, giving the same result as pdf_rewrite_images.
+*/
+typedef struct pdf_image_rewrite_jobs pdf_image_rewrite_jobs;
+
+pdf_image_rewrite_jobs *pdf_new_image_rewrite_jobs(fz_context *ctx, pdf_document *doc, pdf_image_rewriter_options *opts);
+int pdf_count_image_rewrite_jobs(fz_context *ctx, pdf_image_rewrite_jobs *jobs);
+void pdf_load_image_rewrite_job(fz_context *ctx, pdf_document *doc, pdf_image_rewrite_jobs *jobs, int i);
+void pdf_run_image_rewrite_job(fz_context *ctx, pdf_image_rewrite_jobs *jobs, int i);
+void pdf_commit_image_rewrite_jobs(fz_context *ctx, pdf_document *doc, pdf_image_rewrite_jobs *jobs);
+void pdf_drop_image_rewrite_jobs(fz_context *ctx, pdf_image_rewrite_jobs *jobs);
+
 #endif
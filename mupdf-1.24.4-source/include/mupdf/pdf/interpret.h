@@ -209,6 +209,12 @@ typedef struct
 	size_t string_len;
 	int top;
 	float stack[32];
+
+	/* content program being recorded (or replayed instead of lexing) */
+	struct pdf_content_program *prog;
+	int replay;
+	size_t pc;
+	int lexing;
 } pdf_csi;
 
 void pdf_count_q_balance(fz_context *ctx, pdf_document *doc, pdf_obj *res, pdf_obj *stm, int *prepend, int *append);
@@ -449,6 +455,31 @@ void pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc,
 */
 void pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj, fz_cookie *cookie);
 
+/*
+	Content streams, form XObjects, patterns and Type3 glyphs are
+	lexed into a compact program the first time they are processed,
+	which is kept in the store. Processing them again replays the
+	program, skipping decompression, lexing and number parsing.
+
+	Only streams that are unchanged since the file was loaded are
+	cached in this way.
+*/
+void pdf_enable_content_cache(fz_context *ctx, pdf_document *doc);
+void pdf_disable_content_cache(fz_context *ctx, pdf_document *doc);
+
+/*
+	Get the number of times a content stream was replayed from the
+	cache (hits), and the number of times a cacheable content stream
+	had to be lexed (misses).
+*/
+void pdf_content_cache_stats(fz_context *ctx, pdf_document *doc, int *hits, int *misses);
+
+/*
+	Remove the cached Type3 glyph programs of doc from the store.
+	Called by pdf_empty_store.
+*/
+void pdf_empty_glyph_program_store(fz_context *ctx, pdf_document *doc);
+
 /* Text handling helper functions */
 typedef struct
 {
@@ -156,6 +156,13 @@ fz_stream *pdf_open_stream(fz_context *ctx, pdf_obj *ref);
 */
 fz_stream *pdf_open_inline_stream(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj, int length, fz_stream *chain, fz_compression_params *params);
 fz_compressed_buffer *pdf_load_compressed_stream(fz_context *ctx, pdf_document *doc, int num, size_t worst_case);
+
+/*
+	Estimate the decoded length of a stream from its dictionary, as
+	used for the initial buffer size (and compression bomb check)
+	when loading it.
+*/
+size_t pdf_guess_stream_length(fz_context *ctx, pdf_obj *dict);
 void pdf_load_compressed_inline_image(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int length, fz_stream *cstm, int indexed, fz_compressed_image *image);
 fz_stream *pdf_open_stream_with_offset(fz_context *ctx, pdf_document *doc, int num, pdf_obj *dict, int64_t stm_ofs);
 fz_stream *pdf_open_contents_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj);
@@ -222,6 +229,28 @@ void pdf_repair_xref(fz_context *ctx, pdf_document *doc);
 void pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc);
 void pdf_repair_trailer(fz_context *ctx, pdf_document *doc);
 
+/*
+	Decode object streams on several threads ahead of loading the
+	objects in them (for example before saving with garbage collection).
+
+	pdf_new_obj_stm_prefetch reads the encoded data of every object
+	stream that isn't already indexed in the store, on the calling
+	thread. pdf_run_obj_stm_prefetch decodes stream i and parses its
+	header. It uses no document state, so different streams may be
+	decoded on different threads at the same time, each with its own
+	cloned context. Any error is swallowed; the stream is then loaded
+	as usual when needed. pdf_commit_obj_stm_prefetch puts the decoded
+	streams into the store, on the document's thread, and returns how
+	many there were.
+*/
+typedef struct pdf_obj_stm_prefetch pdf_obj_stm_prefetch;
+
+pdf_obj_stm_prefetch *pdf_new_obj_stm_prefetch(fz_context *ctx, pdf_document *doc);
+int pdf_count_obj_stm_prefetch(fz_context *ctx, pdf_obj_stm_prefetch *pf);
+void pdf_run_obj_stm_prefetch(fz_context *ctx, pdf_obj_stm_prefetch *pf, int i);
+int pdf_commit_obj_stm_prefetch(fz_context *ctx, pdf_document *doc, pdf_obj_stm_prefetch *pf);
+void pdf_drop_obj_stm_prefetch(fz_context *ctx, pdf_obj_stm_prefetch *pf);
+
 /*
 	Ensure that the current populating xref has a single subsection
 	that covers the entire range.
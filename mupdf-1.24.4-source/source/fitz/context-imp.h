@@ -61,6 +61,7 @@ void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *su
 int fz_default_image_scale(void *arg, int dst_w, int dst_h, int src_w, int src_h);
 
 void fz_init_aa_context(fz_context *ctx);
+void fz_init_paint_simd(fz_context *ctx);
 
 void fz_new_glyph_cache_context(fz_context *ctx);
 fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
@@ -223,6 +223,7 @@ fz_new_context_imp(const fz_alloc_context *alloc, const fz_locks_context *locks,
 
 	fz_init_error_context(ctx);
 	fz_init_aa_context(ctx);
+	fz_init_paint_simd(ctx);
 	fz_init_random_context(ctx);
 
 	/* Now initialise sections that are shared */
@@ -266,6 +267,9 @@ fz_clone_context(fz_context *ctx)
 	/* Reset error context to initial state. */
 	fz_init_error_context(new_ctx);
 
+	/* Each context has its own front cache for glyphs. */
+	new_ctx->glyph_l1 = NULL;
+
 	/* Then keep lock checking happy by keeping shared contexts with new context */
 	fz_keep_document_handler_context(new_ctx);
 	fz_keep_archive_handler_context(new_ctx);
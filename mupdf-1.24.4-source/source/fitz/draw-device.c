@@ -49,6 +49,10 @@ enum {
 	FZ_DRAWDEV_FLAGS_TYPE3 = 1,
 };
 
+/* How much further to subsample images drawn with FZ_PREVIEW_IMAGES.
+ * For JPEGs at their natural size, 1/8 is DC-only decoding. */
+#define PREVIEW_COARSEN 3
+
 typedef struct {
 	fz_irect scissor;
 	fz_pixmap *dest;
@@ -1833,7 +1837,7 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, fz_matrix
 	if (fz_is_empty_irect(src_area))
 		return;
 
-	pixmap = fz_get_pixmap_from_image(ctx, image, &src_area, &local_ctm, &dx, &dy);
+	pixmap = fz_get_coarse_pixmap_from_image(ctx, image, &src_area, &local_ctm, &dx, &dy, (devp->hints & FZ_PREVIEW_IMAGES) ? PREVIEW_COARSEN : 0);
 	src_cs = fz_default_colorspace(ctx, dev->default_cs, pixmap->colorspace);
 
 	/* convert images with more components (cmyk->rgb) before scaling */
@@ -1951,7 +1955,7 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, fz_ma
 	if (fz_is_empty_irect(src_area))
 		return;
 
-	pixmap = fz_get_pixmap_from_image(ctx, image, &src_area, &local_ctm, &dx, &dy);
+	pixmap = fz_get_coarse_pixmap_from_image(ctx, image, &src_area, &local_ctm, &dx, &dy, (devp->hints & FZ_PREVIEW_IMAGES) ? PREVIEW_COARSEN : 0);
 
 	fz_var(pixmap);
 
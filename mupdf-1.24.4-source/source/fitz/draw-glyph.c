@@ -31,7 +31,12 @@
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
-#define GLYPH_HASH_LEN 509
+/* Initial number of hash buckets; always a power of 2. The table doubles
+ * in size whenever it holds more entries than buckets. */
+#define GLYPH_HASH_LEN 512
+
+/* Number of slots in the per-context front cache; a power of 2. */
+#define GLYPH_L1_LEN 64
 
 typedef struct
 {
@@ -58,15 +63,47 @@ struct fz_glyph_cache
 {
 	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	size_t max;
+	int len;
+	int count;
+	int generation;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t evicted;
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
 };
 
+/*
+	Every context has a small direct mapped cache of its own that sits in
+	front of the shared one, so it can be searched without taking the
+	glyph cache lock. It is only ever accessed by the thread that owns the
+	context.
+
+	Entries hold a reference to their glyph, but not to the font; the
+	font is recognised by its pointer together with its id, so a font
+	freed and reallocated at the same address never matches. Type3
+	glyphs are never put in the front cache. The glyphs held count
+	towards the size of the shared cache. Purging the shared cache bumps
+	its generation, which causes front caches to be flushed when they
+	are next used.
+*/
+typedef struct
+{
+	fz_glyph_key key;
+	unsigned int font_id;
+	fz_glyph *val;
+} fz_glyph_l1_entry;
+
+struct fz_glyph_cache_l1
+{
+	int generation;
+	size_t hits;
+	fz_glyph_l1_entry entry[GLYPH_L1_LEN];
+};
+
 static size_t
 fz_glyph_size(fz_context *ctx, fz_glyph *glyph)
 {
@@ -81,12 +118,131 @@ fz_new_glyph_cache_context(fz_context *ctx)
 	fz_glyph_cache *cache;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
+	fz_try(ctx)
+		cache->entry = fz_calloc(ctx, GLYPH_HASH_LEN, sizeof(*cache->entry));
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
+	cache->len = GLYPH_HASH_LEN;
+	cache->max = MAX_CACHE_SIZE;
 	cache->total = 0;
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
 }
 
+static void shrink_glyph_cache(fz_context *ctx, fz_glyph_cache *cache);
+
+/* Drop everything held by this context's front cache. Must not be called
+ * with the glyph cache lock held. */
+static void
+flush_glyph_l1(fz_context *ctx)
+{
+	fz_glyph_cache_l1 *l1 = ctx->glyph_l1;
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < GLYPH_L1_LEN; i++)
+		size += fz_glyph_size(ctx, l1->entry[i].val);
+	if (size)
+	{
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+		ctx->glyph_cache->total -= size;
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	}
+
+	for (i = 0; i < GLYPH_L1_LEN; i++)
+	{
+		fz_drop_glyph(ctx, l1->entry[i].val);
+		l1->entry[i].key.font = NULL;
+		l1->entry[i].val = NULL;
+	}
+}
+
+static void
+l1_insert(fz_context *ctx, unsigned hash, const fz_glyph_key *key, fz_glyph *val)
+{
+	fz_glyph_cache_l1 *l1 = ctx->glyph_l1;
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_l1_entry *slot;
+	fz_glyph *old_val;
+
+	if (l1 == NULL)
+	{
+		l1 = fz_malloc_no_throw(ctx, sizeof(*l1));
+		if (l1 == NULL)
+			return;
+		memset(l1, 0, sizeof(*l1));
+		l1->generation = ctx->glyph_cache->generation;
+		ctx->glyph_l1 = l1;
+	}
+
+	slot = &l1->entry[hash & (GLYPH_L1_LEN - 1)];
+	old_val = slot->val;
+	slot->key = *key;
+	slot->font_id = key->font->id;
+	slot->val = fz_keep_glyph(ctx, val);
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->total += fz_glyph_size(ctx, val);
+	cache->total -= fz_glyph_size(ctx, old_val);
+	shrink_glyph_cache(ctx, cache);
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+
+	fz_drop_glyph(ctx, old_val);
+}
+
+static void
+drop_glyph_l1(fz_context *ctx)
+{
+	fz_glyph_cache_l1 *l1 = ctx->glyph_l1;
+
+	if (l1 == NULL)
+		return;
+
+	flush_glyph_l1(ctx);
+	ctx->glyph_l1 = NULL;
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	ctx->glyph_cache->hits += l1->hits;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_free(ctx, l1);
+}
+
+/* Double the number of hash buckets. The glyph cache lock is always held
+ * when this function is called. Failure to grow is not an error. */
+static void
+grow_glyph_hash(fz_context *ctx, fz_glyph_cache *cache)
+{
+	fz_glyph_cache_entry **entry, *e, *next;
+	int len = cache->len * 2;
+	int i;
+	unsigned h;
+
+	entry = fz_calloc_no_throw(ctx, len, sizeof(*entry));
+	if (entry == NULL)
+		return;
+
+	for (i = 0; i < cache->len; i++)
+	{
+		for (e = cache->entry[i]; e; e = next)
+		{
+			next = e->bucket_next;
+			h = e->hash & (len - 1);
+			e->bucket_prev = NULL;
+			e->bucket_next = entry[h];
+			if (e->bucket_next)
+				e->bucket_next->bucket_prev = e;
+			entry[h] = e;
+		}
+	}
+
+	fz_free(ctx, cache->entry);
+	cache->entry = entry;
+	cache->len = len;
+}
+
 static void
 drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 {
@@ -106,7 +262,8 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		cache->entry[entry->hash & (cache->len - 1)] = entry->bucket_next;
+	cache->count--;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
@@ -119,18 +276,34 @@ do_purge(fz_context *ctx)
 	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (i = 0; i < cache->len; i++)
 	{
 		while (cache->entry[i])
 			drop_glyph_cache_entry(ctx, cache->entry[i]);
 	}
 
-	cache->total = 0;
+	cache->generation++;
+}
+
+/* Evict the least recently used glyphs until the cache fits within its
+ * limit. The glyph cache lock is always held when this function is
+ * called. */
+static void
+shrink_glyph_cache(fz_context *ctx, fz_glyph_cache *cache)
+{
+	while (cache->total > cache->max && cache->lru_tail)
+	{
+		cache->evictions++;
+		cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
+		drop_glyph_cache_entry(ctx, cache->lru_tail);
+	}
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
+	if (ctx->glyph_l1)
+		flush_glyph_l1(ctx);
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
 	do_purge(ctx);
 	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
@@ -142,11 +315,13 @@ fz_drop_glyph_cache_context(fz_context *ctx)
 	if (!ctx || !ctx->glyph_cache)
 		return;
 
+	drop_glyph_l1(ctx);
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
 	ctx->glyph_cache->refs--;
 	if (ctx->glyph_cache->refs == 0)
 	{
 		do_purge(ctx);
+		fz_free(ctx, ctx->glyph_cache->entry);
 		fz_free(ctx, ctx->glyph_cache);
 		ctx->glyph_cache = NULL;
 	}
@@ -162,6 +337,44 @@ fz_keep_glyph_cache(fz_context *ctx)
 	return ctx->glyph_cache;
 }
 
+void
+fz_set_glyph_cache_size(fz_context *ctx, size_t size)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->max = size;
+	shrink_glyph_cache(ctx, cache);
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+size_t
+fz_glyph_cache_size(fz_context *ctx)
+{
+	return ctx->glyph_cache->max;
+}
+
+void
+fz_glyph_cache_stats(fz_context *ctx, size_t *hits, size_t *misses, size_t *evictions)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	size_t h, m, e;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	h = cache->hits;
+	m = cache->misses;
+	e = cache->evictions;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	if (ctx->glyph_l1)
+		h += ctx->glyph_l1->hits;
+	if (hits)
+		*hits = h;
+	if (misses)
+		*misses = m;
+	if (evictions)
+		*evictions = e;
+}
+
 float
 fz_subpixel_adjust(fz_context *ctx, fz_matrix *ctm, fz_matrix *subpix_ctm, unsigned char *qe, unsigned char *qf)
 {
@@ -286,6 +499,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	fz_glyph *val;
 	int do_cache, locked, caching;
 	fz_glyph_cache_entry *entry;
+	fz_glyph_cache_l1 *l1;
 	unsigned hash;
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
@@ -322,20 +536,45 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+
+	l1 = ctx->glyph_l1;
+	if (l1 && do_cache)
+	{
+		fz_glyph_l1_entry *slot;
+
+		/* An unlocked read; if we see a stale generation we will
+		 * just flush on a later call instead. */
+		if (l1->generation != cache->generation)
+		{
+			flush_glyph_l1(ctx);
+			l1->generation = cache->generation;
+		}
+		slot = &l1->entry[hash & (GLYPH_L1_LEN - 1)];
+		if (slot->val && slot->font_id == font->id && memcmp(&slot->key, &key, sizeof(key)) == 0)
+		{
+			l1->hits++;
+			return fz_keep_glyph(ctx, slot->val);
+		}
+	}
+
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
+	entry = cache->entry[hash & (cache->len - 1)];
 	while (entry)
 	{
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
 			move_to_front(cache, entry);
 			val = fz_keep_glyph(ctx, entry->val);
+			cache->hits++;
 			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			if (do_cache && is_ft_font)
+				l1_insert(ctx, hash, &key, val);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -379,7 +618,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				{
 					/* We had to unlock. Someone else might
 					 * have rendered in the meantime */
-					entry = cache->entry[hash];
+					entry = cache->entry[hash & (cache->len - 1)];
 					while (entry)
 					{
 						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
@@ -396,10 +635,12 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = cache->entry[hash & (cache->len - 1)];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				cache->entry[hash & (cache->len - 1)] = entry;
+				if (++cache->count > cache->len)
+					grow_glyph_hash(ctx, cache);
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
@@ -411,14 +652,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+				shrink_glyph_cache(ctx, cache);
 			}
 		}
 unlock_and_return_val:
@@ -438,6 +672,9 @@ unlock_and_return_val:
 			fz_rethrow(ctx);
 	}
 
+	if (val && do_cache && is_ft_font && val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
+		l1_insert(ctx, hash, &key, val);
+
 	return val;
 }
 
@@ -481,8 +718,10 @@ void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	size_t hits, misses, evictions;
+
+	fz_glyph_cache_stats(ctx, &hits, &misses, &evictions);
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (max %zu)\n", cache->total, cache->max);
+	fz_write_printf(ctx, out, "Glyph Cache Hits: %zu Misses: %zu\n", hits, misses);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %zu (%zu bytes)\n", evictions, cache->evicted);
 }
@@ -101,6 +101,91 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+/*
+	Vectorised (SIMD) versions of the most common painters are
+	provided for x86 CPUs with SSE4.1, and are chosen at runtime
+	when the first context is created. They give exactly the same
+	results as the plain C versions (which are used to paint any
+	leftover pixels at the end of each span), and can be turned off
+	with fz_set_paint_simd for testing and benchmarking.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(FZ_NO_SIMD)
+#define ARCH_X86_SIMD
+#endif
+
+/* -1 until we have looked at the CPU, then 0 or 1. */
+static int paint_simd = -1;
+
+#ifdef ARCH_X86_SIMD
+#include <immintrin.h>
+
+#define SIMD_FN __attribute__((target("sse4.1")))
+
+/* Shuffles used to spread 16 one-byte-per-pixel values (such as a mask)
+ * across the n vectors that hold the same 16 pixels of an n byte per
+ * pixel span (simd_spread), and to repeat the n bytes of a color
+ * across those vectors (simd_repeat). simd_alpha selects the last
+ * byte of each pixel, for spans of 2 or 4 bytes per pixel. */
+static __m128i simd_spread[6][5];
+static __m128i simd_repeat[6][5];
+static __m128i simd_alpha[5];
+
+static int
+simd_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.1");
+}
+
+static void
+init_simd_tables(void)
+{
+	int n, j, k;
+
+	for (n = 1; n <= 5; n++)
+	{
+		for (j = 0; j < n; j++)
+		{
+			for (k = 0; k < 16; k++)
+			{
+				((byte *)&simd_spread[n][j])[k] = (16 * j + k) / n;
+				((byte *)&simd_repeat[n][j])[k] = (16 * j + k) % n;
+			}
+		}
+	}
+	for (n = 2; n <= 4; n += 2)
+		for (k = 0; k < 16; k++)
+			((byte *)&simd_alpha[n])[k] = (k / n) * n + n - 1;
+}
+#else
+static int simd_supported(void) { return 0; }
+static void init_simd_tables(void) { }
+#endif
+
+void
+fz_init_paint_simd(fz_context *ctx)
+{
+	if (paint_simd < 0)
+	{
+		init_simd_tables();
+		paint_simd = simd_supported();
+	}
+}
+
+void
+fz_set_paint_simd(fz_context *ctx, int enable)
+{
+	fz_init_paint_simd(ctx);
+	paint_simd = enable && simd_supported();
+}
+
+int
+fz_paint_simd(fz_context *ctx)
+{
+	return paint_simd > 0;
+}
+
 /* These are used by the non-aa scan converter */
 
 static fz_forceinline void
@@ -1112,6 +1197,213 @@ paint_span_with_color_N_da_op_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTR
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#ifdef ARCH_X86_SIMD
+/* The 16 bit lanes of d are blended towards c by ma (0 to 256), exactly
+ * as FZ_BLEND does; c.ma + d.(256-ma) cannot overflow 16 bits. */
+static fz_forceinline SIMD_FN __m128i
+simd_blend16(__m128i c, __m128i d, __m128i ma)
+{
+	__m128i ima = _mm_sub_epi16(_mm_set1_epi16(256), ma);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(c, ma), _mm_mullo_epi16(d, ima)), 8);
+}
+
+static fz_forceinline SIMD_FN __m128i
+simd_expand16(__m128i m, int solid, __m128i sa)
+{
+	m = _mm_add_epi16(m, _mm_srli_epi16(m, 7));
+	if (!solid)
+		m = _mm_mulhi_epu16(m, sa); /* FZ_COMBINE(m, sa) as sa is pre-shifted by 8 */
+	return m;
+}
+
+static fz_forceinline SIMD_FN void
+template_span_with_color_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, int solid)
+{
+	int n1 = n - da;
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi8(-1);
+	__m128i cpat[5], clo[5], chi[5], sa = zero, cv;
+	byte cb[16] = { 0 };
+	int j;
+
+	if (n1 > 0)
+		memcpy(cb, color, n1);
+	if (da)
+		cb[n1] = 255;
+	cv = _mm_loadu_si128((const __m128i *)cb);
+	for (j = 0; j < n; j++)
+	{
+		cpat[j] = _mm_shuffle_epi8(cv, simd_repeat[n][j]);
+		clo[j] = _mm_cvtepu8_epi16(cpat[j]);
+		chi[j] = _mm_unpackhi_epi8(cpat[j], zero);
+	}
+	if (!solid)
+		sa = _mm_set1_epi16(FZ_EXPAND(color[n1])<<8);
+
+	for (; w >= 16; w -= 16, mp += 16, dp += 16 * n)
+	{
+		__m128i m = _mm_loadu_si128((const __m128i *)mp);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) == 0xFFFF)
+			continue;
+		if (solid && _mm_movemask_epi8(_mm_cmpeq_epi8(m, ones)) == 0xFFFF)
+		{
+			for (j = 0; j < n; j++)
+				_mm_storeu_si128((__m128i *)(dp + 16 * j), cpat[j]);
+			continue;
+		}
+		for (j = 0; j < n; j++)
+		{
+			__m128i mj = _mm_shuffle_epi8(m, simd_spread[n][j]);
+			__m128i d = _mm_loadu_si128((const __m128i *)(dp + 16 * j));
+			__m128i lo = simd_blend16(clo[j], _mm_cvtepu8_epi16(d), simd_expand16(_mm_cvtepu8_epi16(mj), solid, sa));
+			__m128i hi = simd_blend16(chi[j], _mm_unpackhi_epi8(d, zero), simd_expand16(_mm_unpackhi_epi8(mj, zero), solid, sa));
+			_mm_storeu_si128((__m128i *)(dp + 16 * j), _mm_packus_epi16(lo, hi));
+		}
+	}
+	if (w > 0)
+	{
+		if (solid)
+			template_span_with_color_N_general_solid(dp, mp, n, w, color, da);
+		else
+			template_span_with_color_N_general_alpha(dp, mp, n, w, color, da);
+	}
+}
+
+static SIMD_FN void
+paint_span_with_color_0_da_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 1, w, color, 1, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_0_da_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 1, w, color, 1, 0);
+}
+
+static SIMD_FN void
+paint_span_with_color_1_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 1, w, color, 0, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_1_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 1, w, color, 0, 0);
+}
+
+static SIMD_FN void
+paint_span_with_color_1_da_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 2, w, color, 1, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_1_da_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 2, w, color, 1, 0);
+}
+
+#if FZ_PLOTTERS_RGB
+static SIMD_FN void
+paint_span_with_color_3_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 3, w, color, 0, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_3_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 3, w, color, 0, 0);
+}
+
+static SIMD_FN void
+paint_span_with_color_3_da_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 4, w, color, 1, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_3_da_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 4, w, color, 1, 0);
+}
+#endif /* FZ_PLOTTERS_RGB */
+
+#if FZ_PLOTTERS_CMYK
+static SIMD_FN void
+paint_span_with_color_4_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 4, w, color, 0, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_4_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 4, w, color, 0, 0);
+}
+
+static SIMD_FN void
+paint_span_with_color_4_da_solid_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 5, w, color, 1, 1);
+}
+
+static SIMD_FN void
+paint_span_with_color_4_da_alpha_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_with_color_simd(dp, mp, 5, w, color, 1, 0);
+}
+#endif /* FZ_PLOTTERS_CMYK */
+
+static fz_span_color_painter_t *
+fz_get_span_color_painter_simd(int n1, int da, int solid)
+{
+	switch (n1)
+	{
+	case 0:
+		if (!da)
+			return NULL;
+		return solid ? paint_span_with_color_0_da_solid_simd : paint_span_with_color_0_da_alpha_simd;
+	case 1:
+		if (solid)
+			return da ? paint_span_with_color_1_da_solid_simd : paint_span_with_color_1_solid_simd;
+		else
+			return da ? paint_span_with_color_1_da_alpha_simd : paint_span_with_color_1_alpha_simd;
+#if FZ_PLOTTERS_RGB
+	case 3:
+		if (solid)
+			return da ? paint_span_with_color_3_da_solid_simd : paint_span_with_color_3_solid_simd;
+		else
+			return da ? paint_span_with_color_3_da_alpha_simd : paint_span_with_color_3_alpha_simd;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4:
+		if (solid)
+			return da ? paint_span_with_color_4_da_solid_simd : paint_span_with_color_4_solid_simd;
+		else
+			return da ? paint_span_with_color_4_da_alpha_simd : paint_span_with_color_4_alpha_simd;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* ARCH_X86_SIMD */
+
 fz_span_color_painter_t *
 fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -1127,6 +1419,14 @@ fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const f
 			return da ? paint_span_with_color_N_da_op_alpha : paint_span_with_color_N_op_alpha;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef ARCH_X86_SIMD
+	if (paint_simd > 0)
+	{
+		fz_span_color_painter_t *fn = fz_get_span_color_painter_simd(n-da, da, alpha == 255);
+		if (fn)
+			return fn;
+	}
+#endif /* ARCH_X86_SIMD */
 	switch(n-da)
 	{
 	case 0:
@@ -2131,6 +2431,101 @@ paint_span_N_general_alpha_op(byte * FZ_RESTRICT dp, int da, const byte * FZ_RES
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#ifdef ARCH_X86_SIMD
+/* Source over destination, where both have alpha and nb bytes per pixel
+ * (2 or 4). Each vector holds 16/nb whole pixels. */
+static fz_forceinline SIMD_FN __m128i
+simd_span_da_sa16(__m128i s, __m128i d, __m128i a, int solid, __m128i alpha)
+{
+	__m128i t, r;
+
+	if (solid)
+	{
+		/* s + FZ_COMBINE(d, 256 - FZ_EXPAND(a)) */
+		t = _mm_sub_epi16(_mm_set1_epi16(256), _mm_add_epi16(a, _mm_srli_epi16(a, 7)));
+		r = _mm_add_epi16(s, _mm_srli_epi16(_mm_mullo_epi16(d, t), 8));
+	}
+	else
+	{
+		/* FZ_COMBINE(s, alpha) + FZ_COMBINE(d, FZ_EXPAND(255 - FZ_COMBINE(a, alpha))) */
+		t = _mm_sub_epi16(_mm_set1_epi16(255), _mm_srli_epi16(_mm_mullo_epi16(a, alpha), 8));
+		t = _mm_add_epi16(t, _mm_srli_epi16(t, 7));
+		r = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(s, alpha), 8), _mm_srli_epi16(_mm_mullo_epi16(d, t), 8));
+	}
+	/* The C versions store into bytes, so wrap rather than saturate. */
+	return _mm_and_si128(r, _mm_set1_epi16(0xFF));
+}
+
+static fz_forceinline SIMD_FN void
+template_span_da_sa_simd(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, int nb, int w, int solid, int alpha)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i valpha = _mm_set1_epi16(FZ_EXPAND(alpha));
+	int ppv = 16 / nb;
+
+	for (; w >= ppv; w -= ppv, sp += 16, dp += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)sp);
+		__m128i d = _mm_loadu_si128((const __m128i *)dp);
+		__m128i a = _mm_shuffle_epi8(s, simd_alpha[nb]);
+		__m128i lo = simd_span_da_sa16(_mm_cvtepu8_epi16(s), _mm_cvtepu8_epi16(d), _mm_cvtepu8_epi16(a), solid, valpha);
+		__m128i hi = simd_span_da_sa16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(a, zero), solid, valpha);
+		__m128i r = _mm_packus_epi16(lo, hi);
+		/* Fully transparent source pixels leave the destination alone. */
+		if (solid)
+			r = _mm_blendv_epi8(r, d, _mm_cmpeq_epi8(a, zero));
+		_mm_storeu_si128((__m128i *)dp, r);
+	}
+	if (w > 0)
+	{
+		if (nb == 2)
+		{
+			if (solid)
+				template_span_1_general(dp, 1, sp, 1, w);
+			else
+				template_span_1_with_alpha_general(dp, 1, sp, 1, w, alpha);
+		}
+		else
+		{
+			if (solid)
+				template_span_3_general(dp, 1, sp, 1, w);
+			else
+				template_span_3_with_alpha_general(dp, 1, sp, 1, w, alpha);
+		}
+	}
+}
+
+static SIMD_FN void
+paint_span_1_da_sa_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_da_sa_simd(dp, sp, 2, w, 1, 255);
+}
+
+static SIMD_FN void
+paint_span_1_da_sa_alpha_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_da_sa_simd(dp, sp, 2, w, 0, alpha);
+}
+
+#if FZ_PLOTTERS_RGB
+static SIMD_FN void
+paint_span_3_da_sa_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_da_sa_simd(dp, sp, 4, w, 1, 255);
+}
+
+static SIMD_FN void
+paint_span_3_da_sa_alpha_simd(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	template_span_da_sa_simd(dp, sp, 4, w, 0, alpha);
+}
+#endif /* FZ_PLOTTERS_RGB */
+#endif /* ARCH_X86_SIMD */
+
 fz_span_painter_t *
 fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -2145,6 +2540,17 @@ fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RE
 			return NULL;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#ifdef ARCH_X86_SIMD
+	if (paint_simd > 0 && da && sa && alpha > 0)
+	{
+		if (n == 1)
+			return alpha == 255 ? paint_span_1_da_sa_simd : paint_span_1_da_sa_alpha_simd;
+#if FZ_PLOTTERS_RGB
+		if (n == 3)
+			return alpha == 255 ? paint_span_3_da_sa_simd : paint_span_3_da_sa_alpha_simd;
+#endif /* FZ_PLOTTERS_RGB */
+	}
+#endif /* ARCH_X86_SIMD */
 	switch (n)
 	{
 	case 0:
@@ -1310,6 +1310,260 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 }
 #endif
 
+/*
+	Vectorised (SIMD) versions of the horizontal scalers for 1, 3 and
+	4 bytes per pixel and of the vertical scaler are provided for x86
+	CPUs with SSE4.1. They are used whenever fz_paint_simd says the
+	SIMD painters are, and give exactly the same results as the plain
+	C versions above: the sums are formed with exact 32 bit integer
+	arithmetic, and only the bottom 8 bits of each (val>>8) are kept.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(FZ_NO_SIMD) && !defined(ARCH_ARM)
+#define ARCH_X86_SIMD
+#endif
+
+#ifdef ARCH_X86_SIMD
+#include <immintrin.h>
+
+#define SIMD_FN __attribute__((target("sse4.1")))
+
+/* Pack 4 sums of 4 x 32 bits into 16 bytes, as (unsigned char)(val>>8). */
+static fz_forceinline SIMD_FN __m128i
+simd_pack_sums(__m128i a0, __m128i a1, __m128i a2, __m128i a3)
+{
+	const __m128i mask = _mm_set1_epi32(0xFF);
+
+	a0 = _mm_and_si128(_mm_srai_epi32(a0, 8), mask);
+	a1 = _mm_and_si128(_mm_srai_epi32(a1, 8), mask);
+	a2 = _mm_and_si128(_mm_srai_epi32(a2, 8), mask);
+	a3 = _mm_and_si128(_mm_srai_epi32(a3, 8), mask);
+	return _mm_packus_epi16(_mm_packus_epi32(a0, a1), _mm_packus_epi32(a2, a3));
+}
+
+/* Pair two weights up, for use with _mm_madd_epi16. */
+static fz_forceinline SIMD_FN __m128i
+simd_weight_pair(int w0, int w1)
+{
+	return _mm_set1_epi32((w0 & 0xFFFF) | ((unsigned int)w1 << 16));
+}
+
+static SIMD_FN void
+scale_row_to_temp1_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 1;
+	const unsigned char *min;
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count - 1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_setzero_si128();
+		int val;
+		min = &src[*contrib++];
+		len = *contrib++;
+		/* 8 samples and weights at a time. */
+		for (; len >= 8; len -= 8)
+		{
+			__m128i s = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)min));
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)contrib), _mm_loadu_si128((const __m128i *)(contrib + 4)));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 8;
+		}
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		val = 128 + _mm_cvtsi128_si32(acc);
+		while (len-- > 0)
+			val += *min++ * *contrib++;
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+/* Load the n (3 or 4) byte source pixels at p[0] and, if len > 1, p[n]
+ * into the bottom 8 bytes of a vector, without reading beyond them. */
+static fz_forceinline SIMD_FN __m128i
+simd_load_pixels(const unsigned char * FZ_RESTRICT p, int n, int len)
+{
+	unsigned int a;
+	unsigned short b;
+	__m128i v;
+
+	if (n == 4)
+	{
+		memcpy(&a, p, 4);
+		v = _mm_cvtsi32_si128((int)a);
+		if (len > 1)
+		{
+			memcpy(&a, p + 4, 4);
+			v = _mm_insert_epi32(v, (int)a, 1);
+		}
+	}
+	else if (len > 1)
+	{
+		memcpy(&a, p, 4);
+		memcpy(&b, p + 4, 2);
+		v = _mm_insert_epi16(_mm_cvtsi32_si128((int)a), b, 2);
+	}
+	else
+	{
+		memcpy(&b, p, 2);
+		v = _mm_cvtsi32_si128(b | (p[2] << 16));
+	}
+	return v;
+}
+
+/* Scale one pixel of 3 or 4 bytes, taking 2 source pixels at a time. */
+static fz_forceinline SIMD_FN __m128i
+scale_pixel_simd(const unsigned char * FZ_RESTRICT min, const int * FZ_RESTRICT contrib, int len, int n, __m128i shuf)
+{
+	__m128i acc = _mm_set1_epi32(128);
+
+	for (; len >= 2; len -= 2)
+	{
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(simd_load_pixels(min, n, 2), shuf), simd_weight_pair(contrib[0], contrib[1])));
+		min += 2*n;
+		contrib += 2;
+	}
+	if (len)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(simd_load_pixels(min, n, 1), shuf), simd_weight_pair(contrib[0], 0)));
+	return acc;
+}
+
+static SIMD_FN void
+scale_row_to_temp3_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	/* Interleave the channels of 2 pixels into 16 bit pairs. */
+	const __m128i shuf = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 3;
+	const unsigned char *min;
+	__m128i acc;
+	unsigned int out;
+
+	assert(weights->n == 3);
+	if (weights->flip)
+	{
+		dst += 3*(weights->count - 1);
+		step = -3;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		min = &src[3 * *contrib++];
+		len = *contrib++;
+		acc = scale_pixel_simd(min, contrib, len, 3, shuf);
+		contrib += len;
+		acc = _mm_and_si128(_mm_srai_epi32(acc, 8), mask);
+		acc = _mm_packus_epi16(_mm_packus_epi32(acc, acc), acc);
+		out = (unsigned int)_mm_cvtsi128_si32(acc);
+		dst[0] = (unsigned char)out;
+		dst[1] = (unsigned char)(out>>8);
+		dst[2] = (unsigned char)(out>>16);
+		dst += step;
+	}
+}
+
+static SIMD_FN void
+scale_row_to_temp4_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	/* Interleave the channels of 2 pixels into 16 bit pairs. */
+	const __m128i shuf = _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 4;
+	const unsigned char *min;
+	__m128i acc;
+	int out;
+
+	assert(weights->n == 4);
+	if (weights->flip)
+	{
+		dst += 4*(weights->count - 1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		acc = scale_pixel_simd(min, contrib, len, 4, shuf);
+		contrib += len;
+		acc = _mm_and_si128(_mm_srai_epi32(acc, 8), mask);
+		acc = _mm_packus_epi16(_mm_packus_epi32(acc, acc), acc);
+		out = _mm_cvtsi128_si32(acc);
+		memcpy(dst, &out, 4);
+		dst += step;
+	}
+}
+
+static SIMD_FN void
+scale_row_from_temp_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	const __m128i zero = _mm_setzero_si128();
+	int len, x, k;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	/* 16 bytes at a time, taking 2 rows of the temp buffer at a time. */
+	for (x = width; x >= 16; x -= 16)
+	{
+		const unsigned char *min = src;
+		__m128i a0 = _mm_set1_epi32(128);
+		__m128i a1 = a0, a2 = a0, a3 = a0;
+
+		for (k = 0; k < len; k += 2)
+		{
+			__m128i r0 = _mm_loadu_si128((const __m128i *)min);
+			__m128i r1, wp, lo, hi;
+			if (k + 1 < len)
+			{
+				r1 = _mm_loadu_si128((const __m128i *)(min + width));
+				wp = simd_weight_pair(contrib[k], contrib[k+1]);
+			}
+			else
+			{
+				r1 = zero;
+				wp = simd_weight_pair(contrib[k], 0);
+			}
+			lo = _mm_unpacklo_epi8(r0, r1);
+			hi = _mm_unpackhi_epi8(r0, r1);
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wp));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wp));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wp));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wp));
+			min += 2 * width;
+		}
+		_mm_storeu_si128((__m128i *)dst, simd_pack_sums(a0, a1, a2, a3));
+		dst += 16;
+		src += 16;
+	}
+	for (; x > 0; x--)
+	{
+		const unsigned char *min = src;
+		int val = 128;
+		int len2 = len;
+		const int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+	}
+}
+
+#endif /* ARCH_X86_SIMD */
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, int n, int forcealpha, int w, int h, int stride)
@@ -1843,6 +2097,19 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			break;
 		}
 		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
+#ifdef ARCH_X86_SIMD
+		if (fz_paint_simd(ctx))
+		{
+			if (src->n == 1)
+				row_scale_in = scale_row_to_temp1_simd;
+			else if (src->n == 3)
+				row_scale_in = scale_row_to_temp3_simd;
+			else if (src->n == 4)
+				row_scale_in = scale_row_to_temp4_simd;
+			if (!forcealpha)
+				row_scale_out = scale_row_from_temp_simd;
+		}
+#endif /* ARCH_X86_SIMD */
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
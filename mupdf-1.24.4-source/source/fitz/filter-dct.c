@@ -196,6 +196,27 @@ static void invert_cmyk(unsigned char *p, int n)
 		p[i] = 255 - p[i];
 }
 
+/* Have all the coefficients that the scaled inverse DCTs look at (the
+ * top left DCT_h_scaled_size x DCT_v_scaled_size of each block) been
+ * completely read? */
+static int needed_coefs_complete(j_decompress_ptr cinfo)
+{
+	jpeg_component_info *comp = cinfo->comp_info;
+	int i, k, z;
+
+	for (i = 0; i < cinfo->num_components; i++, comp++)
+	{
+		for (k = 0; k <= cinfo->lim_Se; k++)
+		{
+			z = cinfo->natural_order[k];
+			if (z / DCTSIZE < comp->DCT_v_scaled_size && z % DCTSIZE < comp->DCT_h_scaled_size &&
+				cinfo->coef_bits[comp->component_index][k] != 0)
+				return 0;
+		}
+	}
+	return 1;
+}
+
 static int
 next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 {
@@ -205,6 +226,11 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 	unsigned char *ep;
 	int c;
 
+	/* The decoder may be resumed by a different context than the one
+	 * that opened it (see the image decoder cache in image.c), so make
+	 * sure the libjpeg callbacks throw to the one calling us now. */
+	state->ctx = ctx;
+
 	if (max > sizeof(state->buffer))
 		max = sizeof(state->buffer);
 	ep = state->buffer + max;
@@ -264,8 +290,28 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 			cinfo->scale_num = 8/(1<<state->l2factor);
 			cinfo->scale_denom = 8;
 
+			/* When scaling down, the inverse DCT only looks at the low
+			 * frequency coefficients of each block (just the DC one at
+			 * 1/8). A progressive JPEG sends those first, so we can
+			 * produce the output as soon as they are complete, without
+			 * reading the rest of the data. */
+			if (state->l2factor > 0 && cinfo->progressive_mode)
+			{
+				jpeg_calc_output_dimensions(cinfo);
+				cinfo->buffered_image = TRUE;
+			}
+
 			jpeg_start_decompress(cinfo);
 
+			if (cinfo->buffered_image)
+			{
+				int ret;
+				do
+					ret = jpeg_consume_input(cinfo);
+				while (ret != JPEG_REACHED_EOI && ret != JPEG_SUSPENDED && !(ret == JPEG_SCAN_COMPLETED && needed_coefs_complete(cinfo)));
+				jpeg_start_output(cinfo, cinfo->input_scan_number);
+			}
+
 			state->stride = cinfo->output_width * cinfo->output_components;
 			state->scanline = Memento_label(fz_malloc(ctx, state->stride), "dct_scanline");
 			state->rp = state->scanline;
@@ -321,6 +367,8 @@ close_dctd(fz_context *ctx, void *state_)
 {
 	fz_dctd *state = (fz_dctd *)state_;
 
+	state->ctx = ctx;
+
 	if (state->init)
 	{
 		/* We call jpeg_abort rather than the more usual
@@ -88,6 +88,7 @@ int ft_name_index(void *face, const char *name)
 }
 
 static void fz_drop_freetype(fz_context *ctx);
+static unsigned int fz_next_font_id(fz_context *ctx);
 
 static fz_font *
 fz_new_font(fz_context *ctx, const char *name, int use_glyph_bbox, int glyph_count)
@@ -96,6 +97,7 @@ fz_new_font(fz_context *ctx, const char *name, int use_glyph_bbox, int glyph_cou
 
 	font = fz_malloc_struct(ctx, fz_font);
 	font->refs = 1;
+	font->id = fz_next_font_id(ctx);
 
 	if (name)
 		fz_strlcpy(font->name, name, sizeof font->name);
@@ -318,6 +320,8 @@ struct fz_font_context
 	struct { fz_font *serif, *sans; } fallback[256];
 	fz_font *symbol1, *symbol2, *math, *music, *boxes;
 	fz_font *emoji;
+
+	unsigned int next_font_id;
 };
 
 #undef __FTERRORS_H__
@@ -397,6 +401,18 @@ void fz_new_font_context(fz_context *ctx)
 	ctx->font->ftmemory.realloc = ft_realloc;
 }
 
+static unsigned int
+fz_next_font_id(fz_context *ctx)
+{
+	unsigned int id;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	id = ++ctx->font->next_font_id;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return id;
+}
+
 fz_font_context *
 fz_keep_font_context(fz_context *ctx)
 {
@@ -483,14 +483,14 @@ subarea_drop(fz_context *ctx, void *state)
 }
 
 static fz_stream *
-subarea_stream(fz_context *ctx, fz_stream *stm, fz_image *image, const fz_irect *subarea, int l2factor)
+subarea_stream(fz_context *ctx, fz_stream *stm, fz_image *image, const fz_irect *subarea, int l2factor, int first_row)
 {
 	subarea_state *state;
 	int f = 1<<l2factor;
 	int stream_w = (image->w + f - 1)>>l2factor;
 	size_t stream_stride = (stream_w * (size_t)image->n * image->bpc + 7) / 8;
 	int l_margin = subarea->x0 >> l2factor;
-	int t_margin = subarea->y0 >> l2factor;
+	int t_margin = (subarea->y0 >> l2factor) - first_row;
 	int r_margin = (image->w + f - 1 - subarea->x1) >> l2factor;
 	int b_margin = (image->h + f - 1 - subarea->y1) >> l2factor;
 	size_t l_skip = (l_margin * (size_t)image->n * image->bpc)/8;
@@ -595,12 +595,10 @@ subsample_stream(fz_context *ctx, fz_stream *src, int w, int h, int n, int l2ext
 	return fz_new_stream(ctx, state, subsample_next, subsample_drop);
 }
 
-/* l2factor is the amount of subsampling that the decoder is going to be
- * doing for us already. (So for JPEG 0,1,2,3 corresponding to 1, 2, 4,
- * 8. For other formats, probably 0.). l2extra is the additional amount
- * of subsampling we should perform here. */
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
+/* As fz_decomp_image_from_stream, but stm starts first_row scanlines
+ * into the decoded image rather than at the top. */
+static fz_pixmap *
+decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra, int first_row)
 {
 	fz_image *image = &cimg->super;
 	fz_pixmap *tile = NULL;
@@ -653,7 +651,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 			alpha = 1;
 
 		if (subarea)
-			read_stream = sstream = subarea_stream(ctx, stm, image, subarea, l2factor);
+			read_stream = sstream = subarea_stream(ctx, stm, image, subarea, l2factor, first_row);
 		if (image->bpc != 8 || image->use_colorkey)
 			read_stream = unpstream = fz_unpack_stream(ctx, read_stream, image->bpc, w, h, image->n, indexed, image->use_colorkey, 0);
 		if (l2extra && *l2extra && !indexed)
@@ -728,6 +726,16 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	return tile;
 }
 
+/* l2factor is the amount of subsampling that the decoder is going to be
+ * doing for us already. (So for JPEG 0,1,2,3 corresponding to 1, 2, 4,
+ * 8. For other formats, probably 0.). l2extra is the additional amount
+ * of subsampling we should perform here. */
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
+{
+	return decomp_image_from_stream(ctx, stm, cimg, subarea, indexed, l2factor, l2extra, 0);
+}
+
 void
 fz_drop_image_base(fz_context *ctx, fz_image *image)
 {
@@ -761,6 +769,266 @@ drop_pixmap_image(fz_context *ctx, fz_image *image_)
 	fz_drop_pixmap(ctx, image->tile);
 }
 
+/* libjpeg cannot seek, so decoding a subarea of a JPEG means running the
+ * decoder over every scanline above it. When an image is drawn in tiles
+ * or bands, the top of the image would be decoded again for each one.
+ *
+ * Instead, we keep the decoder used for the last subarea in the store,
+ * together with the full width scanlines it produced for it. A later
+ * subarea lying within those scanlines (the next tile along) is cut
+ * straight out of them, and one further down the image (the next band)
+ * carries on decoding from where the last one stopped.
+ *
+ * Decoders are keyed on the image and requested l2factor. A decoder is
+ * only ever used by one thread at a time; if another finds it busy, we
+ * return NULL and it decodes the subarea from scratch as before. */
+typedef struct
+{
+	fz_storable storable;
+	int busy;
+	fz_stream *stm;
+	int native_l2factor; /* Subsampling done by the decoder. */
+	int l2extra; /* Subsampling left for us to do. */
+	int next; /* The next scanline stm will deliver. */
+	int y0, h; /* The scanlines held in samples. */
+	size_t stride;
+	size_t cap;
+	unsigned char *samples;
+	size_t overhead; /* Estimate of memory held by the decoder itself. */
+} fz_image_decoder;
+
+static const fz_store_type fz_image_decoder_store_type =
+{
+	"fz_image_decoder",
+	fz_make_hash_image_key,
+	fz_keep_image_key,
+	fz_drop_image_key,
+	fz_cmp_image_key,
+	fz_format_image_key,
+	fz_needs_reap_image_key
+};
+
+static void
+drop_image_decoder_imp(fz_context *ctx, fz_storable *dec_)
+{
+	fz_image_decoder *dec = (fz_image_decoder *)dec_;
+
+	fz_drop_stream(ctx, dec->stm);
+	fz_free(ctx, dec->samples);
+	fz_free(ctx, dec);
+}
+
+static size_t
+image_decoder_size(fz_image_decoder *dec)
+{
+	return sizeof(*dec) + dec->cap + dec->overhead;
+}
+
+/* Put a decoder into the store (or back into it, with its current size).
+ * Returns 0 if another thread got there first. */
+static int
+store_image_decoder(fz_context *ctx, fz_image_decoder *dec, fz_image_key *key)
+{
+	fz_image_key *keyp = NULL;
+	fz_image_decoder *existing = NULL;
+
+	fz_var(keyp);
+
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image_store_key(ctx, key->image);
+		keyp->l2factor = key->l2factor;
+		keyp->rect = key->rect;
+		existing = fz_store_item(ctx, keyp, dec, image_decoder_size(dec), &fz_image_decoder_store_type);
+	}
+	fz_always(ctx)
+		fz_drop_image_key(ctx, keyp);
+	fz_catch(ctx)
+	{
+		/* Failing to cache the decoder is not an error. */
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+		return 0;
+	}
+
+	if (existing)
+	{
+		fz_drop_storable(ctx, &existing->storable);
+		return 0;
+	}
+	return 1;
+}
+
+static fz_pixmap *
+decomp_jpeg_subarea(fz_context *ctx, fz_compressed_image *image, fz_irect *subarea, int *l2factor, int progressive)
+{
+	fz_image_decoder *dec;
+	fz_image_key key;
+	fz_irect area = *subarea;
+	fz_stream *stm = NULL;
+	fz_pixmap *tile = NULL;
+	size_t need, len;
+	int f, y0, h, from, l2extra, busy, grown, stored;
+
+	key.refs = 1;
+	key.image = &image->super;
+	key.l2factor = l2factor ? *l2factor : 0;
+	key.rect = fz_empty_irect;
+
+	dec = fz_find_item(ctx, drop_image_decoder_imp, &key, &fz_image_decoder_store_type);
+	if (dec)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		busy = dec->busy;
+		dec->busy = 1;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		if (busy)
+		{
+			fz_drop_storable(ctx, &dec->storable);
+			return NULL;
+		}
+	}
+
+	if (dec == NULL)
+	{
+		int l2 = key.l2factor;
+		fz_stream *dstm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &l2);
+		fz_try(ctx)
+		{
+			int stream_w;
+			dec = fz_malloc_struct(ctx, fz_image_decoder);
+			FZ_INIT_STORABLE(dec, 1, drop_image_decoder_imp);
+			dec->busy = 1;
+			dec->stm = dstm;
+			dec->native_l2factor = key.l2factor - l2;
+			dec->l2extra = l2;
+			stream_w = (image->super.w + (1<<dec->native_l2factor) - 1) >> dec->native_l2factor;
+			dec->stride = (stream_w * (size_t)image->super.n * image->super.bpc + 7) / 8;
+			/* Progressive JPEGs hold the coefficients for the whole image. */
+			if (progressive)
+				dec->overhead = (size_t)image->super.w * image->super.h * image->super.n * 2;
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_stream(ctx, dstm);
+			fz_rethrow(ctx);
+		}
+		grown = 1;
+		stored = 0;
+	}
+	else
+	{
+		grown = 0;
+		stored = 1;
+	}
+
+	fz_var(stm);
+	fz_var(tile);
+	fz_var(grown);
+
+	fz_try(ctx)
+	{
+		/* Work out which scanlines of the decoder output we need. */
+		fz_adjust_image_subarea(ctx, &image->super, &area, dec->native_l2factor);
+		f = 1<<dec->native_l2factor;
+		y0 = area.y0 >> dec->native_l2factor;
+		h = (area.y1 - area.y0 + f - 1) >> dec->native_l2factor;
+
+		if (y0 < dec->y0 || y0 + h > dec->y0 + dec->h)
+		{
+			if (y0 < dec->y0)
+			{
+				/* Above where we have got to; start again. */
+				int l2 = key.l2factor;
+				fz_drop_stream(ctx, dec->stm);
+				dec->stm = NULL;
+				dec->stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, &l2);
+				dec->next = 0;
+				dec->y0 = 0;
+				dec->h = 0;
+			}
+
+			need = h * dec->stride;
+			if (need > dec->cap)
+			{
+				dec->samples = fz_realloc(ctx, dec->samples, need);
+				dec->cap = need;
+				grown = 1;
+			}
+
+			/* Keep any of the scanlines we already have, and skip or
+			 * decode the rest. */
+			if (y0 < dec->next)
+			{
+				from = dec->next;
+				memmove(dec->samples, dec->samples + (y0 - dec->y0) * dec->stride, (from - y0) * dec->stride);
+			}
+			else
+			{
+				from = y0;
+				fz_skip(ctx, dec->stm, (y0 - dec->next) * dec->stride);
+			}
+			dec->y0 = y0;
+			dec->h = 0;
+			need = (y0 + h - from) * dec->stride;
+			len = fz_read(ctx, dec->stm, dec->samples + (from - y0) * dec->stride, need);
+			if (len < need)
+			{
+				fz_warn(ctx, "padding truncated image");
+				memset(dec->samples + (from - y0) * dec->stride + len, 0, need - len);
+			}
+			dec->h = h;
+			dec->next = y0 + h;
+		}
+
+		stm = fz_open_memory(ctx, dec->samples + (y0 - dec->y0) * dec->stride, h * dec->stride);
+		l2extra = dec->l2extra;
+		tile = decomp_image_from_stream(ctx, stm, image, subarea, fz_colorspace_is_indexed(ctx, image->super.colorspace), dec->native_l2factor, &l2extra, y0);
+		if (l2factor)
+			*l2factor = l2extra;
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+	{
+		/* The decoder is in an unknown state, so don't let anyone else
+		 * pick it up. */
+		if (stored)
+			fz_remove_item(ctx, drop_image_decoder_imp, &key, &fz_image_decoder_store_type);
+		fz_drop_storable(ctx, &dec->storable);
+		fz_drop_pixmap(ctx, tile);
+		fz_rethrow(ctx);
+	}
+
+	/* Hand the decoder back, re-storing it if it has grown. */
+	if (grown)
+	{
+		if (stored)
+			fz_remove_item(ctx, drop_image_decoder_imp, &key, &fz_image_decoder_store_type);
+		fz_try(ctx)
+			stored = store_image_decoder(ctx, dec, &key);
+		fz_catch(ctx)
+		{
+			fz_drop_storable(ctx, &dec->storable);
+			fz_drop_pixmap(ctx, tile);
+			fz_rethrow(ctx);
+		}
+		if (!stored)
+		{
+			fz_drop_storable(ctx, &dec->storable);
+			return tile;
+		}
+	}
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	dec->busy = 0;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_drop_storable(ctx, &dec->storable);
+
+	return tile;
+}
+
 static fz_pixmap *
 compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
 {
@@ -771,6 +1039,7 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 	fz_pixmap *tile;
 	int can_sub = 0;
 	int local_l2factor;
+	int progressive = 0;
 
 	/* If we are using matte, then the decode code requires both image and tile sizes
 	 * to match. The simplest way to ensure this is to do no native l2factor decoding.
@@ -819,6 +1088,8 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 			{
 				if (d[1] < 0xC0 || (0xC3 < d[1] && d[1] < 0xC9) || 0xCB < d[1])
 					continue;
+				if (d[1] == 0xC2 || d[1] == 0xCA)
+					progressive = 1;
 				if ((d[5] == 0 && d[6] == 0) || ((d[5] << 8) | d[6]) > image->super.h)
 				{
 					d[5] = (image->super.h >> 8) & 0xFF;
@@ -826,6 +1097,15 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 				}
 			}
 		}
+		if (subarea && (subarea->x0 != 0 || subarea->y0 != 0 || subarea->x1 != image->super.w || subarea->y1 != image->super.h))
+		{
+			tile = decomp_jpeg_subarea(ctx, image, subarea, l2factor, progressive);
+			if (tile)
+			{
+				can_sub = 1;
+				break;
+			}
+		}
 		/* fall through */
 
 	default:
@@ -934,6 +1214,12 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
+{
+	return fz_get_coarse_pixmap_from_image(ctx, image, subarea, ctm, dw, dh, 0);
+}
+
+fz_pixmap *
+fz_get_coarse_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh, int coarsen)
 {
 	fz_pixmap *tile;
 	int l2factor, l2factor_remaining;
@@ -998,6 +1284,10 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 			l2factor++;
 	}
 
+	/* For a coarse decode, subsample further, but not to nothing. */
+	while (coarsen-- > 0 && image->w>>(l2factor+1) > 0 && image->h>>(l2factor+1) > 0 && l2factor < 6)
+		l2factor++;
+
 	/* First, look through the store for existing tiles */
 	if (subarea)
 	{
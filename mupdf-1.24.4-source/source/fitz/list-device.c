@@ -144,6 +144,52 @@ enum {
 	INDIRECT_NODE_THRESHOLD = (1<<9)-1
 };
 
+/* A spatial index over a display list, built by fz_index_display_list.
+ *
+ * The list is split into chunks of INDEX_CHUNK nodes. For each chunk we
+ * keep a checkpoint: where it starts, and the graphics state at that
+ * point, so that fz_run_display_list can carry on from there without
+ * unpacking the nodes in between. Each chunk also has a summary of its
+ * nodes, and the summaries of INDEX_FANOUT consecutive chunks (or
+ * summaries) are merged into the level above, and so on.
+ *
+ * A run of chunks whose summary lies wholly outside the scissor can then
+ * be skipped in one step, provided that skipping it leaves the
+ * clip/group/mask nesting as it found it, and that it contains none of
+ * the nodes that are never culled (tiles, layers, structure etc).
+ */
+enum { INDEX_CHUNK = 64, INDEX_FANOUT = 16, INDEX_MAX_LEVELS = 8 };
+
+typedef struct
+{
+	fz_rect bbox; /* Union of the rects of the nodes. */
+	int depth; /* Change in clip nesting depth over the nodes. */
+	int min_depth; /* Lowest depth reached, relative to the start. */
+	int keep; /* Non-zero if any of the nodes are never culled. */
+} fz_display_summary;
+
+typedef struct
+{
+	size_t offset;
+	fz_rect rect;
+	fz_matrix ctm;
+	float alpha;
+	float color[FZ_MAX_COLORS];
+	fz_colorspace *colorspace;
+	fz_stroke_state *stroke;
+	fz_path *path;
+} fz_display_checkpoint;
+
+typedef struct
+{
+	size_t len; /* list->len when the index was built. */
+	size_t count; /* Number of chunks. */
+	fz_display_checkpoint *chunk;
+	int levels;
+	size_t level_count[INDEX_MAX_LEVELS];
+	fz_display_summary *level[INDEX_MAX_LEVELS];
+} fz_display_index;
+
 struct fz_display_list
 {
 	fz_storable storable;
@@ -151,6 +197,7 @@ struct fz_display_list
 	fz_rect mediabox;
 	size_t max;
 	size_t len;
+	fz_display_index *index;
 };
 
 typedef struct
@@ -1545,6 +1592,19 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 	return &dev->super;
 }
 
+static void
+drop_display_index(fz_context *ctx, fz_display_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+	for (i = 0; i < index->levels; i++)
+		fz_free(ctx, index->level[i]);
+	fz_free(ctx, index->chunk);
+	fz_free(ctx, index);
+}
+
 static void
 fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 {
@@ -1658,6 +1718,7 @@ fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 		}
 		node = next;
 	}
+	drop_display_index(ctx, list->index);
 	fz_free(ctx, list->list);
 	fz_free(ctx, list);
 }
@@ -1699,6 +1760,299 @@ int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
 	return !list || list->len == 0;
 }
 
+static void
+add_to_summary(fz_display_summary *sum, fz_display_command cmd, fz_rect rect)
+{
+	switch (cmd)
+	{
+	case FZ_CMD_CLIP_PATH:
+	case FZ_CMD_CLIP_STROKE_PATH:
+	case FZ_CMD_CLIP_TEXT:
+	case FZ_CMD_CLIP_STROKE_TEXT:
+	case FZ_CMD_CLIP_IMAGE_MASK:
+	case FZ_CMD_BEGIN_MASK:
+	case FZ_CMD_BEGIN_GROUP:
+		sum->depth++;
+		break;
+	case FZ_CMD_POP_CLIP:
+	case FZ_CMD_END_GROUP:
+		sum->depth--;
+		if (sum->min_depth > sum->depth)
+			sum->min_depth = sum->depth;
+		break;
+	case FZ_CMD_END_MASK:
+		/* Only skippable along with its begin mask. */
+		if (sum->min_depth > sum->depth - 1)
+			sum->min_depth = sum->depth - 1;
+		break;
+	case FZ_CMD_BEGIN_TILE:
+	case FZ_CMD_END_TILE:
+	case FZ_CMD_RENDER_FLAGS:
+	case FZ_CMD_DEFAULT_COLORSPACES:
+	case FZ_CMD_BEGIN_LAYER:
+	case FZ_CMD_END_LAYER:
+	case FZ_CMD_BEGIN_STRUCTURE:
+	case FZ_CMD_END_STRUCTURE:
+	case FZ_CMD_BEGIN_METATEXT:
+	case FZ_CMD_END_METATEXT:
+		sum->keep = 1;
+		break;
+	default:
+		break;
+	}
+	sum->bbox = fz_union_rect(sum->bbox, rect);
+}
+
+static void
+merge_summaries(fz_display_summary *dst, const fz_display_summary *src, size_t n)
+{
+	size_t i;
+
+	*dst = src[0];
+	for (i = 1; i < n; i++)
+	{
+		if (dst->min_depth > dst->depth + src[i].min_depth)
+			dst->min_depth = dst->depth + src[i].min_depth;
+		dst->depth += src[i].depth;
+		dst->keep |= src[i].keep;
+		dst->bbox = fz_union_rect(dst->bbox, src[i].bbox);
+	}
+}
+
+void
+fz_index_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_index *index;
+	fz_display_node *node = list->list;
+	fz_display_node *node_end = list->list + list->len;
+	fz_display_checkpoint state = { 0 };
+	fz_display_summary *sum = NULL;
+	size_t nodes = 0;
+	size_t max = 0;
+
+	if (list->index)
+	{
+		if (list->index->len == list->len)
+			return;
+		drop_display_index(ctx, list->index);
+		list->index = NULL;
+	}
+
+	state.ctm = fz_identity;
+	state.alpha = 1.0f;
+	state.colorspace = fz_device_gray(ctx);
+
+	index = fz_malloc_struct(ctx, fz_display_index);
+	fz_try(ctx)
+	{
+		while (node != node_end)
+		{
+			fz_display_node n = *node;
+			size_t size = n.size;
+			fz_display_node *next;
+
+			if (nodes % INDEX_CHUNK == 0)
+			{
+				if (index->count == max)
+				{
+					max = max ? max * 2 : 64;
+					index->chunk = fz_realloc_array(ctx, index->chunk, max, fz_display_checkpoint);
+					index->level[0] = fz_realloc_array(ctx, index->level[0], max, fz_display_summary);
+				}
+				state.offset = node - list->list;
+				index->chunk[index->count] = state;
+				sum = &index->level[0][index->count++];
+				sum->bbox = fz_empty_rect;
+				sum->depth = 0;
+				sum->min_depth = 0;
+				sum->keep = 0;
+			}
+			nodes++;
+
+			if (size == INDIRECT_NODE_THRESHOLD)
+			{
+				memcpy(&size, &node[1], sizeof(size_t));
+				node += SIZE_IN_NODES(sizeof(size_t));
+				size -= SIZE_IN_NODES(sizeof(size_t));
+			}
+
+			next = node + size;
+
+			node++;
+			if (n.rect)
+			{
+				state.rect = *(fz_rect *)node;
+				node += SIZE_IN_NODES(sizeof(fz_rect));
+			}
+			if (n.cs)
+			{
+				int k, en;
+
+				switch (n.cs)
+				{
+				default:
+				case CS_GRAY_0:
+					state.colorspace = fz_device_gray(ctx);
+					state.color[0] = 0.0f;
+					break;
+				case CS_GRAY_1:
+					state.colorspace = fz_device_gray(ctx);
+					state.color[0] = 1.0f;
+					break;
+				case CS_RGB_0:
+					state.colorspace = fz_device_rgb(ctx);
+					state.color[0] = 0.0f;
+					state.color[1] = 0.0f;
+					state.color[2] = 0.0f;
+					break;
+				case CS_RGB_1:
+					state.colorspace = fz_device_rgb(ctx);
+					state.color[0] = 1.0f;
+					state.color[1] = 1.0f;
+					state.color[2] = 1.0f;
+					break;
+				case CS_CMYK_0:
+					state.colorspace = fz_device_cmyk(ctx);
+					state.color[0] = 0.0f;
+					state.color[1] = 0.0f;
+					state.color[2] = 0.0f;
+					state.color[3] = 0.0f;
+					break;
+				case CS_CMYK_1:
+					state.colorspace = fz_device_cmyk(ctx);
+					state.color[0] = 0.0f;
+					state.color[1] = 0.0f;
+					state.color[2] = 0.0f;
+					state.color[3] = 1.0f;
+					break;
+				case CS_OTHER_0:
+					align_node_for_pointer(&node);
+					state.colorspace = *(fz_colorspace **)node;
+					node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+					en = fz_colorspace_n(ctx, state.colorspace);
+					for (k = 0; k < en; k++)
+						state.color[k] = 0.0f;
+					break;
+				}
+			}
+			if (n.color)
+			{
+				int nc = fz_colorspace_n(ctx, state.colorspace);
+				memcpy(state.color, (float *)node, nc * sizeof(float));
+				node += SIZE_IN_NODES(nc * sizeof(float));
+			}
+			if (n.alpha)
+			{
+				switch (n.alpha)
+				{
+				default:
+				case ALPHA_0:
+					state.alpha = 0.0f;
+					break;
+				case ALPHA_1:
+					state.alpha = 1.0f;
+					break;
+				case ALPHA_PRESENT:
+					state.alpha = *(float *)node;
+					node += SIZE_IN_NODES(sizeof(float));
+					break;
+				}
+			}
+			if (n.ctm != 0)
+			{
+				float *packed_ctm = (float *)node;
+				if (n.ctm & CTM_CHANGE_AD)
+				{
+					state.ctm.a = *packed_ctm++;
+					state.ctm.d = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_BC)
+				{
+					state.ctm.b = *packed_ctm++;
+					state.ctm.c = *packed_ctm++;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+				if (n.ctm & CTM_CHANGE_EF)
+				{
+					state.ctm.e = *packed_ctm++;
+					state.ctm.f = *packed_ctm;
+					node += SIZE_IN_NODES(2*sizeof(float));
+				}
+			}
+			if (n.stroke)
+			{
+				align_node_for_pointer(&node);
+				state.stroke = *(fz_stroke_state **)node;
+				node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+			}
+			if (n.path)
+			{
+				align_node_for_pointer(&node);
+				state.path = (fz_path *)node;
+			}
+
+			add_to_summary(sum, n.cmd, state.rect);
+
+			node = next;
+		}
+
+		/* Summarise the summaries, until there is only one. */
+		index->levels = 1;
+		index->level_count[0] = index->count;
+		while (index->level_count[index->levels-1] > 1 && index->levels < INDEX_MAX_LEVELS)
+		{
+			int l = index->levels;
+			size_t below = index->level_count[l-1];
+			size_t count = (below + INDEX_FANOUT - 1) / INDEX_FANOUT;
+			size_t j;
+
+			index->level[l] = fz_malloc_array(ctx, count, fz_display_summary);
+			index->level_count[l] = count;
+			index->levels++;
+			for (j = 0; j < count; j++)
+				merge_summaries(&index->level[l][j], &index->level[l-1][j * INDEX_FANOUT], fz_minz(INDEX_FANOUT, below - j * INDEX_FANOUT));
+		}
+		index->len = list->len;
+	}
+	fz_catch(ctx)
+	{
+		if (index->levels == 0)
+			index->levels = 1;
+		drop_display_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	list->index = index;
+}
+
+/* Return the number of chunks, starting with chunk c, that can be skipped
+ * when running the list with the given ctm and scissor. */
+static size_t
+skippable_chunks(fz_display_index *index, size_t c, fz_matrix ctm, fz_rect scissor)
+{
+	int l;
+
+	for (l = index->levels - 1; l >= 0; l--)
+	{
+		size_t span = 1;
+		fz_display_summary *sum;
+		int k;
+
+		for (k = 0; k < l; k++)
+			span *= INDEX_FANOUT;
+		if (c % span != 0)
+			continue;
+		sum = &index->level[l][c / span];
+		if (sum->keep || sum->depth != 0 || sum->min_depth < 0)
+			continue;
+		if (fz_is_valid_rect(fz_intersect_rect(fz_transform_rect(sum->bbox, ctm), scissor)))
+			continue;
+		return fz_minz(span, index->count - c);
+	}
+	return 0;
+}
+
 void
 fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
 {
@@ -1724,6 +2078,10 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 	fz_matrix trans_ctm;
 	int tile_skip_depth = 0;
 
+	/* Spatial index, if the list has an up to date one */
+	fz_display_index *index = list->index;
+	size_t chunk = 0;
+
 	if (cookie)
 	{
 		cookie->progress_max = list->len;
@@ -1732,6 +2090,9 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 
 	color_params = fz_default_color_params;
 
+	if (index && index->len != list->len)
+		index = NULL;
+
 	node = list->list;
 	node_end = &list->list[list->len];
 	for (; node != node_end ; node = next_node)
@@ -1740,6 +2101,42 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_m
 		fz_display_node n = *node;
 		size_t size = n.size;
 
+		/* At the start of each chunk, see whether the index lets us
+		 * jump over it (and maybe some following ones) entirely. */
+		if (index && chunk < index->count && node == list->list + index->chunk[chunk].offset)
+		{
+			size_t skip = 0;
+
+			if (!tiled && tile_skip_depth == 0)
+				skip = skippable_chunks(index, chunk, top_ctm, scissor);
+			if (skip == 0)
+				chunk++;
+			else if (chunk + skip >= index->count)
+			{
+				next_node = node_end;
+				continue;
+			}
+			else
+			{
+				fz_display_checkpoint *cp = &index->chunk[chunk + skip];
+
+				fz_drop_colorspace(ctx, colorspace);
+				colorspace = fz_keep_colorspace(ctx, cp->colorspace);
+				fz_drop_stroke_state(ctx, stroke);
+				stroke = fz_keep_stroke_state(ctx, cp->stroke);
+				fz_drop_path(ctx, path);
+				path = fz_keep_path(ctx, cp->path);
+				memcpy(color, cp->color, sizeof(color));
+				alpha = cp->alpha;
+				ctm = cp->ctm;
+				rect = cp->rect;
+				chunk += skip;
+				next_node = list->list + cp->offset;
+				progress = (int)cp->offset;
+				continue;
+			}
+		}
+
 		if (size == INDIRECT_NODE_THRESHOLD)
 		{
 			memcpy(&size, &node[1], sizeof(size_t));
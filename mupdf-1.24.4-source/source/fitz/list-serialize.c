@@ -0,0 +1,2365 @@
+// Copyright (C) 2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+
+#include <string.h>
+
+/*
+	Serialized display lists.
+
+	The file starts with a header:
+
+		"MUDL" u32 version, rect mediabox
+
+	followed by a sequence of records, each starting with a tag byte,
+	and ending with a DL_END tag. All numbers are little endian; floats
+	are IEEE 754 single precision.
+
+	Command records (tags below DL_DEF_COLORSPACE) replay one device
+	call each. Paths, stroke states and text objects are stored inline
+	in the command that uses them.
+
+	Resource records (colorspaces, fonts, images, shadings and
+	functions) define a shared object:
+
+		tag, u8 digest[16], u32 length, payload
+
+	The digest is the MD5 of the tag byte and the payload, so identical
+	resources are only stored once, and can be recognised across files.
+	Resources are numbered from 1 in the order they are defined, and
+	every resource is defined before its first use. Commands and other
+	resources refer to them by number, with 0 for NULL.
+
+	Objects that only exist as callbacks (tint transforms of Separation
+	and DeviceN colorspaces, soft mask transfer functions) are stored
+	as sampled tables. Type 3 fonts are stored with their glyph display
+	lists nested in the font payload. Images whose compressed data is
+	unavailable are stored as decoded pixmaps.
+*/
+
+#define DL_VERSION 1
+
+enum
+{
+	DL_END = 0,
+	DL_FILL_PATH,
+	DL_STROKE_PATH,
+	DL_CLIP_PATH,
+	DL_CLIP_STROKE_PATH,
+	DL_FILL_TEXT,
+	DL_STROKE_TEXT,
+	DL_CLIP_TEXT,
+	DL_CLIP_STROKE_TEXT,
+	DL_IGNORE_TEXT,
+	DL_FILL_SHADE,
+	DL_FILL_IMAGE,
+	DL_FILL_IMAGE_MASK,
+	DL_CLIP_IMAGE_MASK,
+	DL_POP_CLIP,
+	DL_BEGIN_MASK,
+	DL_END_MASK,
+	DL_BEGIN_GROUP,
+	DL_END_GROUP,
+	DL_BEGIN_TILE,
+	DL_END_TILE,
+	DL_RENDER_FLAGS,
+	DL_DEFAULT_COLORSPACES,
+	DL_BEGIN_LAYER,
+	DL_END_LAYER,
+	DL_BEGIN_STRUCTURE,
+	DL_END_STRUCTURE,
+	DL_BEGIN_METATEXT,
+	DL_END_METATEXT,
+
+	DL_DEF_COLORSPACE = 64,
+	DL_DEF_FONT,
+	DL_DEF_IMAGE,
+	DL_DEF_SHADE,
+	DL_DEF_FUNCTION,
+};
+
+/* Colorspace kinds */
+enum
+{
+	DL_CS_GRAY, DL_CS_RGB, DL_CS_BGR, DL_CS_CMYK, DL_CS_LAB,
+	DL_CS_ICC, DL_CS_INDEXED, DL_CS_SEPARATION
+};
+
+/* Font and image kinds */
+enum { DL_FONT_FREETYPE, DL_FONT_TYPE3 };
+enum { DL_IMAGE_COMPRESSED, DL_IMAGE_PIXMAP };
+
+/* Path segments */
+enum { DL_PATH_END, DL_MOVETO, DL_LINETO, DL_CURVETO, DL_CLOSEPATH, DL_QUADTO, DL_CURVETOV, DL_CURVETOY, DL_RECTTO };
+
+/* Sampled tables are limited to this many grid points. */
+#define DL_MAX_SAMPLES 65536
+
+/* Common helpers */
+
+static int
+sample_grid_size(fz_context *ctx, int m)
+{
+	int g, i;
+	size_t total;
+
+	if (m < 1 || m > 8)
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot sample function with %d inputs", m);
+	for (g = 256; g > 2; g--)
+	{
+		total = 1;
+		for (i = 0; i < m; i++)
+			total *= g;
+		if (total <= DL_MAX_SAMPLES)
+			break;
+	}
+	return g;
+}
+
+static size_t
+sample_count(int m, int g)
+{
+	size_t total = 1;
+	int i;
+	for (i = 0; i < m; i++)
+		total *= g;
+	return total;
+}
+
+/* Multilinear interpolation in a table of g^m points of n values,
+ * covering [0,1] in each input. */
+static void
+eval_samples(int m, int n, int g, const float *samples, const float *in, float *out)
+{
+	int idx[FZ_MAX_COLORS];
+	float frac[FZ_MAX_COLORS];
+	int i, k, corner;
+
+	for (i = 0; i < m; i++)
+	{
+		float x = fz_clamp(in[i], 0, 1) * (g - 1);
+		idx[i] = (int)x;
+		if (idx[i] > g - 2)
+			idx[i] = g - 2;
+		frac[i] = x - idx[i];
+	}
+	for (k = 0; k < n; k++)
+		out[k] = 0;
+	for (corner = 0; corner < (1 << m); corner++)
+	{
+		float weight = 1;
+		size_t ofs = 0, stride = 1;
+		for (i = 0; i < m; i++)
+		{
+			int bit = (corner >> i) & 1;
+			weight *= bit ? frac[i] : 1 - frac[i];
+			ofs += (idx[i] + bit) * stride;
+			stride *= g;
+		}
+		if (weight == 0)
+			continue;
+		for (k = 0; k < n; k++)
+			out[k] += weight * samples[ofs * n + k];
+	}
+}
+
+/* Writing */
+
+typedef struct
+{
+	fz_output *out; /* resource definitions go here */
+	fz_hash_table *ptrs; /* resource pointer -> number */
+	fz_hash_table *digests; /* resource digest -> number */
+	int count;
+} list_writer;
+
+typedef void (write_resource_fn)(fz_context *ctx, list_writer *w, fz_output *out, void *obj);
+
+static void save_list(fz_context *ctx, list_writer *w, fz_output *out, fz_display_list *list);
+
+static void
+write_rect(fz_context *ctx, fz_output *out, fz_rect r)
+{
+	fz_write_float_le(ctx, out, r.x0);
+	fz_write_float_le(ctx, out, r.y0);
+	fz_write_float_le(ctx, out, r.x1);
+	fz_write_float_le(ctx, out, r.y1);
+}
+
+static void
+write_matrix(fz_context *ctx, fz_output *out, fz_matrix m)
+{
+	fz_write_float_le(ctx, out, m.a);
+	fz_write_float_le(ctx, out, m.b);
+	fz_write_float_le(ctx, out, m.c);
+	fz_write_float_le(ctx, out, m.d);
+	fz_write_float_le(ctx, out, m.e);
+	fz_write_float_le(ctx, out, m.f);
+}
+
+static void
+write_floats(fz_context *ctx, fz_output *out, const float *v, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+		fz_write_float_le(ctx, out, v[i]);
+}
+
+static void
+write_string(fz_context *ctx, fz_output *out, const char *s)
+{
+	size_t len = s ? strlen(s) : 0;
+	fz_write_uint32_le(ctx, out, (unsigned int)len);
+	fz_write_data(ctx, out, s, len);
+}
+
+static void
+write_data(fz_context *ctx, fz_output *out, const unsigned char *data, size_t len)
+{
+	if (len > UINT32_MAX)
+		fz_throw(ctx, FZ_ERROR_LIMIT, "object too large to serialize");
+	fz_write_uint32_le(ctx, out, (unsigned int)len);
+	fz_write_data(ctx, out, data, len);
+}
+
+static void
+write_color_params(fz_context *ctx, fz_output *out, fz_color_params cp)
+{
+	fz_write_byte(ctx, out, cp.ri);
+	fz_write_byte(ctx, out, cp.bp);
+	fz_write_byte(ctx, out, cp.op);
+	fz_write_byte(ctx, out, cp.opm);
+}
+
+static int
+ref_resource(fz_context *ctx, list_writer *w, void *obj, int tag, write_resource_fn *fn)
+{
+	fz_buffer *buf;
+	fz_output *out = NULL;
+	unsigned char digest[16];
+	unsigned char t = tag;
+	fz_md5 md5;
+	int id;
+
+	if (obj == NULL)
+		return 0;
+	id = (int)(intptr_t)fz_hash_find(ctx, w->ptrs, &obj);
+	if (id < 0)
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot serialize recursive resource");
+	if (id)
+		return id;
+
+	buf = fz_new_buffer(ctx, 256);
+	fz_var(out);
+	fz_try(ctx)
+	{
+		/* Mark the resource as in progress while writing it, so that a
+		 * Type 3 glyph using its own font cannot recurse forever. */
+		fz_hash_insert(ctx, w->ptrs, &obj, (void *)(intptr_t)-1);
+		out = fz_new_output_with_buffer(ctx, buf);
+		fn(ctx, w, out, obj);
+		fz_close_output(ctx, out);
+		fz_hash_remove(ctx, w->ptrs, &obj);
+
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, &t, 1);
+		fz_md5_update(&md5, buf->data, buf->len);
+		fz_md5_final(&md5, digest);
+
+		id = (int)(intptr_t)fz_hash_find(ctx, w->digests, digest);
+		if (id == 0)
+		{
+			fz_write_byte(ctx, w->out, t);
+			fz_write_data(ctx, w->out, digest, 16);
+			write_data(ctx, w->out, buf->data, buf->len);
+			id = ++w->count;
+			fz_hash_insert(ctx, w->digests, digest, (void *)(intptr_t)id);
+		}
+		fz_hash_insert(ctx, w->ptrs, &obj, (void *)(intptr_t)id);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_hash_remove(ctx, w->ptrs, &obj);
+		fz_rethrow(ctx);
+	}
+
+	return id;
+}
+
+typedef struct
+{
+	fz_colorspace *cs;
+	fz_function *fn;
+} sample_source;
+
+static void
+write_samples(fz_context *ctx, fz_output *out, sample_source *src, int m, int n)
+{
+	float in[FZ_MAX_COLORS], res[FZ_MAX_COLORS];
+	int g = sample_grid_size(ctx, m);
+	size_t i, count = sample_count(m, g);
+	int k;
+
+	fz_write_uint32_le(ctx, out, m);
+	fz_write_uint32_le(ctx, out, n);
+	fz_write_uint32_le(ctx, out, g);
+	for (i = 0; i < count; i++)
+	{
+		size_t j = i;
+		for (k = 0; k < m; k++)
+		{
+			in[k] = (float)(j % g) / (g - 1);
+			j /= g;
+		}
+		if (src->cs)
+			src->cs->u.separation.eval(ctx, src->cs->u.separation.tint, in, m, res, n);
+		else
+			fz_eval_function(ctx, src->fn, in, m, res, n);
+		write_floats(ctx, out, res, n);
+	}
+}
+
+static int ref_colorspace(fz_context *ctx, list_writer *w, fz_colorspace *cs);
+
+static void
+write_colorspace(fz_context *ctx, list_writer *w, fz_output *out, void *obj)
+{
+	fz_colorspace *cs = obj;
+	int i, base;
+
+	if (cs == fz_device_gray(ctx))
+		fz_write_byte(ctx, out, DL_CS_GRAY);
+	else if (cs == fz_device_rgb(ctx))
+		fz_write_byte(ctx, out, DL_CS_RGB);
+	else if (cs == fz_device_bgr(ctx))
+		fz_write_byte(ctx, out, DL_CS_BGR);
+	else if (cs == fz_device_cmyk(ctx))
+		fz_write_byte(ctx, out, DL_CS_CMYK);
+	else if (cs == fz_device_lab(ctx))
+		fz_write_byte(ctx, out, DL_CS_LAB);
+	else if (cs->type == FZ_COLORSPACE_INDEXED)
+	{
+		base = ref_colorspace(ctx, w, cs->u.indexed.base);
+		fz_write_byte(ctx, out, DL_CS_INDEXED);
+		fz_write_uint32_le(ctx, out, base);
+		fz_write_uint32_le(ctx, out, cs->u.indexed.high);
+		fz_write_data(ctx, out, cs->u.indexed.lookup, (size_t)(cs->u.indexed.high + 1) * cs->u.indexed.base->n);
+	}
+	else if (cs->type == FZ_COLORSPACE_SEPARATION)
+	{
+		sample_source src = { cs, NULL };
+		base = ref_colorspace(ctx, w, cs->u.separation.base);
+		fz_write_byte(ctx, out, DL_CS_SEPARATION);
+		write_string(ctx, out, cs->name);
+		fz_write_uint32_le(ctx, out, base);
+		fz_write_uint32_le(ctx, out, cs->n);
+		for (i = 0; i < cs->n; i++)
+			write_string(ctx, out, cs->u.separation.colorant[i]);
+		write_samples(ctx, out, &src, cs->n, cs->u.separation.base->n);
+	}
+#if FZ_ENABLE_ICC
+	else if (cs->flags & FZ_COLORSPACE_IS_ICC)
+	{
+		fz_write_byte(ctx, out, DL_CS_ICC);
+		fz_write_byte(ctx, out, cs->type);
+		write_string(ctx, out, cs->name);
+		write_data(ctx, out, cs->u.icc.buffer->data, cs->u.icc.buffer->len);
+	}
+#endif
+	else if (cs->type == FZ_COLORSPACE_GRAY)
+		fz_write_byte(ctx, out, DL_CS_GRAY);
+	else if (cs->type == FZ_COLORSPACE_RGB)
+		fz_write_byte(ctx, out, DL_CS_RGB);
+	else if (cs->type == FZ_COLORSPACE_BGR)
+		fz_write_byte(ctx, out, DL_CS_BGR);
+	else if (cs->type == FZ_COLORSPACE_CMYK)
+		fz_write_byte(ctx, out, DL_CS_CMYK);
+	else if (cs->type == FZ_COLORSPACE_LAB)
+		fz_write_byte(ctx, out, DL_CS_LAB);
+	else
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot serialize colorspace %s", cs->name);
+}
+
+static int
+ref_colorspace(fz_context *ctx, list_writer *w, fz_colorspace *cs)
+{
+	return ref_resource(ctx, w, cs, DL_DEF_COLORSPACE, write_colorspace);
+}
+
+static void
+write_function(fz_context *ctx, list_writer *w, fz_output *out, void *obj)
+{
+	fz_function *fn = obj;
+	sample_source src = { NULL, fn };
+	write_samples(ctx, out, &src, fn->m, fn->n);
+}
+
+static int
+ref_function(fz_context *ctx, list_writer *w, fz_function *fn)
+{
+	return ref_resource(ctx, w, fn, DL_DEF_FUNCTION, write_function);
+}
+
+static unsigned int
+pack_font_flags(fz_font_flags_t *f)
+{
+	return f->is_mono | f->is_serif << 1 | f->is_bold << 2 | f->is_italic << 3 |
+		f->ft_substitute << 4 | f->ft_stretch << 5 | f->fake_bold << 6 |
+		f->fake_italic << 7 | f->has_opentype << 8 | f->invalid_bbox << 9 |
+		f->cjk << 10 | f->cjk_lang << 11 | f->embed << 13 | f->never_embed << 14;
+}
+
+static void
+unpack_font_flags(fz_font_flags_t *f, unsigned int x)
+{
+	f->is_mono = x & 1;
+	f->is_serif = (x >> 1) & 1;
+	f->is_bold = (x >> 2) & 1;
+	f->is_italic = (x >> 3) & 1;
+	f->ft_substitute = (x >> 4) & 1;
+	f->ft_stretch = (x >> 5) & 1;
+	f->fake_bold = (x >> 6) & 1;
+	f->fake_italic = (x >> 7) & 1;
+	f->has_opentype = (x >> 8) & 1;
+	f->invalid_bbox = (x >> 9) & 1;
+	f->cjk = (x >> 10) & 1;
+	f->cjk_lang = (x >> 11) & 3;
+	f->embed = (x >> 13) & 1;
+	f->never_embed = (x >> 14) & 1;
+}
+
+static void
+write_font(fz_context *ctx, list_writer *w, fz_output *out, void *obj)
+{
+	fz_font *font = obj;
+	int i;
+
+	if (font->t3lists)
+	{
+		fz_write_byte(ctx, out, DL_FONT_TYPE3);
+		write_string(ctx, out, font->name);
+		fz_write_uint32_le(ctx, out, pack_font_flags(&font->flags));
+		write_rect(ctx, out, font->bbox);
+		write_matrix(ctx, out, font->t3matrix);
+		write_floats(ctx, out, font->t3widths, 256);
+		for (i = 0; i < 256; i++)
+			fz_write_uint16_le(ctx, out, font->t3flags[i]);
+		for (i = 0; i < 256; i++)
+		{
+			fz_write_byte(ctx, out, font->t3lists[i] != NULL);
+			if (font->t3lists[i])
+			{
+				/* Glyph bounds that have not been computed yet are
+				 * written as empty, and computed again on demand. */
+				if (font->bbox_table && font->bbox_table[0])
+					write_rect(ctx, out, font->bbox_table[0][i]);
+				else
+					write_rect(ctx, out, fz_empty_rect);
+				save_list(ctx, w, out, font->t3lists[i]);
+			}
+		}
+	}
+	else if (font->buffer)
+	{
+		fz_write_byte(ctx, out, DL_FONT_FREETYPE);
+		write_string(ctx, out, font->name);
+		fz_write_uint32_le(ctx, out, pack_font_flags(&font->flags));
+		write_rect(ctx, out, font->bbox);
+		fz_write_int32_le(ctx, out, font->subfont);
+		fz_write_int32_le(ctx, out, font->use_glyph_bbox);
+		fz_write_int16_le(ctx, out, font->width_default);
+		fz_write_uint32_le(ctx, out, font->width_table ? font->width_count : 0);
+		if (font->width_table)
+			for (i = 0; i < font->width_count; i++)
+				fz_write_int16_le(ctx, out, font->width_table[i]);
+		write_data(ctx, out, font->buffer->data, font->buffer->len);
+	}
+	else
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot serialize font %s", font->name);
+}
+
+static int
+ref_font(fz_context *ctx, list_writer *w, fz_font *font)
+{
+	return ref_resource(ctx, w, font, DL_DEF_FONT, write_font);
+}
+
+static void
+write_compressed_buffer(fz_context *ctx, fz_output *out, fz_compressed_buffer *cbuf)
+{
+	fz_compression_params *p = &cbuf->params;
+	fz_buffer *globals;
+
+	fz_write_uint32_le(ctx, out, p->type);
+	switch (p->type)
+	{
+	case FZ_IMAGE_JPEG:
+		fz_write_int32_le(ctx, out, p->u.jpeg.color_transform);
+		fz_write_int32_le(ctx, out, p->u.jpeg.invert_cmyk);
+		break;
+	case FZ_IMAGE_JPX:
+		fz_write_int32_le(ctx, out, p->u.jpx.smask_in_data);
+		break;
+	case FZ_IMAGE_JBIG2:
+		fz_write_int32_le(ctx, out, p->u.jbig2.embedded);
+		globals = p->u.jbig2.globals ? fz_jbig2_globals_data(ctx, p->u.jbig2.globals) : NULL;
+		if (globals)
+			write_data(ctx, out, globals->data, globals->len);
+		else
+			fz_write_uint32_le(ctx, out, 0);
+		break;
+	case FZ_IMAGE_FAX:
+		fz_write_int32_le(ctx, out, p->u.fax.columns);
+		fz_write_int32_le(ctx, out, p->u.fax.rows);
+		fz_write_int32_le(ctx, out, p->u.fax.k);
+		fz_write_int32_le(ctx, out, p->u.fax.end_of_line);
+		fz_write_int32_le(ctx, out, p->u.fax.encoded_byte_align);
+		fz_write_int32_le(ctx, out, p->u.fax.end_of_block);
+		fz_write_int32_le(ctx, out, p->u.fax.black_is_1);
+		fz_write_int32_le(ctx, out, p->u.fax.damaged_rows_before_error);
+		break;
+	case FZ_IMAGE_FLATE:
+		fz_write_int32_le(ctx, out, p->u.flate.columns);
+		fz_write_int32_le(ctx, out, p->u.flate.colors);
+		fz_write_int32_le(ctx, out, p->u.flate.predictor);
+		fz_write_int32_le(ctx, out, p->u.flate.bpc);
+		break;
+	case FZ_IMAGE_LZW:
+		fz_write_int32_le(ctx, out, p->u.lzw.columns);
+		fz_write_int32_le(ctx, out, p->u.lzw.colors);
+		fz_write_int32_le(ctx, out, p->u.lzw.predictor);
+		fz_write_int32_le(ctx, out, p->u.lzw.bpc);
+		fz_write_int32_le(ctx, out, p->u.lzw.early_change);
+		break;
+	}
+	write_data(ctx, out, cbuf->buffer->data, cbuf->buffer->len);
+}
+
+static int ref_image(fz_context *ctx, list_writer *w, fz_image *image);
+
+static void
+write_image(fz_context *ctx, list_writer *w, fz_output *out, void *obj)
+{
+	fz_image *image = obj;
+	fz_compressed_buffer *cbuf = fz_compressed_image_buffer(ctx, image);
+	fz_pixmap *pix;
+	int mask = ref_image(ctx, w, image->mask);
+	int cs, y;
+
+	if (cbuf && cbuf->buffer)
+	{
+		cs = ref_colorspace(ctx, w, image->colorspace);
+		fz_write_byte(ctx, out, DL_IMAGE_COMPRESSED);
+		fz_write_int32_le(ctx, out, image->w);
+		fz_write_int32_le(ctx, out, image->h);
+		fz_write_byte(ctx, out, image->n);
+		fz_write_byte(ctx, out, image->bpc);
+		fz_write_uint32_le(ctx, out, cs);
+		fz_write_int32_le(ctx, out, image->xres);
+		fz_write_int32_le(ctx, out, image->yres);
+		fz_write_byte(ctx, out, image->interpolate);
+		fz_write_byte(ctx, out, image->imagemask);
+		fz_write_byte(ctx, out, image->orientation);
+		fz_write_byte(ctx, out, image->use_decode);
+		if (image->use_decode)
+			write_floats(ctx, out, image->decode, 2 * image->n);
+		fz_write_byte(ctx, out, image->use_colorkey);
+		if (image->use_colorkey)
+			for (y = 0; y < 2 * image->n; y++)
+				fz_write_int32_le(ctx, out, image->colorkey[y]);
+		fz_write_uint32_le(ctx, out, mask);
+		write_compressed_buffer(ctx, out, cbuf);
+		return;
+	}
+
+	pix = fz_get_pixmap_from_image(ctx, image, NULL, NULL, NULL, NULL);
+	fz_try(ctx)
+	{
+		cs = ref_colorspace(ctx, w, pix->colorspace);
+		fz_write_byte(ctx, out, DL_IMAGE_PIXMAP);
+		fz_write_int32_le(ctx, out, pix->w);
+		fz_write_int32_le(ctx, out, pix->h);
+		fz_write_byte(ctx, out, pix->n);
+		fz_write_byte(ctx, out, pix->alpha);
+		fz_write_uint32_le(ctx, out, cs);
+		fz_write_int32_le(ctx, out, pix->xres);
+		fz_write_int32_le(ctx, out, pix->yres);
+		fz_write_byte(ctx, out, image->interpolate);
+		fz_write_byte(ctx, out, image->imagemask);
+		fz_write_byte(ctx, out, image->orientation);
+		fz_write_uint32_le(ctx, out, mask);
+		for (y = 0; y < pix->h; y++)
+			fz_write_data(ctx, out, pix->samples + y * (size_t)pix->stride, (size_t)pix->w * pix->n);
+	}
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, pix);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int
+ref_image(fz_context *ctx, list_writer *w, fz_image *image)
+{
+	return ref_resource(ctx, w, image, DL_DEF_IMAGE, write_image);
+}
+
+static void
+write_shade(fz_context *ctx, list_writer *w, fz_output *out, void *obj)
+{
+	fz_shade *shade = obj;
+	int cs = ref_colorspace(ctx, w, shade->colorspace);
+	int n = fz_colorspace_n(ctx, shade->colorspace);
+	int i;
+
+	fz_write_byte(ctx, out, shade->type);
+	write_rect(ctx, out, shade->bbox);
+	fz_write_uint32_le(ctx, out, cs);
+	write_matrix(ctx, out, shade->matrix);
+	fz_write_byte(ctx, out, shade->use_background);
+	write_floats(ctx, out, shade->background, n);
+	fz_write_byte(ctx, out, shade->use_function);
+	if (shade->use_function)
+		for (i = 0; i < 256; i++)
+			write_floats(ctx, out, shade->function[i], n + 1);
+	switch (shade->type)
+	{
+	case FZ_FUNCTION_BASED:
+		write_matrix(ctx, out, shade->u.f.matrix);
+		fz_write_int32_le(ctx, out, shade->u.f.xdivs);
+		fz_write_int32_le(ctx, out, shade->u.f.ydivs);
+		write_floats(ctx, out, &shade->u.f.domain[0][0], 4);
+		write_floats(ctx, out, shade->u.f.fn_vals, (size_t)(shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n);
+		break;
+	case FZ_LINEAR:
+	case FZ_RADIAL:
+		fz_write_int32_le(ctx, out, shade->u.l_or_r.extend[0]);
+		fz_write_int32_le(ctx, out, shade->u.l_or_r.extend[1]);
+		write_floats(ctx, out, &shade->u.l_or_r.coords[0][0], 6);
+		break;
+	default:
+		fz_write_int32_le(ctx, out, shade->u.m.vprow);
+		fz_write_int32_le(ctx, out, shade->u.m.bpflag);
+		fz_write_int32_le(ctx, out, shade->u.m.bpcoord);
+		fz_write_int32_le(ctx, out, shade->u.m.bpcomp);
+		fz_write_float_le(ctx, out, shade->u.m.x0);
+		fz_write_float_le(ctx, out, shade->u.m.x1);
+		fz_write_float_le(ctx, out, shade->u.m.y0);
+		fz_write_float_le(ctx, out, shade->u.m.y1);
+		write_floats(ctx, out, shade->u.m.c0, FZ_MAX_COLORS);
+		write_floats(ctx, out, shade->u.m.c1, FZ_MAX_COLORS);
+		break;
+	}
+	fz_write_byte(ctx, out, shade->buffer != NULL);
+	if (shade->buffer)
+		write_compressed_buffer(ctx, out, shade->buffer);
+}
+
+static int
+ref_shade(fz_context *ctx, list_writer *w, fz_shade *shade)
+{
+	return ref_resource(ctx, w, shade, DL_DEF_SHADE, write_shade);
+}
+
+static void
+write_path_moveto(fz_context *ctx, void *arg, float x, float y)
+{
+	fz_output *out = arg;
+	fz_write_byte(ctx, out, DL_MOVETO);
+	fz_write_float_le(ctx, out, x);
+	fz_write_float_le(ctx, out, y);
+}
+
+static void
+write_path_lineto(fz_context *ctx, void *arg, float x, float y)
+{
+	fz_output *out = arg;
+	fz_write_byte(ctx, out, DL_LINETO);
+	fz_write_float_le(ctx, out, x);
+	fz_write_float_le(ctx, out, y);
+}
+
+static void
+write_path_curveto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	fz_output *out = arg;
+	fz_write_byte(ctx, out, DL_CURVETO);
+	fz_write_float_le(ctx, out, x1);
+	fz_write_float_le(ctx, out, y1);
+	fz_write_float_le(ctx, out, x2);
+	fz_write_float_le(ctx, out, y2);
+	fz_write_float_le(ctx, out, x3);
+	fz_write_float_le(ctx, out, y3);
+}
+
+static void
+write_path_closepath(fz_context *ctx, void *arg)
+{
+	fz_write_byte(ctx, arg, DL_CLOSEPATH);
+}
+
+static void
+write_path_4(fz_context *ctx, fz_output *out, int op, float a, float b, float c, float d)
+{
+	fz_write_byte(ctx, out, op);
+	fz_write_float_le(ctx, out, a);
+	fz_write_float_le(ctx, out, b);
+	fz_write_float_le(ctx, out, c);
+	fz_write_float_le(ctx, out, d);
+}
+
+static void
+write_path_quadto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2)
+{
+	write_path_4(ctx, arg, DL_QUADTO, x1, y1, x2, y2);
+}
+
+static void
+write_path_curvetov(fz_context *ctx, void *arg, float x2, float y2, float x3, float y3)
+{
+	write_path_4(ctx, arg, DL_CURVETOV, x2, y2, x3, y3);
+}
+
+static void
+write_path_curvetoy(fz_context *ctx, void *arg, float x1, float y1, float x3, float y3)
+{
+	write_path_4(ctx, arg, DL_CURVETOY, x1, y1, x3, y3);
+}
+
+static void
+write_path_rectto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2)
+{
+	write_path_4(ctx, arg, DL_RECTTO, x1, y1, x2, y2);
+}
+
+static const fz_path_walker write_path_walker =
+{
+	write_path_moveto,
+	write_path_lineto,
+	write_path_curveto,
+	write_path_closepath,
+	write_path_quadto,
+	write_path_curvetov,
+	write_path_curvetoy,
+	write_path_rectto
+};
+
+static void
+write_path(fz_context *ctx, fz_output *out, const fz_path *path)
+{
+	fz_walk_path(ctx, path, &write_path_walker, out);
+	fz_write_byte(ctx, out, DL_PATH_END);
+}
+
+static void
+write_stroke(fz_context *ctx, fz_output *out, const fz_stroke_state *stroke)
+{
+	fz_write_byte(ctx, out, stroke->start_cap);
+	fz_write_byte(ctx, out, stroke->dash_cap);
+	fz_write_byte(ctx, out, stroke->end_cap);
+	fz_write_byte(ctx, out, stroke->linejoin);
+	fz_write_float_le(ctx, out, stroke->linewidth);
+	fz_write_float_le(ctx, out, stroke->miterlimit);
+	fz_write_float_le(ctx, out, stroke->dash_phase);
+	fz_write_uint32_le(ctx, out, stroke->dash_len);
+	write_floats(ctx, out, stroke->dash_list, stroke->dash_len);
+}
+
+/* Define the fonts used by a text object, before the command using it
+ * starts to be written. */
+static void
+ref_text_fonts(fz_context *ctx, list_writer *w, const fz_text *text)
+{
+	fz_text_span *span;
+	for (span = text->head; span; span = span->next)
+		ref_font(ctx, w, span->font);
+}
+
+static void
+write_text(fz_context *ctx, list_writer *w, fz_output *out, const fz_text *text)
+{
+	fz_text_span *span;
+	int count = 0, i;
+
+	for (span = text->head; span; span = span->next)
+		count++;
+	fz_write_uint32_le(ctx, out, count);
+	for (span = text->head; span; span = span->next)
+	{
+		fz_write_uint32_le(ctx, out, ref_font(ctx, w, span->font));
+		write_matrix(ctx, out, span->trm);
+		fz_write_byte(ctx, out, span->wmode);
+		fz_write_byte(ctx, out, span->bidi_level);
+		fz_write_byte(ctx, out, span->markup_dir);
+		fz_write_uint16_le(ctx, out, span->language);
+		fz_write_uint32_le(ctx, out, span->len);
+		for (i = 0; i < span->len; i++)
+		{
+			fz_write_float_le(ctx, out, span->items[i].x);
+			fz_write_float_le(ctx, out, span->items[i].y);
+			fz_write_int32_le(ctx, out, span->items[i].gid);
+			fz_write_int32_le(ctx, out, span->items[i].ucs);
+			fz_write_int32_le(ctx, out, span->items[i].cid);
+		}
+	}
+}
+
+/* A device that writes the calls it receives. */
+
+typedef struct
+{
+	fz_device super;
+	list_writer *w;
+	fz_output *out;
+} fz_list_writer_device;
+
+static void
+write_color(fz_context *ctx, fz_output *out, int cs_id, fz_colorspace *cs, const float *color)
+{
+	fz_write_uint32_le(ctx, out, cs_id);
+	if (cs)
+		write_floats(ctx, out, color, fz_colorspace_n(ctx, cs));
+}
+
+static void
+dlw_fill_path(fz_context *ctx, fz_device *dev_, const fz_path *path, int even_odd, fz_matrix ctm, fz_colorspace *cs, const float *color, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	fz_write_byte(ctx, dev->out, DL_FILL_PATH);
+	write_path(ctx, dev->out, path);
+	fz_write_byte(ctx, dev->out, even_odd);
+	write_matrix(ctx, dev->out, ctm);
+	write_color(ctx, dev->out, cs_id, cs, color);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_stroke_path(fz_context *ctx, fz_device *dev_, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, fz_colorspace *cs, const float *color, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	fz_write_byte(ctx, dev->out, DL_STROKE_PATH);
+	write_path(ctx, dev->out, path);
+	write_stroke(ctx, dev->out, stroke);
+	write_matrix(ctx, dev->out, ctm);
+	write_color(ctx, dev->out, cs_id, cs, color);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_clip_path(fz_context *ctx, fz_device *dev_, const fz_path *path, int even_odd, fz_matrix ctm, fz_rect scissor)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_CLIP_PATH);
+	write_path(ctx, dev->out, path);
+	fz_write_byte(ctx, dev->out, even_odd);
+	write_matrix(ctx, dev->out, ctm);
+	write_rect(ctx, dev->out, scissor);
+}
+
+static void
+dlw_clip_stroke_path(fz_context *ctx, fz_device *dev_, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_CLIP_STROKE_PATH);
+	write_path(ctx, dev->out, path);
+	write_stroke(ctx, dev->out, stroke);
+	write_matrix(ctx, dev->out, ctm);
+	write_rect(ctx, dev->out, scissor);
+}
+
+static void
+dlw_fill_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm, fz_colorspace *cs, const float *color, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	ref_text_fonts(ctx, dev->w, text);
+	fz_write_byte(ctx, dev->out, DL_FILL_TEXT);
+	write_text(ctx, dev->w, dev->out, text);
+	write_matrix(ctx, dev->out, ctm);
+	write_color(ctx, dev->out, cs_id, cs, color);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_stroke_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_colorspace *cs, const float *color, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	ref_text_fonts(ctx, dev->w, text);
+	fz_write_byte(ctx, dev->out, DL_STROKE_TEXT);
+	write_text(ctx, dev->w, dev->out, text);
+	write_stroke(ctx, dev->out, stroke);
+	write_matrix(ctx, dev->out, ctm);
+	write_color(ctx, dev->out, cs_id, cs, color);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_clip_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm, fz_rect scissor)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	ref_text_fonts(ctx, dev->w, text);
+	fz_write_byte(ctx, dev->out, DL_CLIP_TEXT);
+	write_text(ctx, dev->w, dev->out, text);
+	write_matrix(ctx, dev->out, ctm);
+	write_rect(ctx, dev->out, scissor);
+}
+
+static void
+dlw_clip_stroke_text(fz_context *ctx, fz_device *dev_, const fz_text *text, const fz_stroke_state *stroke, fz_matrix ctm, fz_rect scissor)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	ref_text_fonts(ctx, dev->w, text);
+	fz_write_byte(ctx, dev->out, DL_CLIP_STROKE_TEXT);
+	write_text(ctx, dev->w, dev->out, text);
+	write_stroke(ctx, dev->out, stroke);
+	write_matrix(ctx, dev->out, ctm);
+	write_rect(ctx, dev->out, scissor);
+}
+
+static void
+dlw_ignore_text(fz_context *ctx, fz_device *dev_, const fz_text *text, fz_matrix ctm)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	ref_text_fonts(ctx, dev->w, text);
+	fz_write_byte(ctx, dev->out, DL_IGNORE_TEXT);
+	write_text(ctx, dev->w, dev->out, text);
+	write_matrix(ctx, dev->out, ctm);
+}
+
+static void
+dlw_fill_shade(fz_context *ctx, fz_device *dev_, fz_shade *shade, fz_matrix ctm, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int id = ref_shade(ctx, dev->w, shade);
+	fz_write_byte(ctx, dev->out, DL_FILL_SHADE);
+	fz_write_uint32_le(ctx, dev->out, id);
+	write_matrix(ctx, dev->out, ctm);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_fill_image(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int id = ref_image(ctx, dev->w, image);
+	fz_write_byte(ctx, dev->out, DL_FILL_IMAGE);
+	fz_write_uint32_le(ctx, dev->out, id);
+	write_matrix(ctx, dev->out, ctm);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_fill_image_mask(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, fz_colorspace *cs, const float *color, float alpha, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int id = ref_image(ctx, dev->w, image);
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	fz_write_byte(ctx, dev->out, DL_FILL_IMAGE_MASK);
+	fz_write_uint32_le(ctx, dev->out, id);
+	write_matrix(ctx, dev->out, ctm);
+	write_color(ctx, dev->out, cs_id, cs, color);
+	fz_write_float_le(ctx, dev->out, alpha);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_clip_image_mask(fz_context *ctx, fz_device *dev_, fz_image *image, fz_matrix ctm, fz_rect scissor)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int id = ref_image(ctx, dev->w, image);
+	fz_write_byte(ctx, dev->out, DL_CLIP_IMAGE_MASK);
+	fz_write_uint32_le(ctx, dev->out, id);
+	write_matrix(ctx, dev->out, ctm);
+	write_rect(ctx, dev->out, scissor);
+}
+
+static void
+dlw_pop_clip(fz_context *ctx, fz_device *dev_)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_POP_CLIP);
+}
+
+static void
+dlw_begin_mask(fz_context *ctx, fz_device *dev_, fz_rect area, int luminosity, fz_colorspace *cs, const float *bc, fz_color_params cp)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	static const float black[FZ_MAX_COLORS] = { 0 };
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	fz_write_byte(ctx, dev->out, DL_BEGIN_MASK);
+	write_rect(ctx, dev->out, area);
+	fz_write_byte(ctx, dev->out, luminosity);
+	write_color(ctx, dev->out, cs_id, cs, bc ? bc : black);
+	write_color_params(ctx, dev->out, cp);
+}
+
+static void
+dlw_end_mask(fz_context *ctx, fz_device *dev_, fz_function *tr)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int id = ref_function(ctx, dev->w, tr);
+	fz_write_byte(ctx, dev->out, DL_END_MASK);
+	fz_write_uint32_le(ctx, dev->out, id);
+}
+
+static void
+dlw_begin_group(fz_context *ctx, fz_device *dev_, fz_rect area, fz_colorspace *cs, int isolated, int knockout, int blendmode, float alpha)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int cs_id = ref_colorspace(ctx, dev->w, cs);
+	fz_write_byte(ctx, dev->out, DL_BEGIN_GROUP);
+	write_rect(ctx, dev->out, area);
+	fz_write_uint32_le(ctx, dev->out, cs_id);
+	fz_write_byte(ctx, dev->out, isolated);
+	fz_write_byte(ctx, dev->out, knockout);
+	fz_write_byte(ctx, dev->out, blendmode);
+	fz_write_float_le(ctx, dev->out, alpha);
+}
+
+static void
+dlw_end_group(fz_context *ctx, fz_device *dev_)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_END_GROUP);
+}
+
+static int
+dlw_begin_tile(fz_context *ctx, fz_device *dev_, fz_rect area, fz_rect view, float xstep, float ystep, fz_matrix ctm, int id)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_BEGIN_TILE);
+	write_rect(ctx, dev->out, area);
+	write_rect(ctx, dev->out, view);
+	fz_write_float_le(ctx, dev->out, xstep);
+	fz_write_float_le(ctx, dev->out, ystep);
+	write_matrix(ctx, dev->out, ctm);
+	fz_write_int32_le(ctx, dev->out, id);
+	return 0;
+}
+
+static void
+dlw_end_tile(fz_context *ctx, fz_device *dev_)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_END_TILE);
+}
+
+static void
+dlw_render_flags(fz_context *ctx, fz_device *dev_, int set, int clear)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_RENDER_FLAGS);
+	fz_write_int32_le(ctx, dev->out, set);
+	fz_write_int32_le(ctx, dev->out, clear);
+}
+
+static void
+dlw_set_default_colorspaces(fz_context *ctx, fz_device *dev_, fz_default_colorspaces *dcs)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	int gray = ref_colorspace(ctx, dev->w, fz_default_gray(ctx, dcs));
+	int rgb = ref_colorspace(ctx, dev->w, fz_default_rgb(ctx, dcs));
+	int cmyk = ref_colorspace(ctx, dev->w, fz_default_cmyk(ctx, dcs));
+	int oi = ref_colorspace(ctx, dev->w, fz_default_output_intent(ctx, dcs));
+	fz_write_byte(ctx, dev->out, DL_DEFAULT_COLORSPACES);
+	fz_write_uint32_le(ctx, dev->out, gray);
+	fz_write_uint32_le(ctx, dev->out, rgb);
+	fz_write_uint32_le(ctx, dev->out, cmyk);
+	fz_write_uint32_le(ctx, dev->out, oi);
+}
+
+static void
+dlw_begin_layer(fz_context *ctx, fz_device *dev_, const char *name)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_BEGIN_LAYER);
+	write_string(ctx, dev->out, name);
+}
+
+static void
+dlw_end_layer(fz_context *ctx, fz_device *dev_)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_END_LAYER);
+}
+
+static void
+dlw_begin_structure(fz_context *ctx, fz_device *dev_, fz_structure standard, const char *raw, int idx)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_BEGIN_STRUCTURE);
+	fz_write_int32_le(ctx, dev->out, standard);
+	write_string(ctx, dev->out, raw);
+	fz_write_int32_le(ctx, dev->out, idx);
+}
+
+static void
+dlw_end_structure(fz_context *ctx, fz_device *dev_)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_END_STRUCTURE);
+}
+
+static void
+dlw_begin_metatext(fz_context *ctx, fz_device *dev_, fz_metatext meta, const char *text)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_BEGIN_METATEXT);
+	fz_write_int32_le(ctx, dev->out, meta);
+	write_string(ctx, dev->out, text);
+}
+
+static void
+dlw_end_metatext(fz_context *ctx, fz_device *dev_)
+{
+	fz_list_writer_device *dev = (fz_list_writer_device *)dev_;
+	fz_write_byte(ctx, dev->out, DL_END_METATEXT);
+}
+
+static fz_device *
+new_list_writer_device(fz_context *ctx, list_writer *w, fz_output *out)
+{
+	fz_list_writer_device *dev = fz_new_derived_device(ctx, fz_list_writer_device);
+
+	dev->super.fill_path = dlw_fill_path;
+	dev->super.stroke_path = dlw_stroke_path;
+	dev->super.clip_path = dlw_clip_path;
+	dev->super.clip_stroke_path = dlw_clip_stroke_path;
+
+	dev->super.fill_text = dlw_fill_text;
+	dev->super.stroke_text = dlw_stroke_text;
+	dev->super.clip_text = dlw_clip_text;
+	dev->super.clip_stroke_text = dlw_clip_stroke_text;
+	dev->super.ignore_text = dlw_ignore_text;
+
+	dev->super.fill_shade = dlw_fill_shade;
+	dev->super.fill_image = dlw_fill_image;
+	dev->super.fill_image_mask = dlw_fill_image_mask;
+	dev->super.clip_image_mask = dlw_clip_image_mask;
+
+	dev->super.pop_clip = dlw_pop_clip;
+
+	dev->super.begin_mask = dlw_begin_mask;
+	dev->super.end_mask = dlw_end_mask;
+	dev->super.begin_group = dlw_begin_group;
+	dev->super.end_group = dlw_end_group;
+
+	dev->super.begin_tile = dlw_begin_tile;
+	dev->super.end_tile = dlw_end_tile;
+
+	dev->super.render_flags = dlw_render_flags;
+	dev->super.set_default_colorspaces = dlw_set_default_colorspaces;
+
+	dev->super.begin_layer = dlw_begin_layer;
+	dev->super.end_layer = dlw_end_layer;
+
+	dev->super.begin_structure = dlw_begin_structure;
+	dev->super.end_structure = dlw_end_structure;
+
+	dev->super.begin_metatext = dlw_begin_metatext;
+	dev->super.end_metatext = dlw_end_metatext;
+
+	dev->w = w;
+	dev->out = out;
+
+	return &dev->super;
+}
+
+static void
+save_list(fz_context *ctx, list_writer *w, fz_output *out, fz_display_list *list)
+{
+	fz_device *dev;
+
+	write_rect(ctx, out, fz_bound_display_list(ctx, list));
+	dev = new_list_writer_device(ctx, w, out);
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
+		fz_close_device(ctx, dev);
+		fz_write_byte(ctx, out, DL_END);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_save_display_list(fz_context *ctx, fz_display_list *list, fz_output *out)
+{
+	list_writer w = { 0 };
+
+	fz_var(w.ptrs);
+	fz_var(w.digests);
+
+	fz_try(ctx)
+	{
+		w.out = out;
+		w.ptrs = fz_new_hash_table(ctx, 64, sizeof(void *), -1, NULL);
+		w.digests = fz_new_hash_table(ctx, 64, 16, -1, NULL);
+		fz_write_data(ctx, out, "MUDL", 4);
+		fz_write_uint32_le(ctx, out, DL_VERSION);
+		save_list(ctx, &w, out, list);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_hash_table(ctx, w.ptrs);
+		fz_drop_hash_table(ctx, w.digests);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Reading */
+
+typedef struct
+{
+	int tag;
+	void *obj;
+} list_resource;
+
+typedef struct
+{
+	fz_stream *stm;
+	int len, max;
+	list_resource *res;
+} list_reader;
+
+static void load_list_commands(fz_context *ctx, list_reader *r, fz_device *dev);
+
+static int
+read_byte(fz_context *ctx, fz_stream *stm)
+{
+	int c = fz_read_byte(ctx, stm);
+	if (c == EOF)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "premature end of display list");
+	return c;
+}
+
+static fz_rect
+read_rect(fz_context *ctx, fz_stream *stm)
+{
+	fz_rect r;
+	r.x0 = fz_read_float_le(ctx, stm);
+	r.y0 = fz_read_float_le(ctx, stm);
+	r.x1 = fz_read_float_le(ctx, stm);
+	r.y1 = fz_read_float_le(ctx, stm);
+	return r;
+}
+
+static fz_matrix
+read_matrix(fz_context *ctx, fz_stream *stm)
+{
+	fz_matrix m;
+	m.a = fz_read_float_le(ctx, stm);
+	m.b = fz_read_float_le(ctx, stm);
+	m.c = fz_read_float_le(ctx, stm);
+	m.d = fz_read_float_le(ctx, stm);
+	m.e = fz_read_float_le(ctx, stm);
+	m.f = fz_read_float_le(ctx, stm);
+	return m;
+}
+
+static void
+read_floats(fz_context *ctx, fz_stream *stm, float *v, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+		v[i] = fz_read_float_le(ctx, stm);
+}
+
+static void
+read_bytes(fz_context *ctx, fz_stream *stm, unsigned char *data, size_t len)
+{
+	if (fz_read(ctx, stm, data, len) != len)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "premature end of display list");
+}
+
+/* Returns a string that the caller must free. */
+static char *
+read_string(fz_context *ctx, fz_stream *stm)
+{
+	size_t len = fz_read_uint32_le(ctx, stm);
+	char *s = fz_malloc(ctx, len + 1);
+	fz_try(ctx)
+		read_bytes(ctx, stm, (unsigned char *)s, len);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, s);
+		fz_rethrow(ctx);
+	}
+	s[len] = 0;
+	return s;
+}
+
+static fz_buffer *
+read_data(fz_context *ctx, fz_stream *stm)
+{
+	size_t len = fz_read_uint32_le(ctx, stm);
+	fz_buffer *buf = fz_new_buffer(ctx, len ? len : 1);
+	fz_try(ctx)
+	{
+		read_bytes(ctx, stm, buf->data, len);
+		buf->len = len;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static fz_color_params
+read_color_params(fz_context *ctx, fz_stream *stm)
+{
+	fz_color_params cp;
+	cp.ri = read_byte(ctx, stm);
+	cp.bp = read_byte(ctx, stm);
+	cp.op = read_byte(ctx, stm);
+	cp.opm = read_byte(ctx, stm);
+	return cp;
+}
+
+/* Returns a borrowed reference. */
+static void *
+read_ref(fz_context *ctx, list_reader *r, int tag)
+{
+	unsigned int id = fz_read_uint32_le(ctx, r->stm);
+	if (id == 0)
+		return NULL;
+	if (id > (unsigned int)r->len || r->res[id-1].tag != tag)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid resource reference in display list");
+	return r->res[id-1].obj;
+}
+
+static fz_colorspace *
+read_color(fz_context *ctx, list_reader *r, float *color)
+{
+	fz_colorspace *cs = read_ref(ctx, r, DL_DEF_COLORSPACE);
+	if (cs)
+		read_floats(ctx, r->stm, color, fz_colorspace_n(ctx, cs));
+	return cs;
+}
+
+typedef struct
+{
+	int m, n, g;
+	float *samples;
+} sampled_table;
+
+/* Read a table written by write_samples, after its m and n. */
+static sampled_table *
+read_sample_table(fz_context *ctx, fz_stream *stm, int m, int n)
+{
+	sampled_table *t;
+	size_t count;
+
+	t = fz_malloc_struct(ctx, sampled_table);
+	fz_try(ctx)
+	{
+		t->m = m;
+		t->n = n;
+		t->g = fz_read_uint32_le(ctx, stm);
+		if (t->g != sample_grid_size(ctx, m))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "invalid sample table in display list");
+		count = sample_count(m, t->g) * n;
+		t->samples = fz_malloc_array(ctx, count, float);
+		read_floats(ctx, stm, t->samples, count);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, t->samples);
+		fz_free(ctx, t);
+		fz_rethrow(ctx);
+	}
+	return t;
+}
+
+static void
+sampled_tint_eval(fz_context *ctx, void *tint, const float *s, int sn, float *d, int dn)
+{
+	sampled_table *t = tint;
+	eval_samples(t->m, t->n, t->g, t->samples, s, d);
+}
+
+static void
+sampled_tint_drop(fz_context *ctx, void *tint)
+{
+	sampled_table *t = tint;
+	if (!t)
+		return;
+	fz_free(ctx, t->samples);
+	fz_free(ctx, t);
+}
+
+static fz_colorspace *
+read_colorspace(fz_context *ctx, list_reader *r)
+{
+	fz_colorspace *cs = NULL;
+	fz_colorspace *base;
+	fz_buffer *buf = NULL;
+	unsigned char *lookup = NULL;
+	char *name = NULL;
+	char *colorant = NULL;
+	int kind, type, high, n, i;
+
+	fz_var(cs);
+	fz_var(buf);
+	fz_var(lookup);
+	fz_var(name);
+	fz_var(colorant);
+
+	kind = read_byte(ctx, r->stm);
+	switch (kind)
+	{
+	case DL_CS_GRAY: return fz_keep_colorspace(ctx, fz_device_gray(ctx));
+	case DL_CS_RGB: return fz_keep_colorspace(ctx, fz_device_rgb(ctx));
+	case DL_CS_BGR: return fz_keep_colorspace(ctx, fz_device_bgr(ctx));
+	case DL_CS_CMYK: return fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
+	case DL_CS_LAB: return fz_keep_colorspace(ctx, fz_device_lab(ctx));
+	}
+
+	fz_try(ctx)
+	{
+		switch (kind)
+		{
+		case DL_CS_INDEXED:
+			base = read_ref(ctx, r, DL_DEF_COLORSPACE);
+			high = fz_read_uint32_le(ctx, r->stm);
+			if (!base || high < 0 || high > 255)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid indexed colorspace in display list");
+			lookup = fz_malloc(ctx, (size_t)(high + 1) * base->n);
+			read_bytes(ctx, r->stm, lookup, (size_t)(high + 1) * base->n);
+			cs = fz_new_indexed_colorspace(ctx, base, high, lookup);
+			lookup = NULL;
+			break;
+		case DL_CS_SEPARATION:
+			name = read_string(ctx, r->stm);
+			base = read_ref(ctx, r, DL_DEF_COLORSPACE);
+			n = fz_read_uint32_le(ctx, r->stm);
+			if (!base || n < 1 || n > FZ_MAX_COLORS)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid separation colorspace in display list");
+			cs = fz_new_colorspace(ctx, FZ_COLORSPACE_SEPARATION, 0, n, name);
+			cs->u.separation.eval = sampled_tint_eval;
+			cs->u.separation.drop = sampled_tint_drop;
+			cs->u.separation.base = fz_keep_colorspace(ctx, base);
+			for (i = 0; i < n; i++)
+			{
+				colorant = read_string(ctx, r->stm);
+				if (colorant[0])
+					fz_colorspace_name_colorant(ctx, cs, i, colorant);
+				fz_free(ctx, colorant);
+				colorant = NULL;
+			}
+			if ((int)fz_read_uint32_le(ctx, r->stm) != n || (int)fz_read_uint32_le(ctx, r->stm) != base->n)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid separation colorspace in display list");
+			cs->u.separation.tint = read_sample_table(ctx, r->stm, n, base->n);
+			break;
+		case DL_CS_ICC:
+			type = read_byte(ctx, r->stm);
+			name = read_string(ctx, r->stm);
+			buf = read_data(ctx, r->stm);
+#if FZ_ENABLE_ICC
+			cs = fz_new_icc_colorspace(ctx, type, 0, name, buf);
+#else
+			if (type == FZ_COLORSPACE_GRAY)
+				cs = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+			else if (type == FZ_COLORSPACE_RGB)
+				cs = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
+			else if (type == FZ_COLORSPACE_BGR)
+				cs = fz_keep_colorspace(ctx, fz_device_bgr(ctx));
+			else if (type == FZ_COLORSPACE_CMYK)
+				cs = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
+			else
+				cs = fz_keep_colorspace(ctx, fz_device_lab(ctx));
+#endif
+			break;
+		default:
+			fz_throw(ctx, FZ_ERROR_FORMAT, "unknown colorspace in display list");
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, name);
+		fz_free(ctx, colorant);
+		fz_free(ctx, lookup);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_colorspace(ctx, cs);
+		fz_rethrow(ctx);
+	}
+
+	return cs;
+}
+
+typedef struct
+{
+	fz_function super;
+	sampled_table *table;
+} sampled_function;
+
+static void
+sampled_function_eval(fz_context *ctx, fz_function *fn, const float *in, float *out)
+{
+	sampled_table *t = ((sampled_function *)fn)->table;
+	eval_samples(t->m, t->n, t->g, t->samples, in, out);
+}
+
+static void
+sampled_function_drop(fz_context *ctx, fz_storable *fn_)
+{
+	sampled_function *fn = (sampled_function *)fn_;
+	sampled_tint_drop(ctx, fn->table);
+	fz_free(ctx, fn);
+}
+
+static fz_function *
+read_function(fz_context *ctx, list_reader *r)
+{
+	sampled_function *fn;
+	int m, n;
+
+	m = fz_read_uint32_le(ctx, r->stm);
+	n = fz_read_uint32_le(ctx, r->stm);
+	if (m < 1 || m > FZ_FUNCTION_MAX_M || n < 1 || n > FZ_FUNCTION_MAX_N)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid function in display list");
+
+	fn = fz_new_derived_function(ctx, sampled_function, 0, m, n, sampled_function_eval, sampled_function_drop);
+	fz_try(ctx)
+	{
+		fn->table = read_sample_table(ctx, r->stm, m, n);
+		fn->super.size = sizeof(*fn) + sample_count(m, fn->table->g) * n * sizeof(float);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_function(ctx, &fn->super);
+		fz_rethrow(ctx);
+	}
+	return &fn->super;
+}
+
+static fz_font *
+read_font(fz_context *ctx, list_reader *r)
+{
+	fz_font *font = NULL;
+	fz_buffer *buf = NULL;
+	fz_device *dev = NULL;
+	char *name = NULL;
+	fz_font_flags_t flags = { 0 };
+	fz_rect bbox;
+	int kind, subfont, use_glyph_bbox, i, k;
+
+	fz_var(font);
+	fz_var(buf);
+	fz_var(dev);
+	fz_var(name);
+
+	fz_try(ctx)
+	{
+		kind = read_byte(ctx, r->stm);
+		name = read_string(ctx, r->stm);
+		unpack_font_flags(&flags, fz_read_uint32_le(ctx, r->stm));
+		bbox = read_rect(ctx, r->stm);
+		if (kind == DL_FONT_TYPE3)
+		{
+			font = fz_new_type3_font(ctx, name, read_matrix(ctx, r->stm));
+			font->flags = flags;
+			font->bbox = bbox;
+			read_floats(ctx, r->stm, font->t3widths, 256);
+			/* Glyphs that could only be drawn by re-running their
+			 * content stream are drawn from their lists instead. */
+			for (i = 0; i < 256; i++)
+				font->t3flags[i] = fz_read_uint16_le(ctx, r->stm) & ~FZ_DEVFLAG_UNCACHEABLE;
+			for (i = 0; i < 256; i++)
+			{
+				if (!read_byte(ctx, r->stm))
+					continue;
+				if (font->bbox_table == NULL)
+				{
+					font->bbox_table = fz_malloc_struct(ctx, fz_rect *);
+					font->bbox_table[0] = fz_malloc_array(ctx, 256, fz_rect);
+					for (k = 0; k < 256; k++)
+						font->bbox_table[0][k] = fz_empty_rect;
+				}
+				font->bbox_table[0][i] = read_rect(ctx, r->stm);
+				font->t3lists[i] = fz_new_display_list(ctx, read_rect(ctx, r->stm));
+				dev = fz_new_list_device(ctx, font->t3lists[i]);
+				load_list_commands(ctx, r, dev);
+				fz_close_device(ctx, dev);
+				fz_drop_device(ctx, dev);
+				dev = NULL;
+			}
+		}
+		else if (kind == DL_FONT_FREETYPE)
+		{
+			int width_default, width_count;
+
+			subfont = fz_read_int32_le(ctx, r->stm);
+			use_glyph_bbox = fz_read_int32_le(ctx, r->stm);
+			width_default = fz_read_int16_le(ctx, r->stm);
+			width_count = fz_read_uint32_le(ctx, r->stm);
+			if (width_count < 0)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid font widths in display list");
+			if (width_count > 0)
+			{
+				/* Read the widths before the font data; keep them in
+				 * buf until the font exists. */
+				buf = fz_new_buffer(ctx, width_count * sizeof(short));
+				for (i = 0; i < width_count; i++)
+				{
+					short w = fz_read_int16_le(ctx, r->stm);
+					fz_append_data(ctx, buf, &w, sizeof w);
+				}
+			}
+			{
+				fz_buffer *data = read_data(ctx, r->stm);
+				fz_try(ctx)
+					font = fz_new_font_from_buffer(ctx, name, data, subfont, use_glyph_bbox);
+				fz_always(ctx)
+					fz_drop_buffer(ctx, data);
+				fz_catch(ctx)
+					fz_rethrow(ctx);
+			}
+			font->flags = flags;
+			font->bbox = bbox;
+			font->width_default = width_default;
+			if (width_count > 0)
+			{
+				font->width_table = fz_malloc_array(ctx, width_count, short);
+				memcpy(font->width_table, buf->data, width_count * sizeof(short));
+				font->width_count = width_count;
+			}
+		}
+		else
+			fz_throw(ctx, FZ_ERROR_FORMAT, "unknown font in display list");
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_buffer(ctx, buf);
+		fz_free(ctx, name);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_font(ctx, font);
+		fz_rethrow(ctx);
+	}
+
+	return font;
+}
+
+static fz_compressed_buffer *
+read_compressed_buffer(fz_context *ctx, fz_stream *stm)
+{
+	fz_compressed_buffer *cbuf = fz_new_compressed_buffer(ctx);
+	fz_compression_params *p = &cbuf->params;
+	fz_buffer *globals = NULL;
+
+	fz_var(globals);
+
+	fz_try(ctx)
+	{
+		p->type = fz_read_uint32_le(ctx, stm);
+		switch (p->type)
+		{
+		case FZ_IMAGE_JPEG:
+			p->u.jpeg.color_transform = fz_read_int32_le(ctx, stm);
+			p->u.jpeg.invert_cmyk = fz_read_int32_le(ctx, stm);
+			break;
+		case FZ_IMAGE_JPX:
+			p->u.jpx.smask_in_data = fz_read_int32_le(ctx, stm);
+			break;
+		case FZ_IMAGE_JBIG2:
+			p->u.jbig2.embedded = fz_read_int32_le(ctx, stm);
+			globals = read_data(ctx, stm);
+			if (globals->len > 0)
+				p->u.jbig2.globals = fz_load_jbig2_globals(ctx, globals);
+			break;
+		case FZ_IMAGE_FAX:
+			p->u.fax.columns = fz_read_int32_le(ctx, stm);
+			p->u.fax.rows = fz_read_int32_le(ctx, stm);
+			p->u.fax.k = fz_read_int32_le(ctx, stm);
+			p->u.fax.end_of_line = fz_read_int32_le(ctx, stm);
+			p->u.fax.encoded_byte_align = fz_read_int32_le(ctx, stm);
+			p->u.fax.end_of_block = fz_read_int32_le(ctx, stm);
+			p->u.fax.black_is_1 = fz_read_int32_le(ctx, stm);
+			p->u.fax.damaged_rows_before_error = fz_read_int32_le(ctx, stm);
+			break;
+		case FZ_IMAGE_FLATE:
+			p->u.flate.columns = fz_read_int32_le(ctx, stm);
+			p->u.flate.colors = fz_read_int32_le(ctx, stm);
+			p->u.flate.predictor = fz_read_int32_le(ctx, stm);
+			p->u.flate.bpc = fz_read_int32_le(ctx, stm);
+			break;
+		case FZ_IMAGE_LZW:
+			p->u.lzw.columns = fz_read_int32_le(ctx, stm);
+			p->u.lzw.colors = fz_read_int32_le(ctx, stm);
+			p->u.lzw.predictor = fz_read_int32_le(ctx, stm);
+			p->u.lzw.bpc = fz_read_int32_le(ctx, stm);
+			p->u.lzw.early_change = fz_read_int32_le(ctx, stm);
+			break;
+		}
+		cbuf->buffer = read_data(ctx, stm);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, globals);
+	fz_catch(ctx)
+	{
+		fz_drop_compressed_buffer(ctx, cbuf);
+		fz_rethrow(ctx);
+	}
+
+	return cbuf;
+}
+
+/* Bits per component that fz_unpack_stream can handle. */
+static int
+valid_bpc(int bpc)
+{
+	return bpc == 1 || bpc == 2 || bpc == 4 || bpc == 8 || bpc == 16;
+}
+
+static fz_image *
+read_image(fz_context *ctx, list_reader *r)
+{
+	fz_image *image = NULL;
+	fz_pixmap *pix = NULL;
+	fz_colorspace *cs;
+	fz_image *mask;
+	float decode[FZ_MAX_COLORS * 2];
+	int colorkey[FZ_MAX_COLORS * 2];
+	int use_decode, use_colorkey;
+	int kind, w, h, n, bpc, alpha, xres, yres, interpolate, imagemask, orientation, y;
+
+	fz_var(pix);
+
+	kind = read_byte(ctx, r->stm);
+	w = fz_read_int32_le(ctx, r->stm);
+	h = fz_read_int32_le(ctx, r->stm);
+	n = read_byte(ctx, r->stm);
+	bpc = alpha = read_byte(ctx, r->stm);
+	cs = read_ref(ctx, r, DL_DEF_COLORSPACE);
+	xres = fz_read_int32_le(ctx, r->stm);
+	yres = fz_read_int32_le(ctx, r->stm);
+	interpolate = read_byte(ctx, r->stm);
+	imagemask = read_byte(ctx, r->stm);
+	orientation = read_byte(ctx, r->stm);
+	if (w <= 0 || h <= 0 || n > FZ_MAX_COLORS + 1)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid image in display list");
+
+	if (kind == DL_IMAGE_COMPRESSED)
+	{
+		/* The decode and colorkey arrays are sized by the colorspace, and
+		 * the image is unpacked according to n and bpc. */
+		if (n != (cs ? fz_colorspace_n(ctx, cs) : 1) || !valid_bpc(bpc))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "invalid image in display list");
+		use_decode = read_byte(ctx, r->stm);
+		if (use_decode)
+			read_floats(ctx, r->stm, decode, 2 * n);
+		use_colorkey = read_byte(ctx, r->stm);
+		if (use_colorkey)
+			for (y = 0; y < 2 * n; y++)
+				colorkey[y] = fz_read_int32_le(ctx, r->stm);
+		mask = read_ref(ctx, r, DL_DEF_IMAGE);
+		image = fz_new_image_from_compressed_buffer(ctx, w, h, bpc, cs, xres, yres,
+			interpolate, imagemask, use_decode ? decode : NULL, use_colorkey ? colorkey : NULL,
+			read_compressed_buffer(ctx, r->stm), mask);
+		image->orientation = orientation;
+	}
+	else if (kind == DL_IMAGE_PIXMAP)
+	{
+		mask = read_ref(ctx, r, DL_DEF_IMAGE);
+		pix = fz_new_pixmap(ctx, cs, w, h, NULL, alpha);
+		fz_try(ctx)
+		{
+			if (pix->n != n)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid image in display list");
+			pix->xres = xres;
+			pix->yres = yres;
+			for (y = 0; y < h; y++)
+				read_bytes(ctx, r->stm, pix->samples + y * (size_t)pix->stride, (size_t)w * n);
+			image = fz_new_image_from_pixmap(ctx, pix, mask);
+			image->interpolate = interpolate;
+			image->imagemask = imagemask;
+			image->orientation = orientation;
+		}
+		fz_always(ctx)
+			fz_drop_pixmap(ctx, pix);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	else
+		fz_throw(ctx, FZ_ERROR_FORMAT, "unknown image in display list");
+
+	return image;
+}
+
+static fz_shade *
+read_shade(fz_context *ctx, list_reader *r)
+{
+	fz_shade *shade;
+	int n, i;
+	size_t count;
+
+	shade = fz_malloc_struct(ctx, fz_shade);
+	FZ_INIT_STORABLE(shade, 1, fz_drop_shade_imp);
+	fz_try(ctx)
+	{
+		shade->type = read_byte(ctx, r->stm);
+		if (shade->type < FZ_FUNCTION_BASED || shade->type > FZ_MESH_TYPE7)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "unknown shading in display list");
+		shade->bbox = read_rect(ctx, r->stm);
+		shade->colorspace = fz_keep_colorspace(ctx, read_ref(ctx, r, DL_DEF_COLORSPACE));
+		if (!shade->colorspace)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "shading without colorspace in display list");
+		n = fz_colorspace_n(ctx, shade->colorspace);
+		shade->matrix = read_matrix(ctx, r->stm);
+		shade->use_background = read_byte(ctx, r->stm);
+		read_floats(ctx, r->stm, shade->background, n);
+		shade->use_function = read_byte(ctx, r->stm);
+		if (shade->use_function)
+			for (i = 0; i < 256; i++)
+				read_floats(ctx, r->stm, shade->function[i], n + 1);
+		switch (shade->type)
+		{
+		case FZ_FUNCTION_BASED:
+			shade->u.f.matrix = read_matrix(ctx, r->stm);
+			shade->u.f.xdivs = fz_read_int32_le(ctx, r->stm);
+			shade->u.f.ydivs = fz_read_int32_le(ctx, r->stm);
+			if (shade->u.f.xdivs < 1 || shade->u.f.xdivs > 1024 || shade->u.f.ydivs < 1 || shade->u.f.ydivs > 1024)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid shading in display list");
+			read_floats(ctx, r->stm, &shade->u.f.domain[0][0], 4);
+			count = (size_t)(shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n;
+			shade->u.f.fn_vals = fz_malloc_array(ctx, count, float);
+			read_floats(ctx, r->stm, shade->u.f.fn_vals, count);
+			break;
+		case FZ_LINEAR:
+		case FZ_RADIAL:
+			shade->u.l_or_r.extend[0] = fz_read_int32_le(ctx, r->stm);
+			shade->u.l_or_r.extend[1] = fz_read_int32_le(ctx, r->stm);
+			read_floats(ctx, r->stm, &shade->u.l_or_r.coords[0][0], 6);
+			break;
+		default:
+			shade->u.m.vprow = fz_read_int32_le(ctx, r->stm);
+			shade->u.m.bpflag = fz_read_int32_le(ctx, r->stm);
+			shade->u.m.bpcoord = fz_read_int32_le(ctx, r->stm);
+			shade->u.m.bpcomp = fz_read_int32_le(ctx, r->stm);
+			/* As checked by pdf_load_mesh_params. */
+			if (shade->u.m.bpcoord != 1 && shade->u.m.bpcoord != 2 && shade->u.m.bpcoord != 4 &&
+				shade->u.m.bpcoord != 8 && shade->u.m.bpcoord != 12 && shade->u.m.bpcoord != 16 &&
+				shade->u.m.bpcoord != 24 && shade->u.m.bpcoord != 32)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid shading in display list");
+			if (shade->u.m.bpcomp != 1 && shade->u.m.bpcomp != 2 && shade->u.m.bpcomp != 4 &&
+				shade->u.m.bpcomp != 8 && shade->u.m.bpcomp != 12 && shade->u.m.bpcomp != 16)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid shading in display list");
+			shade->u.m.x0 = fz_read_float_le(ctx, r->stm);
+			shade->u.m.x1 = fz_read_float_le(ctx, r->stm);
+			shade->u.m.y0 = fz_read_float_le(ctx, r->stm);
+			shade->u.m.y1 = fz_read_float_le(ctx, r->stm);
+			read_floats(ctx, r->stm, shade->u.m.c0, FZ_MAX_COLORS);
+			read_floats(ctx, r->stm, shade->u.m.c1, FZ_MAX_COLORS);
+			break;
+		}
+		if (read_byte(ctx, r->stm))
+			shade->buffer = read_compressed_buffer(ctx, r->stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_shade(ctx, shade);
+		fz_rethrow(ctx);
+	}
+	return shade;
+}
+
+static void
+drop_resource(fz_context *ctx, list_resource *res)
+{
+	switch (res->tag)
+	{
+	case DL_DEF_COLORSPACE: fz_drop_colorspace(ctx, res->obj); break;
+	case DL_DEF_FONT: fz_drop_font(ctx, res->obj); break;
+	case DL_DEF_IMAGE: fz_drop_image(ctx, res->obj); break;
+	case DL_DEF_SHADE: fz_drop_shade(ctx, res->obj); break;
+	case DL_DEF_FUNCTION: fz_drop_function(ctx, res->obj); break;
+	}
+}
+
+static void
+load_resource(fz_context *ctx, list_reader *r, int tag)
+{
+	unsigned char digest[16];
+	size_t len;
+	int64_t start;
+	void *obj = NULL;
+
+	read_bytes(ctx, r->stm, digest, 16);
+	len = fz_read_uint32_le(ctx, r->stm);
+	start = fz_tell(ctx, r->stm);
+
+	if (r->len == r->max)
+	{
+		int max = r->max ? r->max * 2 : 32;
+		r->res = fz_realloc_array(ctx, r->res, max, list_resource);
+		r->max = max;
+	}
+
+	switch (tag)
+	{
+	case DL_DEF_COLORSPACE: obj = read_colorspace(ctx, r); break;
+	case DL_DEF_FONT: obj = read_font(ctx, r); break;
+	case DL_DEF_IMAGE: obj = read_image(ctx, r); break;
+	case DL_DEF_SHADE: obj = read_shade(ctx, r); break;
+	case DL_DEF_FUNCTION: obj = read_function(ctx, r); break;
+	default: fz_throw(ctx, FZ_ERROR_FORMAT, "unknown resource in display list");
+	}
+
+	r->res[r->len].tag = tag;
+	r->res[r->len].obj = obj;
+	r->len++;
+
+	if (fz_tell(ctx, r->stm) - start != (int64_t)len)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt resource in display list");
+}
+
+static fz_path *
+read_path(fz_context *ctx, fz_stream *stm)
+{
+	fz_path *path = fz_new_path(ctx);
+	float v[6];
+	int op;
+
+	fz_try(ctx)
+	{
+		while ((op = read_byte(ctx, stm)) != DL_PATH_END)
+		{
+			switch (op)
+			{
+			case DL_MOVETO:
+				read_floats(ctx, stm, v, 2);
+				fz_moveto(ctx, path, v[0], v[1]);
+				break;
+			case DL_LINETO:
+				read_floats(ctx, stm, v, 2);
+				fz_lineto(ctx, path, v[0], v[1]);
+				break;
+			case DL_CURVETO:
+				read_floats(ctx, stm, v, 6);
+				fz_curveto(ctx, path, v[0], v[1], v[2], v[3], v[4], v[5]);
+				break;
+			case DL_CLOSEPATH:
+				fz_closepath(ctx, path);
+				break;
+			case DL_QUADTO:
+				read_floats(ctx, stm, v, 4);
+				fz_quadto(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_CURVETOV:
+				read_floats(ctx, stm, v, 4);
+				fz_curvetov(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_CURVETOY:
+				read_floats(ctx, stm, v, 4);
+				fz_curvetoy(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_RECTTO:
+				read_floats(ctx, stm, v, 4);
+				fz_rectto(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			default:
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt path in display list");
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+	return path;
+}
+
+static fz_stroke_state *
+read_stroke(fz_context *ctx, fz_stream *stm)
+{
+	fz_stroke_state *stroke;
+	fz_stroke_state s;
+	unsigned int dash_len;
+
+	s.start_cap = read_byte(ctx, stm);
+	s.dash_cap = read_byte(ctx, stm);
+	s.end_cap = read_byte(ctx, stm);
+	s.linejoin = read_byte(ctx, stm);
+	s.linewidth = fz_read_float_le(ctx, stm);
+	s.miterlimit = fz_read_float_le(ctx, stm);
+	s.dash_phase = fz_read_float_le(ctx, stm);
+	dash_len = fz_read_uint32_le(ctx, stm);
+	if (dash_len > 0x10000)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt stroke state in display list");
+
+	stroke = fz_new_stroke_state_with_dash_len(ctx, dash_len);
+	stroke->start_cap = s.start_cap;
+	stroke->dash_cap = s.dash_cap;
+	stroke->end_cap = s.end_cap;
+	stroke->linejoin = s.linejoin;
+	stroke->linewidth = s.linewidth;
+	stroke->miterlimit = s.miterlimit;
+	stroke->dash_phase = s.dash_phase;
+	stroke->dash_len = dash_len;
+	fz_try(ctx)
+		read_floats(ctx, stm, stroke->dash_list, dash_len);
+	fz_catch(ctx)
+	{
+		fz_drop_stroke_state(ctx, stroke);
+		fz_rethrow(ctx);
+	}
+	return stroke;
+}
+
+static fz_text *
+read_text(fz_context *ctx, list_reader *r)
+{
+	fz_text *text = fz_new_text(ctx);
+	fz_font *font;
+	fz_matrix trm;
+	unsigned int spans, len, i;
+	int wmode, bidi_level, markup_dir, language;
+	float x, y;
+	int gid, ucs, cid;
+
+	fz_try(ctx)
+	{
+		spans = fz_read_uint32_le(ctx, r->stm);
+		while (spans--)
+		{
+			font = read_ref(ctx, r, DL_DEF_FONT);
+			if (!font)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "text without font in display list");
+			trm = read_matrix(ctx, r->stm);
+			wmode = read_byte(ctx, r->stm);
+			bidi_level = read_byte(ctx, r->stm);
+			markup_dir = read_byte(ctx, r->stm);
+			language = fz_read_uint16_le(ctx, r->stm);
+			len = fz_read_uint32_le(ctx, r->stm);
+			for (i = 0; i < len; i++)
+			{
+				x = fz_read_float_le(ctx, r->stm);
+				y = fz_read_float_le(ctx, r->stm);
+				gid = fz_read_int32_le(ctx, r->stm);
+				ucs = fz_read_int32_le(ctx, r->stm);
+				cid = fz_read_int32_le(ctx, r->stm);
+				trm.e = x;
+				trm.f = y;
+				fz_show_glyph_aux(ctx, text, font, trm, gid, ucs, cid, wmode, bidi_level, markup_dir, language);
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	return text;
+}
+
+static void
+load_list_commands(fz_context *ctx, list_reader *r, fz_device *dev)
+{
+	fz_stream *stm = r->stm;
+	fz_path *path = NULL;
+	fz_stroke_state *stroke = NULL;
+	fz_text *text = NULL;
+	fz_default_colorspaces *dcs = NULL;
+	char *str = NULL;
+	float color[FZ_MAX_COLORS];
+	fz_colorspace *cs;
+	fz_matrix ctm;
+	fz_rect rect, view;
+	float alpha, xstep, ystep;
+	int tag, even_odd, a, b, c;
+	void *obj;
+
+	fz_var(path);
+	fz_var(stroke);
+	fz_var(text);
+	fz_var(dcs);
+	fz_var(str);
+
+	fz_try(ctx)
+	{
+		while ((tag = read_byte(ctx, stm)) != DL_END)
+		{
+			switch (tag)
+			{
+			case DL_FILL_PATH:
+				path = read_path(ctx, stm);
+				even_odd = read_byte(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				cs = read_color(ctx, r, color);
+				alpha = fz_read_float_le(ctx, stm);
+				fz_fill_path(ctx, dev, path, even_odd, ctm, cs, color, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_STROKE_PATH:
+				path = read_path(ctx, stm);
+				stroke = read_stroke(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				cs = read_color(ctx, r, color);
+				alpha = fz_read_float_le(ctx, stm);
+				fz_stroke_path(ctx, dev, path, stroke, ctm, cs, color, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_CLIP_PATH:
+				path = read_path(ctx, stm);
+				even_odd = read_byte(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				fz_clip_path(ctx, dev, path, even_odd, ctm, read_rect(ctx, stm));
+				break;
+			case DL_CLIP_STROKE_PATH:
+				path = read_path(ctx, stm);
+				stroke = read_stroke(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				fz_clip_stroke_path(ctx, dev, path, stroke, ctm, read_rect(ctx, stm));
+				break;
+			case DL_FILL_TEXT:
+				text = read_text(ctx, r);
+				ctm = read_matrix(ctx, stm);
+				cs = read_color(ctx, r, color);
+				alpha = fz_read_float_le(ctx, stm);
+				fz_fill_text(ctx, dev, text, ctm, cs, color, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_STROKE_TEXT:
+				text = read_text(ctx, r);
+				stroke = read_stroke(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				cs = read_color(ctx, r, color);
+				alpha = fz_read_float_le(ctx, stm);
+				fz_stroke_text(ctx, dev, text, stroke, ctm, cs, color, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_CLIP_TEXT:
+				text = read_text(ctx, r);
+				ctm = read_matrix(ctx, stm);
+				fz_clip_text(ctx, dev, text, ctm, read_rect(ctx, stm));
+				break;
+			case DL_CLIP_STROKE_TEXT:
+				text = read_text(ctx, r);
+				stroke = read_stroke(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				fz_clip_stroke_text(ctx, dev, text, stroke, ctm, read_rect(ctx, stm));
+				break;
+			case DL_IGNORE_TEXT:
+				text = read_text(ctx, r);
+				fz_ignore_text(ctx, dev, text, read_matrix(ctx, stm));
+				break;
+			case DL_FILL_SHADE:
+				obj = read_ref(ctx, r, DL_DEF_SHADE);
+				ctm = read_matrix(ctx, stm);
+				alpha = fz_read_float_le(ctx, stm);
+				if (!obj)
+					fz_throw(ctx, FZ_ERROR_FORMAT, "missing shading in display list");
+				fz_fill_shade(ctx, dev, obj, ctm, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_FILL_IMAGE:
+				obj = read_ref(ctx, r, DL_DEF_IMAGE);
+				ctm = read_matrix(ctx, stm);
+				alpha = fz_read_float_le(ctx, stm);
+				if (!obj)
+					fz_throw(ctx, FZ_ERROR_FORMAT, "missing image in display list");
+				fz_fill_image(ctx, dev, obj, ctm, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_FILL_IMAGE_MASK:
+				obj = read_ref(ctx, r, DL_DEF_IMAGE);
+				ctm = read_matrix(ctx, stm);
+				cs = read_color(ctx, r, color);
+				alpha = fz_read_float_le(ctx, stm);
+				if (!obj)
+					fz_throw(ctx, FZ_ERROR_FORMAT, "missing image in display list");
+				fz_fill_image_mask(ctx, dev, obj, ctm, cs, color, alpha, read_color_params(ctx, stm));
+				break;
+			case DL_CLIP_IMAGE_MASK:
+				obj = read_ref(ctx, r, DL_DEF_IMAGE);
+				ctm = read_matrix(ctx, stm);
+				if (!obj)
+					fz_throw(ctx, FZ_ERROR_FORMAT, "missing image in display list");
+				fz_clip_image_mask(ctx, dev, obj, ctm, read_rect(ctx, stm));
+				break;
+			case DL_POP_CLIP:
+				fz_pop_clip(ctx, dev);
+				break;
+			case DL_BEGIN_MASK:
+				rect = read_rect(ctx, stm);
+				a = read_byte(ctx, stm);
+				cs = read_color(ctx, r, color);
+				fz_begin_mask(ctx, dev, rect, a, cs, color, read_color_params(ctx, stm));
+				break;
+			case DL_END_MASK:
+				fz_end_mask_tr(ctx, dev, read_ref(ctx, r, DL_DEF_FUNCTION));
+				break;
+			case DL_BEGIN_GROUP:
+				rect = read_rect(ctx, stm);
+				cs = read_ref(ctx, r, DL_DEF_COLORSPACE);
+				a = read_byte(ctx, stm);
+				b = read_byte(ctx, stm);
+				c = read_byte(ctx, stm);
+				fz_begin_group(ctx, dev, rect, cs, a, b, c, fz_read_float_le(ctx, stm));
+				break;
+			case DL_END_GROUP:
+				fz_end_group(ctx, dev);
+				break;
+			case DL_BEGIN_TILE:
+				rect = read_rect(ctx, stm);
+				view = read_rect(ctx, stm);
+				xstep = fz_read_float_le(ctx, stm);
+				ystep = fz_read_float_le(ctx, stm);
+				ctm = read_matrix(ctx, stm);
+				(void)fz_begin_tile_id(ctx, dev, rect, view, xstep, ystep, ctm, fz_read_int32_le(ctx, stm));
+				break;
+			case DL_END_TILE:
+				fz_end_tile(ctx, dev);
+				break;
+			case DL_RENDER_FLAGS:
+				a = fz_read_int32_le(ctx, stm);
+				fz_render_flags(ctx, dev, a, fz_read_int32_le(ctx, stm));
+				break;
+			case DL_DEFAULT_COLORSPACES:
+				dcs = fz_new_default_colorspaces(ctx);
+				if ((cs = read_ref(ctx, r, DL_DEF_COLORSPACE)) != NULL)
+					fz_set_default_gray(ctx, dcs, cs);
+				if ((cs = read_ref(ctx, r, DL_DEF_COLORSPACE)) != NULL)
+					fz_set_default_rgb(ctx, dcs, cs);
+				if ((cs = read_ref(ctx, r, DL_DEF_COLORSPACE)) != NULL)
+					fz_set_default_cmyk(ctx, dcs, cs);
+				if ((cs = read_ref(ctx, r, DL_DEF_COLORSPACE)) != NULL)
+					fz_set_default_output_intent(ctx, dcs, cs);
+				fz_set_default_colorspaces(ctx, dev, dcs);
+				break;
+			case DL_BEGIN_LAYER:
+				str = read_string(ctx, stm);
+				fz_begin_layer(ctx, dev, str);
+				break;
+			case DL_END_LAYER:
+				fz_end_layer(ctx, dev);
+				break;
+			case DL_BEGIN_STRUCTURE:
+				a = fz_read_int32_le(ctx, stm);
+				str = read_string(ctx, stm);
+				fz_begin_structure(ctx, dev, a, str, fz_read_int32_le(ctx, stm));
+				break;
+			case DL_END_STRUCTURE:
+				fz_end_structure(ctx, dev);
+				break;
+			case DL_BEGIN_METATEXT:
+				a = fz_read_int32_le(ctx, stm);
+				str = read_string(ctx, stm);
+				fz_begin_metatext(ctx, dev, a, str);
+				break;
+			case DL_END_METATEXT:
+				fz_end_metatext(ctx, dev);
+				break;
+			case DL_DEF_COLORSPACE:
+			case DL_DEF_FONT:
+			case DL_DEF_IMAGE:
+			case DL_DEF_SHADE:
+			case DL_DEF_FUNCTION:
+				load_resource(ctx, r, tag);
+				break;
+			default:
+				fz_throw(ctx, FZ_ERROR_FORMAT, "unknown command in display list");
+			}
+
+			fz_drop_path(ctx, path);
+			path = NULL;
+			fz_drop_stroke_state(ctx, stroke);
+			stroke = NULL;
+			fz_drop_text(ctx, text);
+			text = NULL;
+			fz_drop_default_colorspaces(ctx, dcs);
+			dcs = NULL;
+			fz_free(ctx, str);
+			str = NULL;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_drop_stroke_state(ctx, stroke);
+		fz_drop_text(ctx, text);
+		fz_drop_default_colorspaces(ctx, dcs);
+		fz_free(ctx, str);
+		fz_rethrow(ctx);
+	}
+}
+
+fz_display_list *
+fz_load_display_list(fz_context *ctx, fz_stream *stm)
+{
+	list_reader r = { 0 };
+	fz_display_list *list = NULL;
+	fz_device *dev = NULL;
+	unsigned char magic[4];
+	int i;
+
+	fz_var(list);
+	fz_var(dev);
+
+	r.stm = stm;
+	fz_try(ctx)
+	{
+		read_bytes(ctx, stm, magic, 4);
+		if (memcmp(magic, "MUDL", 4))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "not a serialized display list");
+		if (fz_read_uint32_le(ctx, stm) != DL_VERSION)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "unsupported display list version");
+		list = fz_new_display_list(ctx, read_rect(ctx, stm));
+		dev = fz_new_list_device(ctx, list);
+		load_list_commands(ctx, &r, dev);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		for (i = 0; i < r.len; i++)
+			drop_resource(ctx, &r.res[i]);
+		fz_free(ctx, r.res);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	return list;
+}
@@ -41,12 +41,38 @@
  * except the _no_throw family which instead silently returns NULL.
  */
 
+static void *fz_malloc_default(void *opaque, size_t size);
+static void *fz_realloc_default(void *opaque, void *old, size_t size);
+static void fz_free_default(void *opaque, void *ptr);
+
+/*
+ * FZ_LOCK_ALLOC serialises calls into the allocator, but it also guards
+ * the store and every reference count, so holding it across each malloc
+ * and free makes it the most contended lock when many threads render at
+ * once. The default allocator is the (thread-safe) C library one, so we
+ * call it without the lock, and only take the lock when we need to
+ * scavenge memory from the store. Client supplied allocators (and Memento
+ * builds) keep being called with the lock held.
+ */
+#ifdef MEMENTO
+#define allocator_is_threadsafe(ctx) 0
+#else
+#define allocator_is_threadsafe(ctx) ((ctx)->alloc.malloc == fz_malloc_default && (ctx)->alloc.realloc == fz_realloc_default && (ctx)->alloc.free == fz_free_default)
+#endif
+
 static void *
 do_scavenging_malloc(fz_context *ctx, size_t size)
 {
 	void *p;
 	int phase = 0;
 
+	if (allocator_is_threadsafe(ctx))
+	{
+		p = ctx->alloc.malloc(ctx->alloc.user, size);
+		if (p != NULL)
+			return p;
+	}
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		p = ctx->alloc.malloc(ctx->alloc.user, size);
@@ -67,6 +93,13 @@ do_scavenging_realloc(fz_context *ctx, void *p, size_t size)
 	void *q;
 	int phase = 0;
 
+	if (allocator_is_threadsafe(ctx))
+	{
+		q = ctx->alloc.realloc(ctx->alloc.user, p, size);
+		if (q != NULL)
+			return q;
+	}
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		q = ctx->alloc.realloc(ctx->alloc.user, p, size);
@@ -169,6 +202,11 @@ fz_free(fz_context *ctx, void *p)
 {
 	if (p)
 	{
+		if (allocator_is_threadsafe(ctx))
+		{
+			ctx->alloc.free(ctx->alloc.user, p);
+			return;
+		}
 		fz_lock(ctx, FZ_LOCK_ALLOC);
 		ctx->alloc.free(ctx->alloc.user, p);
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
@@ -0,0 +1,456 @@
+// Copyright (C) 2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+	Compact structured text.
+
+	All blocks, lines and chars of a page are held in three arrays. The
+	lines of a block and the chars of a line are contiguous ranges in
+	these arrays. Fonts are held once in a table, and chars refer to them
+	by index.
+
+	The quads of the chars are held in a separate array, either as full
+	fz_quads, or quantized as half precision floats relative to the char
+	origin. Quads that cannot be quantized (because they are too large)
+	are held in full in an overflow array.
+*/
+
+enum
+{
+	CHAR_EXACT_QUAD = 1
+};
+
+typedef struct
+{
+	int c;
+	int color;
+	float size;
+	fz_point origin;
+	unsigned short font;
+	unsigned char bidi;
+	unsigned char flags;
+} compact_char;
+
+typedef struct
+{
+	int wmode;
+	fz_point dir;
+	fz_rect bbox;
+	int first_char, len;
+} compact_line;
+
+typedef struct
+{
+	int type;
+	fz_rect bbox;
+	int first_line, len;
+	fz_matrix transform;
+	fz_image *image;
+} compact_block;
+
+struct fz_compact_stext_page
+{
+	int refs;
+	int flags;
+	fz_rect mediabox;
+	int block_len, line_len, char_len, font_len, exact_len;
+	compact_block *blocks;
+	compact_line *lines;
+	compact_char *chars;
+	fz_quad *quads; /* when not quantized */
+	unsigned short *half_quads; /* when quantized, 8 per char */
+	fz_quad *exact_quads; /* when quantized, for chars flagged CHAR_EXACT_QUAD */
+	fz_font **fonts;
+};
+
+/* IEEE 754 half precision floats, rounding to nearest even. */
+
+typedef union
+{
+	float f;
+	uint32_t u;
+} float_bits;
+
+static unsigned short
+float_to_half(float f)
+{
+	float_bits x;
+	uint32_t sign, mant, h, rem, halfway;
+	int e, shift;
+
+	x.f = f;
+	sign = (x.u >> 16) & 0x8000;
+	e = (int)((x.u >> 23) & 0xff) - 127 + 15;
+	mant = x.u & 0x7fffff;
+
+	if (e >= 31)
+		return sign | 0x7c00;
+	if (e <= 0)
+	{
+		/* subnormal or zero */
+		if (e < -10)
+			return sign;
+		mant |= 0x800000;
+		shift = 14 - e;
+		h = mant >> shift;
+		rem = mant & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	h = ((uint32_t)e << 10) | (mant >> 13);
+	rem = mant & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++; /* may carry into the exponent, which is correct */
+	return sign | h;
+}
+
+static float
+half_to_float(unsigned short h)
+{
+	float_bits x;
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t e = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+
+	if (e == 0)
+	{
+		float f = ldexpf((float)mant, -24);
+		return sign ? -f : f;
+	}
+	if (e == 31)
+		x.u = sign | 0x7f800000 | (mant << 13);
+	else
+		x.u = sign | ((e + 112) << 23) | (mant << 13);
+	return x.f;
+}
+
+/* Quantize the 4 corners of a quad relative to the origin. Returns 0 if
+ * the offsets are out of range. */
+static int
+quantize_quad(unsigned short *h, fz_quad q, fz_point o)
+{
+	float v[8];
+	int i;
+
+	v[0] = q.ul.x - o.x; v[1] = q.ul.y - o.y;
+	v[2] = q.ur.x - o.x; v[3] = q.ur.y - o.y;
+	v[4] = q.ll.x - o.x; v[5] = q.ll.y - o.y;
+	v[6] = q.lr.x - o.x; v[7] = q.lr.y - o.y;
+	for (i = 0; i < 8; i++)
+	{
+		if (!(fabsf(v[i]) <= 65504))
+			return 0;
+		h[i] = float_to_half(v[i]);
+	}
+	return 1;
+}
+
+static fz_quad
+unquantize_quad(const unsigned short *h, fz_point o)
+{
+	fz_quad q;
+	q.ul = fz_make_point(o.x + half_to_float(h[0]), o.y + half_to_float(h[1]));
+	q.ur = fz_make_point(o.x + half_to_float(h[2]), o.y + half_to_float(h[3]));
+	q.ll = fz_make_point(o.x + half_to_float(h[4]), o.y + half_to_float(h[5]));
+	q.lr = fz_make_point(o.x + half_to_float(h[6]), o.y + half_to_float(h[7]));
+	return q;
+}
+
+static int
+intern_font(fz_context *ctx, fz_compact_stext_page *cpage, fz_font *font, int *font_max)
+{
+	int i;
+
+	/* Search backwards; the most recent font is the most likely one. */
+	for (i = cpage->font_len - 1; i >= 0; i--)
+		if (cpage->fonts[i] == font)
+			return i;
+
+	if (cpage->font_len == 65536)
+		fz_throw(ctx, FZ_ERROR_LIMIT, "too many fonts in compact text page");
+	if (cpage->font_len == *font_max)
+	{
+		int new_max = *font_max ? *font_max * 2 : 16;
+		cpage->fonts = fz_realloc_array(ctx, cpage->fonts, new_max, fz_font *);
+		*font_max = new_max;
+	}
+	cpage->fonts[cpage->font_len] = fz_keep_font(ctx, font);
+	return cpage->font_len++;
+}
+
+fz_compact_stext_page *
+fz_new_compact_stext_page(fz_context *ctx, fz_stext_page *page, int flags)
+{
+	fz_compact_stext_page *cpage;
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	int font_max = 0;
+	int exact_max = 0;
+
+	cpage = fz_malloc_struct(ctx, fz_compact_stext_page);
+	cpage->refs = 1;
+	cpage->flags = flags;
+	cpage->mediabox = page->mediabox;
+
+	fz_try(ctx)
+	{
+		int b = 0, l = 0, n = 0;
+
+		for (block = page->first_block; block; block = block->next)
+		{
+			cpage->block_len++;
+			if (block->type == FZ_STEXT_BLOCK_TEXT)
+				for (line = block->u.t.first_line; line; line = line->next)
+				{
+					cpage->line_len++;
+					for (ch = line->first_char; ch; ch = ch->next)
+						cpage->char_len++;
+				}
+		}
+
+		/* Zeroed, so that a partially filled array can be dropped. */
+		cpage->blocks = fz_calloc(ctx, cpage->block_len, sizeof *cpage->blocks);
+		cpage->lines = fz_malloc_array(ctx, cpage->line_len, compact_line);
+		cpage->chars = fz_malloc_array(ctx, cpage->char_len, compact_char);
+		if (flags & FZ_COMPACT_STEXT_QUANTIZE)
+			cpage->half_quads = fz_malloc_array(ctx, cpage->char_len * (size_t)8, unsigned short);
+		else
+			cpage->quads = fz_malloc_array(ctx, cpage->char_len, fz_quad);
+
+		for (block = page->first_block; block; block = block->next)
+		{
+			compact_block *cb = &cpage->blocks[b++];
+			cb->type = block->type;
+			cb->bbox = block->bbox;
+			cb->first_line = l;
+			if (block->type == FZ_STEXT_BLOCK_IMAGE)
+			{
+				cb->transform = block->u.i.transform;
+				cb->image = fz_keep_image(ctx, block->u.i.image);
+				continue;
+			}
+			if (block->type != FZ_STEXT_BLOCK_TEXT)
+				continue;
+			for (line = block->u.t.first_line; line; line = line->next)
+			{
+				compact_line *cl = &cpage->lines[l++];
+				cl->wmode = line->wmode;
+				cl->dir = line->dir;
+				cl->bbox = line->bbox;
+				cl->first_char = n;
+				for (ch = line->first_char; ch; ch = ch->next)
+				{
+					compact_char *cc = &cpage->chars[n];
+					cc->c = ch->c;
+					cc->color = ch->color;
+					cc->size = ch->size;
+					cc->origin = ch->origin;
+					cc->bidi = (unsigned char)ch->bidi;
+					cc->flags = 0;
+					cc->font = (unsigned short)intern_font(ctx, cpage, ch->font, &font_max);
+					if (!(flags & FZ_COMPACT_STEXT_QUANTIZE))
+						cpage->quads[n] = ch->quad;
+					else if (!quantize_quad(&cpage->half_quads[n * (size_t)8], ch->quad, ch->origin))
+					{
+						/* Too large for half floats: keep the index of
+						 * the exact quad in place of the offsets. */
+						unsigned int idx = cpage->exact_len;
+						if (cpage->exact_len == exact_max)
+						{
+							exact_max = exact_max ? exact_max * 2 : 16;
+							cpage->exact_quads = fz_realloc_array(ctx, cpage->exact_quads, exact_max, fz_quad);
+						}
+						cpage->exact_quads[cpage->exact_len++] = ch->quad;
+						memcpy(&cpage->half_quads[n * (size_t)8], &idx, sizeof idx);
+						cc->flags |= CHAR_EXACT_QUAD;
+					}
+					n++;
+				}
+				cl->len = n - cl->first_char;
+			}
+			cb->len = l - cb->first_line;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_compact_stext_page(ctx, cpage);
+		fz_rethrow(ctx);
+	}
+
+	return cpage;
+}
+
+fz_compact_stext_page *
+fz_keep_compact_stext_page(fz_context *ctx, fz_compact_stext_page *cpage)
+{
+	return fz_keep_imp(ctx, cpage, &cpage->refs);
+}
+
+void
+fz_drop_compact_stext_page(fz_context *ctx, fz_compact_stext_page *cpage)
+{
+	int i;
+
+	if (!fz_drop_imp(ctx, cpage, &cpage->refs))
+		return;
+
+	if (cpage->blocks)
+		for (i = 0; i < cpage->block_len; i++)
+			if (cpage->blocks[i].type == FZ_STEXT_BLOCK_IMAGE)
+				fz_drop_image(ctx, cpage->blocks[i].image);
+	for (i = 0; i < cpage->font_len; i++)
+		fz_drop_font(ctx, cpage->fonts[i]);
+	fz_free(ctx, cpage->fonts);
+	fz_free(ctx, cpage->blocks);
+	fz_free(ctx, cpage->lines);
+	fz_free(ctx, cpage->chars);
+	fz_free(ctx, cpage->quads);
+	fz_free(ctx, cpage->half_quads);
+	fz_free(ctx, cpage->exact_quads);
+	fz_free(ctx, cpage);
+}
+
+size_t
+fz_compact_stext_page_size(fz_context *ctx, fz_compact_stext_page *cpage)
+{
+	size_t size = sizeof *cpage;
+	size += cpage->block_len * sizeof *cpage->blocks;
+	size += cpage->line_len * sizeof *cpage->lines;
+	size += cpage->char_len * sizeof *cpage->chars;
+	size += cpage->font_len * sizeof *cpage->fonts;
+	if (!(cpage->flags & FZ_COMPACT_STEXT_QUANTIZE))
+		size += cpage->char_len * sizeof *cpage->quads;
+	else
+		size += cpage->char_len * 8 * sizeof *cpage->half_quads + cpage->exact_len * sizeof *cpage->exact_quads;
+	return size;
+}
+
+static fz_quad
+compact_char_quad(fz_compact_stext_page *cpage, int i)
+{
+	unsigned int idx;
+
+	if (!(cpage->flags & FZ_COMPACT_STEXT_QUANTIZE))
+		return cpage->quads[i];
+	if (cpage->chars[i].flags & CHAR_EXACT_QUAD)
+	{
+		memcpy(&idx, &cpage->half_quads[i * (size_t)8], sizeof idx);
+		return cpage->exact_quads[idx];
+	}
+	return unquantize_quad(&cpage->half_quads[i * (size_t)8], cpage->chars[i].origin);
+}
+
+fz_stext_page *
+fz_new_stext_page_from_compact(fz_context *ctx, fz_compact_stext_page *cpage)
+{
+	fz_stext_page *page = fz_new_stext_page(ctx, cpage->mediabox);
+	int b, l, n;
+
+	fz_try(ctx)
+	{
+		for (b = 0; b < cpage->block_len; b++)
+		{
+			compact_block *cb = &cpage->blocks[b];
+			fz_stext_block *block;
+
+			if (cb->type != FZ_STEXT_BLOCK_TEXT && cb->type != FZ_STEXT_BLOCK_IMAGE)
+				continue;
+
+			block = fz_pool_alloc(ctx, page->pool, sizeof *block);
+			block->type = cb->type;
+			block->bbox = cb->bbox;
+			block->prev = page->last_block;
+			if (page->last_block)
+				page->last_block->next = block;
+			else
+				page->first_block = block;
+			page->last_block = block;
+			if (cb->type == FZ_STEXT_BLOCK_IMAGE)
+			{
+				block->u.i.transform = cb->transform;
+				block->u.i.image = fz_keep_image(ctx, cb->image);
+			}
+			else
+			{
+				for (l = cb->first_line; l < cb->first_line + cb->len; l++)
+				{
+					compact_line *cl = &cpage->lines[l];
+					fz_stext_line *line = fz_pool_alloc(ctx, page->pool, sizeof *line);
+					fz_stext_char *chars = NULL;
+
+					line->wmode = cl->wmode;
+					line->dir = cl->dir;
+					line->bbox = cl->bbox;
+
+					/* Link the line and each char as soon as it exists,
+					 * so that fz_drop_stext_page finds every font we have
+					 * kept if anything throws. */
+					line->prev = block->u.t.last_line;
+					if (block->u.t.last_line)
+						block->u.t.last_line->next = line;
+					else
+						block->u.t.first_line = line;
+					block->u.t.last_line = line;
+
+					/* The chars of a line are allocated as one array,
+					 * so that following the next pointers walks
+					 * through memory in order. */
+					if (cl->len > 0)
+						chars = fz_pool_alloc(ctx, page->pool, cl->len * sizeof *chars);
+					for (n = 0; n < cl->len; n++)
+					{
+						compact_char *cc = &cpage->chars[cl->first_char + n];
+						fz_stext_char *ch = &chars[n];
+						ch->c = cc->c;
+						ch->bidi = cc->bidi;
+						ch->color = cc->color;
+						ch->origin = cc->origin;
+						ch->quad = compact_char_quad(cpage, cl->first_char + n);
+						ch->size = cc->size;
+						ch->font = fz_keep_font(ctx, cpage->fonts[cc->font]);
+						ch->next = NULL;
+						if (line->last_char)
+							line->last_char->next = ch;
+						else
+							line->first_char = ch;
+						line->last_char = ch;
+					}
+				}
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stext_page(ctx, page);
+		fz_rethrow(ctx);
+	}
+
+	return page;
+}
@@ -125,6 +125,18 @@ typedef struct
 	const fz_text *lasttext;
 	fz_stext_options opts;
 
+	/* When streaming, finished lines are passed to line_fn, and the
+	 * page is emptied once it has grown large enough. line_block is
+	 * the number of the first block on the page. flush_line is the
+	 * last line passed on, in block flush_block (number flush_n on
+	 * the page). */
+	fz_stext_line_fn *line_fn;
+	void *line_arg;
+	int line_block;
+	fz_stext_block *flush_block;
+	fz_stext_line *flush_line;
+	int flush_n;
+
 	metatext_t *metatext;
 
 	/* Store the last values we saw. We need this for flushing the actualtext. */
@@ -390,6 +402,87 @@ static void reverse_bidi_line(fz_stext_line *line)
 	}
 }
 
+/* Set the bbox of a finished line, and put visually ordered text into logical order. */
+static void
+finish_line(fz_stext_line *line)
+{
+	fz_stext_char *ch;
+	int reorder = 0;
+
+	for (ch = line->first_char; ch; ch = ch->next)
+	{
+		fz_rect ch_box = fz_rect_from_quad(ch->quad);
+		if (ch == line->first_char)
+			line->bbox = ch_box;
+		else
+			line->bbox = fz_union_rect(line->bbox, ch_box);
+		if (ch->bidi == 3)
+			reorder = 1;
+	}
+	if (reorder)
+		reverse_bidi_line(line);
+}
+
+/* Amount of memory a streaming device may collect before it frees it. */
+#define STREAM_POOL_MAX (64<<10)
+
+/* Pass the lines of a streaming device's page that have not been
+ * passed on yet to the callback. If keep_last is set, the last block
+ * is still being added to; otherwise the device is done. Once the
+ * page is large enough (or at the end) it is replaced by an empty one,
+ * which starts with an (empty) text block continuing the last block
+ * if needed. */
+static void
+flush_stext_stream(fz_context *ctx, fz_stext_device *dev, int keep_last)
+{
+	fz_stext_page *page = dev->page;
+	fz_stext_page *fresh;
+	fz_stext_block *block = dev->flush_block;
+	fz_stext_line *line = dev->flush_line;
+	int n = dev->flush_n;
+
+	if (block == NULL)
+	{
+		block = page->first_block;
+		n = 0;
+	}
+	for (; block; block = block->next, n++)
+	{
+		if (block->type != FZ_STEXT_BLOCK_TEXT)
+			continue;
+		for (line = line ? line->next : block->u.t.first_line; line; line = line->next)
+		{
+			finish_line(line);
+			dev->line_fn(ctx, dev->line_arg, dev->line_block + n, line);
+			dev->flush_block = block;
+			dev->flush_line = line;
+			dev->flush_n = n;
+		}
+	}
+
+	if (keep_last && fz_pool_size(ctx, page->pool) < STREAM_POOL_MAX)
+		return;
+
+	fresh = fz_new_stext_page(ctx, page->mediabox);
+	if (keep_last && n > 0)
+	{
+		fz_try(ctx)
+			add_text_block_to_page(ctx, fresh);
+		fz_catch(ctx)
+		{
+			fz_drop_stext_page(ctx, fresh);
+			fz_rethrow(ctx);
+		}
+		n--;
+	}
+	dev->page = fresh;
+	dev->line_block += n;
+	dev->flush_block = NULL;
+	dev->flush_line = NULL;
+	dev->flush_n = 0;
+	fz_drop_stext_page(ctx, page);
+}
+
 static int is_hyphen(int c)
 {
 	/* check for: hyphen-minus, soft hyphen, hyphen, and non-breaking hyphen */
@@ -635,6 +728,13 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int
 	/* Start a new line */
 	if (new_line || !cur_line || force_new_line)
 	{
+		/* All lines so far are finished, so hand them out. */
+		if (dev->line_fn)
+		{
+			flush_stext_stream(ctx, dev, 1);
+			page = dev->page;
+			cur_block = page->last_block;
+		}
 		cur_line = add_line_to_block(ctx, page, cur_block, &ndir, wmode, bidi);
 		dev->start = p;
 	}
@@ -1270,7 +1370,12 @@ fz_stext_close_device(fz_context *ctx, fz_device *dev)
 	fz_stext_page *page = tdev->page;
 	fz_stext_block *block;
 	fz_stext_line *line;
-	fz_stext_char *ch;
+
+	if (tdev->line_fn)
+	{
+		flush_stext_stream(ctx, tdev, 0);
+		return;
+	}
 
 	for (block = page->first_block; block; block = block->next)
 	{
@@ -1278,20 +1383,8 @@ fz_stext_close_device(fz_context *ctx, fz_device *dev)
 			continue;
 		for (line = block->u.t.first_line; line; line = line->next)
 		{
-			int reorder = 0;
-			for (ch = line->first_char; ch; ch = ch->next)
-			{
-				fz_rect ch_box = fz_rect_from_quad(ch->quad);
-				if (ch == line->first_char)
-					line->bbox = ch_box;
-				else
-					line->bbox = fz_union_rect(line->bbox, ch_box);
-				if (ch->bidi == 3)
-					reorder = 1;
-			}
+			finish_line(line);
 			block->bbox = fz_union_rect(block->bbox, line->bbox);
-			if (reorder)
-				reverse_bidi_line(line);
 		}
 	}
 
@@ -1307,6 +1400,8 @@ fz_stext_drop_device(fz_context *ctx, fz_device *dev)
 	fz_drop_font(ctx, tdev->last.font);
 	while (tdev->metatext)
 		pop_metatext(ctx, tdev);
+	if (tdev->line_fn)
+		fz_drop_stext_page(ctx, tdev->page);
 }
 
 fz_stext_options *
@@ -1399,3 +1494,24 @@ fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options
 
 	return (fz_device*)dev;
 }
+
+fz_device *
+fz_new_stext_stream_device(fz_context *ctx, fz_rect mediabox, const fz_stext_options *opts, fz_stext_line_fn *fn, void *arg)
+{
+	fz_stext_page *page = fz_new_stext_page(ctx, mediabox);
+	fz_stext_device *dev = NULL;
+
+	fz_try(ctx)
+		dev = (fz_stext_device *)fz_new_stext_device(ctx, page, opts);
+	fz_catch(ctx)
+	{
+		fz_drop_stext_page(ctx, page);
+		fz_rethrow(ctx);
+	}
+
+	/* The device owns the page from now on. */
+	dev->line_fn = fn;
+	dev->line_arg = arg;
+
+	return (fz_device*)dev;
+}
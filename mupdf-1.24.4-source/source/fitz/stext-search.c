@@ -683,3 +683,469 @@ no_more_matches:;
 
 	return hits.len;
 }
+
+/* Multiple needle search.
+ *
+ * The needles are compiled into an Aho-Corasick automaton over canonical
+ * characters (see canon above, with runs of spaces collapsed into one), so
+ * that the page text is scanned once however many needles there are. Each
+ * needle finds the same non-overlapping matches as fz_search_stext_page
+ * would find for it alone.
+ */
+
+typedef struct
+{
+	int fail; /* node for the longest proper suffix in the trie */
+	int dict; /* nearest node on the fail chain where a needle ends */
+	int out; /* first needle ending at this node, or -1 */
+	int child, sibling; /* for the breadth first walk */
+	int c;
+} needle_node;
+
+typedef struct
+{
+	int node, c, child;
+} needle_edge;
+
+struct fz_search_needles
+{
+	int refs;
+	int count;
+	int *len; /* length of each needle in canonical characters */
+	int *next_out; /* next needle ending at the same node, or -1 */
+	int max_len;
+	int node_len, node_max;
+	needle_node *node;
+	int edge_len, edge_max; /* open addressing; edge_max is a power of 2 */
+	needle_edge *edge;
+};
+
+static inline unsigned int
+needle_edge_hash(int node, int c)
+{
+	return (unsigned int)node * 0x9E3779B1u ^ (unsigned int)c * 0x85EBCA77u;
+}
+
+/* Returns 0 if there is no edge; the root is never a child. */
+static int
+find_needle_edge(fz_search_needles *nd, int node, int c)
+{
+	unsigned int mask = nd->edge_max - 1;
+	unsigned int h = needle_edge_hash(node, c) & mask;
+	while (nd->edge[h].node >= 0)
+	{
+		if (nd->edge[h].node == node && nd->edge[h].c == c)
+			return nd->edge[h].child;
+		h = (h + 1) & mask;
+	}
+	return 0;
+}
+
+static void
+insert_needle_edge(needle_edge *edge, int edge_max, int node, int c, int child)
+{
+	unsigned int mask = edge_max - 1;
+	unsigned int h = needle_edge_hash(node, c) & mask;
+	while (edge[h].node >= 0)
+		h = (h + 1) & mask;
+	edge[h].node = node;
+	edge[h].c = c;
+	edge[h].child = child;
+}
+
+static int
+add_needle_node(fz_context *ctx, fz_search_needles *nd, int parent, int c)
+{
+	needle_node *node;
+	int i, id;
+
+	if (nd->node_len == nd->node_max)
+	{
+		int max = nd->node_max * 2;
+		nd->node = fz_realloc_array(ctx, nd->node, max, needle_node);
+		nd->node_max = max;
+	}
+	if ((nd->edge_len + 1) * 2 > nd->edge_max)
+	{
+		int max = nd->edge_max * 2;
+		needle_edge *edge = fz_malloc_array(ctx, max, needle_edge);
+		for (i = 0; i < max; i++)
+			edge[i].node = -1;
+		for (i = 0; i < nd->edge_max; i++)
+			if (nd->edge[i].node >= 0)
+				insert_needle_edge(edge, max, nd->edge[i].node, nd->edge[i].c, nd->edge[i].child);
+		fz_free(ctx, nd->edge);
+		nd->edge = edge;
+		nd->edge_max = max;
+	}
+
+	id = nd->node_len++;
+	node = &nd->node[id];
+	node->fail = 0;
+	node->dict = 0;
+	node->out = -1;
+	node->child = 0;
+	node->c = c;
+	node->sibling = nd->node[parent].child;
+	nd->node[parent].child = id;
+	insert_needle_edge(nd->edge, nd->edge_max, parent, c, id);
+	nd->edge_len++;
+	return id;
+}
+
+static void
+build_needle_links(fz_context *ctx, fz_search_needles *nd)
+{
+	int *queue = fz_malloc_array(ctx, nd->node_len, int);
+	int head = 0, tail = 0;
+	int u, v, f, w;
+
+	for (v = nd->node[0].child; v; v = nd->node[v].sibling)
+		queue[tail++] = v;
+	while (head < tail)
+	{
+		u = queue[head++];
+		for (v = nd->node[u].child; v; v = nd->node[v].sibling)
+		{
+			f = nd->node[u].fail;
+			while (f && !find_needle_edge(nd, f, nd->node[v].c))
+				f = nd->node[f].fail;
+			w = find_needle_edge(nd, f, nd->node[v].c);
+			nd->node[v].fail = w;
+			nd->node[v].dict = nd->node[w].out >= 0 ? w : nd->node[w].dict;
+			queue[tail++] = v;
+		}
+	}
+	fz_free(ctx, queue);
+}
+
+fz_search_needles *
+fz_new_search_needles(fz_context *ctx, int n, const char * const *needles)
+{
+	fz_search_needles *nd = fz_malloc_struct(ctx, fz_search_needles);
+	int i, c, prev, state, child, len;
+	const char *s;
+
+	nd->refs = 1;
+	nd->count = n;
+	fz_try(ctx)
+	{
+		nd->len = fz_malloc_array(ctx, n, int);
+		nd->next_out = fz_malloc_array(ctx, n, int);
+		nd->node_max = 256;
+		nd->node = fz_malloc_array(ctx, nd->node_max, needle_node);
+		nd->edge_max = 512;
+		nd->edge = fz_malloc_array(ctx, nd->edge_max, needle_edge);
+		for (i = 0; i < nd->edge_max; i++)
+			nd->edge[i].node = -1;
+		memset(&nd->node[0], 0, sizeof(needle_node));
+		nd->node[0].out = -1;
+		nd->node_len = 1;
+
+		for (i = 0; i < n; i++)
+		{
+			state = 0;
+			len = 0;
+			prev = 0;
+			for (s = needles[i] ? needles[i] : ""; *s; prev = c)
+			{
+				s += chartocanon(&c, s);
+				if (c == ' ' && prev == ' ')
+					continue;
+				child = find_needle_edge(nd, state, c);
+				if (!child)
+					child = add_needle_node(ctx, nd, state, c);
+				state = child;
+				len++;
+			}
+			nd->len[i] = len;
+			nd->next_out[i] = -1;
+			/* Like fz_search_stext_page, empty needles never match. */
+			if (len == 0)
+				continue;
+			nd->next_out[i] = nd->node[state].out;
+			nd->node[state].out = i;
+			if (len > nd->max_len)
+				nd->max_len = len;
+		}
+
+		build_needle_links(ctx, nd);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_search_needles(ctx, nd);
+		fz_rethrow(ctx);
+	}
+
+	return nd;
+}
+
+fz_search_needles *
+fz_keep_search_needles(fz_context *ctx, fz_search_needles *nd)
+{
+	return fz_keep_imp(ctx, nd, &nd->refs);
+}
+
+void
+fz_drop_search_needles(fz_context *ctx, fz_search_needles *nd)
+{
+	if (fz_drop_imp(ctx, nd, &nd->refs))
+	{
+		fz_free(ctx, nd->len);
+		fz_free(ctx, nd->next_out);
+		fz_free(ctx, nd->node);
+		fz_free(ctx, nd->edge);
+		fz_free(ctx, nd);
+	}
+}
+
+int
+fz_count_search_needles(fz_context *ctx, fz_search_needles *nd)
+{
+	return nd ? nd->count : 0;
+}
+
+static inline int
+next_needle_state(fz_search_needles *nd, int state, int c)
+{
+	int child;
+	for (;;)
+	{
+		child = find_needle_edge(nd, state, c);
+		if (child || state == 0)
+			return child;
+		state = nd->node[state].fail;
+	}
+}
+
+/* State shared by the page and string scanners. Symbol k (a canonical
+ * character fed to the automaton) is remembered in a ring of max_len
+ * entries, which is all a match can span. */
+typedef struct
+{
+	fz_search_needles *nd;
+	int state;
+	int prev;
+	int64_t k;
+	int64_t *last; /* last symbol of the previous match of each needle */
+	size_t *start; /* per symbol: where it starts */
+	size_t *end; /* per symbol: where it ends */
+} needle_scan;
+
+static void
+init_needle_scan(fz_context *ctx, needle_scan *scan, fz_search_needles *nd)
+{
+	int i;
+
+	scan->nd = nd;
+	scan->state = 0;
+	scan->prev = 0;
+	scan->k = 0;
+	scan->last = NULL;
+	scan->start = NULL;
+	scan->end = NULL;
+	fz_try(ctx)
+	{
+		scan->last = fz_malloc_array(ctx, nd->count, int64_t);
+		for (i = 0; i < nd->count; i++)
+			scan->last[i] = -1;
+		scan->start = fz_malloc_array(ctx, nd->max_len + 1, size_t);
+		scan->end = fz_malloc_array(ctx, nd->max_len + 1, size_t);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, scan->last);
+		fz_free(ctx, scan->start);
+		fz_rethrow(ctx);
+	}
+}
+
+static void
+drop_needle_scan(fz_context *ctx, needle_scan *scan)
+{
+	fz_free(ctx, scan->last);
+	fz_free(ctx, scan->start);
+	fz_free(ctx, scan->end);
+}
+
+typedef void (needle_match_fn)(fz_context *ctx, void *arg, int needle, size_t start, size_t end);
+
+/* Feed one canonical character covering [start,end). */
+static void
+feed_needle_scan(fz_context *ctx, needle_scan *scan, int c, size_t start, size_t end, needle_match_fn *fn, void *arg)
+{
+	fz_search_needles *nd = scan->nd;
+	int ring = nd->max_len + 1;
+	int64_t first;
+	int s, i;
+
+	if (c == ' ' && scan->prev == ' ')
+		return;
+	scan->prev = c;
+
+	scan->start[scan->k % ring] = start;
+	scan->end[scan->k % ring] = end;
+	scan->state = next_needle_state(nd, scan->state, c);
+
+	s = nd->node[scan->state].out >= 0 ? scan->state : nd->node[scan->state].dict;
+	for (; s; s = nd->node[s].dict)
+	{
+		for (i = nd->node[s].out; i >= 0; i = nd->next_out[i])
+		{
+			first = scan->k - nd->len[i] + 1;
+			if (first <= scan->last[i])
+				continue;
+			scan->last[i] = scan->k;
+			fn(ctx, arg, i, scan->start[first % ring], end);
+		}
+	}
+	scan->k++;
+}
+
+typedef struct
+{
+	fz_search_hit_char_fn *fn;
+	void *arg;
+	fz_stext_line **line;
+	fz_stext_char **ch;
+	int len, max;
+} page_needle_scan;
+
+static void
+on_page_needle_match(fz_context *ctx, void *arg, int needle, size_t start, size_t end)
+{
+	page_needle_scan *ps = arg;
+	size_t i;
+	for (i = start; i < end; i++)
+		ps->fn(ctx, ps->arg, needle, ps->line[i], ps->ch[i], i == start);
+}
+
+void
+fz_match_stext_page_needles(fz_context *ctx, fz_stext_page *page, fz_search_needles *nd, fz_rect area, fz_search_hit_char_fn *fn, void *arg)
+{
+	page_needle_scan ps = { 0 };
+	needle_scan scan;
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	int infinite = fz_is_infinite_rect(area);
+
+	if (!nd || nd->max_len == 0)
+		return;
+
+	init_needle_scan(ctx, &scan, nd);
+	ps.fn = fn;
+	ps.arg = arg;
+	fz_try(ctx)
+	{
+		for (block = page->first_block; block; block = block->next)
+		{
+			if (block->type != FZ_STEXT_BLOCK_TEXT)
+				continue;
+			for (line = block->u.t.first_line; line; line = line->next)
+			{
+				for (ch = line->first_char; ch; ch = ch->next)
+				{
+					if (!infinite && fz_is_empty_rect(fz_intersect_rect(fz_rect_from_quad(ch->quad), area)))
+						continue;
+					if (ps.len == ps.max)
+					{
+						int max = ps.max ? ps.max * 2 : 1024;
+						ps.line = fz_realloc_array(ctx, ps.line, max, fz_stext_line *);
+						ps.ch = fz_realloc_array(ctx, ps.ch, max, fz_stext_char *);
+						ps.max = max;
+					}
+					ps.line[ps.len] = line;
+					ps.ch[ps.len] = ch;
+					ps.len++;
+					feed_needle_scan(ctx, &scan, canon(ch->c), ps.len - 1, ps.len, on_page_needle_match, &ps);
+				}
+				/* Line breaks match spaces, but contain no characters. */
+				feed_needle_scan(ctx, &scan, ' ', ps.len, ps.len, on_page_needle_match, &ps);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		drop_needle_scan(ctx, &scan);
+		fz_free(ctx, ps.line);
+		fz_free(ctx, ps.ch);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+typedef struct
+{
+	fz_search_hit_string_fn *fn;
+	void *arg;
+} string_needle_scan;
+
+static void
+on_string_needle_match(fz_context *ctx, void *arg, int needle, size_t start, size_t end)
+{
+	string_needle_scan *ss = arg;
+	ss->fn(ctx, ss->arg, needle, start, end);
+}
+
+void
+fz_match_string_needles(fz_context *ctx, fz_search_needles *nd, const char *text, fz_search_hit_string_fn *fn, void *arg)
+{
+	string_needle_scan ss = { fn, arg };
+	needle_scan scan;
+	const char *s = text;
+	int c, n;
+
+	if (!nd || nd->max_len == 0)
+		return;
+
+	init_needle_scan(ctx, &scan, nd);
+	fz_try(ctx)
+	{
+		while (*s)
+		{
+			n = chartocanon(&c, s);
+			feed_needle_scan(ctx, &scan, c, s - text, s + n - text, on_string_needle_match, &ss);
+			s += n;
+		}
+	}
+	fz_always(ctx)
+		drop_needle_scan(ctx, &scan);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+struct needle_highlight
+{
+	struct highlight hits;
+	int *hit_needle;
+	int *hit_mark;
+};
+
+static void
+on_needle_hit_char(fz_context *ctx, void *arg, int needle, fz_stext_line *line, fz_stext_char *ch, int is_at_start)
+{
+	struct needle_highlight *nh = arg;
+	int len = nh->hits.len;
+	add_hit_char(ctx, &nh->hits, nh->hit_mark, line, ch, is_at_start);
+	if (nh->hit_needle && nh->hits.len > len)
+		nh->hit_needle[len] = needle;
+}
+
+int
+fz_search_stext_page_needles(fz_context *ctx, fz_stext_page *page, fz_search_needles *nd, int *hit_needle, int *hit_mark, fz_quad *quads, int max_quads)
+{
+	struct needle_highlight nh;
+
+	nh.hits.len = 0;
+	nh.hits.cap = max_quads;
+	nh.hits.box = quads;
+	nh.hits.hfuzz = 0.2f; /* merge kerns but not large gaps */
+	nh.hits.vfuzz = 0.1f;
+	nh.hit_needle = hit_needle;
+	nh.hit_mark = hit_mark;
+
+	fz_match_stext_page_needles(ctx, page, nd, fz_infinite_rect, on_needle_hit_char, &nh);
+
+	return nh.hits.len;
+}
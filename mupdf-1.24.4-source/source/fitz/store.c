@@ -59,6 +59,11 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* Lookup and eviction counts, for tuning the store size. */
+	size_t hits;
+	size_t misses;
+	size_t evictions;
 };
 
 void
@@ -82,6 +87,9 @@ fz_new_store_context(fz_context *ctx, size_t max)
 	store->max = max;
 	store->defer_reap_count = 0;
 	store->needs_reaping = 0;
+	store->hits = 0;
+	store->misses = 0;
+	store->evictions = 0;
 	ctx->store = store;
 }
 
@@ -279,6 +287,7 @@ evict(fz_context *ctx, fz_item *item)
 	int drop;
 
 	store->size -= item->size;
+	store->evictions++;
 	/* Unlink from the linked list */
 	if (item->next)
 		item->next->prev = item->prev;
@@ -350,6 +359,7 @@ ensure_space(fz_context *ctx, size_t tofree)
 			continue;
 
 		store->size -= item->size;
+		store->evictions++;
 
 		/* Unlink from the linked list */
 		if (item->next)
@@ -621,9 +631,11 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 			(void)Memento_takeRef(item->val);
 			item->val->refs++;
 		}
+		store->hits++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	store->misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -703,6 +715,28 @@ fz_empty_store(fz_context *ctx)
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
+void
+fz_store_stats(fz_context *ctx, size_t *hits, size_t *misses, size_t *evictions)
+{
+	fz_store *store = ctx->store;
+	size_t h = 0, m = 0, e = 0;
+
+	if (store)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		h = store->hits;
+		m = store->misses;
+		e = store->evictions;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
+	if (hits)
+		*hits = h;
+	if (misses)
+		*misses = m;
+	if (evictions)
+		*evictions = e;
+}
+
 fz_store *
 fz_keep_store_context(fz_context *ctx)
 {
@@ -31,6 +31,13 @@
 #include <errno.h>
 #include <stdio.h>
 
+#if !defined(_WIN32) && !defined(FZ_NO_MMAP) && (defined(__linux__) || defined(__APPLE__))
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 int
 fz_file_exists(fz_context *ctx, const char *path)
 {
@@ -153,6 +160,117 @@ static void drop_file(fz_context *ctx, void *state_)
 	fz_free(ctx, state);
 }
 
+/* Memory mapped file stream */
+
+/* The whole file is mapped, so the stream is set up like a memory stream
+ * (see fz_open_memory) and the mapping is all the state we need. */
+typedef struct
+{
+	void *data;
+	size_t len;
+} fz_mapped_file;
+
+static int next_buffer(fz_context *ctx, fz_stream *stm, size_t max);
+
+static int file_mapping =
+#ifdef HAVE_MMAP
+	1;
+#else
+	0;
+#endif
+
+void
+fz_set_file_mapping(fz_context *ctx, int enable)
+{
+#ifdef HAVE_MMAP
+	file_mapping = !!enable;
+#endif
+}
+
+int
+fz_file_mapping(fz_context *ctx)
+{
+	return file_mapping;
+}
+
+#ifdef HAVE_MMAP
+static void drop_mapped_file(fz_context *ctx, void *state_)
+{
+	fz_mapped_file *state = state_;
+	if (munmap(state->data, state->len) < 0)
+		fz_warn(ctx, "cannot unmap file: %s", strerror(errno));
+	fz_free(ctx, state);
+}
+
+/* Like seek_buffer, but mappings may be larger than an int, so offsets are
+ * kept 64 bit and clamped to the mapping. */
+static void seek_mapped_file(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	fz_mapped_file *state = stm->state;
+	unsigned char *data = state->data;
+
+	if (whence == 1)
+		offset += (int64_t)(stm->rp - data);
+	else if (whence == 2)
+		offset += (int64_t)state->len;
+
+	if (offset < 0)
+		offset = 0;
+	if ((uint64_t)offset > state->len)
+		offset = (int64_t)state->len;
+	stm->rp = data + (size_t)offset;
+}
+
+/* Map the open file, or return NULL (leaving file open) if we cannot. On
+ * success the file is closed, as the mapping does not need it. On
+ * exceptions the file is left open for the caller to close. */
+static fz_stream *
+fz_open_file_ptr_mapped(fz_context *ctx, FILE *file, int access)
+{
+	fz_mapped_file *state;
+	fz_stream *stm;
+	struct stat st;
+	void *data;
+
+	if (fstat(fileno(file), &st) < 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	/* Empty files cannot be mapped, nor files too big for our address space. */
+	if (st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX)
+		return NULL;
+
+	state = fz_malloc_struct(ctx, fz_mapped_file);
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (data == MAP_FAILED)
+	{
+		fz_free(ctx, state);
+		return NULL;
+	}
+	if (access == FZ_ACCESS_SEQUENTIAL)
+		(void)madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+	else if (access == FZ_ACCESS_RANDOM)
+		(void)madvise(data, (size_t)st.st_size, MADV_RANDOM);
+	state->data = data;
+	state->len = (size_t)st.st_size;
+
+	stm = fz_new_stream(ctx, state, next_buffer, drop_mapped_file);
+	stm->seek = seek_mapped_file;
+
+	stm->rp = data;
+	stm->wp = (unsigned char *)data + state->len;
+	stm->pos = (int64_t)state->len;
+
+	fclose(file);
+
+	return stm;
+}
+#else
+static fz_stream *
+fz_open_file_ptr_mapped(fz_context *ctx, FILE *file, int access)
+{
+	return NULL;
+}
+#endif
+
 static fz_stream *
 fz_open_file_ptr(fz_context *ctx, FILE *file)
 {
@@ -166,6 +284,30 @@ fz_open_file_ptr(fz_context *ctx, FILE *file)
 	return stm;
 }
 
+/* Open file as a mapped stream if file mapping is enabled and possible,
+ * otherwise as a buffered stream. */
+static fz_stream *
+fz_open_file_ptr_default(fz_context *ctx, FILE *file)
+{
+	fz_stream *stm = NULL;
+
+	fz_var(stm);
+
+	if (file_mapping)
+	{
+		fz_try(ctx)
+			stm = fz_open_file_ptr_mapped(ctx, file, FZ_ACCESS_NORMAL);
+		fz_catch(ctx)
+		{
+			fclose(file);
+			fz_rethrow(ctx);
+		}
+	}
+	if (stm)
+		return stm;
+	return fz_open_file_ptr(ctx, file);
+}
+
 fz_stream *fz_open_file_ptr_no_close(fz_context *ctx, FILE *file)
 {
 	fz_stream *stm;
@@ -190,7 +332,31 @@ fz_open_file(fz_context *ctx, const char *name)
 #endif
 	if (file == NULL)
 		fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot open %s: %s", name, strerror(errno));
-	return fz_open_file_ptr(ctx, file);
+	return fz_open_file_ptr_default(ctx, file);
+}
+
+fz_stream *
+fz_open_file_mapped(fz_context *ctx, const char *name, int access)
+{
+	fz_stream *stm = NULL;
+	FILE *file;
+#ifdef _WIN32
+	file = fz_fopen_utf8(name, "rb");
+#else
+	file = fopen(name, "rb");
+#endif
+	if (file == NULL)
+		fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot open %s: %s", name, strerror(errno));
+	fz_try(ctx)
+		stm = fz_open_file_ptr_mapped(ctx, file, access);
+	fz_catch(ctx)
+	{
+		fclose(file);
+		fz_rethrow(ctx);
+	}
+	if (!stm)
+		fclose(file);
+	return stm;
 }
 
 fz_stream *
@@ -204,7 +370,7 @@ fz_try_open_file(fz_context *ctx, const char *name)
 #endif
 	if (file == NULL)
 		return NULL;
-	return fz_open_file_ptr(ctx, file);
+	return fz_open_file_ptr_default(ctx, file);
 }
 
 #ifdef _WIN32
@@ -33,6 +33,8 @@ typedef struct
 	int num;
 	int gen;
 	float dpi;
+	fz_image *image; /* The original, while waiting to be recompressed. */
+	fz_image *newimg; /* The recompressed image, or NULL to keep the original. */
 } image_details;
 
 typedef struct
@@ -49,7 +51,7 @@ typedef struct
 	image_details *img;
 } unique_image_list;
 
-typedef struct
+typedef struct pdf_image_rewrite_jobs
 {
 	image_list list;
 	unique_image_list uilist;
@@ -116,6 +118,8 @@ gather_image_rewrite(fz_context *ctx, void *opaque, fz_image **image, fz_matrix
 		uilist->img[uilist->len].num = num;
 		uilist->img[uilist->len].gen = gen;
 		uilist->img[uilist->len].dpi = dpi;
+		uilist->img[uilist->len].image = NULL;
+		uilist->img[uilist->len].newimg = NULL;
 		uilist->len++;
 	}
 
@@ -423,9 +427,22 @@ resample(fz_context *ctx, fz_pixmap *src, int method, float from_dpi, float to_d
 		h2 = h3;
 	}
 
-	fz_subsample_pixmap(ctx, src, factor);
+	/* The pixmap may be the one cached for the image, and subsampling
+	 * works in place, so don't change it under the image's feet. */
+	if (src->storable.refs > 1)
+		src = fz_clone_pixmap(ctx, src);
+	else
+		src = fz_keep_pixmap(ctx, src);
+
+	fz_try(ctx)
+		fz_subsample_pixmap(ctx, src, factor);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, src);
+		fz_rethrow(ctx);
+	}
 
-	return fz_keep_pixmap(ctx, src);
+	return src;
 }
 
 static int
@@ -706,89 +723,83 @@ recompress_image(fz_context *ctx, fz_pixmap *pix, int type, int fmt, int method,
 	return fz_new_image_from_compressed_buffer(ctx, pix->w, pix->h, bpc, cs, pix->xres, pix->yres, interpolate, 0, NULL, NULL, cbuf, oldimg->mask);
 }
 
-static void
-do_image_rewrite(fz_context *ctx, void *opaque, fz_image **image, fz_matrix ctm, pdf_obj *im_obj)
+/* Decode, resample and recompress an image as the options say. Returns the
+ * new image, or NULL if the image should be left as it is. This uses no
+ * document state, so may be called from any thread. */
+static fz_image *
+rewrite_image(fz_context *ctx, pdf_image_rewriter_options *opts, fz_image *image, float dpi)
 {
-	image_info *info = (image_info *)opaque;
-	image_list *ilist = &info->list;
-	unique_image_list *uilist = &info->uilist;
-	float dpi;
 	fz_pixmap *pix;
 	fz_pixmap *newpix = NULL;
+	fz_image *newimg = NULL;
 	image_type type;
-	int fmt = fz_compressed_image_type(ctx, *image);
+	int fmt = fz_compressed_image_type(ctx, image);
 	int lossy = fmt_is_lossy(fmt);
 
 	/* FIXME: We don't recompress im_obj->mask! */
 
 	/* Can't recompress colorkeyed images, currently. */
-	if ((*image)->use_colorkey)
-		return;
+	if (image->use_colorkey)
+		return NULL;
 	/* Can't recompress scalable images. */
-	if ((*image)->scalable)
-		return;
+	if (image->scalable)
+		return NULL;
 
 	/* Can't rewrite separation ones, currently, as we can't pdf_add_image a separation image. */
-	if (fz_colorspace_is_indexed(ctx, (*image)->colorspace) &&
-		fz_colorspace_is_device_n(ctx, (*image)->colorspace->u.indexed.base))
-		return;
-	if (fz_colorspace_is_device_n(ctx, (*image)->colorspace))
-		return;
-
-	if (im_obj == NULL)
-		dpi = dpi_from_ctm(ctm, (*image)->w, (*image)->h);
-	else
-		dpi = uilist->img[ilist->uimg[info->which++]].dpi;
+	if (fz_colorspace_is_indexed(ctx, image->colorspace) &&
+		fz_colorspace_is_device_n(ctx, image->colorspace->u.indexed.base))
+		return NULL;
+	if (fz_colorspace_is_device_n(ctx, image->colorspace))
+		return NULL;
 
 	/* What sort of image is this? */
-	pix = fz_get_pixmap_from_image(ctx, *image, NULL, NULL, NULL, NULL);
+	pix = fz_get_pixmap_from_image(ctx, image, NULL, NULL, NULL, NULL);
 	type = classify_pixmap(ctx, pix);
 
 	fz_var(newpix);
+	fz_var(newimg);
 
 	fz_try(ctx)
 	{
-		fz_image *newimg = NULL;
-
 		if (type == IMAGE_BITONAL &&
-			info->opts->bitonal_image_recompress_method != FZ_RECOMPRESS_NEVER &&
-			info->opts->bitonal_image_subsample_threshold != 0 &&
-			dpi > info->opts->bitonal_image_subsample_threshold)
+			opts->bitonal_image_recompress_method != FZ_RECOMPRESS_NEVER &&
+			opts->bitonal_image_subsample_threshold != 0 &&
+			dpi > opts->bitonal_image_subsample_threshold)
 		{
 			/* Resample a bitonal image. */
-			newpix = resample(ctx, pix, info->opts->bitonal_image_subsample_method, dpi, info->opts->bitonal_image_subsample_to);
+			newpix = resample(ctx, pix, opts->bitonal_image_subsample_method, dpi, opts->bitonal_image_subsample_to);
 		}
 		else if (type == IMAGE_COLOR && lossy &&
-			info->opts->color_lossy_image_recompress_method != FZ_RECOMPRESS_NEVER &&
-			info->opts->color_lossy_image_subsample_threshold != 0 &&
-			dpi > info->opts->color_lossy_image_subsample_threshold)
+			opts->color_lossy_image_recompress_method != FZ_RECOMPRESS_NEVER &&
+			opts->color_lossy_image_subsample_threshold != 0 &&
+			dpi > opts->color_lossy_image_subsample_threshold)
 		{
 			/* Resample a lossily encoded color image. */
-			newpix = resample(ctx, pix, info->opts->color_lossy_image_subsample_method, dpi, info->opts->color_lossy_image_subsample_to);
+			newpix = resample(ctx, pix, opts->color_lossy_image_subsample_method, dpi, opts->color_lossy_image_subsample_to);
 		}
 		else if (type == IMAGE_COLOR && !lossy &&
-			info->opts->color_lossless_image_recompress_method != FZ_RECOMPRESS_NEVER &&
-			info->opts->color_lossless_image_subsample_threshold != 0 &&
-			dpi > info->opts->color_lossless_image_subsample_threshold)
+			opts->color_lossless_image_recompress_method != FZ_RECOMPRESS_NEVER &&
+			opts->color_lossless_image_subsample_threshold != 0 &&
+			dpi > opts->color_lossless_image_subsample_threshold)
 		{
 			/* Resample a losslessly color image. */
-			newpix = resample(ctx, pix, info->opts->color_lossless_image_subsample_method, dpi, info->opts->color_lossless_image_subsample_to);
+			newpix = resample(ctx, pix, opts->color_lossless_image_subsample_method, dpi, opts->color_lossless_image_subsample_to);
 		}
 		else if (type == IMAGE_GRAY && lossy &&
-			info->opts->gray_lossy_image_recompress_method != FZ_RECOMPRESS_NEVER &&
-			info->opts->gray_lossy_image_subsample_threshold != 0 &&
-			dpi > info->opts->gray_lossy_image_subsample_threshold)
+			opts->gray_lossy_image_recompress_method != FZ_RECOMPRESS_NEVER &&
+			opts->gray_lossy_image_subsample_threshold != 0 &&
+			dpi > opts->gray_lossy_image_subsample_threshold)
 		{
 			/* Resample a lossily encoded gray image. */
-			newpix = resample(ctx, pix, info->opts->gray_lossy_image_subsample_method, dpi, info->opts->gray_lossy_image_subsample_to);
+			newpix = resample(ctx, pix, opts->gray_lossy_image_subsample_method, dpi, opts->gray_lossy_image_subsample_to);
 		}
 		else if (type == IMAGE_GRAY && !lossy &&
-			info->opts->gray_lossless_image_recompress_method != FZ_RECOMPRESS_NEVER &&
-			info->opts->gray_lossless_image_subsample_threshold != 0 &&
-			dpi > info->opts->gray_lossless_image_subsample_threshold)
+			opts->gray_lossless_image_recompress_method != FZ_RECOMPRESS_NEVER &&
+			opts->gray_lossless_image_subsample_threshold != 0 &&
+			dpi > opts->gray_lossless_image_subsample_threshold)
 		{
 			/* Resample a losslessly encoded gray image. */
-			newpix = resample(ctx, pix, info->opts->gray_lossless_image_subsample_method, dpi, info->opts->gray_lossless_image_subsample_to);
+			newpix = resample(ctx, pix, opts->gray_lossless_image_subsample_method, dpi, opts->gray_lossless_image_subsample_to);
 		}
 
 		if (newpix)
@@ -797,52 +808,48 @@ do_image_rewrite(fz_context *ctx, void *opaque, fz_image **image, fz_matrix ctm,
 			if (type == IMAGE_COLOR)
 			{
 				if (lossy)
-					newimg = recompress_image(ctx, newpix, type, fmt, info->opts->color_lossy_image_recompress_method, info->opts->color_lossy_image_recompress_quality, *image);
+					newimg = recompress_image(ctx, newpix, type, fmt, opts->color_lossy_image_recompress_method, opts->color_lossy_image_recompress_quality, image);
 				else
-					newimg = recompress_image(ctx, newpix, type, fmt, info->opts->color_lossless_image_recompress_method, info->opts->color_lossless_image_recompress_quality, *image);
+					newimg = recompress_image(ctx, newpix, type, fmt, opts->color_lossless_image_recompress_method, opts->color_lossless_image_recompress_quality, image);
 			}
 			else if (type == IMAGE_GRAY)
 			{
 				if (lossy)
-					newimg = recompress_image(ctx, newpix, type, fmt, info->opts->gray_lossy_image_recompress_method, info->opts->gray_lossy_image_recompress_quality, *image);
+					newimg = recompress_image(ctx, newpix, type, fmt, opts->gray_lossy_image_recompress_method, opts->gray_lossy_image_recompress_quality, image);
 				else
-					newimg = recompress_image(ctx, newpix, type, fmt, info->opts->gray_lossless_image_recompress_method, info->opts->gray_lossless_image_recompress_quality, *image);
+					newimg = recompress_image(ctx, newpix, type, fmt, opts->gray_lossless_image_recompress_method, opts->gray_lossless_image_recompress_quality, image);
 			}
 			else if (type == IMAGE_BITONAL)
-				newimg = recompress_image(ctx, newpix, type, fmt, info->opts->bitonal_image_recompress_method, info->opts->bitonal_image_recompress_quality, *image);
+				newimg = recompress_image(ctx, newpix, type, fmt, opts->bitonal_image_recompress_method, opts->bitonal_image_recompress_quality, image);
 		}
 		else if (type == IMAGE_COLOR)
 		{
 			if (lossy)
-				newimg = recompress_image(ctx, pix, type, fmt, info->opts->color_lossy_image_recompress_method, info->opts->color_lossy_image_recompress_quality, *image);
+				newimg = recompress_image(ctx, pix, type, fmt, opts->color_lossy_image_recompress_method, opts->color_lossy_image_recompress_quality, image);
 			else
-				newimg = recompress_image(ctx, pix, type, fmt, info->opts->color_lossless_image_recompress_method, info->opts->color_lossless_image_recompress_quality, *image);
+				newimg = recompress_image(ctx, pix, type, fmt, opts->color_lossless_image_recompress_method, opts->color_lossless_image_recompress_quality, image);
 		}
 		else if (type == IMAGE_GRAY)
 		{
 			if (lossy)
-				newimg = recompress_image(ctx, pix, type, fmt, info->opts->gray_lossy_image_recompress_method, info->opts->gray_lossy_image_recompress_quality, *image);
+				newimg = recompress_image(ctx, pix, type, fmt, opts->gray_lossy_image_recompress_method, opts->gray_lossy_image_recompress_quality, image);
 			else
-				newimg = recompress_image(ctx, pix, type, fmt, info->opts->gray_lossless_image_recompress_method, info->opts->gray_lossless_image_recompress_quality, *image);
+				newimg = recompress_image(ctx, pix, type, fmt, opts->gray_lossless_image_recompress_method, opts->gray_lossless_image_recompress_quality, image);
 		}
 		else if (type == IMAGE_BITONAL)
 		{
-			newimg = recompress_image(ctx, pix, type, fmt, info->opts->bitonal_image_recompress_method, info->opts->bitonal_image_recompress_quality, *image);
+			newimg = recompress_image(ctx, pix, type, fmt, opts->bitonal_image_recompress_method, opts->bitonal_image_recompress_quality, image);
 		}
 
 		if (newimg)
 		{
-			size_t oldsize = fz_image_size(ctx, *image);
+			size_t oldsize = fz_image_size(ctx, image);
 			size_t newsize = fz_image_size(ctx, newimg);
 			if (oldsize <= newsize)
 			{
 				/* Old one was smaller! Don't mess with it. */
 				fz_drop_image(ctx, newimg);
-			}
-			else
-			{
-				fz_drop_image(ctx, *image);
-				*image = newimg;
+				newimg = NULL;
 			}
 		}
 	}
@@ -853,8 +860,52 @@ do_image_rewrite(fz_context *ctx, void *opaque, fz_image **image, fz_matrix ctm,
 	}
 	fz_catch(ctx)
 	{
+		fz_drop_image(ctx, newimg);
 		fz_rethrow(ctx);
 	}
+
+	return newimg;
+}
+
+static void
+do_image_rewrite(fz_context *ctx, void *opaque, fz_image **image, fz_matrix ctm, pdf_obj *im_obj)
+{
+	image_info *info = (image_info *)opaque;
+	image_list *ilist = &info->list;
+	unique_image_list *uilist = &info->uilist;
+	image_details *img;
+	fz_image *newimg;
+	int i;
+
+	/* Inline images weren't gathered, so are recompressed as we go. */
+	if (im_obj == NULL)
+	{
+		newimg = rewrite_image(ctx, info->opts, *image, dpi_from_ctm(ctm, (*image)->w, (*image)->h));
+		if (newimg)
+		{
+			fz_drop_image(ctx, *image);
+			*image = newimg;
+		}
+		return;
+	}
+
+	/* We see the images in the order they were gathered in. */
+	i = info->which < ilist->len ? ilist->uimg[info->which++] : uilist->len;
+	if (i >= uilist->len || uilist->img[i].num != pdf_to_num(ctx, im_obj) || uilist->img[i].gen != pdf_to_gen(ctx, im_obj))
+	{
+		for (i = 0; i < uilist->len; i++)
+			if (uilist->img[i].num == pdf_to_num(ctx, im_obj) && uilist->img[i].gen == pdf_to_gen(ctx, im_obj))
+				break;
+		if (i == uilist->len)
+			return;
+	}
+	img = &uilist->img[i];
+
+	if (img->newimg)
+	{
+		fz_drop_image(ctx, *image);
+		*image = fz_keep_image(ctx, img->newimg);
+	}
 }
 
 static void
@@ -920,13 +971,31 @@ rewrite_image_info(fz_context *ctx, pdf_document *doc, int page_num, image_info
 		fz_rethrow(ctx);
 }
 
-void pdf_rewrite_images(fz_context *ctx, pdf_document *doc, pdf_image_rewriter_options *opts)
+void
+pdf_drop_image_rewrite_jobs(fz_context *ctx, pdf_image_rewrite_jobs *jobs)
 {
 	int i;
-	int n = pdf_count_pages(ctx, doc);
-	image_info info = { 0 };
 
-	info.opts = opts;
+	if (!jobs)
+		return;
+	for (i = 0; i < jobs->uilist.len; i++)
+	{
+		fz_drop_image(ctx, jobs->uilist.img[i].image);
+		fz_drop_image(ctx, jobs->uilist.img[i].newimg);
+	}
+	fz_free(ctx, jobs->list.uimg);
+	fz_free(ctx, jobs->uilist.img);
+	fz_free(ctx, jobs);
+}
+
+pdf_image_rewrite_jobs *
+pdf_new_image_rewrite_jobs(fz_context *ctx, pdf_document *doc, pdf_image_rewriter_options *opts)
+{
+	pdf_image_rewrite_jobs *jobs;
+	int i, n;
+
+	jobs = fz_malloc_struct(ctx, pdf_image_rewrite_jobs);
+	jobs->opts = opts;
 
 	/* If nothing to do, do nothing! */
 	if (opts->bitonal_image_subsample_threshold == 0 &&
@@ -934,20 +1003,108 @@ void pdf_rewrite_images(fz_context *ctx, pdf_document *doc, pdf_image_rewriter_o
 		opts->gray_lossy_image_subsample_threshold == 0 &&
 		opts->color_lossless_image_subsample_threshold == 0 &&
 		opts->color_lossy_image_subsample_threshold == 0)
-		return;
+		return jobs;
 
 	/* Pass 1: Gather information */
-	for (i = 0; i < n; i++)
+	fz_try(ctx)
 	{
-		gather_image_info(ctx, doc, i, &info);
+		n = pdf_count_pages(ctx, doc);
+		for (i = 0; i < n; i++)
+			gather_image_info(ctx, doc, i, jobs);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_image_rewrite_jobs(ctx, jobs);
+		fz_rethrow(ctx);
 	}
 
-	/* Pass 2: Resample as required */
-	for (i = 0; i < n; i++)
+	return jobs;
+}
+
+int
+pdf_count_image_rewrite_jobs(fz_context *ctx, pdf_image_rewrite_jobs *jobs)
+{
+	return jobs ? jobs->uilist.len : 0;
+}
+
+void
+pdf_load_image_rewrite_job(fz_context *ctx, pdf_document *doc, pdf_image_rewrite_jobs *jobs, int i)
+{
+	image_details *img;
+	pdf_obj *ref;
+
+	if (!jobs || i < 0 || i >= jobs->uilist.len)
+		return;
+	img = &jobs->uilist.img[i];
+	if (img->image)
+		return;
+
+	ref = pdf_new_indirect(ctx, doc, img->num, img->gen);
+	fz_try(ctx)
+		img->image = pdf_load_image(ctx, doc, ref);
+	fz_always(ctx)
+		pdf_drop_obj(ctx, ref);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+pdf_run_image_rewrite_job(fz_context *ctx, pdf_image_rewrite_jobs *jobs, int i)
+{
+	image_details *img;
+
+	if (!jobs || i < 0 || i >= jobs->uilist.len)
+		return;
+	img = &jobs->uilist.img[i];
+	if (!img->image)
+		return;
+
+	fz_try(ctx)
+		img->newimg = rewrite_image(ctx, jobs->opts, img->image, img->dpi);
+	fz_always(ctx)
 	{
-		rewrite_image_info(ctx, doc, i, &info);
+		/* Only the recompressed image is needed from now on. */
+		fz_drop_image(ctx, img->image);
+		img->image = NULL;
 	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+pdf_commit_image_rewrite_jobs(fz_context *ctx, pdf_document *doc, pdf_image_rewrite_jobs *jobs)
+{
+	int i, n;
+
+	if (pdf_count_image_rewrite_jobs(ctx, jobs) == 0)
+		return;
 
-	fz_free(ctx, info.list.uimg);
-	fz_free(ctx, info.uilist.img);
+	/* Pass 2: Replace the images as recompressed */
+	jobs->which = 0;
+	n = pdf_count_pages(ctx, doc);
+	for (i = 0; i < n; i++)
+		rewrite_image_info(ctx, doc, i, jobs);
+}
+
+void pdf_rewrite_images(fz_context *ctx, pdf_document *doc, pdf_image_rewriter_options *opts)
+{
+	pdf_image_rewrite_jobs *jobs;
+	int i, n;
+
+	jobs = pdf_new_image_rewrite_jobs(ctx, doc, opts);
+	fz_try(ctx)
+	{
+		/* Recompress each image once, however often it is used. */
+		n = pdf_count_image_rewrite_jobs(ctx, jobs);
+		for (i = 0; i < n; i++)
+		{
+			pdf_load_image_rewrite_job(ctx, doc, jobs, i);
+			pdf_run_image_rewrite_job(ctx, jobs, i);
+		}
+		pdf_commit_image_rewrite_jobs(ctx, doc, jobs);
+	}
+	fz_always(ctx)
+		pdf_drop_image_rewrite_jobs(ctx, jobs);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
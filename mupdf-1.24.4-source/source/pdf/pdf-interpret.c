@@ -207,6 +207,625 @@ parse_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm, char *csname,
 	return img;
 }
 
+/*
+ * Content programs.
+ *
+ * The lexed token sequence of a content stream is kept in the store so
+ * that running the same page, form, pattern or glyph again can skip the
+ * lexer. Each token is one byte, followed by a zigzag varint for
+ * integers, a float for reals, or a varint length and the bytes for
+ * names, keywords and strings. Arrays and dictionaries parsed as a
+ * whole, and inline images, are kept as objects and referred to by
+ * index.
+ *
+ * A program is only used while the streams it was recorded from are
+ * unchanged: they must still be the same objects, read from the same
+ * offsets in the file, and run with the same resource dictionary.
+ */
+
+enum
+{
+	PROG_OBJECT = 0xf0,
+	PROG_IMAGE = 0xf1
+};
+
+/* Don't keep recording programs larger than this. */
+#define MAX_CONTENT_PROGRAM (32 << 20)
+
+typedef struct
+{
+	int num;
+	int64_t stm_ofs;
+	pdf_obj *obj;
+} pdf_content_source;
+
+typedef struct pdf_content_program
+{
+	fz_storable storable;
+	fz_buffer *code;
+	pdf_obj *rdb;
+	int nobjs, maxobjs;
+	pdf_obj **objs;
+	int nimages, maximages;
+	fz_image **images;
+	int nsrc;
+	pdf_content_source *src;
+} pdf_content_program;
+
+static void
+drop_content_program_imp(fz_context *ctx, fz_storable *prog_)
+{
+	pdf_content_program *prog = (pdf_content_program *)prog_;
+	int i;
+
+	fz_drop_buffer(ctx, prog->code);
+	pdf_drop_obj(ctx, prog->rdb);
+	for (i = 0; i < prog->nobjs; i++)
+		pdf_drop_obj(ctx, prog->objs[i]);
+	for (i = 0; i < prog->nimages; i++)
+		fz_drop_image(ctx, prog->images[i]);
+	for (i = 0; i < prog->nsrc; i++)
+		pdf_drop_obj(ctx, prog->src[i].obj);
+	fz_free(ctx, prog->objs);
+	fz_free(ctx, prog->images);
+	fz_free(ctx, prog->src);
+	fz_free(ctx, prog);
+}
+
+static void
+drop_content_program(fz_context *ctx, pdf_content_program *prog)
+{
+	fz_drop_storable(ctx, &prog->storable);
+}
+
+static pdf_content_program *
+new_content_program(fz_context *ctx, pdf_obj *rdb, int nsrc)
+{
+	pdf_content_program *prog = fz_malloc_struct(ctx, pdf_content_program);
+
+	FZ_INIT_STORABLE(prog, 1, drop_content_program_imp);
+	fz_try(ctx)
+	{
+		prog->code = fz_new_buffer(ctx, 1024);
+		if (nsrc > 0)
+			prog->src = fz_malloc_struct_array(ctx, nsrc, pdf_content_source);
+	}
+	fz_catch(ctx)
+	{
+		drop_content_program(ctx, prog);
+		fz_rethrow(ctx);
+	}
+	prog->rdb = pdf_keep_obj(ctx, rdb);
+
+	return prog;
+}
+
+static size_t
+content_program_size(fz_context *ctx, pdf_content_program *prog)
+{
+	size_t size = sizeof(*prog) + prog->code->cap;
+	int i;
+
+	size += prog->maxobjs * sizeof(pdf_obj *);
+	size += prog->maximages * sizeof(fz_image *);
+	size += prog->nsrc * sizeof(pdf_content_source);
+	for (i = 0; i < prog->nimages; i++)
+		size += fz_image_size(ctx, prog->images[i]);
+
+	return size;
+}
+
+/* Describe the stream 'ref' as read from the file, or return 0 if it
+ * has been changed in memory (or never came from the file). */
+static int
+content_source(fz_context *ctx, pdf_document *doc, pdf_obj *ref, pdf_content_source *src)
+{
+	pdf_xref_entry *x;
+
+	if (!pdf_is_indirect(ctx, ref) || pdf_get_indirect_document(ctx, ref) != doc)
+		return 0;
+	if (pdf_is_local_object(ctx, doc, ref))
+		return 0;
+	x = pdf_get_xref_entry_no_change(ctx, doc, pdf_to_num(ctx, ref));
+	if (x == NULL || x->type != 'n' || x->stm_buf != NULL || x->stm_ofs <= 0 || x->obj == NULL)
+		return 0;
+
+	src->num = pdf_to_num(ctx, ref);
+	src->stm_ofs = x->stm_ofs;
+	src->obj = x->obj;
+	return 1;
+}
+
+/* Documents may be interpreted by several threads at once, so the statistics
+ * are updated under the alloc lock. */
+static void
+count_content_cache(fz_context *ctx, pdf_document *doc, int hit)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (hit)
+		doc->content_cache.hits++;
+	else
+		doc->content_cache.misses++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+/* The store key for the streams in stmobj, or NULL if they can't be cached. */
+static pdf_obj *
+content_program_key(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj)
+{
+	if (doc->content_cache.disabled)
+		return NULL;
+	if (pdf_is_indirect(ctx, stmobj))
+		return stmobj;
+	/* A direct array of streams is keyed by its first stream; the
+	 * sources recorded in the program tell them apart. */
+	if (pdf_is_array(ctx, stmobj) && pdf_is_indirect(ctx, pdf_array_get(ctx, stmobj, 0)))
+		return pdf_array_get(ctx, stmobj, 0);
+	return NULL;
+}
+
+static int
+content_program_sources(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj, pdf_content_source *src)
+{
+	int i, n;
+
+	if (!pdf_is_array(ctx, stmobj))
+	{
+		if (src && !content_source(ctx, doc, stmobj, src))
+			return -1;
+		return 1;
+	}
+
+	n = pdf_array_len(ctx, stmobj);
+	if (src)
+		for (i = 0; i < n; i++)
+			if (!content_source(ctx, doc, pdf_array_get(ctx, stmobj, i), &src[i]))
+				return -1;
+	return n;
+}
+
+static int
+content_program_is_current(fz_context *ctx, pdf_document *doc, pdf_content_program *prog, pdf_obj *rdb, pdf_obj *stmobj)
+{
+	pdf_content_source src;
+	pdf_obj *ref;
+	int i, n;
+
+	if (prog->rdb != rdb)
+		return 0;
+	n = content_program_sources(ctx, doc, stmobj, NULL);
+	if (n != prog->nsrc)
+		return 0;
+	for (i = 0; i < n; i++)
+	{
+		ref = pdf_is_array(ctx, stmobj) ? pdf_array_get(ctx, stmobj, i) : stmobj;
+		if (!content_source(ctx, doc, ref, &src))
+			return 0;
+		if (src.num != prog->src[i].num || src.stm_ofs != prog->src[i].stm_ofs || src.obj != prog->src[i].obj)
+			return 0;
+	}
+	return 1;
+}
+
+/* Look for a current program for stmobj in the store. */
+static pdf_content_program *
+find_content_program(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj)
+{
+	pdf_content_program *prog;
+	pdf_obj *key;
+
+	key = content_program_key(ctx, doc, stmobj);
+	if (!key)
+		return NULL;
+
+	prog = pdf_find_item(ctx, drop_content_program_imp, key);
+	if (prog && !content_program_is_current(ctx, doc, prog, rdb, stmobj))
+	{
+		pdf_remove_item(ctx, drop_content_program_imp, key);
+		drop_content_program(ctx, prog);
+		prog = NULL;
+	}
+	if (prog)
+		count_content_cache(ctx, doc, 1);
+	return prog;
+}
+
+/* Start recording a program for stmobj, if it can be cached. */
+static pdf_content_program *
+record_content_program(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj)
+{
+	pdf_content_program *prog;
+	int i, n;
+
+	if (!content_program_key(ctx, doc, stmobj))
+		return NULL;
+	n = content_program_sources(ctx, doc, stmobj, NULL);
+	if (n <= 0)
+		return NULL;
+
+	prog = new_content_program(ctx, rdb, n);
+	if (content_program_sources(ctx, doc, stmobj, prog->src) < 0)
+	{
+		drop_content_program(ctx, prog);
+		return NULL;
+	}
+	for (i = 0; i < n; i++)
+		pdf_keep_obj(ctx, prog->src[i].obj);
+	prog->nsrc = n;
+
+	count_content_cache(ctx, doc, 0);
+	return prog;
+}
+
+static void
+store_content_program(fz_context *ctx, pdf_document *doc, pdf_obj *stmobj, pdf_content_program *prog)
+{
+	pdf_content_program *existing;
+	pdf_obj *key = content_program_key(ctx, doc, stmobj);
+
+	/* Someone may have recorded the same streams meanwhile. */
+	existing = pdf_find_item(ctx, drop_content_program_imp, key);
+	if (existing)
+	{
+		drop_content_program(ctx, existing);
+		return;
+	}
+	fz_trim_buffer(ctx, prog->code);
+	pdf_store_item(ctx, key, prog, content_program_size(ctx, prog));
+}
+
+/* Type 3 glyph programs are keyed by the buffer holding the glyph. The key
+ * also records the document, so that its programs (which keep objects of
+ * the document alive) can be removed from the store when it is dropped. */
+
+typedef struct
+{
+	int refs;
+	fz_buffer *buf;
+	pdf_document *doc;
+} glyph_program_key;
+
+static int
+glyph_program_make_hash_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	glyph_program_key *key = (glyph_program_key *)key_;
+	hash->u.pi.ptr = key->buf;
+	hash->u.pi.i = 0;
+	return 1;
+}
+
+static void *
+glyph_program_keep_key(fz_context *ctx, void *key_)
+{
+	glyph_program_key *key = (glyph_program_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+glyph_program_drop_key(fz_context *ctx, void *key_)
+{
+	glyph_program_key *key = (glyph_program_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_buffer(ctx, key->buf);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+glyph_program_cmp_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	glyph_program_key *k0 = (glyph_program_key *)k0_;
+	glyph_program_key *k1 = (glyph_program_key *)k1_;
+	return k0->buf != k1->buf || k0->doc != k1->doc;
+}
+
+static void
+glyph_program_format_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	glyph_program_key *key = (glyph_program_key *)key_;
+	fz_snprintf(s, n, "(glyph buffer %p)", key->buf);
+}
+
+static const fz_store_type glyph_program_store_type =
+{
+	"pdf_glyph_program",
+	glyph_program_make_hash_key,
+	glyph_program_keep_key,
+	glyph_program_drop_key,
+	glyph_program_cmp_key,
+	glyph_program_format_key,
+	NULL
+};
+
+static void
+store_glyph_program(fz_context *ctx, pdf_document *doc, fz_buffer *contents, pdf_content_program *prog)
+{
+	glyph_program_key *key = NULL;
+	void *existing;
+
+	fz_var(key);
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, glyph_program_key);
+		key->refs = 1;
+		key->buf = fz_keep_buffer(ctx, contents);
+		key->doc = doc;
+		existing = fz_store_item(ctx, key, prog, content_program_size(ctx, prog), &glyph_program_store_type);
+		fz_drop_storable(ctx, existing);
+	}
+	fz_always(ctx)
+		glyph_program_drop_key(ctx, key);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int
+glyph_program_filter(fz_context *ctx, void *doc, void *key)
+{
+	return ((glyph_program_key *)key)->doc == doc;
+}
+
+void
+pdf_empty_glyph_program_store(fz_context *ctx, pdf_document *doc)
+{
+	fz_filter_store(ctx, glyph_program_filter, doc, &glyph_program_store_type);
+}
+
+static void
+abandon_content_program(fz_context *ctx, pdf_csi *csi)
+{
+	if (csi->prog && !csi->replay)
+	{
+		drop_content_program(ctx, csi->prog);
+		csi->prog = NULL;
+	}
+}
+
+static void
+append_varint(fz_context *ctx, fz_buffer *code, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		fz_append_byte(ctx, code, (int)(v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	fz_append_byte(ctx, code, (int)v);
+}
+
+static uint64_t
+read_varint(const unsigned char *code, size_t *pc)
+{
+	uint64_t v = 0;
+	int shift = 0;
+	int c;
+
+	do
+	{
+		c = code[(*pc)++];
+		v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	}
+	while (c & 0x80);
+
+	return v;
+}
+
+static void
+record_token(fz_context *ctx, pdf_csi *csi, pdf_token tok)
+{
+	fz_buffer *code = csi->prog->code;
+	pdf_lexbuf *buf = csi->buf;
+
+	fz_append_byte(ctx, code, tok);
+	switch (tok)
+	{
+	case PDF_TOK_INT:
+		append_varint(ctx, code, ((uint64_t)buf->i << 1) ^ (uint64_t)(buf->i >> 63));
+		break;
+	case PDF_TOK_REAL:
+		fz_append_data(ctx, code, &buf->f, sizeof buf->f);
+		break;
+	case PDF_TOK_NAME:
+	case PDF_TOK_KEYWORD:
+	case PDF_TOK_STRING:
+		append_varint(ctx, code, buf->len);
+		fz_append_data(ctx, code, buf->scratch, buf->len);
+		break;
+	default:
+		break;
+	}
+
+	if (code->len > MAX_CONTENT_PROGRAM)
+		abandon_content_program(ctx, csi);
+}
+
+static pdf_token
+replay_token(fz_context *ctx, pdf_csi *csi)
+{
+	fz_buffer *code = csi->prog->code;
+	pdf_lexbuf *buf = csi->buf;
+	uint64_t v;
+	size_t n;
+	int tok;
+
+	if (csi->pc >= code->len)
+		return PDF_TOK_EOF;
+
+	tok = code->data[csi->pc++];
+	switch (tok)
+	{
+	case PDF_TOK_INT:
+		v = read_varint(code->data, &csi->pc);
+		buf->i = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+		break;
+	case PDF_TOK_REAL:
+		memcpy(&buf->f, code->data + csi->pc, sizeof buf->f);
+		csi->pc += sizeof buf->f;
+		break;
+	case PDF_TOK_NAME:
+	case PDF_TOK_KEYWORD:
+	case PDF_TOK_STRING:
+		n = read_varint(code->data, &csi->pc);
+		while (n >= (size_t)buf->size)
+			pdf_lexbuf_grow(ctx, buf);
+		memcpy(buf->scratch, code->data + csi->pc, n);
+		buf->scratch[n] = 0;
+		buf->len = n;
+		csi->pc += n;
+		break;
+	case PROG_OBJECT:
+	case PROG_IMAGE:
+		/* Skip the operand we weren't expecting. */
+		(void)read_varint(code->data, &csi->pc);
+		if (tok == PROG_IMAGE)
+			csi->pc += read_varint(code->data, &csi->pc);
+		fz_throw(ctx, FZ_ERROR_SYNTAX, "content program out of step");
+	default:
+		break;
+	}
+
+	return tok;
+}
+
+static void
+replay_expect(fz_context *ctx, pdf_csi *csi, int op)
+{
+	fz_buffer *code = csi->prog->code;
+
+	if (csi->pc >= code->len || code->data[csi->pc] != op)
+		fz_throw(ctx, FZ_ERROR_SYNTAX, "content program out of step");
+	csi->pc++;
+}
+
+/* pdf_lex, recording or replaying the program as appropriate. */
+static pdf_token
+csi_lex(fz_context *ctx, pdf_csi *csi, fz_stream *stm)
+{
+	pdf_token tok;
+
+	if (csi->replay)
+		return replay_token(ctx, csi);
+
+	csi->lexing = 1;
+	tok = pdf_lex(ctx, stm, csi->buf);
+	csi->lexing = 0;
+
+	if (csi->prog)
+		record_token(ctx, csi, tok);
+
+	return tok;
+}
+
+static void
+record_object(fz_context *ctx, pdf_csi *csi, pdf_obj *obj)
+{
+	pdf_content_program *prog = csi->prog;
+
+	if (prog->nobjs == prog->maxobjs)
+	{
+		int newmax = prog->maxobjs ? prog->maxobjs * 2 : 16;
+		prog->objs = fz_realloc_array(ctx, prog->objs, newmax, pdf_obj *);
+		prog->maxobjs = newmax;
+	}
+	fz_append_byte(ctx, prog->code, PROG_OBJECT);
+	append_varint(ctx, prog->code, prog->nobjs);
+	prog->objs[prog->nobjs++] = pdf_keep_obj(ctx, obj);
+}
+
+/* pdf_parse_array or pdf_parse_dict, recording or replaying. */
+static pdf_obj *
+csi_parse_object(fz_context *ctx, pdf_csi *csi, fz_stream *stm, int is_array)
+{
+	pdf_obj *obj;
+
+	if (csi->replay)
+	{
+		replay_expect(ctx, csi, PROG_OBJECT);
+		return pdf_keep_obj(ctx, csi->prog->objs[read_varint(csi->prog->code->data, &csi->pc)]);
+	}
+
+	csi->lexing = 1;
+	if (is_array)
+		obj = pdf_parse_array(ctx, csi->doc, stm, csi->buf);
+	else
+		obj = pdf_parse_dict(ctx, csi->doc, stm, csi->buf);
+	csi->lexing = 0;
+
+	if (csi->prog)
+	{
+		fz_try(ctx)
+			record_object(ctx, csi, obj);
+		fz_catch(ctx)
+		{
+			pdf_drop_obj(ctx, obj);
+			fz_rethrow(ctx);
+		}
+	}
+
+	return obj;
+}
+
+static void
+record_image(fz_context *ctx, pdf_csi *csi, fz_image *img, const char *csname)
+{
+	pdf_content_program *prog = csi->prog;
+	size_t n = strlen(csname);
+
+	if (prog->nimages == prog->maximages)
+	{
+		int newmax = prog->maximages ? prog->maximages * 2 : 4;
+		prog->images = fz_realloc_array(ctx, prog->images, newmax, fz_image *);
+		prog->maximages = newmax;
+	}
+	fz_append_byte(ctx, prog->code, PROG_IMAGE);
+	append_varint(ctx, prog->code, prog->nimages);
+	append_varint(ctx, prog->code, n);
+	fz_append_data(ctx, prog->code, csname, n);
+	prog->images[prog->nimages++] = fz_keep_image(ctx, img);
+}
+
+/* parse_inline_image, recording or replaying. */
+static fz_image *
+csi_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm, char *csname, int cslen)
+{
+	fz_image *img;
+
+	if (csi->replay)
+	{
+		const unsigned char *data = csi->prog->code->data;
+		size_t n, len;
+		int i;
+
+		replay_expect(ctx, csi, PROG_IMAGE);
+		i = (int)read_varint(data, &csi->pc);
+		n = read_varint(data, &csi->pc);
+		len = n < (size_t)cslen ? n : (size_t)cslen - 1;
+		memcpy(csname, data + csi->pc, len);
+		csname[len] = 0;
+		csi->pc += n;
+		return fz_keep_image(ctx, csi->prog->images[i]);
+	}
+
+	csi->lexing = 1;
+	img = parse_inline_image(ctx, csi, stm, csname, cslen);
+	csi->lexing = 0;
+
+	if (csi->prog)
+	{
+		fz_try(ctx)
+			record_image(ctx, csi, img, csname);
+		fz_catch(ctx)
+		{
+			fz_drop_image(ctx, img);
+			fz_rethrow(ctx);
+		}
+	}
+
+	return img;
+}
+
 static void
 pdf_process_extgstate(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, pdf_obj *dict)
 {
@@ -803,7 +1422,7 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	/* shadings, images, xobjects */
 	case B('B','I'):
 		{
-			fz_image *img = parse_inline_image(ctx, csi, stm, csname, sizeof csname);
+			fz_image *img = csi_inline_image(ctx, csi, stm, csname, sizeof csname);
 			fz_try(ctx)
 			{
 				if (proc->op_BI)
@@ -884,13 +1503,14 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 				{
 					if (cookie->abort)
 					{
+						abandon_content_program(ctx, csi);
 						tok = PDF_TOK_EOF;
 						break;
 					}
 					cookie->progress++;
 				}
 
-				tok = pdf_lex(ctx, stm, buf);
+				tok = csi_lex(ctx, csi, stm);
 
 				if (in_text_array)
 				{
@@ -950,7 +1570,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					}
 					else
 					{
-						csi->obj = pdf_parse_array(ctx, doc, stm, buf);
+						csi->obj = csi_parse_object(ctx, csi, stm, 1);
 					}
 					break;
 
@@ -960,7 +1580,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 						pdf_drop_obj(ctx, csi->obj);
 						csi->obj = NULL;
 					}
-					csi->obj = pdf_parse_dict(ctx, doc, stm, buf);
+					csi->obj = csi_parse_object(ctx, csi, stm, 0);
 					break;
 
 				case PDF_TOK_NAME:
@@ -1027,6 +1647,13 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 		fz_catch(ctx)
 		{
 			int caught = fz_caught(ctx);
+
+			/* Don't keep a program for a stream we couldn't read
+			 * or that we didn't get to the end of. */
+			if (csi->lexing || caught == FZ_ERROR_TRYLATER)
+				abandon_content_program(ctx, csi);
+			csi->lexing = 0;
+
 			if (cookie)
 			{
 				if (caught == FZ_ERROR_TRYLATER)
@@ -1046,6 +1673,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
 					{
 						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
+						abandon_content_program(ctx, csi);
 						tok = PDF_TOK_EOF;
 					}
 				}
@@ -1071,6 +1699,7 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 					if (++syntax_errors >= MAX_SYNTAX_ERRORS)
 					{
 						fz_warn(ctx, "too many syntax errors; ignoring rest of page");
+						abandon_content_program(ctx, csi);
 						tok = PDF_TOK_EOF;
 					}
 				}
@@ -1118,8 +1747,17 @@ pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc
 	fz_try(ctx)
 	{
 		fz_defer_reap_start(ctx);
-		stm = pdf_open_contents_stream(ctx, doc, stmobj);
+		csi.prog = find_content_program(ctx, doc, rdb, stmobj);
+		if (csi.prog)
+			csi.replay = 1;
+		else
+		{
+			csi.prog = record_content_program(ctx, doc, rdb, stmobj);
+			stm = pdf_open_contents_stream(ctx, doc, stmobj);
+		}
 		pdf_process_stream(ctx, proc, &csi, stm);
+		if (csi.prog && !csi.replay)
+			store_content_program(ctx, doc, stmobj, csi.prog);
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
@@ -1128,6 +1766,8 @@ pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc
 		fz_drop_stream(ctx, stm);
 		pdf_clear_stack(ctx, &csi);
 		pdf_lexbuf_fin(ctx, &buf);
+		if (csi.prog)
+			drop_content_program(ctx, csi.prog);
 	}
 	fz_catch(ctx)
 	{
@@ -1136,6 +1776,29 @@ pdf_process_raw_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc
 	}
 }
 
+void
+pdf_enable_content_cache(fz_context *ctx, pdf_document *doc)
+{
+	doc->content_cache.disabled = 0;
+}
+
+void
+pdf_disable_content_cache(fz_context *ctx, pdf_document *doc)
+{
+	doc->content_cache.disabled = 1;
+}
+
+void
+pdf_content_cache_stats(fz_context *ctx, pdf_document *doc, int *hits, int *misses)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (hits)
+		*hits = doc->content_cache.hits;
+	if (misses)
+		*misses = doc->content_cache.misses;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void
 pdf_process_contents(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_obj *rdb, pdf_obj *stmobj, fz_cookie *cookie, pdf_obj **out_res)
 {
@@ -1236,8 +1899,30 @@ pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_o
 	fz_try(ctx)
 	{
 		pdf_processor_push_resources(ctx, proc, rdb);
-		stm = fz_open_buffer(ctx, contents);
+		if (!doc->content_cache.disabled)
+		{
+			glyph_program_key key = { 1, contents, doc };
+			csi.prog = fz_find_item(ctx, drop_content_program_imp, &key, &glyph_program_store_type);
+			if (csi.prog && csi.prog->rdb != rdb)
+			{
+				fz_remove_item(ctx, drop_content_program_imp, &key, &glyph_program_store_type);
+				drop_content_program(ctx, csi.prog);
+				csi.prog = NULL;
+			}
+			if (csi.prog)
+				csi.replay = 1;
+			else
+				csi.prog = new_content_program(ctx, rdb, 0);
+			count_content_cache(ctx, doc, csi.replay);
+		}
+		if (!csi.replay)
+			stm = fz_open_buffer(ctx, contents);
 		pdf_process_stream(ctx, proc, &csi, stm);
+		if (csi.prog && !csi.replay)
+		{
+			fz_trim_buffer(ctx, csi.prog->code);
+			store_glyph_program(ctx, doc, contents, csi.prog);
+		}
 		pdf_process_end(ctx, proc, &csi);
 	}
 	fz_always(ctx)
@@ -1246,6 +1931,8 @@ pdf_process_glyph(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_o
 		fz_drop_stream(ctx, stm);
 		pdf_clear_stack(ctx, &csi);
 		pdf_lexbuf_fin(ctx, &buf);
+		if (csi.prog)
+			drop_content_program(ctx, csi.prog);
 	}
 	fz_catch(ctx)
 	{
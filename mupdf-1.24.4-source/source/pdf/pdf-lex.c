@@ -63,8 +63,11 @@ static inline int lex_byte(fz_context *ctx, fz_stream *stm)
 		fz_write_printf(ctx, fz_stdout(ctx), "<%02x>", c);
 	return c;
 }
+/* Dumping disables the fast paths, so that every byte is seen. */
+#define lex_buffered(S) 0
 #else
 #define lex_byte(C,S) fz_read_byte(C,S)
+#define lex_buffered(S) ((S)->rp < (S)->wp)
 #endif
 
 static inline int iswhite(int ch)
@@ -91,10 +94,60 @@ static inline int unhex(int ch)
 	return 0;
 }
 
+/*
+	Character classes for scanning runs of bytes directly in the
+	stream buffer. The lexing functions below use these to skip over
+	whitespace, comments, names and numbers without going through
+	fz_read_byte for every byte, and fall back to the bytewise code
+	when a run reaches the end of the buffered data.
+*/
+#define LEX_WHITE 1
+#define LEX_DELIM 2
+#define LEX_DIGIT 4
+#define LEX_HASH 8
+
+#define W LEX_WHITE
+#define D LEX_DELIM
+#define N LEX_DIGIT
+#define H LEX_HASH
+static const unsigned char lex_class[256] = {
+	W,0,0,0,0,0,0,0,0,W,W,0,W,W,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	W,0,0,H,0,D,0,0,D,D,0,0,0,0,0,D,
+	N,N,N,N,N,N,N,N,N,N,0,0,D,0,D,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,D,0,D,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,D,0,D,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+};
+#undef W
+#undef D
+#undef N
+#undef H
+
 static void
 lex_white(fz_context *ctx, fz_stream *f)
 {
 	int c;
+
+	if (lex_buffered(f))
+	{
+		const unsigned char *p = f->rp, *end = f->wp;
+		while (p < end && (lex_class[*p] & LEX_WHITE))
+			p++;
+		f->rp = (unsigned char *)p;
+		if (p < end)
+			return;
+	}
+
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
@@ -106,6 +159,20 @@ static void
 lex_comment(fz_context *ctx, fz_stream *f)
 {
 	int c;
+
+	if (lex_buffered(f))
+	{
+		const unsigned char *p = f->rp, *end = f->wp;
+		while (p < end && *p != '\012' && *p != '\015')
+			p++;
+		if (p < end)
+		{
+			f->rp = (unsigned char *)p + 1;
+			return;
+		}
+		f->rp = (unsigned char *)p;
+	}
+
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
@@ -184,6 +251,45 @@ static int64_t fast_atoi(char *s)
 	return neg ? -i : i;
 }
 
+/* Scan a well formed number that ends inside the buffered data. */
+static int
+lex_number_buffered(fz_stream *f, pdf_lexbuf *buf, int c, char **isreal)
+{
+	const unsigned char *p = f->rp, *end = f->wp;
+	const unsigned char *dot = NULL;
+	size_t n;
+
+	while (p < end)
+	{
+		if (lex_class[*p] & LEX_DIGIT)
+			p++;
+		else if (*p == '.' && !dot && c != '.')
+			dot = p++;
+		else
+			break;
+	}
+	if (p == end || !(lex_class[*p] & (LEX_WHITE | LEX_DELIM)))
+		return 0;
+
+	/* Numbers that fill the scratch buffer are truncated by the slow path. */
+	n = p - f->rp;
+	if (n + 2 > (size_t)buf->size - 1)
+		return 0;
+
+	buf->scratch[0] = c;
+	memcpy(buf->scratch + 1, f->rp, n);
+	buf->scratch[n + 1] = 0;
+	f->rp = (unsigned char *)p;
+
+	if (c == '.')
+		*isreal = buf->scratch;
+	else if (dot)
+		*isreal = buf->scratch + 1 + (dot - (p - n));
+	else
+		*isreal = NULL;
+	return 1;
+}
+
 static int
 lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 {
@@ -193,6 +299,12 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 	int neg = (c == '-');
 	int isbad = 0;
 
+	/* Most numbers are simple and in the buffer; doubled signs,
+	 * stray characters, and runs that end at the end of the buffer
+	 * take the slow path below. */
+	if (lex_buffered(f) && *f->rp != '-' && lex_number_buffered(f, buf, c, &isreal))
+		goto convert;
+
 	*s++ = c;
 
 	c = lex_byte(ctx, f);
@@ -244,6 +356,7 @@ end:
 	*s = '\0';
 	if (isbad)
 		return PDF_TOK_KEYWORD;
+convert:
 	if (isreal)
 	{
 		/* We'd like to use the fastest possible atof
@@ -271,6 +384,27 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 	char *e = s + fz_minz(127, lb->size);
 	int c;
 
+	/* Names without escapes that end inside the buffered data. */
+	if (lex_buffered(f))
+	{
+		const unsigned char *p = f->rp, *end = f->wp;
+		size_t n;
+
+		while (p < end && !(lex_class[*p] & (LEX_WHITE | LEX_DELIM | LEX_HASH)))
+			p++;
+		n = p - f->rp;
+		if (p < end && (lex_class[*p] & (LEX_WHITE | LEX_DELIM)) && n < 127)
+		{
+			while (n >= (size_t)lb->size)
+				pdf_lexbuf_grow(ctx, lb);
+			memcpy(lb->scratch, f->rp, n);
+			lb->scratch[n] = 0;
+			lb->len = n;
+			f->rp = (unsigned char *)p;
+			return;
+		}
+	}
+
 	while (1)
 	{
 		if (s == e)
@@ -110,6 +110,7 @@ typedef struct
 	int len;
 	int cap;
 	struct keyval *items;
+	int *index; /* lazily built key hash index, see pdf_dict_find_indexed */
 } pdf_obj_dict;
 
 typedef struct
@@ -1424,6 +1425,7 @@ void pdf_undo(fz_context *ctx, pdf_document *doc)
 	doc->journal->current = entry->prev;
 
 	swap_fragments(ctx, doc, entry);
+	doc->change_count++;
 }
 
 /* Move forwards in the undo history. Throws an error if we are at the
@@ -1463,6 +1465,7 @@ void pdf_redo(fz_context *ctx, pdf_document *doc)
 	doc->journal->current = entry;
 
 	swap_fragments(ctx, doc, entry);
+	doc->change_count++;
 }
 
 void pdf_discard_journal(fz_context *ctx, pdf_journal *journal)
@@ -1842,6 +1845,8 @@ static void prepare_object_for_alteration(fz_context *ctx, pdf_obj *obj, pdf_obj
 		}
 	}
 
+	doc->change_count++;
+
 	entry = NULL;
 	if (doc->journal)
 	{
@@ -2127,6 +2132,7 @@ pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 
 	obj->len = 0;
 	obj->cap = initialcap > 1 ? initialcap : 10;
+	obj->index = NULL;
 
 	fz_try(ctx)
 	{
@@ -2233,12 +2239,139 @@ pdf_dict_put_val_null(fz_context *ctx, pdf_obj *obj, int idx)
 	DICT(obj)->items[idx].v = PDF_NULL;
 }
 
+/*
+	Dictionaries with more than PDF_DICT_INDEX_MIN entries get an open
+	addressing hash index over their keys, built on first lookup, so that
+	resource dictionaries and the like that are queried many times per
+	page do not need a linear scan (or bisection) with strcmp per lookup.
+
+	The index stores item positions, so it is dropped whenever entries
+	are removed or reordered, and extended when entries are appended.
+	index[0] holds the mask; slots index[1..mask+1] hold position+1, or 0
+	when empty.
+*/
+#define PDF_DICT_INDEX_MIN 12
+
+static const char *
+dict_key_name(pdf_obj *k)
+{
+	if (k < PDF_LIMIT)
+		return PDF_NAME_LIST[(intptr_t)k];
+	if (k->kind == PDF_NAME)
+		return NAME(k)->n;
+	return "";
+}
+
+static unsigned int
+dict_key_hash(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s)
+	{
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+pdf_dict_drop_index(fz_context *ctx, pdf_obj *obj)
+{
+	fz_free(ctx, DICT(obj)->index);
+	DICT(obj)->index = NULL;
+}
+
+static void
+pdf_dict_index_insert(int *index, const char *key, int i)
+{
+	unsigned int mask = index[0];
+	unsigned int h = dict_key_hash(key) & mask;
+	while (index[1 + h])
+		h = (h + 1) & mask;
+	index[1 + h] = i + 1;
+}
+
+/* Keep the index up to date when an entry is appended at position i. */
+static void
+pdf_dict_index_append(fz_context *ctx, pdf_obj *obj, int i)
+{
+	int *index = DICT(obj)->index;
+	if (!index)
+		return;
+	if ((unsigned int)(i + 1) * 2 > (unsigned int)index[0] + 1)
+		pdf_dict_drop_index(ctx, obj);
+	else
+		pdf_dict_index_insert(index, dict_key_name(DICT(obj)->items[i].k), i);
+}
+
+static int *
+pdf_dict_build_index(fz_context *ctx, pdf_obj *obj)
+{
+	int len = DICT(obj)->len;
+	unsigned int size = 16;
+	int *index;
+	int i;
+
+	/* Keep the load factor at or below one half, leaving room for appends. */
+	while (size < (unsigned int)DICT(obj)->cap * 2)
+		size <<= 1;
+	index = fz_calloc_no_throw(ctx, size + 1, sizeof(int));
+	if (!index)
+		return NULL;
+	index[0] = size - 1;
+	for (i = 0; i < len; i++)
+		pdf_dict_index_insert(index, dict_key_name(DICT(obj)->items[i].k), i);
+	DICT(obj)->index = index;
+	return index;
+}
+
+/* Look up key (whose constant name is keyobj, or NULL if it is not a
+ * constant name) through the index. Returns the position, -1 if the key
+ * is not present, or -2 if the dictionary has no index. */
+static int
+pdf_dict_find_indexed(fz_context *ctx, pdf_obj *obj, const char *key, pdf_obj *keyobj)
+{
+	int *index;
+	unsigned int mask, h;
+	int i;
+
+	if (DICT(obj)->len <= PDF_DICT_INDEX_MIN)
+		return -2;
+	index = DICT(obj)->index;
+	if (!index)
+	{
+		index = pdf_dict_build_index(ctx, obj);
+		if (!index)
+			return -2;
+	}
+
+	mask = index[0];
+	h = dict_key_hash(key) & mask;
+	while ((i = index[1 + h]) != 0)
+	{
+		pdf_obj *k = DICT(obj)->items[i - 1].k;
+		if (k == keyobj && keyobj)
+			return i - 1;
+		/* Distinct constant names never match. */
+		if (!(k < PDF_LIMIT && keyobj))
+			if (!strcmp(dict_key_name(k), key))
+				return i - 1;
+		h = (h + 1) & mask;
+	}
+	return -1;
+}
+
 /* Returns 0 <= i < len for key found. Returns -1-len < i <= -1 for key
  * not found, but with insertion point -1-i. */
 static int
 pdf_dict_finds(fz_context *ctx, pdf_obj *obj, const char *key)
 {
 	int len = DICT(obj)->len;
+	int i = pdf_dict_find_indexed(ctx, obj, key, NULL);
+	if (i >= 0)
+		return i;
+	if (i == -1 && !(obj->flags & PDF_FLAGS_SORTED))
+		return -1 - len;
 	if ((obj->flags & PDF_FLAGS_SORTED) && len > 0)
 	{
 		int l = 0;
@@ -2278,6 +2411,11 @@ static int
 pdf_dict_find(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 {
 	int len = DICT(obj)->len;
+	int i = pdf_dict_find_indexed(ctx, obj, PDF_NAME_LIST[(intptr_t)key], key);
+	if (i >= 0)
+		return i;
+	if (i == -1 && !(obj->flags & PDF_FLAGS_SORTED))
+		return -1 - len;
 	if ((obj->flags & PDF_FLAGS_SORTED) && len > 0)
 	{
 		int l = 0;
@@ -2478,13 +2616,17 @@ pdf_dict_get_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val, pdf_
 
 		i = -1-i;
 		if ((obj->flags & PDF_FLAGS_SORTED) && DICT(obj)->len > 0)
+		{
 			memmove(&DICT(obj)->items[i + 1],
 					&DICT(obj)->items[i],
 					(DICT(obj)->len - i) * sizeof(struct keyval));
+			pdf_dict_drop_index(ctx, obj);
+		}
 
 		DICT(obj)->items[i].k = pdf_keep_obj(ctx, key);
 		DICT(obj)->items[i].v = pdf_keep_obj(ctx, val);
 		DICT(obj)->len ++;
+		pdf_dict_index_append(ctx, obj, i);
 	}
 }
 
@@ -2727,6 +2869,7 @@ pdf_dict_dels(fz_context *ctx, pdf_obj *obj, const char *key)
 		obj->flags &= ~PDF_FLAGS_SORTED;
 		DICT(obj)->items[i] = DICT(obj)->items[DICT(obj)->len-1];
 		DICT(obj)->len --;
+		pdf_dict_drop_index(ctx, obj);
 	}
 }
 
@@ -2752,6 +2895,7 @@ pdf_sort_dict(fz_context *ctx, pdf_obj *obj)
 	{
 		qsort(DICT(obj)->items, DICT(obj)->len, sizeof(struct keyval), keyvalcmp);
 		obj->flags |= PDF_FLAGS_SORTED;
+		pdf_dict_drop_index(ctx, obj);
 	}
 }
 
@@ -3048,6 +3192,7 @@ pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
 	}
 
 	fz_free(ctx, DICT(obj)->items);
+	fz_free(ctx, DICT(obj)->index);
 	fz_free(ctx, obj);
 }
 
@@ -541,6 +541,31 @@ pdf_guess_filter_length(size_t len, const char *filter)
 	return nlen;
 }
 
+size_t
+pdf_guess_stream_length(fz_context *ctx, pdf_obj *dict)
+{
+	pdf_obj *obj;
+	int64_t ilen;
+	size_t len;
+	int i, n;
+
+	ilen = pdf_dict_get_int64(ctx, dict, PDF_NAME(Length));
+	if (ilen < 0)
+		ilen = 0;
+	len = (size_t)ilen;
+	/* In 32 bit builds, we might find a length being too
+	 * large for a size_t. */
+	if ((int64_t)len != ilen)
+		fz_throw(ctx, FZ_ERROR_LIMIT, "Stream too large");
+	obj = pdf_dict_get(ctx, dict, PDF_NAME(Filter));
+	len = pdf_guess_filter_length(len, pdf_to_name(ctx, obj));
+	n = pdf_array_len(ctx, obj);
+	for (i = 0; i < n; i++)
+		len = pdf_guess_filter_length(len, pdf_array_get_name(ctx, obj, i));
+
+	return len;
+}
+
 /* Check if an entry has a cached stream and return whether it is directly
  * reusable. A buffer is directly reusable only if the stream is
  * uncompressed, or if it is compressed purely a compression method we can
@@ -597,8 +622,7 @@ static fz_buffer *
 pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compression_params *params, int *truncated, size_t worst_case)
 {
 	fz_stream *stm = NULL;
-	pdf_obj *dict, *obj;
-	int i, n;
+	pdf_obj *dict;
 	size_t len;
 	fz_buffer *buf;
 
@@ -615,21 +639,7 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 
 	dict = pdf_load_object(ctx, doc, num);
 	fz_try(ctx)
-	{
-		int64_t ilen = pdf_dict_get_int64(ctx, dict, PDF_NAME(Length));
-		if (ilen < 0)
-			ilen = 0;
-		len = (size_t)ilen;
-		/* In 32 bit builds, we might find a length being too
-		 * large for a size_t. */
-		if ((int64_t)len != ilen)
-			fz_throw(ctx, FZ_ERROR_LIMIT, "Stream too large");
-		obj = pdf_dict_get(ctx, dict, PDF_NAME(Filter));
-		len = pdf_guess_filter_length(len, pdf_to_name(ctx, obj));
-		n = pdf_array_len(ctx, obj);
-		for (i = 0; i < n; i++)
-			len = pdf_guess_filter_length(len, pdf_array_get_name(ctx, obj, i));
-	}
+		len = pdf_guess_stream_length(ctx, dict);
 	fz_always(ctx)
 	{
 		pdf_drop_obj(ctx, dict);
@@ -704,52 +704,234 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pd
 }
 
 /*
- * Scan for and remove duplicate objects (slow)
+ * Scan for and remove duplicate objects.
+ *
+ * Rather than comparing every object against every preceding object, we
+ * fingerprint each object with a hash that is consistent with pdf_objcmp
+ * (equal objects always hash equal), sort by fingerprint, and only run the
+ * full comparison between objects that share a fingerprint.
  */
 
+typedef struct
+{
+	uint32_t hash;
+	uint32_t digest;
+	int num;
+} dedupe_entry;
+
+#define DEDUPE_HASH_SEED 2166136261u
+
+static uint32_t dedupe_hash_bytes(uint32_t h, const unsigned char *s, size_t n)
+{
+	while (n--)
+	{
+		h ^= *s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static uint32_t dedupe_hash_int(uint32_t h, uint64_t v)
+{
+	unsigned char b[8];
+	int i;
+	for (i = 0; i < 8; i++)
+		b[i] = (unsigned char)(v >> (8 * i));
+	return dedupe_hash_bytes(h, b, 8);
+}
+
+/* Hash a direct object, without following indirect references. Objects
+ * that pdf_objcmp considers equal must produce the same hash. */
+static uint32_t dedupe_hash_obj(fz_context *ctx, pdf_obj *obj)
+{
+	uint32_t h = DEDUPE_HASH_SEED;
+	int i, n;
+
+	if (obj == NULL)
+		return h;
+
+	if (pdf_is_indirect(ctx, obj))
+	{
+		h = dedupe_hash_int(h, 'R');
+		h = dedupe_hash_int(h, pdf_to_num(ctx, obj));
+		return dedupe_hash_int(h, pdf_to_gen(ctx, obj));
+	}
+	if (pdf_is_null(ctx, obj))
+		return dedupe_hash_int(h, 'n');
+	if (pdf_is_bool(ctx, obj))
+		return dedupe_hash_int(h, pdf_to_bool(ctx, obj) ? 't' : 'f');
+	if (pdf_is_int(ctx, obj))
+	{
+		h = dedupe_hash_int(h, 'i');
+		return dedupe_hash_int(h, (uint64_t)pdf_to_int64(ctx, obj));
+	}
+	if (pdf_is_real(ctx, obj))
+	{
+		float f = pdf_to_real(ctx, obj);
+		uint32_t bits;
+		if (f == 0)
+			f = 0; /* -0 and +0 compare equal. */
+		memcpy(&bits, &f, sizeof bits);
+		h = dedupe_hash_int(h, 'f');
+		return dedupe_hash_int(h, bits);
+	}
+	if (pdf_is_name(ctx, obj))
+	{
+		/* Constant and allocated names with the same text compare equal. */
+		const char *s = pdf_to_name(ctx, obj);
+		h = dedupe_hash_int(h, '/');
+		return dedupe_hash_bytes(h, (const unsigned char *)s, strlen(s));
+	}
+	if (pdf_is_string(ctx, obj))
+	{
+		h = dedupe_hash_int(h, '(');
+		return dedupe_hash_bytes(h, (const unsigned char *)pdf_to_str_buf(ctx, obj), pdf_to_str_len(ctx, obj));
+	}
+	if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		h = dedupe_hash_int(h, '[');
+		h = dedupe_hash_int(h, n);
+		for (i = 0; i < n; i++)
+			h = dedupe_hash_int(h, dedupe_hash_obj(ctx, pdf_array_get(ctx, obj, i)));
+		return h;
+	}
+	if (pdf_is_dict(ctx, obj))
+	{
+		/* Unsorted dictionaries compare equal regardless of key order,
+		 * so combine the entries with an order independent sum. */
+		uint32_t sum = 0;
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; i < n; i++)
+		{
+			uint32_t kv = dedupe_hash_obj(ctx, pdf_dict_get_key(ctx, obj, i));
+			kv = dedupe_hash_int(kv, dedupe_hash_obj(ctx, pdf_dict_get_val(ctx, obj, i)));
+			sum += kv;
+		}
+		h = dedupe_hash_int(h, '<');
+		h = dedupe_hash_int(h, n);
+		return dedupe_hash_int(h, sum);
+	}
+	return h;
+}
+
+static int dedupe_entry_cmp(const void *a_, const void *b_)
+{
+	const dedupe_entry *a = a_;
+	const dedupe_entry *b = b_;
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	if (a->digest != b->digest)
+		return a->digest < b->digest ? -1 : 1;
+	return a->num - b->num;
+}
+
+static uint32_t dedupe_hash_stream(fz_context *ctx, pdf_document *doc, int num)
+{
+	fz_buffer *buf = pdf_load_raw_stream_number(ctx, doc, num);
+	unsigned char *data;
+	size_t len = fz_buffer_storage(ctx, buf, &data);
+	uint32_t h = dedupe_hash_bytes(DEDUPE_HASH_SEED, data, len);
+	fz_drop_buffer(ctx, buf);
+	return h;
+}
+
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
 {
-	int num, other;
+	int num, i, j, s, e, n;
 	int xref_len = pdf_xref_len(ctx, doc);
+	int deep = (opts->do_garbage >= 4);
+	dedupe_entry *list;
 
 	expand_lists(ctx, opts, xref_len);
-	for (num = 1; num < xref_len; num++)
+
+	list = fz_malloc_array(ctx, xref_len, dedupe_entry);
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
+		/* Fingerprint every live object. Streams only ever compare equal
+		 * to other streams in deep mode, so skip them otherwise. */
+		n = 0;
+		for (num = 1; num < xref_len && num < opts->list_len; num++)
 		{
-			pdf_obj *a, *b;
-			int newnum;
-
-			if (num == other || num >= opts->list_len || !opts->use_list[num] || !opts->use_list[other])
+			if (!opts->use_list[num])
 				continue;
+			if (!deep && pdf_obj_num_is_stream(ctx, doc, num))
+				continue;
+			list[n].hash = dedupe_hash_obj(ctx, pdf_get_xref_entry_no_null(ctx, doc, num)->obj);
+			list[n].digest = 0;
+			list[n].num = num;
+			n++;
+		}
+		qsort(list, n, sizeof *list, dedupe_entry_cmp);
 
-			/* TODO: resolve indirect references to see if we can omit them */
+		for (s = 0; s < n; s = e)
+		{
+			for (e = s + 1; e < n && list[e].hash == list[s].hash; e++)
+				;
+			if (e - s < 2)
+				continue;
 
-			a = pdf_get_xref_entry_no_null(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry_no_null(ctx, doc, other)->obj;
-			if (opts->do_garbage >= 4)
+			/* Only load stream contents for streams whose dictionaries
+			 * collide, then split the bucket by content. */
+			if (deep)
 			{
-				if (pdf_objcmp_deep(ctx, a, b))
-					continue;
+				int streams = 0;
+				for (i = s; i < e; i++)
+				{
+					if (pdf_obj_num_is_stream(ctx, doc, list[i].num))
+					{
+						list[i].digest = dedupe_hash_stream(ctx, doc, list[i].num);
+						streams = 1;
+					}
+				}
+				if (streams)
+					qsort(list + s, e - s, sizeof *list, dedupe_entry_cmp);
 			}
-			else
+
+			/* Compare within the bucket in object number order, so the
+			 * lowest numbered of any set of duplicates is kept. */
+			for (i = s + 1; i < e; i++)
 			{
-				if (pdf_objcmp(ctx, a, b))
-					continue;
-			}
+				for (j = s; j < i; j++)
+				{
+					pdf_obj *a, *b;
+					int other = list[j].num;
+					int newnum;
 
-			/* Keep the lowest numbered object */
-			newnum = fz_mini(num, other);
-			opts->renumber_map[num] = newnum;
-			opts->renumber_map[other] = newnum;
-			opts->rev_renumber_map[newnum] = num; /* Either will do */
-			opts->use_list[fz_maxi(num, other)] = 0;
+					num = list[i].num;
+					if (list[j].digest != list[i].digest || !opts->use_list[other])
+						continue;
 
-			/* One duplicate was found, do not look for another */
-			break;
+					a = pdf_get_xref_entry_no_null(ctx, doc, num)->obj;
+					b = pdf_get_xref_entry_no_null(ctx, doc, other)->obj;
+					if (deep)
+					{
+						if (pdf_objcmp_deep(ctx, a, b))
+							continue;
+					}
+					else
+					{
+						if (pdf_objcmp(ctx, a, b))
+							continue;
+					}
+
+					/* Keep the lowest numbered object */
+					newnum = fz_mini(num, other);
+					opts->renumber_map[num] = newnum;
+					opts->renumber_map[other] = newnum;
+					opts->rev_renumber_map[newnum] = num; /* Either will do */
+					opts->use_list[fz_maxi(num, other)] = 0;
+
+					/* One duplicate was found, do not look for another */
+					break;
+				}
+			}
 		}
 	}
+	fz_always(ctx)
+		fz_free(ctx, list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 /*
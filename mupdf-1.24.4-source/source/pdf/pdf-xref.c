@@ -2103,6 +2103,139 @@ pdf_keep_document(fz_context *ctx, pdf_document *doc)
  * compressed object streams
  */
 
+/*
+	Object streams are decoded once, and the object numbers and offsets
+	in their headers indexed, into a pdf_obj_stm_index that is kept in
+	the store. Objects are then parsed out of it one at a time as they
+	are needed, so the work (and memory) spent on a huge file depends on
+	the objects that are actually used, not on the size of the file.
+*/
+typedef struct
+{
+	fz_storable storable;
+	pdf_obj *objstm; /* To notice the stream being replaced. */
+	fz_buffer *buf;
+	int64_t first;
+	int count;
+	int *num;
+	int64_t *ofs;
+} pdf_obj_stm_index;
+
+static void
+pdf_drop_obj_stm_index_imp(fz_context *ctx, fz_storable *idx_)
+{
+	pdf_obj_stm_index *idx = (pdf_obj_stm_index *)idx_;
+
+	pdf_drop_obj(ctx, idx->objstm);
+	fz_drop_buffer(ctx, idx->buf);
+	fz_free(ctx, idx->num);
+	fz_free(ctx, idx->ofs);
+	fz_free(ctx, idx);
+}
+
+static pdf_obj_stm_index *
+pdf_new_obj_stm_index(fz_context *ctx, pdf_obj *objstm)
+{
+	pdf_obj_stm_index *idx;
+
+	idx = fz_malloc_struct(ctx, pdf_obj_stm_index);
+	FZ_INIT_STORABLE(idx, 1, pdf_drop_obj_stm_index_imp);
+	idx->objstm = pdf_keep_obj(ctx, objstm);
+
+	fz_try(ctx)
+	{
+		idx->count = pdf_dict_get_int(ctx, objstm, PDF_NAME(N));
+		idx->first = pdf_dict_get_int(ctx, objstm, PDF_NAME(First));
+
+		if (idx->count < 0 || idx->count > PDF_MAX_OBJECT_NUMBER)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "number of objects in object stream out of range");
+
+		idx->num = fz_calloc(ctx, idx->count, sizeof(*idx->num));
+		idx->ofs = fz_calloc(ctx, idx->count, sizeof(*idx->ofs));
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_storable(ctx, &idx->storable);
+		fz_rethrow(ctx);
+	}
+
+	return idx;
+}
+
+/* Read the object numbers and offsets from the header of the decoded
+ * stream. This uses no document state. */
+static void
+pdf_parse_obj_stm_index(fz_context *ctx, pdf_obj_stm_index *idx, int num, pdf_lexbuf *buf)
+{
+	fz_stream *stm;
+	pdf_token tok;
+	int i;
+
+	stm = fz_open_buffer(ctx, idx->buf);
+	fz_try(ctx)
+	{
+		for (i = 0; i < idx->count; i++)
+		{
+			tok = pdf_lex(ctx, stm, buf);
+			if (tok != PDF_TOK_INT)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
+			idx->num[i] = buf->i;
+
+			tok = pdf_lex(ctx, stm, buf);
+			if (tok != PDF_TOK_INT)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
+			idx->ofs[i] = buf->i;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+pdf_check_obj_stm_index(fz_context *ctx, pdf_document *doc, pdf_obj_stm_index *idx)
+{
+	int xref_len = pdf_xref_len(ctx, doc);
+	int i;
+
+	for (i = 0; i < idx->count; i++)
+	{
+		if (idx->num[i] <= 0 || idx->num[i] >= xref_len)
+		{
+			fz_warn(ctx, "object stream object out of range, skipping");
+			idx->num[i] = 0;
+		}
+	}
+}
+
+static pdf_obj_stm_index *
+pdf_load_obj_stm_index(fz_context *ctx, pdf_document *doc, int num, pdf_obj *objstm, pdf_lexbuf *buf)
+{
+	pdf_obj_stm_index *idx;
+
+	idx = pdf_new_obj_stm_index(ctx, objstm);
+	fz_try(ctx)
+	{
+		idx->buf = pdf_load_stream_number(ctx, doc, num);
+		pdf_parse_obj_stm_index(ctx, idx, num, buf);
+		pdf_check_obj_stm_index(ctx, doc, idx);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_storable(ctx, &idx->storable);
+		fz_rethrow(ctx);
+	}
+
+	return idx;
+}
+
+static size_t
+pdf_obj_stm_index_size(pdf_obj_stm_index *idx)
+{
+	return sizeof(*idx) + idx->buf->len + idx->count * (sizeof(*idx->num) + sizeof(*idx->ofs));
+}
+
 /*
 	Do not hold pdf_xref_entry's over call to this function as they
 	may be invalidated!
@@ -2110,25 +2243,22 @@ pdf_keep_document(fz_context *ctx, pdf_document *doc)
 static pdf_xref_entry *
 pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, int target)
 {
-	fz_stream *stm = NULL;
+	pdf_obj_stm_index *idx = NULL;
 	pdf_obj *objstm = NULL;
-	int *numbuf = NULL;
-	int64_t *ofsbuf = NULL;
+	pdf_obj *key = NULL;
+	fz_stream *stm = NULL;
+	fz_stream *sub = NULL;
 
 	pdf_obj *obj;
-	int64_t first;
-	int count;
-	int i;
-	pdf_token tok;
+	pdf_xref_entry *entry;
 	pdf_xref_entry *ret_entry = NULL;
-	int ret_idx;
-	int xref_len;
-	int found;
-	fz_stream *sub = NULL;
+	uint64_t length;
+	int64_t offset;
+	int i;
 
-	fz_var(numbuf);
-	fz_var(ofsbuf);
+	fz_var(idx);
 	fz_var(objstm);
+	fz_var(key);
 	fz_var(stm);
 	fz_var(sub);
 
@@ -2149,60 +2279,50 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	{
 		(void)pdf_mark_obj(ctx, objstm);
 
-		count = pdf_dict_get_int(ctx, objstm, PDF_NAME(N));
-		first = pdf_dict_get_int(ctx, objstm, PDF_NAME(First));
-
-		if (count < 0 || count > PDF_MAX_OBJECT_NUMBER)
-			fz_throw(ctx, FZ_ERROR_FORMAT, "number of objects in object stream out of range");
-
-		numbuf = fz_calloc(ctx, count, sizeof(*numbuf));
-		ofsbuf = fz_calloc(ctx, count, sizeof(*ofsbuf));
-
-		xref_len = pdf_xref_len(ctx, doc);
-
-		found = 0;
-
-		stm = pdf_open_stream_number(ctx, doc, num);
-		for (i = 0; i < count; i++)
+		key = pdf_new_indirect(ctx, doc, num, 0);
+		idx = pdf_find_item(ctx, pdf_drop_obj_stm_index_imp, key);
+		if (idx && idx->objstm != objstm)
 		{
-			tok = pdf_lex(ctx, stm, buf);
-			if (tok != PDF_TOK_INT)
-				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
-			numbuf[found] = buf->i;
-
-			tok = pdf_lex(ctx, stm, buf);
-			if (tok != PDF_TOK_INT)
-				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
-			ofsbuf[found] = buf->i;
-
-			if (numbuf[found] <= 0 || numbuf[found] >= xref_len)
-				fz_warn(ctx, "object stream object out of range, skipping");
-			else
-				found++;
+			/* The object stream has been replaced since we indexed it. */
+			pdf_remove_item(ctx, pdf_drop_obj_stm_index_imp, key);
+			fz_drop_storable(ctx, &idx->storable);
+			idx = NULL;
+		}
+		if (!idx)
+		{
+			idx = pdf_load_obj_stm_index(ctx, doc, num, objstm, buf);
+			pdf_store_item(ctx, key, idx, pdf_obj_stm_index_size(idx));
 		}
 
-		ret_idx = -1;
-		for (i = 0; i < found; i++)
+		/* The xref gives the index of the object within the stream;
+		 * fall back to searching for it if that is wrong. */
+		entry = pdf_get_xref_entry_no_null(ctx, doc, target);
+		i = entry->gen;
+		if (i >= idx->count || idx->num[i] != target)
 		{
-			pdf_xref_entry *entry;
-			uint64_t length;
-			int64_t offset;
+			for (i = 0; i < idx->count; i++)
+				if (idx->num[i] == target)
+					break;
+		}
 
-			offset = first + ofsbuf[i];
-			if (i+1 < found)
-				length = ofsbuf[i+1] - ofsbuf[i];
+		if (i < idx->count)
+		{
+			offset = idx->first + idx->ofs[i];
+			if (i+1 < idx->count)
+				length = idx->ofs[i+1] - idx->ofs[i];
 			else
 				length = UINT64_MAX;
 
+			stm = fz_open_buffer(ctx, idx->buf);
 			sub = fz_open_null_filter(ctx, stm, length, offset);
 
 			obj = pdf_parse_stm_obj(ctx, doc, sub, buf);
-			fz_drop_stream(ctx, sub);
-			sub = NULL;
 
-			entry = pdf_get_xref_entry_no_null(ctx, doc, numbuf[i]);
+			/* Parsing can cause the xref to be solidified, which
+			 * will move the entry, so look it up again. */
+			entry = pdf_get_xref_entry_no_null(ctx, doc, target);
 
-			pdf_set_obj_parent(ctx, obj, numbuf[i]);
+			pdf_set_obj_parent(ctx, obj, target);
 
 			/* We may have set entry->type to be 'O' from being 'o' to avoid nasty
 			 * recursions in pdf_cache_object. Accept the type being 'O' here. */
@@ -2217,7 +2337,7 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 				if (entry->obj)
 				{
 					if (pdf_objcmp(ctx, entry->obj, obj))
-						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", numbuf[i]);
+						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", target);
 					pdf_drop_obj(ctx, obj);
 				}
 				else
@@ -2226,27 +2346,21 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 					fz_drop_buffer(ctx, entry->stm_buf);
 					entry->stm_buf = NULL;
 				}
-				if (numbuf[i] == target)
-					ret_idx = i;
+				ret_entry = entry;
 			}
 			else
 			{
 				pdf_drop_obj(ctx, obj);
 			}
 		}
-		/* Parsing our way through the stream can cause the xref to be
-		 * solidified, which will move an entry. We therefore can't
-		 * read the entry for returning until no more parsing is to be
-		 * done. Thus we end up reading this entry twice. */
-		if (ret_idx >= 0)
-			ret_entry = pdf_get_xref_entry_no_null(ctx, doc, numbuf[ret_idx]);
 	}
 	fz_always(ctx)
 	{
-		fz_drop_stream(ctx, stm);
 		fz_drop_stream(ctx, sub);
-		fz_free(ctx, ofsbuf);
-		fz_free(ctx, numbuf);
+		fz_drop_stream(ctx, stm);
+		if (idx)
+			fz_drop_storable(ctx, &idx->storable);
+		pdf_drop_obj(ctx, key);
 		pdf_unmark_obj(ctx, objstm);
 		pdf_drop_obj(ctx, objstm);
 	}
@@ -2257,6 +2371,256 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	return ret_entry;
 }
 
+/*
+ * Decoding object streams ahead of time, possibly on other threads.
+ */
+
+typedef struct
+{
+	int num;
+	pdf_obj_stm_index *idx;
+	fz_compressed_buffer *data;
+	size_t len;
+	int decoded;
+} pdf_obj_stm_prefetch_job;
+
+struct pdf_obj_stm_prefetch
+{
+	int len, cap;
+	pdf_obj_stm_prefetch_job *job;
+};
+
+void
+pdf_drop_obj_stm_prefetch(fz_context *ctx, pdf_obj_stm_prefetch *pf)
+{
+	int i;
+
+	if (!pf)
+		return;
+	for (i = 0; i < pf->len; i++)
+	{
+		if (pf->job[i].idx)
+			fz_drop_storable(ctx, &pf->job[i].idx->storable);
+		fz_drop_compressed_buffer(ctx, pf->job[i].data);
+	}
+	fz_free(ctx, pf->job);
+	fz_free(ctx, pf);
+}
+
+/* Read the encoded data for object stream num, unless it is indexed
+ * already or needs a filter that we don't decode ahead of time. */
+static void
+add_obj_stm_prefetch_job(fz_context *ctx, pdf_document *doc, pdf_obj_stm_prefetch *pf, int num)
+{
+	pdf_obj_stm_prefetch_job *job;
+	pdf_obj_stm_index *idx = NULL;
+	fz_compressed_buffer *data = NULL;
+	pdf_obj *objstm = NULL;
+	pdf_obj *key;
+	size_t len = 0;
+
+	fz_var(idx);
+	fz_var(data);
+	fz_var(objstm);
+
+	key = pdf_new_indirect(ctx, doc, num, 0);
+	fz_try(ctx)
+	{
+		idx = pdf_find_item(ctx, pdf_drop_obj_stm_index_imp, key);
+		if (idx)
+		{
+			fz_drop_storable(ctx, &idx->storable);
+			idx = NULL;
+			break;
+		}
+
+		if (!pdf_obj_num_is_stream(ctx, doc, num))
+			break;
+		objstm = pdf_load_object(ctx, doc, num);
+		idx = pdf_new_obj_stm_index(ctx, objstm);
+		len = pdf_guess_stream_length(ctx, objstm);
+		data = pdf_load_compressed_stream(ctx, doc, num, 0);
+		switch (data->params.type)
+		{
+		case FZ_IMAGE_RAW:
+		case FZ_IMAGE_FLATE:
+		case FZ_IMAGE_LZW:
+		case FZ_IMAGE_RLD:
+			break;
+		default:
+			fz_drop_compressed_buffer(ctx, data);
+			data = NULL;
+			break;
+		}
+		if (!data)
+			break;
+
+		if (pf->len == pf->cap)
+		{
+			int newcap = pf->cap ? pf->cap * 2 : 64;
+			pf->job = fz_realloc_array(ctx, pf->job, newcap, pdf_obj_stm_prefetch_job);
+			pf->cap = newcap;
+		}
+		job = &pf->job[pf->len++];
+		job->num = num;
+		job->idx = idx;
+		job->data = data;
+		job->len = len;
+		job->decoded = 0;
+		idx = NULL;
+		data = NULL;
+	}
+	fz_always(ctx)
+	{
+		if (idx)
+			fz_drop_storable(ctx, &idx->storable);
+		fz_drop_compressed_buffer(ctx, data);
+		pdf_drop_obj(ctx, objstm);
+		pdf_drop_obj(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		/* Leave it to be loaded (and reported) as usual. */
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_ignore_error(ctx);
+	}
+}
+
+pdf_obj_stm_prefetch *
+pdf_new_obj_stm_prefetch(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj_stm_prefetch *pf;
+	unsigned char *seen = NULL;
+	pdf_xref_entry *x;
+	int i, xref_len;
+
+	fz_var(seen);
+
+	pf = fz_malloc_struct(ctx, pdf_obj_stm_prefetch);
+	fz_try(ctx)
+	{
+		xref_len = pdf_xref_len(ctx, doc);
+		seen = fz_calloc(ctx, xref_len, 1);
+		for (i = 1; i < xref_len; i++)
+		{
+			x = pdf_get_xref_entry_no_change(ctx, doc, i);
+			if (!x || x->type != 'o' || x->obj)
+				continue;
+			if (x->ofs <= 0 || x->ofs >= xref_len || seen[x->ofs])
+				continue;
+			seen[x->ofs] = 1;
+			add_obj_stm_prefetch_job(ctx, doc, pf, (int)x->ofs);
+			/* Loading may have changed the xref. */
+			xref_len = fz_mini(xref_len, pdf_xref_len(ctx, doc));
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, seen);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj_stm_prefetch(ctx, pf);
+		fz_rethrow(ctx);
+	}
+
+	return pf;
+}
+
+int
+pdf_count_obj_stm_prefetch(fz_context *ctx, pdf_obj_stm_prefetch *pf)
+{
+	return pf ? pf->len : 0;
+}
+
+void
+pdf_run_obj_stm_prefetch(fz_context *ctx, pdf_obj_stm_prefetch *pf, int i)
+{
+	pdf_obj_stm_prefetch_job *job;
+	fz_stream *stm = NULL;
+	fz_stream *decomp = NULL;
+	pdf_lexbuf buf;
+
+	if (!pf || i < 0 || i >= pf->len)
+		return;
+	job = &pf->job[i];
+
+	fz_var(stm);
+	fz_var(decomp);
+
+	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
+	fz_try(ctx)
+	{
+		stm = fz_open_buffer(ctx, job->data->buffer);
+		if (job->data->params.type != FZ_IMAGE_RAW)
+			decomp = fz_open_image_decomp_stream(ctx, stm, &job->data->params, NULL);
+		/* Read as pdf_load_stream_number would, bomb check and all. */
+		job->idx->buf = fz_read_all(ctx, decomp ? decomp : stm, job->len);
+		pdf_parse_obj_stm_index(ctx, job->idx, job->num, &buf);
+		job->decoded = 1;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, decomp);
+		fz_drop_stream(ctx, stm);
+		pdf_lexbuf_fin(ctx, &buf);
+	}
+	fz_catch(ctx)
+	{
+		/* Leave it to be loaded (and reported) as usual. */
+		fz_ignore_error(ctx);
+	}
+}
+
+int
+pdf_commit_obj_stm_prefetch(fz_context *ctx, pdf_document *doc, pdf_obj_stm_prefetch *pf)
+{
+	pdf_obj_stm_prefetch_job *job;
+	pdf_obj_stm_index *idx;
+	pdf_obj *objstm = NULL;
+	pdf_obj *key = NULL;
+	int i, n = 0;
+
+	fz_var(objstm);
+	fz_var(key);
+
+	for (i = 0; i < pdf_count_obj_stm_prefetch(ctx, pf); i++)
+	{
+		job = &pf->job[i];
+		if (!job->decoded)
+			continue;
+		fz_try(ctx)
+		{
+			key = pdf_new_indirect(ctx, doc, job->num, 0);
+			idx = pdf_find_item(ctx, pdf_drop_obj_stm_index_imp, key);
+			if (idx)
+			{
+				fz_drop_storable(ctx, &idx->storable);
+				break;
+			}
+			/* Only if the stream hasn't been replaced meanwhile. */
+			objstm = pdf_load_object(ctx, doc, job->num);
+			if (objstm != job->idx->objstm)
+				break;
+			pdf_check_obj_stm_index(ctx, doc, job->idx);
+			pdf_store_item(ctx, key, job->idx, pdf_obj_stm_index_size(job->idx));
+			n++;
+		}
+		fz_always(ctx)
+		{
+			pdf_drop_obj(ctx, objstm);
+			pdf_drop_obj(ctx, key);
+			objstm = NULL;
+			key = NULL;
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+			fz_ignore_error(ctx);
+		}
+	}
+
+	return n;
+}
+
 /*
  * object loading
  */
@@ -2833,6 +3197,7 @@ pdf_delete_object(fz_context *ctx, pdf_document *doc, int num)
 	}
 
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
+	doc->change_count++;
 
 	fz_drop_buffer(ctx, x->stm_buf);
 	pdf_drop_obj(ctx, x->obj);
@@ -2936,6 +3301,7 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 	}
 
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
+	doc->change_count++;
 
 	pdf_drop_obj(ctx, x->obj);
 
@@ -2946,6 +3312,12 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 	pdf_set_obj_parent(ctx, newobj, num);
 }
 
+int
+pdf_change_count(fz_context *ctx, pdf_document *doc)
+{
+	return doc->change_count;
+}
+
 void
 pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *newbuf, int compressed)
 {
@@ -2975,6 +3347,7 @@ pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *n
 		}
 
 		x = pdf_get_xref_entry_no_null(ctx, doc, num);
+		doc->change_count++;
 	}
 
 	fz_drop_buffer(ctx, x->stm_buf);
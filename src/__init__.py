@@ -2568,6 +2568,18 @@ class DeviceWrapper:
             raise Exception( f'Unrecognised args for DeviceWrapper: {args!r}')
 
 
+class _SearchNeedles:
+    '''Needles compiled once for searching any number of pages.'''
+
+    def __init__(self, needles):
+        self.this = extra.JM_new_search_needles(needles)
+
+    def __del__(self):
+        if getattr(self, 'this', None):
+            extra.JM_drop_search_needles(self.this)
+            self.this = None
+
+
 class DisplayList:
     def __del__(self):
         if not type(self) is DisplayList: return
@@ -2581,20 +2593,87 @@ class DisplayList:
         else:
             assert 0, f'Unrecognised {args=}'
 
-    def get_pixmap(self, matrix=None, colorspace=None, alpha=0, clip=None):
+    def build_index(self):
+        """Build a spatial index so that rendering small areas can skip
+        commands lying outside of them.
+
+        Call this before sharing the display list between threads.
+        """
+        mupdf.fz_index_display_list(self.this)
+
+    @staticmethod
+    def frombytes(data):
+        """Make a DisplayList from data created by DisplayList.tobytes()."""
+        stm = mupdf.fz_open_buffer(JM_BufferFromBytes(data))
+        return DisplayList(mupdf.fz_load_display_list(stm))
+
+    def get_pixmap(self, matrix=None, colorspace=None, alpha=0, clip=None, threads=1, preview=False, out=None):
+        '''
+        If `threads` > 1, the pixmap is split into horizontal bands that are
+        rendered concurrently from this display list.
+
+        If `preview` is true, images are drawn from coarse decodes, which are
+        much quicker. The pixmap's `preview_rects` then lists the areas
+        covered by images, for redrawing with Page.refine_pixmap().
+
+        If `out` is not None, it is a writable buffer, for example a numpy
+        uint8 array of shape (height, width, n), that is rendered into instead
+        of newly allocated memory. Rows may be padded, as in a slice of a
+        larger array. The returned pixmap shares this memory.
+        '''
         if isinstance(colorspace, Colorspace):
             colorspace = colorspace.this
         else:
             colorspace = mupdf.FzColorspace(mupdf.FzColorspace.Fixed_RGB)
-        val = JM_pixmap_from_display_list(self.this, matrix, colorspace, alpha, clip, None)
+        hints = mupdf.FZ_PREVIEW_IMAGES if preview else 0
+        if out is not None:
+            # The pixmap's samples will be in `out`. Holding a memoryview
+            # keeps its memory exported, so it cannot be resized or freed
+            # while the pixmap exists.
+            out = memoryview(out)
+        if g_use_extra:
+            # Renders with the GIL released, so can run concurrently with
+            # other threads.
+            pix = extra.JM_pixmap_from_display_list_nogil(self.this, matrix, colorspace, alpha, clip, threads, hints, out)
+            val = Pixmap('raw', mupdf.FzPixmap(pix))
+        else:
+            val = JM_pixmap_from_display_list(self.this, matrix, colorspace, alpha, clip, None, hints)
+            if out is not None:
+                # Cannot render in place here, so copy the samples into
+                # `out`, which must not have padded rows.
+                if not out.c_contiguous:
+                    raise ValueError('out: buffer is not contiguous')
+                mv = out.cast('B')
+                samples = val.samples_mv
+                if len(mv) < len(samples):
+                    raise ValueError('out: buffer is too small')
+                mv[:len(samples)] = samples
+        if out is not None:
+            val._out = out
         val.thisown = True
+        if preview:
+            rects = []
+            dev = JM_new_image_bbox_device_Device(rects)
+            mupdf.fz_run_display_list(self.this, dev, JM_matrix_from_py(matrix), JM_rect_from_py(clip), mupdf.FzCookie())
+            mupdf.fz_close_device(dev)
+            val.preview_rects = []
+            for _, r in rects:
+                r = Rect(r).round() & val.irect
+                if not r.is_empty:
+                    val.preview_rects.append(r)
+            # Remembered for Page.refine_pixmap().
+            val._preview = (self, Matrix(matrix) if matrix is not None else Matrix(1, 1))
         return val
 
     def get_textpage(self, flags=3):
         """Make a TextPage from a DisplayList."""
-        stext_options = mupdf.FzStextOptions()
-        stext_options.flags = flags
-        val = mupdf.FzStextPage(self.this, stext_options)
+        if g_use_extra:
+            # Runs with the GIL released.
+            val = mupdf.FzStextPage(extra.JM_new_stext_page_from_display_list_nogil(self.this, flags))
+        else:
+            stext_options = mupdf.FzStextOptions()
+            stext_options.flags = flags
+            val = mupdf.FzStextPage(self.this, stext_options)
         val.thisown = True
         return val
 
@@ -2613,6 +2692,19 @@ class DisplayList:
                 mupdf.FzCookie(),
                 )
 
+    def tobytes(self):
+        """Serialize the display list to a bytes object.
+
+        Images, fonts and shadings are stored once each, so the result can
+        be cached or passed to another process and loaded with
+        DisplayList.frombytes() much faster than interpreting the page again.
+        """
+        res = mupdf.fz_new_buffer(1024)
+        out = mupdf.FzOutput(res)
+        mupdf.fz_save_display_list(self.this, out)
+        out.fz_close_output()
+        return JM_BinFromBuffer(res)
+
 if g_use_extra:
     extra_FzDocument_insert_pdf = extra.FzDocument_insert_pdf
 
@@ -3457,6 +3549,7 @@ class Document:
                 page._erase()
                 page = None
         self._page_refs.clear()
+        self._search_index = None
 
     def _set_page_labels(self, labels):
         pdf = _as_pdf_document(self)
@@ -4096,6 +4189,7 @@ class Document:
             preserve_metadata=1,
             use_objstms=1,
             compression_effort=0,
+            threads=1,
             ):
         '''
         Save PDF using some different defaults
@@ -4120,6 +4214,7 @@ class Document:
                 preserve_metadata=preserve_metadata,
                 use_objstms=use_objstms,
                 compression_effort=compression_effort,
+                threads=threads,
                 )
 
     def find_bookmark(self, bm):
@@ -5361,6 +5456,74 @@ class Document:
         self._resolved_names = dest_dict  # store result or reuse
         return dest_dict
 
+    def rewrite_images(
+            self,
+            dpi_threshold=None,
+            dpi_target=0,
+            quality=0,
+            lossy=True,
+            lossless=True,
+            bitonal=True,
+            color=True,
+            gray=True,
+            options=None,
+            threads=1,
+            ):
+        """Reduce the resolution of images and recompress them.
+
+        Images shown at more than `dpi_threshold` dpi are resampled to about
+        `dpi_target` dpi, and recompressed as JPEG (color or gray) or CCITT
+        fax (bitonal) with `quality`. Images used more than once are handled
+        once, at the highest resolution needed. `options` may be a complete
+        mupdf.PdfImageRewriterOptions instead. If `threads` > 1, that many
+        images are recompressed concurrently; the result is the same.
+        """
+        if self.is_closed or self.is_encrypted:
+            raise ValueError("document closed or encrypted")
+        pdf = _as_pdf_document(self)
+        if options is None:
+            if not dpi_threshold or not dpi_target:
+                raise ValueError("need dpi_threshold and dpi_target")
+            if dpi_target >= dpi_threshold:
+                raise ValueError(f"{dpi_target=} must be less than {dpi_threshold=}")
+            quality = str(quality)
+            options = mupdf.PdfImageRewriterOptions()
+            if bitonal:
+                options.bitonal_image_subsample_method = mupdf.FZ_SUBSAMPLE_AVERAGE
+                options.bitonal_image_subsample_threshold = dpi_threshold
+                options.bitonal_image_subsample_to = dpi_target
+                options.bitonal_image_recompress_method = mupdf.FZ_RECOMPRESS_FAX
+                options.bitonal_image_recompress_quality = quality
+            if color and lossy:
+                options.color_lossy_image_subsample_method = mupdf.FZ_SUBSAMPLE_AVERAGE
+                options.color_lossy_image_subsample_threshold = dpi_threshold
+                options.color_lossy_image_subsample_to = dpi_target
+                options.color_lossy_image_recompress_method = mupdf.FZ_RECOMPRESS_JPEG
+                options.color_lossy_image_recompress_quality = quality
+            if color and lossless:
+                options.color_lossless_image_subsample_method = mupdf.FZ_SUBSAMPLE_AVERAGE
+                options.color_lossless_image_subsample_threshold = dpi_threshold
+                options.color_lossless_image_subsample_to = dpi_target
+                options.color_lossless_image_recompress_method = mupdf.FZ_RECOMPRESS_JPEG
+                options.color_lossless_image_recompress_quality = quality
+            if gray and lossy:
+                options.gray_lossy_image_subsample_method = mupdf.FZ_SUBSAMPLE_AVERAGE
+                options.gray_lossy_image_subsample_threshold = dpi_threshold
+                options.gray_lossy_image_subsample_to = dpi_target
+                options.gray_lossy_image_recompress_method = mupdf.FZ_RECOMPRESS_JPEG
+                options.gray_lossy_image_recompress_quality = quality
+            if gray and lossless:
+                options.gray_lossless_image_subsample_method = mupdf.FZ_SUBSAMPLE_AVERAGE
+                options.gray_lossless_image_subsample_threshold = dpi_threshold
+                options.gray_lossless_image_subsample_to = dpi_target
+                options.gray_lossless_image_recompress_method = mupdf.FZ_RECOMPRESS_JPEG
+                options.gray_lossless_image_recompress_quality = quality
+        if g_use_extra:
+            # Runs with the GIL released.
+            extra.JM_rewrite_images(pdf, options, threads)
+        else:
+            mupdf.pdf_rewrite_images(pdf, options)
+
     def save(
             self,
             filename,
@@ -5383,10 +5546,15 @@ class Document:
             preserve_metadata=1,
             use_objstms=0,
             compression_effort=0,
+            threads=1,
             ):
         # From %pythonprepend save
         #
-        """Save PDF to file, pathlib.Path or file pointer."""
+        """Save PDF to file, pathlib.Path or file pointer.
+
+        If `threads` > 1, the object streams of the document are decompressed
+        concurrently before writing.
+        """
         if self.is_closed or self.is_encrypted:
             raise ValueError("document closed or encrypted")
         if type(filename) is str:
@@ -5439,6 +5607,10 @@ class Document:
         JM_embedded_clean(pdf)
         if no_new_id == 0:
             JM_ensure_identity(pdf)
+        if threads > 1 and not incremental and g_use_extra:
+            # Writing loads every object, so have their object streams
+            # decompressed up front, with the GIL released.
+            extra.JM_prefetch_obj_stms(pdf, threads)
         if isinstance(filename, str):
             #log( 'calling mupdf.pdf_save_document()')
             mupdf.pdf_save_document(pdf, filename, opts)
@@ -5469,6 +5641,209 @@ class Document:
         """ Save PDF incrementally"""
         return self.save(self.name, incremental=True, encryption=mupdf.PDF_ENCRYPT_KEEP)
 
+    def render_pages(self, pages=None, *, matrix=None, dpi=None, colorspace=None, alpha=False, annots=True, out=None, threads=1):
+        """Render many pages into one buffer in a single call.
+
+        Args:
+            pages: iterable of page numbers, default all pages.
+            matrix: (matrix_like) transformation, default Identity.
+            dpi: desired dots per inch. If given, matrix is ignored.
+            colorspace: (str/Colorspace) rgb, gray or cmyk, default csRGB.
+            alpha: (bool) whether to include an alpha channel.
+            annots: (bool) whether to also render annotations.
+            out: (buffer) writable, contiguous buffer to render into, e.g. a
+                numpy uint8 array. If it has shape (count, height, width, n),
+                its height and width are used for the pages.
+            threads: (int) render this many pages at a time.
+        Returns:
+            (buffer, shape): buffer holds the pixels, and is `out` if given,
+            else a new bytearray. shape is (count, height, width, n), with
+            height and width those of the largest page unless given by `out`.
+            Each page's pixels start at the top left of its height * width
+            slot, and the rest of the slot is cleared like an empty page.
+        """
+        if self.is_closed or self.is_encrypted:
+            raise ValueError("document closed or encrypted")
+        page_count = self.page_count
+        if pages is None:
+            pages = range(page_count)
+        pages = list(pages)
+        for pno in pages:
+            if not 0 <= pno < page_count:
+                raise ValueError(MSG_BAD_PAGENO)
+        if dpi:
+            zoom = dpi / 72
+            matrix = Matrix(zoom, zoom)
+        elif matrix is None:
+            matrix = Matrix(1, 1)
+        else:
+            matrix = Matrix(matrix)
+        if colorspace is None:
+            colorspace = csRGB
+        elif type(colorspace) is str:
+            colorspace = {"GRAY": csGRAY, "CMYK": csCMYK}.get(colorspace.upper(), csRGB)
+        if colorspace.n not in (1, 3, 4):
+            raise ValueError("unsupported colorspace")
+        n = colorspace.n + (1 if alpha else 0)
+
+        shape = None
+        if out is not None and memoryview(out).ndim == 4:
+            _, h, w, out_n = memoryview(out).shape
+            if out_n != n:
+                raise ValueError("out: shape does not match colorspace")
+            shape = (len(pages), h, w, n)
+        if shape is None:
+            if g_use_extra:
+                w, h = extra.JM_bound_pages(_as_fz_document(self), pages, matrix)
+            else:
+                w = h = 0
+                for pno in pages:
+                    irect = (self[pno].rect * matrix).round()
+                    w = max(w, irect.width)
+                    h = max(h, irect.height)
+            shape = (len(pages), h, w, n)
+        if out is None:
+            out = bytearray(len(pages) * h * w * n)
+
+        if g_use_extra:
+            # Renders with the GIL released, into `out` directly.
+            extra.JM_render_pages_nogil(
+                    _as_fz_document(self), pages, matrix, colorspace.this, alpha, annots, out, w, h, threads,
+                    )
+        else:
+            mv = memoryview(out).cast('B')
+            size = h * w * n
+            if len(mv) < len(pages) * size:
+                raise ValueError("out: buffer is too small")
+            blank = bytes([0 if alpha or colorspace.n == 4 else 255]) * size
+            for i, pno in enumerate(pages):
+                pix = self[pno].get_pixmap(matrix=matrix, colorspace=colorspace, alpha=alpha, annots=annots)
+                samples = pix.samples_mv
+                row = min(w, pix.width) * n
+                mv[i * size : (i + 1) * size] = blank
+                for y in range(min(h, pix.height)):
+                    start = i * size + y * w * n
+                    mv[start : start + row] = samples[y * pix.stride : y * pix.stride + row]
+        return out, shape
+
+    def search(self, needles, pages=None, quads=False, flags=None, index=False):
+        """Search pages for many strings at once.
+
+        Args:
+            needles: sequence of strings to search for.
+            pages: iterable of page numbers, default all pages.
+            quads: (bool) return quads instead of rectangles.
+            flags: text extraction flags, default as in Page.search_for().
+            index: (bool) use and extend the document's search index, which
+                lets repeated searches skip pages not containing any needle.
+        Returns:
+            a list of (pno, needle_index, areas) items, one per occurrence,
+            where areas are the rectangles or quads covering it.
+        """
+        if self.is_closed or self.is_encrypted:
+            raise ValueError("document closed or encrypted")
+        needles = list(needles)
+        if pages is None:
+            pages = range(self.page_count)
+        if flags is None:
+            flags = (0
+                    | TEXT_DEHYPHENATE
+                    | TEXT_PRESERVE_WHITESPACE
+                    | TEXT_PRESERVE_LIGATURES
+                    | TEXT_MEDIABOX_CLIP
+                    )
+        results = []
+
+        def areas(val):
+            val = [Quad(q) for q in val]
+            if quads:
+                return val
+            val = [q.rect for q in val]
+            i = 0  # join overlapping rects on the same line
+            while i < len(val) - 1:
+                v1 = val[i]
+                v2 = val[i + 1]
+                if v1.y1 != v2.y1 or (v1 & v2).is_empty:
+                    i += 1
+                    continue
+                val[i] = v1 | v2
+                del val[i + 1]
+            return val
+
+        if not g_use_extra:
+            # No multi-needle search: search for each needle separately and
+            # report the hits like the native search does, in the order in
+            # which they end on the page, longer ones first.
+            for pno in pages:
+                tp = self[pno].get_textpage(flags=flags)
+                hits = []
+                for i, needle in enumerate(needles):
+                    found = []
+                    JM_search_stext_page(tp.this, needle, found)
+                    hits += [(end, begin, -i, val) for begin, end, val in found]
+                hits.sort(key=lambda hit: hit[:3])
+                for end, begin, i, val in hits:
+                    results.append((pno, -i, areas(val)))
+            return results
+
+        compiled = _SearchNeedles(needles)
+        idx = None
+        candidates = None
+        if index:
+            # The index maps each word to the pages containing it. Every
+            # run of non-space characters in a needle lies within a word of
+            # any page it occurs on, so pages without a word containing the
+            # longest such run of some needle can be skipped. It is discarded
+            # when any object of the document has changed.
+            pdf = _as_pdf_document(self, required=0)
+            changes = mupdf.pdf_change_count(pdf) if pdf.m_internal else 0
+            if not getattr(self, "_search_index", None) or self._search_index[0] != changes:
+                self._search_index = (changes, dict())
+            idx = self._search_index[1].setdefault(flags, (set(), dict()))
+            tokens = [
+                    max(re.split('[ \t\r\n\u00a0\u2028\u2029]+', n), key=len)
+                    for n in needles
+                    ]
+            if idx[0] and all(tokens):
+                words = list(idx[1])
+                compiled_tokens = _SearchNeedles(tokens)
+                found = extra.JM_search_needles_in_words(compiled_tokens.this, words)
+                candidates = set()
+                for word_indices in found:
+                    for w in word_indices:
+                        candidates |= idx[1][words[w]]
+
+        for pno in pages:
+            if candidates is not None and pno in idx[0] and pno not in candidates:
+                continue
+            tp = self[pno].get_textpage(flags=flags)
+            for i, val in extra.JM_search_stext_page_needles(tp.this.m_internal, compiled.this):
+                results.append((pno, i, areas(val)))
+            if idx is not None and pno not in idx[0]:
+                for word in extra.JM_stext_page_words(tp.this.m_internal):
+                    idx[1].setdefault(word, set()).add(pno)
+                idx[0].add(pno)
+        return results
+
+    def iter_text(self, pages=None, flags=None):
+        """Iterate over the plain text of pages.
+
+        Args:
+            pages: iterable of page numbers, default all pages.
+            flags: text extraction flags, default as in Page.get_text().
+        Yields:
+            the text of each page, equal to Page.get_text(), without making
+            a TextPage.
+        """
+        if self.is_closed or self.is_encrypted:
+            raise ValueError("document closed or encrypted")
+        if pages is None:
+            pages = range(self.page_count)
+        if flags is None:
+            flags = TEXTFLAGS_TEXT
+        for pno in pages:
+            yield self[pno]._stream_text(None, flags)
+
     def select(self, pyliste):
         """Build sub-pdf with page numbers in the list."""
         if self.is_closed or self.is_encrypted:
@@ -5746,6 +6121,7 @@ class Document:
             preserve_metadata=1,
             use_objstms=0,
             compression_effort=0,
+            threads=1,
     ):
         from io import BytesIO
         bio = BytesIO()
@@ -5770,6 +6146,7 @@ class Document:
                 preserve_metadata=preserve_metadata,
                 use_objstms=use_objstms,
                 compression_effort=compression_effort,
+                threads=threads,
         )
         return bio.getvalue()
 
@@ -9233,6 +9610,47 @@ class Page:
         textpage.parent = weakref.proxy(self)
         return textpage
 
+    def _stream_text(self, clip=None, flags=0, delimiters=None, words=False, callback=None):
+        """Return the text or words of the page without making a TextPage.
+
+        The result equals that of TextPage.extractText() or
+        TextPage.extractWORDS(). If callback is given, it is instead called
+        with the list of words of each line as soon as the line is complete.
+        """
+        CheckParent(self)
+        old_rotation = self.rotation
+        if old_rotation != 0:
+            self.set_rotation(0)
+        try:
+            if g_use_extra:
+                # Lines are streamed to native code with the GIL released.
+                return extra.JM_page_stream_text(self.this, clip, flags, delimiters, words, callback)
+            tp = TextPage(self._get_textpage(clip, flags=flags))
+            if words:
+                if callback:
+                    callback(tp.extractWORDS(delimiters))
+                    return
+                return tp.extractWORDS(delimiters)
+            return tp.extractText()
+        finally:
+            if old_rotation != 0:
+                self.set_rotation(old_rotation)
+
+    def iter_words(self, clip=None, flags=None, delimiters=None):
+        """Iterate over the words of the page.
+
+        Yields the same items as get_text("words"), but the page's text is
+        never stored in a TextPage. The page is interpreted on the calling
+        thread before the first word is yielded, so the caller may change
+        the document while iterating.
+        """
+        if flags is None:
+            flags = TEXTFLAGS_WORDS
+        lines = []
+        self._stream_text(clip, flags, delimiters, words=True, callback=lines.append)
+        for line in lines:
+            yield from line
+
     def get_texttrace(self):
 
         CheckParent(self)
@@ -10184,15 +10602,71 @@ class Pixmap:
     @property
     def samples(self)->bytes:
         mv = self.samples_mv
-        return bytes( mv)
+        n = self.width * self.n
+        stride = self.stride
+        if stride == n:
+            return bytes( mv)
+        # Rows are padded, e.g. in a slice of a larger array passed as `out`
+        # to get_pixmap(), so copy the rows without the padding.
+        return b''.join( mv[ y * stride : y * stride + n] for y in range( self.height))
 
     @property
     def samples_mv(self):
         '''
-        Pixmap samples memoryview.
+        Pixmap samples memoryview. It keeps the samples alive, so remains
+        valid after the Pixmap has been dropped.
         '''
+        if g_use_extra:
+            return self._samples_buffer(1)
         return mupdf.fz_pixmap_samples_memoryview(self.this)
 
+    def _samples_buffer(self, flat):
+        '''
+        Returns a memoryview of a new native buffer over the samples. The
+        buffers are remembered while they are exported, so that shrink() can
+        refuse to reallocate the samples.
+        '''
+        buffer = extra.JM_pixmap_buffer(self.this, flat, getattr(self, '_out', None))
+        self._buffers = [b for b in getattr(self, '_buffers', []) if extra.JM_pixmap_buffer_exports(b)]
+        self._buffers.append(buffer)
+        return memoryview(buffer)
+
+    def _samples_exported(self):
+        '''
+        True if memory views or arrays of the samples may still exist.
+        '''
+        if getattr(self, '_array_exported', False):
+            return True
+        return any(extra.JM_pixmap_buffer_exports(b) for b in getattr(self, '_buffers', []))
+
+    def __buffer__(self, flags):
+        '''
+        Buffer protocol (Python >= 3.12): the samples, without copying, as
+        shape (height, width, n) bytes.
+        '''
+        if g_use_extra:
+            return self._samples_buffer(0)
+        mv = mupdf.fz_pixmap_samples_memoryview(self.this)
+        return mv.cast('B', (self.height, self.width, self.n))
+
+    @property
+    def __array_interface__(self):
+        '''
+        NumPy array interface: the samples, without copying, as a uint8 array
+        of shape (height, width, n). The array keeps this Pixmap alive.
+        '''
+        # We cannot tell when the array is released, so the samples count as
+        # exported from now on.
+        self._array_exported = True
+        return dict(
+                shape=(self.height, self.width, self.n),
+                typestr='|u1',
+                data=(self.samples_ptr, False),
+                # None means C-contiguous.
+                strides=None if self.stride == self.width * self.n else (self.stride, self.n, 1),
+                version=3,
+                )
+
     @property
     def samples_ptr(self):
         return mupdf.fz_pixmap_samples_int(self.this)
@@ -10238,6 +10712,22 @@ class Pixmap:
             self.set_dpi(self.xres, self.yres)
         return self._writeIMG(filename, idx, jpg_quality)
 
+    def scale(self, width, height, clip=None, threads=1):
+        """Return a copy scaled to width x height pixels, optionally clipped.
+
+        If `threads` > 1, the rows of the result are split into horizontal
+        bands that are scaled concurrently. The result is the same.
+        """
+        if g_use_extra:
+            pm = extra.JM_scale_pixmap_nogil(self.this, width, height, clip, threads)
+            pm = mupdf.FzPixmap(pm)
+        else:
+            bbox = JM_irect_from_py(clip)
+            pm = mupdf.fz_scale_pixmap(self.this, self.this.x(), self.this.y(), width, height, bbox)
+        if not pm.m_internal:
+            raise ValueError("cannot scale pixmap")
+        return Pixmap('raw', pm)
+
     def set_alpha(self, alphavalues=None, premultiply=1, opaque=None, matte=None):
         """Set alpha channel to values contained in a byte array.
         If omitted, set alphas to 255.
@@ -10417,10 +10907,22 @@ class Pixmap:
 
     def shrink(self, factor):
         """Divide width and height by 2**factor.
-        E.g. factor=1 shrinks to 25% of original size (in place)."""
+        E.g. factor=1 shrinks to 25% of original size (in place).
+
+        The samples are reallocated, so BufferError is raised while memoryviews
+        or arrays of the samples exist.
+        """
         if factor < 1:
             message_warning("ignoring shrink factor < 1")
             return
+        if (getattr(self, '_out', None) is not None
+                or not (self.this.m_internal.flags & mupdf.FZ_PIXMAP_FLAG_FREE_SAMPLES)
+                ):
+            # The samples are in memory that the pixmap does not own, e.g. a
+            # caller's `out` buffer, so they cannot be reallocated.
+            raise ValueError('cannot shrink pixmap with borrowed samples')
+        if self._samples_exported():
+            raise BufferError('cannot shrink pixmap with exported samples')
         mupdf.fz_subsample_pixmap( self.this, factor)
         # Pixmap has changed so clear our memory view.
         self._memory_view = None
@@ -12441,6 +12943,19 @@ class TextPage:
                 lines.append(litem)
         return lines
 
+    def extractCOLUMNS(self) -> dict:
+        """Return the characters of the page as columns of typed arrays.
+
+        Every column is a memoryview with one item per character, in the
+        order of extractRAWDICT(). Except for "quad", which has 8 items per
+        character (ul, ur, ll, lr). Columns can be used without copying,
+        e.g. with numpy.frombuffer() or numpy.asarray().
+        """
+        val = JM_stext_page_columns(self.this)
+        for name, typecode in _stext_columns:
+            val[name] = memoryview(val[name]).cast(typecode)
+        return val
+
     def extractDICT(self, cb=None, sort=False) -> dict:
         """Return page content as a Python dict of images and text spans."""
         val = self._textpage_dict(raw=False)
@@ -13311,6 +13826,27 @@ TEXTFLAGS_DICT = (0
 
 TEXTFLAGS_RAWDICT = TEXTFLAGS_DICT
 
+# Names and array typecodes of the columns of TextPage.extractCOLUMNS().
+_stext_columns = (
+        ("c", "I"),
+        ("x0", "f"),
+        ("y0", "f"),
+        ("x1", "f"),
+        ("y1", "f"),
+        ("quad", "f"),
+        ("ox", "f"),
+        ("oy", "f"),
+        ("dx", "f"),
+        ("dy", "f"),
+        ("font", "i"),
+        ("size", "f"),
+        ("flags", "i"),
+        ("color", "i"),
+        ("block", "i"),
+        ("line", "i"),
+        ("span", "i"),
+        )
+
 TEXTFLAGS_SEARCH = (0
         | TEXT_PRESERVE_LIGATURES
         | TEXT_PRESERVE_WHITESPACE
@@ -16442,6 +16978,79 @@ def JM_make_textpage_dict(tp, page_dict, raw):
     page_dict[dictkey_blocks] = block_list
 
 
+def JM_stext_page_columns(tp):
+    '''
+    Return the characters of a text page as a dict of bytes objects, each an
+    array with one item per character. See TextPage.extractCOLUMNS().
+    '''
+    if g_use_extra:
+        return extra.JM_stext_page_columns(tp.m_internal)
+    import array
+    cols = dict()
+    for name, typecode in _stext_columns:
+        cols[name] = array.array(typecode)
+    fonts = []
+    tp_rect = mupdf.FzRect(tp.m_internal.mediabox)
+    infinite = mupdf.fz_is_infinite_rect(tp_rect)
+    block_n = -1
+    for block in tp:
+        block_n += 1
+        if block.m_internal.type != mupdf.FZ_STEXT_BLOCK_TEXT:
+            continue
+        if (not infinite
+                and mupdf.fz_is_empty_rect(mupdf.fz_intersect_rect(tp_rect, mupdf.FzRect(block.m_internal.bbox)))
+                ):
+            continue
+        line_n = -1
+        for line in block:
+            line_n += 1
+            if (not infinite
+                    and mupdf.fz_is_empty_rect(mupdf.fz_intersect_rect(tp_rect, mupdf.FzRect(line.m_internal.bbox)))
+                    ):
+                continue
+            span_n = -1
+            old_style = None
+            for ch in line:
+                r = JM_char_bbox(line, ch)
+                if not infinite and not JM_rects_overlap(tp_rect, r):
+                    continue
+                font = mupdf.FzFont(mupdf.ll_fz_keep_font(ch.m_internal.font))
+                flags = JM_char_font_flags(font, line, ch)
+                fontname = JM_font_name(font)
+                style = (ch.m_internal.size, flags, ch.m_internal.color, fontname)
+                if style != old_style:
+                    span_n += 1
+                    old_style = style
+                    if fontname not in fonts:
+                        fonts.append(fontname)
+                    font_n = fonts.index(fontname)
+                q = JM_char_quad(line, ch)
+                cols["c"].append(ch.m_internal.c)
+                cols["x0"].append(r.x0)
+                cols["y0"].append(r.y0)
+                cols["x1"].append(r.x1)
+                cols["y1"].append(r.y1)
+                cols["quad"].extend((
+                        q.ul.x, q.ul.y, q.ur.x, q.ur.y,
+                        q.ll.x, q.ll.y, q.lr.x, q.lr.y,
+                        ))
+                cols["ox"].append(ch.m_internal.origin.x)
+                cols["oy"].append(ch.m_internal.origin.y)
+                cols["dx"].append(line.m_internal.dir.x)
+                cols["dy"].append(line.m_internal.dir.y)
+                cols["font"].append(font_n)
+                cols["size"].append(ch.m_internal.size)
+                cols["flags"].append(flags)
+                cols["color"].append(ch.m_internal.color)
+                cols["block"].append(block_n)
+                cols["line"].append(line_n)
+                cols["span"].append(span_n)
+    rc = {"count": len(cols["c"]), "fonts": fonts}
+    for name, a in cols.items():
+        rc[name] = a.tobytes()
+    return rc
+
+
 def JM_matrix_from_py(m):
     a = [0, 0, 0, 0, 0, 0]
     if isinstance(m, mupdf.FzMatrix):
@@ -16751,6 +17360,7 @@ def JM_pixmap_from_display_list(
         alpha,
         clip,
         seps,
+        hints=0,
         ):
     '''
     Version of fz_new_pixmap_from_display_list (util.c) to also support
@@ -16779,9 +17389,11 @@ def JM_pixmap_from_display_list(
 
     if not mupdf.fz_is_infinite_rect(rclip):
         dev = mupdf.fz_new_draw_device_with_bbox(matrix, pix, irect)
+        mupdf.fz_enable_device_hints(dev, hints)
         mupdf.fz_run_display_list(list_, dev, mupdf.FzMatrix(), rclip, mupdf.FzCookie())
     else:
         dev = mupdf.fz_new_draw_device(matrix, pix)
+        mupdf.fz_enable_device_hints(dev, hints)
         mupdf.fz_run_display_list(list_, dev, mupdf.FzMatrix(), mupdf.FzRect(mupdf.FzRect.Fixed_INFINITE), mupdf.FzCookie())
 
     mupdf.fz_close_device(dev)
@@ -17056,8 +17668,14 @@ def JM_rotate_page_matrix(page):
     return m
 
 
-def JM_search_stext_page(page, needle):
-    if g_use_extra:
+def JM_search_stext_page(page, needle, found=None):
+    '''
+    Returns the quads of the hits of `needle`. If `found` is a list, then
+    instead appends a (begin, end, quads) item to it for each hit, where begin
+    and end are the hit's position in the text, and quads are not merged with
+    those of the previous hit.
+    '''
+    if g_use_extra and found is None:
         return extra.JM_search_stext_page(page.m_internal, needle)
     
     rect = mupdf.FzRect(page.m_internal.mediabox)
@@ -17101,6 +17719,10 @@ def JM_search_stext_page(page, needle):
                     if not inside:
                         if haystack >= begin:
                             inside = 1
+                            if found is not None:
+                                hits.len = 0
+                                hits.quads = []
+                                found.append((begin, end, hits.quads))
                     if inside:
                         if haystack < end:
                             on_highlight_char(hits, line, ch)
@@ -19084,6 +19706,21 @@ class JM_new_bbox_device_Device(mupdf.FzDevice2):
     fill_image_mask = jm_bbox_fill_image_mask
     
 
+class JM_new_image_bbox_device_Device(mupdf.FzDevice2):
+    '''
+    Like JM_new_bbox_device_Device, but only records images.
+    '''
+    def __init__(self, result):
+        super().__init__()
+        self.result = result
+        self.layers = False
+        self.use_virtual_fill_image()
+        self.use_virtual_fill_image_mask()
+
+    fill_image = jm_bbox_fill_image
+    fill_image_mask = jm_bbox_fill_image_mask
+
+
 class JM_new_output_fileptr_Output(mupdf.FzOutput2):
     def __init__(self, bio):
         super().__init__()
@@ -20923,8 +21560,9 @@ def apply_pages(
         pagefn:
             Function to call for each page; is passed (page, *pagefn_args,
             **pagefn_kwargs). Return value is added to list that we return. If
-            `method` is not 'single', must be a top-level function - nested
-            functions don't work with concurrency.
+            `method` is 'mp' or 'fork', must be a top-level function - nested
+            functions don't work with concurrency. If `method` is 'threads',
+            is passed the page's `DisplayList` instead of the page.
         pagefn_args
         pagefn_kwargs:
             Additional args to pass to `pagefn`. Must be picklable.
@@ -20944,9 +21582,14 @@ def apply_pages(
             'fork'
                  Operate concurrently using custom implementation with
                  `os.fork()`. Does not work on Windows.
+            'threads'
+                Operate concurrently using a pool of threads sharing a single
+                Document. Pages are interpreted into display lists one at
+                a time, then rasterisation and text extraction run in
+                parallel without the GIL.
         concurrency:
-            Number of worker processes to use when operating concurrently. If
-            None, we use the number of available CPUs.
+            Number of worker processes or threads to use when operating
+            concurrently. If None, we use the number of available CPUs.
         _stats:
             Internal, may change or be removed. If true, we output simple
             timing diagnostics.
@@ -21013,6 +21656,20 @@ def apply_pages(
                     _stats,
                     )
         
+        elif method == 'threads':
+            ret = _apply_pages._threads(
+                    path,
+                    pages,
+                    pagefn,
+                    pagefn_args,
+                    pagefn_kwargs,
+                    initfn,
+                    initfn_args,
+                    initfn_kwargs,
+                    concurrency,
+                    _stats,
+                    )
+        
         else:
             assert 0, f'Unrecognised {method=}.'
         
@@ -21026,6 +21683,58 @@ def apply_pages(
     return ret
 
 
+def _get_text_displaylist(displaylist, option='text', flags=None, sort=False, delimiters=None):
+    '''
+    Equivalent of `Page.get_text()` for a DisplayList, used by
+    `get_text(method='threads')`. The TextPage is created without holding the
+    GIL.
+    '''
+    formats = {
+        "text": TEXTFLAGS_TEXT,
+        "html": TEXTFLAGS_HTML,
+        "json": TEXTFLAGS_DICT,
+        "rawjson": TEXTFLAGS_RAWDICT,
+        "xml": TEXTFLAGS_XML,
+        "xhtml": TEXTFLAGS_XHTML,
+        "dict": TEXTFLAGS_DICT,
+        "rawdict": TEXTFLAGS_RAWDICT,
+        "words": TEXTFLAGS_WORDS,
+        "blocks": TEXTFLAGS_BLOCKS,
+    }
+    option = option.lower()
+    if option not in formats:
+        option = "text"
+    if flags is None:
+        flags = formats[option]
+    tp = TextPage(displaylist.get_textpage(flags))
+    cb = displaylist.rect
+    if option == "words":
+        t = tp.extractWORDS(delimiters)
+        if sort:
+            t.sort(key=lambda w: (w[3], w[0]))
+    elif option == "blocks":
+        t = tp.extractBLOCKS()
+        if sort:
+            t.sort(key=lambda b: (b[3], b[0]))
+    elif option == "json":
+        t = tp.extractJSON(cb=cb, sort=sort)
+    elif option == "rawjson":
+        t = tp.extractRAWJSON(cb=cb, sort=sort)
+    elif option == "dict":
+        t = tp.extractDICT(cb=cb, sort=sort)
+    elif option == "rawdict":
+        t = tp.extractRAWDICT(cb=cb, sort=sort)
+    elif option == "html":
+        t = tp.extractHTML()
+    elif option == "xml":
+        t = tp.extractXML()
+    elif option == "xhtml":
+        t = tp.extractXHTML()
+    else:
+        t = tp.extractText(sort=sort)
+    return t
+
+
 def get_text(
         path,
         *,
@@ -21059,9 +21768,12 @@ def get_text(
             'fork'
                  Operate concurrently using custom implementation with
                  `os.fork`. Does not work on Windows.
+            'threads'
+                Operate concurrently using threads sharing a single Document;
+                see `apply_pages()`. `clip` and `textpage` are not supported.
         concurrency:
-            Number of worker processes to use when operating concurrently. If
-            None, we use the number of available CPUs.
+            Number of worker processes or threads to use when operating
+            concurrently. If None, we use the number of available CPUs.
         option
         clip
         flags
@@ -21070,6 +21782,23 @@ def get_text(
         delimiters:
             Passed to internal calls to `Page.get_text()`.
     '''
+    if method == 'threads':
+        assert clip is None and textpage is None, \
+                f'{method=} does not support `clip` or `textpage`.'
+        return apply_pages(
+                path,
+                _get_text_displaylist,
+                pagefn_kwargs=dict(
+                        option=option,
+                        flags=flags,
+                        sort=sort,
+                        delimiters=delimiters,
+                        ),
+                pages=pages,
+                method=method,
+                concurrency=concurrency,
+                _stats=_stats,
+                )
     args_dict = dict(
             option=option,
             clip=clip,
@@ -21479,6 +22208,23 @@ class TOOLS:
         '''
         mupdf.fz_purge_glyph_cache()
 
+    @staticmethod
+    def glyph_cache_size(size=None):
+        '''
+        Set / return the maximum size of MuPDF's glyph cache in bytes.
+        '''
+        if size is not None:
+            mupdf.fz_set_glyph_cache_size(size)
+        return mupdf.fz_glyph_cache_size()
+
+    @staticmethod
+    def glyph_cache_stats():
+        '''
+        Return dict with the hits, misses and evictions of MuPDF's glyph cache.
+        '''
+        hits, misses, evictions = mupdf.fz_glyph_cache_stats()
+        return dict(hits=hits, misses=misses, evictions=evictions)
+
     @staticmethod
     def image_profile(stream, keep_image=0):
         '''
@@ -21777,6 +22523,7 @@ Page.insert_text            = utils.insert_text
 Page.insert_textbox         = utils.insert_textbox
 Page.insert_htmlbox         = utils.insert_htmlbox
 Page.new_shape              = lambda x: utils.Shape(x)
+Page.refine_pixmap          = utils.refine_pixmap
 Page.replace_image          = utils.replace_image
 Page.search_for             = utils.search_for
 Page.show_pdf_page          = utils.show_pdf_page
@@ -1,5 +1,7 @@
+import concurrent.futures
 import multiprocessing
 import os
+import threading
 import time
 
 import pymupdf
@@ -251,3 +253,59 @@ def _fork(
                 pymupdf.log(f'{pid=} => {e=}')
         if stats:
             _stats_write(t, 'Join all child proceses')
+
+
+def _threads(
+        path,
+        pages,
+        pagefn,
+        pagefn_args,
+        pagefn_kwargs,
+        initfn,
+        initfn_args,
+        initfn_kwargs,
+        concurrency,
+        stats,
+        ):
+    # All threads share a single Document, so there is only one copy of the
+    # document and of MuPDF's store. MuPDF documents are not thread-safe, so
+    # we only interpret pages while holding `document_lock`, creating a
+    # DisplayList for each page. Display lists can be used concurrently, and
+    # each thread uses its own clone of the fz_context (see the MuPDF C++
+    # bindings' internal_context_get()), so `pagefn()` is passed the
+    # DisplayList and can rasterise or extract text from it in parallel;
+    # DisplayList.get_pixmap() and DisplayList.get_textpage() release the GIL.
+    #
+    if concurrency is None:
+        concurrency = multiprocessing.cpu_count()
+    if initfn:
+        initfn(*initfn_args, **initfn_kwargs)
+    document_lock = threading.Lock()
+    
+    if stats:
+        t = time.time()
+    document = pymupdf.Document(path)
+    if stats:
+        _stats_write(t, 'pymupdf.Document()')
+    
+    def fn(page_number):
+        with document_lock:
+            if stats:
+                t = time.time()
+            page = document[page_number]
+            displaylist = page.get_displaylist()
+            del page
+            if stats:
+                _stats_write(t, f'{page_number=} get_displaylist()')
+        if stats:
+            t = time.time()
+        ret = pagefn(displaylist, *pagefn_args, **pagefn_kwargs)
+        if stats:
+            _stats_write(t, f'{page_number=} pagefn()')
+        return ret
+    
+    try:
+        with concurrent.futures.ThreadPoolExecutor(concurrency) as executor:
+            return list(executor.map(fn, pages))
+    finally:
+        document.close()
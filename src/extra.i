@@ -96,7 +96,17 @@ catch(...) {
 #include "mupdf/internal.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
 #include <float.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 /* Returns equivalent of `repr(x)`. */
@@ -707,6 +717,14 @@ static int LIST_APPEND_DROP(PyObject *list, PyObject *item)
     return rc;
 }
 
+static int SET_ADD_DROP(PyObject *set, PyObject *item)
+{
+    if (!set || !PySet_Check(set) || !item) return -2;
+    int rc = PySet_Add(set, item);
+    Py_DECREF(item);
+    return rc;
+}
+
 static int LIST_APPEND(PyObject *list, PyObject *item)
 {
     if (!list || !PyList_Check(list) || !item) return -2;
@@ -3402,198 +3420,1864 @@ fz_stext_page* page_get_textpage(
     return tpage;
 }
 
-// return extension for pymupdf image type
-const char *JM_image_extension(int type)
+/* Returns false if the MuPDF C++ bindings are not in multithreaded mode
+(MUPDF_mt_ctx=0). All threads then share one fz_context, so MuPDF must only be
+called with the GIL held. */
+static bool JM_mt_ctx()
 {
-    switch (type) {
-        case(FZ_IMAGE_RAW): return "raw";
-        case(FZ_IMAGE_FLATE): return "flate";
-        case(FZ_IMAGE_LZW): return "lzw";
-        case(FZ_IMAGE_RLD): return "rld";
-        case(FZ_IMAGE_BMP): return "bmp";
-        case(FZ_IMAGE_GIF): return "gif";
-        case(FZ_IMAGE_JBIG2): return "jb2";
-        case(FZ_IMAGE_JPEG): return "jpeg";
-        case(FZ_IMAGE_JPX): return "jpx";
-        case(FZ_IMAGE_JXR): return "jxr";
-        case(FZ_IMAGE_PNG): return "png";
-        case(FZ_IMAGE_PNM): return "pnm";
-        case(FZ_IMAGE_TIFF): return "tiff";
-        default: return "n/a";
+    const char* mt_ctx = getenv("MUPDF_mt_ctx");
+    return !(mt_ctx && !strcmp(mt_ctx, "0"));
+}
+
+/* Releases the GIL for the lifetime of the instance, so that MuPDF can run
+on this thread's own fz_context (see mupdf::internal_context_get()) while other
+Python threads continue. No Python objects may be touched within the scope.
+
+Does nothing if MUPDF_mt_ctx=0, see JM_mt_ctx(). */
+struct JM_allow_threads
+{
+    JM_allow_threads()
+    : m_state(JM_mt_ctx() ? PyEval_SaveThread() : NULL)
+    {}
+    ~JM_allow_threads()
+    {
+        if (m_state)
+            PyEval_RestoreThread(m_state);
+    }
+    PyThreadState* m_state;
+};
+
+/* Calls fn(i) for i in 0..threads-1, fn(0) on the calling thread and the
+others on new threads, each of which uses its own clone of the fz_context.
+Returns once all calls have returned, rethrowing the first exception raised by
+any of them.
+
+If a thread cannot be started, or if MUPDF_mt_ctx=0, the calling thread makes
+the remaining calls itself after fn(0). Callers that hand out work from a
+shared counter therefore get it all done, and callers that split work by `i`
+get every part done. */
+static void JM_run_on_threads(int threads, const std::function<void(int)>& fn)
+{
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(std::max(threads, 1));
+    int started = 1;
+    if (JM_mt_ctx())
+    {
+        for (; started < threads; started++)
+        {
+            int i = started;
+            try
+            {
+                workers.emplace_back([&fn, &errors, i]()
+                {
+                    try
+                    {
+                        fn(i);
+                    }
+                    catch (...)
+                    {
+                        errors[i] = std::current_exception();
+                    }
+                });
+            }
+            catch (...)
+            {
+                break;
+            }
+        }
+    }
+    /* This thread makes call 0, and those that no thread was started for. */
+    for (int i = 0; i < std::max(threads, 1); i++)
+    {
+        if (i > 0 && i < started)
+            continue;
+        try
+        {
+            fn(i);
+        }
+        catch (...)
+        {
+            errors[i] = std::current_exception();
+        }
+    }
+    for (auto& worker: workers)
+        worker.join();
+    for (auto& error: errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
     }
 }
 
-void JM_make_image_block(fz_stext_block *block, PyObject *block_dict)
+/* Renders rows band.y0..band.y1 of `pix` from `list`, using the calling
+thread's fz_context. Draws into a band pixmap that shares `pix`'s samples, so
+bands rendered by different threads end up in the same pixmap. */
+static void JM_render_band(
+        fz_display_list* list,
+        fz_matrix matrix,
+        fz_rect rclip,
+        fz_pixmap* pix,
+        fz_irect band,
+        int hints
+        )
 {
     fz_context* ctx = mupdf::internal_context_get();
-    fz_image *image = block->u.i.image;
-    fz_buffer *buf = NULL, *freebuf = NULL;
-    fz_compressed_buffer *buffer = fz_compressed_image_buffer(ctx, image);
-    fz_var(buf);
-    fz_var(freebuf);
-    int n = fz_colorspace_n(ctx, image->colorspace);
-    int w = image->w;
-    int h = image->h;
-    const char *ext = NULL;
-    int type = FZ_IMAGE_UNKNOWN;
-    if (buffer)
-        type = buffer->params.type;
-    if (type < FZ_IMAGE_BMP || type == FZ_IMAGE_JBIG2)
-        type = FZ_IMAGE_UNKNOWN;
-    PyObject *bytes = NULL;
-    fz_var(bytes);
+    fz_pixmap* bandpix = NULL;
+    fz_device* dev = NULL;
+    fz_var(bandpix);
+    fz_var(dev);
     fz_try(ctx) {
-        if (buffer && type != FZ_IMAGE_UNKNOWN) {
-            buf = buffer->buffer;
-            ext = JM_image_extension(type);
-        } else {
-            buf = freebuf = fz_new_buffer_from_image_as_png(ctx, image, fz_default_color_params);
-            ext = "png";
-        }
-        bytes = JM_BinFromBuffer(buf);
+        unsigned char* samples = pix->samples + (size_t) (band.y0 - pix->y) * pix->stride;
+        bandpix = fz_new_pixmap_with_data(ctx, pix->colorspace, band.x1 - band.x0, band.y1 - band.y0, pix->seps, pix->alpha, pix->stride, samples);
+        bandpix->x = band.x0;
+        bandpix->y = band.y0;
+        dev = fz_new_draw_device_with_bbox(ctx, matrix, bandpix, &band);
+        fz_enable_device_hints(ctx, dev, hints);
+        fz_run_display_list(ctx, list, dev, fz_identity, rclip, NULL);
+        fz_close_device(ctx, dev);
     }
     fz_always(ctx) {
-        if (!bytes)
-            bytes = PyBytes_FromString("");
-        DICT_SETITEM_DROP(block_dict, dictkey_width,
-                        Py_BuildValue("i", w));
-        DICT_SETITEM_DROP(block_dict, dictkey_height,
-                        Py_BuildValue("i", h));
-        DICT_SETITEM_DROP(block_dict, dictkey_ext,
-                        Py_BuildValue("s", ext));
-        DICT_SETITEM_DROP(block_dict, dictkey_colorspace,
-                        Py_BuildValue("i", n));
-        DICT_SETITEM_DROP(block_dict, dictkey_xres,
-                        Py_BuildValue("i", image->xres));
-        DICT_SETITEM_DROP(block_dict, dictkey_yres,
-                        Py_BuildValue("i", image->xres));
-        DICT_SETITEM_DROP(block_dict, dictkey_bpc,
-                        Py_BuildValue("i", (int) image->bpc));
-        DICT_SETITEM_DROP(block_dict, dictkey_matrix,
-                        JM_py_from_matrix(block->u.i.transform));
-        DICT_SETITEM_DROP(block_dict, dictkey_size,
-                        Py_BuildValue("n", PyBytes_Size(bytes)));
-        DICT_SETITEM_DROP(block_dict, dictkey_image, bytes);
-
-        fz_drop_buffer(ctx, freebuf);
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, bandpix);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
     }
-    fz_catch(ctx) {;}
-    return;
 }
 
-static void JM_make_text_block(fz_stext_block *block, PyObject *block_dict, int raw, fz_buffer *buff, fz_rect tp_rect)
+/* Writable view of a Python buffer, released on destruction. Must be
+constructed and destroyed with the GIL held. */
+struct JM_writable_buffer
 {
-    fz_stext_line *line;
-    PyObject *line_list = PyList_New(0), *line_dict;
-    fz_rect block_rect = fz_empty_rect;
-    for (line = block->u.t.first_line; line; line = line->next) {
-        if (fz_is_empty_rect(fz_intersect_rect(tp_rect, line->bbox)) &&
-            !fz_is_infinite_rect(tp_rect)) {
-            continue;
+    JM_writable_buffer(PyObject* obj)
+    : m_valid(false)
+    {
+        if (obj == Py_None)
+            return;
+        if (PyObject_GetBuffer(obj, &m_view, PyBUF_STRIDES | PyBUF_WRITABLE) < 0)
+        {
+            PyErr_Clear();
+            throw std::runtime_error("out: not a writable buffer");
         }
-        line_dict = PyDict_New();
-        mupdf::FzStextLine line2(line);
-        mupdf::FzBuffer buff2( mupdf::ll_fz_keep_buffer( buff));
-        mupdf::FzRect tp_rect2( tp_rect);
-        mupdf::FzRect line_rect2 = JM_make_spanlist(
-                line_dict,
-                line2,
-                raw,
-                buff2,
-                tp_rect2
-                );
-        fz_rect& line_rect = *line_rect2.internal();
-        block_rect = fz_union_rect(block_rect, line_rect);
-        DICT_SETITEM_DROP(line_dict, dictkey_wmode,
-                    Py_BuildValue("i", line->wmode));
-        DICT_SETITEM_DROP(line_dict, dictkey_dir, JM_py_from_point(line->dir));
-        DICT_SETITEM_DROP(line_dict, dictkey_bbox,
-                    JM_py_from_rect(line_rect));
-        LIST_APPEND_DROP(line_list, line_dict);
+        m_valid = true;
     }
-    DICT_SETITEM_DROP(block_dict, dictkey_bbox, JM_py_from_rect(block_rect));
-    DICT_SETITEM_DROP(block_dict, dictkey_lines, line_list);
-    return;
-}
+    ~JM_writable_buffer()
+    {
+        if (m_valid)
+            PyBuffer_Release(&m_view);
+    }
+    /* Sets *stride to the row stride to use for a w x h x n pixmap in the
+    buffer. Returns NULL on success, or an error message if the buffer cannot
+    hold such a pixmap. The buffer may be laid out as bytes, as rows of w*n
+    bytes, or as (h, w, n), with arbitrary row stride. */
+    const char* pixmap_stride(int w, int h, int n, ptrdiff_t* stride)
+    {
+        Py_ssize_t row = (Py_ssize_t) w * n;
+        *stride = row;
+        if (m_view.itemsize != 1)
+            return "out: items must be bytes";
+        if (m_view.ndim <= 1)
+        {
+            if (m_view.ndim == 1 && m_view.strides[0] != 1)
+                return "out: buffer is not contiguous";
+            if (m_view.len < row * h)
+                return "out: buffer is too small";
+            return NULL;
+        }
+        Py_ssize_t expected = 1;
+        for (int d = m_view.ndim - 1; d > 0; d--)
+        {
+            if (m_view.shape[d] > 1 && m_view.strides[d] != expected)
+                return "out: rows are not contiguous";
+            expected *= m_view.shape[d];
+        }
+        if (m_view.shape[0] != h || expected != row)
+            return "out: shape does not match pixmap";
+        *stride = m_view.strides[0];
+        if (h > 1 && (*stride < row || *stride > INT_MAX))
+            return "out: bad row stride";
+        return NULL;
+    }
+    bool m_valid;
+    Py_buffer m_view;
+};
 
-void JM_make_textpage_dict(fz_stext_page *tp, PyObject *page_dict, int raw)
+/* Version of JM_pixmap_from_display_list() in __init__.py that rasterises
+with the GIL released, so that several threads can render display lists of the
+same document concurrently.
+
+If `threads` > 1, the pixmap is split into that many horizontal bands, which
+are rendered concurrently from the shared display list, each thread using its
+own clone of the fz_context. This requires the MuPDF C++ bindings to be in
+multithreaded mode, so `threads` is ignored if MUPDF_mt_ctx=0.
+
+`hints` are enabled on the draw device(s), e.g. FZ_PREVIEW_IMAGES.
+
+If `out` is not None, it is a writable buffer that the pixmap's samples are
+rendered into, instead of newly allocated memory. The returned pixmap refers
+to this memory, so the caller must keep `out` alive for as long as the pixmap. */
+fz_pixmap* JM_pixmap_from_display_list_nogil(
+        mupdf::FzDisplayList& list,
+        PyObject* ctm,
+        mupdf::FzColorspace& cs,
+        int alpha,
+        PyObject* clip,
+        int threads,
+        int hints,
+        PyObject* out
+        )
 {
+    fz_matrix matrix = JM_matrix_from_py(ctm);
+    fz_rect rclip = JM_rect_from_py(clip);
+    if (!JM_mt_ctx())
+        threads = 1;
+    /* Released after allow_threads has restored the GIL. */
+    JM_writable_buffer outbuf(out);
+    JM_allow_threads allow_threads;
     fz_context* ctx = mupdf::internal_context_get();
-    fz_stext_block *block;
-    fz_buffer *text_buffer = fz_new_buffer(ctx, 128);
-    PyObject *block_dict, *block_list = PyList_New(0);
-    fz_rect tp_rect = tp->mediabox;
-    int block_n = -1;
-    for (block = tp->first_block; block; block = block->next) {
-        block_n++;
-        if (!fz_contains_rect(tp_rect, block->bbox) &&
-            !fz_is_infinite_rect(tp_rect) &&
-            block->type == FZ_STEXT_BLOCK_IMAGE) {
-            continue;
+    fz_pixmap* pix = NULL;
+    fz_device* dev = NULL;
+    fz_irect irect;
+    int band_h = 0;
+    fz_var(pix);
+    fz_var(dev);
+    fz_try(ctx) {
+        fz_rect rect = fz_intersect_rect(fz_bound_display_list(ctx, list.m_internal), rclip);
+        irect = fz_round_rect(fz_transform_rect(rect, matrix));
+        if (outbuf.m_valid)
+        {
+            int w = irect.x1 - irect.x0;
+            int h = irect.y1 - irect.y0;
+            ptrdiff_t stride;
+            const char* e = outbuf.pixmap_stride(w, h, fz_colorspace_n(ctx, cs.m_internal) + alpha, &stride);
+            if (e)
+                fz_throw(ctx, FZ_ERROR_ARGUMENT, "%s", e);
+            pix = fz_new_pixmap_with_data(ctx, cs.m_internal, w, h, NULL, alpha, (int) stride, (unsigned char*) outbuf.m_view.buf);
+            pix->x = irect.x0;
+            pix->y = irect.y0;
         }
-        if (!fz_is_infinite_rect(tp_rect) &&
-            fz_is_empty_rect(fz_intersect_rect(tp_rect, block->bbox))) {
-            continue;
+        else
+        {
+            pix = fz_new_pixmap_with_bbox(ctx, cs.m_internal, irect, NULL, alpha);
         }
-
-        block_dict = PyDict_New();
-        DICT_SETITEM_DROP(block_dict, dictkey_number, Py_BuildValue("i", block_n));
-        DICT_SETITEM_DROP(block_dict, dictkey_type, Py_BuildValue("i", block->type));
-        if (block->type == FZ_STEXT_BLOCK_IMAGE) {
-            DICT_SETITEM_DROP(block_dict, dictkey_bbox, JM_py_from_rect(block->bbox));
-            JM_make_image_block(block, block_dict);
-        } else {
-            JM_make_text_block(block, block_dict, raw, text_buffer, tp_rect);
+        if (alpha)
+            fz_clear_pixmap(ctx, pix);
+        else
+            fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+        /* Bands of fewer than 32 rows are not worth a thread. */
+        if (threads > 1 && pix->h / threads < 32)
+            threads = pix->h / 32;
+        if (threads > 1)
+        {
+            band_h = (pix->h + threads - 1) / threads;
+        }
+        else
+        {
+            if (!fz_is_infinite_rect(rclip))
+                dev = fz_new_draw_device_with_bbox(ctx, matrix, pix, &irect);
+            else
+                dev = fz_new_draw_device(ctx, matrix, pix);
+            fz_enable_device_hints(ctx, dev, hints);
+            fz_run_display_list(ctx, list.m_internal, dev, fz_identity, rclip, NULL);
+            fz_close_device(ctx, dev);
         }
-
-        LIST_APPEND_DROP(block_list, block_dict);
     }
-    DICT_SETITEM_DROP(page_dict, dictkey_blocks, block_list);
-    fz_drop_buffer(ctx, text_buffer);
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_pixmap(ctx, pix);
+        mupdf::internal_throw_exception(ctx);
+    }
+    if (band_h)
+    {
+        /* Band i is rendered by the i-th thread. */
+        try
+        {
+            JM_run_on_threads(threads, [&](int i)
+            {
+                fz_irect band = irect;
+                band.y0 = irect.y0 + i * band_h;
+                band.y1 = fz_mini(band.y0 + band_h, irect.y1);
+                if (band.y0 < band.y1)
+                    JM_render_band(list.m_internal, matrix, rclip, pix, band, hints);
+            });
+        }
+        catch (...)
+        {
+            fz_drop_pixmap(ctx, pix);
+            throw;
+        }
+    }
+    return pix;
 }
 
-//-----------------------------------------------------------------
-// get one pixel as a list
-//-----------------------------------------------------------------
-PyObject *pixmap_pixel(fz_pixmap* pm, int x, int y)
+/* Python object exporting the buffer protocol over a fz_pixmap's samples.
+It holds a reference to the pixmap, so memoryviews and arrays made from it stay
+valid after the Pixmap that it came from has been dropped.
+
+If `flat` is true, the samples are exported as stride * (h - 1) + w * n bytes,
+which excludes the padding after the last row, otherwise as an array of shape
+(h, w, n) with strides (stride, n, 1). A pixmap rendered into a slice of a
+caller's array may end exactly at the end of the array's memory.
+
+`owner` is kept alive too, for pixmaps whose samples are in a Python buffer.
+
+Shape and strides are taken from the pixmap each time the buffer is exported.
+`exports` counts the exports that have not been released yet; the pixmap must
+not be reallocated while any of its buffers has one. */
+struct JM_PixmapBuffer
 {
-    fz_context* ctx = mupdf::internal_context_get();
-    PyObject *p = NULL;
-    if (0
-            || x < 0
-            || x >= pm->w
-            || y < 0
-            || y >= pm->h
-            )
+    PyObject_HEAD
+    fz_pixmap* pixmap;
+    PyObject* owner;
+    int flat;
+    Py_ssize_t exports;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+};
+
+static void JM_PixmapBuffer_dealloc(PyObject* self)
+{
+    fz_drop_pixmap(mupdf::internal_context_get(), ((JM_PixmapBuffer*) self)->pixmap);
+    Py_XDECREF(((JM_PixmapBuffer*) self)->owner);
+    PyObject_Free(self);
+}
+
+static int JM_PixmapBuffer_getbuffer(PyObject* self, Py_buffer* view, int flags)
+{
+    JM_PixmapBuffer* b = (JM_PixmapBuffer*) self;
+    fz_pixmap* pix = b->pixmap;
+    if (b->flat)
     {
-        throw std::range_error( MSG_PIXEL_OUTSIDE);
+        Py_ssize_t len = pix->h ? (Py_ssize_t) pix->stride * (pix->h - 1) + (Py_ssize_t) pix->w * pix->n : 0;
+        if (PyBuffer_FillInfo(view, self, pix->samples, len, 0, flags) < 0)
+            return -1;
+        b->exports++;
+        return 0;
     }
-    int n = pm->n;
-    int stride = fz_pixmap_stride(ctx, pm);
-    int i = stride * y + n * x;
-    p = PyTuple_New(n);
-    for (int j = 0; j < n; j++)
+    bool contiguous = pix->stride == (ptrdiff_t) pix->w * pix->n;
+    if (!contiguous && ((flags & PyBUF_STRIDES) != PyBUF_STRIDES
+            || (flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS
+            || (flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS))
     {
-        PyTuple_SET_ITEM(p, j, Py_BuildValue("i", pm->samples[i + j]));
+        PyErr_SetString(PyExc_BufferError, "pixmap rows are not contiguous");
+        view->obj = NULL;
+        return -1;
     }
-    return p;
+    if ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS)
+    {
+        PyErr_SetString(PyExc_BufferError, "pixmap samples are not Fortran contiguous");
+        view->obj = NULL;
+        return -1;
+    }
+    if ((flags & PyBUF_ND) != PyBUF_ND)
+    {
+        if (PyBuffer_FillInfo(view, self, pix->samples, (Py_ssize_t) pix->h * pix->w * pix->n, 0, flags) < 0)
+            return -1;
+        b->exports++;
+        return 0;
+    }
+    b->shape[0] = pix->h;
+    b->shape[1] = pix->w;
+    b->shape[2] = pix->n;
+    b->strides[0] = pix->stride;
+    b->strides[1] = pix->n;
+    b->strides[2] = 1;
+    view->obj = self;
+    Py_INCREF(self);
+    view->buf = pix->samples;
+    view->len = (Py_ssize_t) pix->h * pix->w * pix->n;
+    view->readonly = 0;
+    view->itemsize = 1;
+    view->format = (flags & PyBUF_FORMAT) ? (char*) "B" : NULL;
+    view->ndim = 3;
+    view->shape = b->shape;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? b->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    b->exports++;
+    return 0;
 }
 
-int pixmap_n(mupdf::FzPixmap& pixmap)
+static void JM_PixmapBuffer_releasebuffer(PyObject* self, Py_buffer* view)
 {
-    return mupdf::fz_pixmap_components( pixmap);
+    ((JM_PixmapBuffer*) self)->exports--;
 }
 
-static int
-JM_INT_ITEM(PyObject *obj, Py_ssize_t idx, int *result)
+static PyBufferProcs JM_PixmapBuffer_as_buffer = {
+    JM_PixmapBuffer_getbuffer,
+    JM_PixmapBuffer_releasebuffer
+};
+
+static PyTypeObject JM_PixmapBuffer_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pymupdf.PixmapBuffer",
+    sizeof(JM_PixmapBuffer)
+};
+
+/* Returns a new JM_PixmapBuffer for `pixmap`, see above. */
+PyObject* JM_pixmap_buffer(mupdf::FzPixmap& pixmap, int flat, PyObject* owner)
 {
-    PyObject *temp = PySequence_ITEM(obj, idx);
-    if (!temp) return 1;
-    if (PyLong_Check(temp)) {
-        *result = (int) PyLong_AsLong(temp);
-        Py_DECREF(temp);
-    } else if (PyFloat_Check(temp)) {
-        *result = (int) PyFloat_AsDouble(temp);
+    static bool type_ready = false;
+    if (!type_ready)
+    {
+        JM_PixmapBuffer_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+        JM_PixmapBuffer_Type.tp_doc = "Buffer over the samples of a pixmap.";
+        JM_PixmapBuffer_Type.tp_dealloc = JM_PixmapBuffer_dealloc;
+        JM_PixmapBuffer_Type.tp_as_buffer = &JM_PixmapBuffer_as_buffer;
+        if (PyType_Ready(&JM_PixmapBuffer_Type) < 0)
+            throw std::runtime_error("cannot initialise pixmap buffer type");
+        type_ready = true;
+    }
+    JM_PixmapBuffer* b = PyObject_New(JM_PixmapBuffer, &JM_PixmapBuffer_Type);
+    if (!b)
+        throw std::runtime_error("cannot create pixmap buffer");
+    fz_pixmap* pix = fz_keep_pixmap(mupdf::internal_context_get(), pixmap.m_internal);
+    b->pixmap = pix;
+    Py_INCREF(owner);
+    b->owner = owner;
+    b->flat = flat;
+    b->exports = 0;
+    return (PyObject*) b;
+}
+
+/* Returns the number of unreleased exports of a buffer made by
+JM_pixmap_buffer(). */
+int JM_pixmap_buffer_exports(PyObject* buffer)
+{
+    if (!PyObject_TypeCheck(buffer, &JM_PixmapBuffer_Type))
+        throw std::runtime_error("not a pixmap buffer");
+    return (int) ((JM_PixmapBuffer*) buffer)->exports;
+}
+
+/* Scales rows band.y0..band.y1 of `pix` from `src`, using the calling thread's
+fz_context, and copies them into `pix`. */
+static void JM_scale_band(
+        fz_pixmap* src,
+        float w,
+        float h,
+        fz_pixmap* pix,
+        fz_irect band
+        )
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_pixmap* bandpix = NULL;
+    fz_var(bandpix);
+    fz_try(ctx) {
+        bandpix = fz_scale_pixmap(ctx, src, src->x, src->y, w, h, &band);
+        if (bandpix)
+        {
+            fz_irect r = fz_intersect_irect(fz_pixmap_bbox(ctx, bandpix), fz_pixmap_bbox(ctx, pix));
+            if (bandpix->n != pix->n)
+                fz_throw(ctx, FZ_ERROR_GENERIC, "scaled band does not match pixmap");
+            for (int y = r.y0; y < r.y1; y++)
+            {
+                memcpy(
+                        pix->samples + (size_t) (y - pix->y) * pix->stride + (size_t) (r.x0 - pix->x) * pix->n,
+                        bandpix->samples + (size_t) (y - bandpix->y) * bandpix->stride + (size_t) (r.x0 - bandpix->x) * bandpix->n,
+                        (size_t) (r.x1 - r.x0) * pix->n
+                        );
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, bandpix);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+}
+
+/* Returns `src` scaled to `w` x `h` pixels at the same origin, clipped to
+`clip`, with the GIL released.
+
+If `threads` > 1, the output rows are split into that many horizontal bands
+which are scaled concurrently, each thread using its own clone of the
+fz_context. As each output row depends only on its own source rows, the result
+is the same as scaling in one go. Flipped (negative) sizes are always scaled by
+the calling thread alone, and `threads` is ignored if MUPDF_mt_ctx=0. */
+fz_pixmap* JM_scale_pixmap_nogil(
+        mupdf::FzPixmap& src,
+        float w,
+        float h,
+        PyObject* clip,
+        int threads
+        )
+{
+    fz_irect bbox = JM_irect_from_py(clip);
+    if (!JM_mt_ctx())
+        threads = 1;
+    JM_allow_threads allow_threads;
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_pixmap* spix = src.m_internal;
+    fz_pixmap* pix = NULL;
+    fz_irect irect;
+    int band_h = 0;
+    fz_var(pix);
+    if (threads > 1 && w >= 1 && h >= 1)
+    {
+        /* The pixmap origin is integral, so this is the bbox that
+        fz_scale_pixmap() gives. */
+        irect.x0 = spix->x;
+        irect.y0 = spix->y;
+        irect.x1 = spix->x + (int) ceilf(w);
+        irect.y1 = spix->y + (int) ceilf(h);
+        irect = fz_intersect_irect(irect, bbox);
+        /* Bands of fewer than 32 rows are not worth a thread. */
+        if (fz_is_empty_irect(irect))
+            threads = 1;
+        else if ((irect.y1 - irect.y0) / threads < 32)
+            threads = (irect.y1 - irect.y0) / 32;
+        if (threads > 1)
+            band_h = (irect.y1 - irect.y0 + threads - 1) / threads;
+    }
+    fz_try(ctx) {
+        if (band_h)
+        {
+            /* Non-integral sizes give an alpha channel, see
+            fz_scale_pixmap_cached(). */
+            int alpha = spix->alpha || w != (float) (int) w || h != (float) (int) h;
+            pix = fz_new_pixmap_with_bbox(ctx, spix->colorspace, irect, spix->seps, alpha);
+        }
+        else
+            pix = fz_scale_pixmap(ctx, spix, spix->x, spix->y, w, h, &bbox);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+    if (band_h)
+    {
+        /* Band i is scaled by the i-th thread. */
+        try
+        {
+            JM_run_on_threads(threads, [&](int i)
+            {
+                fz_irect band = irect;
+                band.y0 = irect.y0 + i * band_h;
+                band.y1 = fz_mini(band.y0 + band_h, irect.y1);
+                if (band.y0 < band.y1)
+                    JM_scale_band(spix, w, h, pix, band);
+            });
+        }
+        catch (...)
+        {
+            fz_drop_pixmap(ctx, pix);
+            throw;
+        }
+    }
+    return pix;
+}
+
+/* Makes a stext page from a display list with the GIL released. */
+fz_stext_page* JM_new_stext_page_from_display_list_nogil(
+        mupdf::FzDisplayList& list,
+        int flags
+        )
+{
+    fz_stext_options options;
+    memset(&options, 0, sizeof options);
+    options.flags = flags;
+    JM_allow_threads allow_threads;
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_stext_page* tpage = NULL;
+    fz_try(ctx) {
+        tpage = fz_new_stext_page_from_display_list(ctx, list.m_internal, &options);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+    return tpage;
+}
+
+/* Decodes prefetch jobs, taking the next one from `next` until none are
+left, using the calling thread's fz_context. */
+static void JM_prefetch_obj_stm_jobs(
+        pdf_obj_stm_prefetch* pf,
+        std::atomic<int>& next
+        )
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_try(ctx) {
+        int n = pdf_count_obj_stm_prefetch(ctx, pf);
+        for (int i = next++; i < n; i = next++)
+            pdf_run_obj_stm_prefetch(ctx, pf, i);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+}
+
+/* Decodes the object streams of `pdf` with the GIL released, using up to
+`threads` threads, so that loading their objects later (as when saving with
+garbage collection) does not have to inflate them one by one.
+
+Only decoding runs concurrently, each thread using its own clone of the
+fz_context; the results are added to the store by the calling thread. Returns
+the number of object streams decoded. `threads` is ignored if MUPDF_mt_ctx=0. */
+int JM_prefetch_obj_stms(
+        mupdf::PdfDocument& pdf,
+        int threads
+        )
+{
+    if (!JM_mt_ctx())
+        threads = 1;
+    JM_allow_threads allow_threads;
+    fz_context* ctx = mupdf::internal_context_get();
+    pdf_document* doc = pdf.m_internal;
+    pdf_obj_stm_prefetch* pf = NULL;
+    int n = 0;
+    fz_try(ctx) {
+        pf = pdf_new_obj_stm_prefetch(ctx, doc);
+        n = pdf_count_obj_stm_prefetch(ctx, pf);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+    if (threads > n)
+        threads = n;
+    if (threads < 1)
+        threads = 1;
+    /* Jobs are handed out one at a time. */
+    std::atomic<int> next(0);
+    try
+    {
+        JM_run_on_threads(threads, [&](int)
+        {
+            JM_prefetch_obj_stm_jobs(pf, next);
+        });
+    }
+    catch (...)
+    {
+        pdf_drop_obj_stm_prefetch(ctx, pf);
+        throw;
+    }
+    fz_try(ctx) {
+        n = pdf_commit_obj_stm_prefetch(ctx, doc, pf);
+    }
+    fz_always(ctx) {
+        pdf_drop_obj_stm_prefetch(ctx, pf);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+    return n;
+}
+
+/* Recompresses images start..end-1 of `jobs`, taking the next one from
+`next` until none are left, using the calling thread's fz_context. */
+static void JM_run_image_rewrite_jobs(
+        pdf_image_rewrite_jobs* jobs,
+        std::atomic<int>& next,
+        int end
+        )
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_try(ctx) {
+        for (int i = next++; i < end; i = next++)
+            pdf_run_image_rewrite_job(ctx, jobs, i);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+}
+
+/* Does pdf_rewrite_images() with the GIL released, decoding, resampling and
+recompressing up to `threads` images at a time.
+
+Images are loaded from the document by the calling thread, a batch of a few
+per thread at a time so that not all originals are in memory at once. Each
+batch is then recompressed concurrently, each thread using its own clone of
+the fz_context. The document is only changed once all images are done, on the
+calling thread, and the result is the same as with one thread. `threads` is
+ignored if MUPDF_mt_ctx=0. */
+void JM_rewrite_images(
+        mupdf::PdfDocument& pdf,
+        mupdf::PdfImageRewriterOptions& opts,
+        int threads
+        )
+{
+    if (!JM_mt_ctx())
+        threads = 1;
+    if (threads < 1)
+        threads = 1;
+    JM_allow_threads allow_threads;
+    fz_context* ctx = mupdf::internal_context_get();
+    pdf_document* doc = pdf.m_internal;
+    pdf_image_rewrite_jobs* jobs = NULL;
+    int n = 0;
+    fz_try(ctx) {
+        jobs = pdf_new_image_rewrite_jobs(ctx, doc, opts.internal());
+        n = pdf_count_image_rewrite_jobs(ctx, jobs);
+    }
+    fz_catch(ctx) {
+        mupdf::internal_throw_exception(ctx);
+    }
+    try
+    {
+        for (int start = 0; start < n; start += 4 * threads)
+        {
+            int end = std::min(n, start + 4 * threads);
+            fz_try(ctx) {
+                for (int i = start; i < end; i++)
+                    pdf_load_image_rewrite_job(ctx, doc, jobs, i);
+            }
+            fz_catch(ctx) {
+                mupdf::internal_throw_exception(ctx);
+            }
+            /* Jobs are handed out one at a time. */
+            std::atomic<int> next(start);
+            JM_run_on_threads(std::min(threads, end - start), [&](int)
+            {
+                JM_run_image_rewrite_jobs(jobs, next, end);
+            });
+        }
+        fz_try(ctx) {
+            pdf_commit_image_rewrite_jobs(ctx, doc, jobs);
+        }
+        fz_catch(ctx) {
+            mupdf::internal_throw_exception(ctx);
+        }
+    }
+    catch (...)
+    {
+        pdf_drop_image_rewrite_jobs(ctx, jobs);
+        throw;
+    }
+    pdf_drop_image_rewrite_jobs(ctx, jobs);
+}
+
+/* Returns the page numbers in Python sequence `pages`. */
+static std::vector<int> JM_page_numbers(PyObject* pages)
+{
+    std::vector<int> ret;
+    PyObject* seq = PySequence_Fast(pages, "pages: not a sequence");
+    if (!seq)
+    {
+        PyErr_Clear();
+        throw std::runtime_error("pages: not a sequence");
+    }
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t i = 0; i < n; i++)
+    {
+        long pno = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (pno == -1 && PyErr_Occurred())
+        {
+            PyErr_Clear();
+            Py_DECREF(seq);
+            throw std::runtime_error("pages: not a sequence of ints");
+        }
+        ret.push_back((int) pno);
+    }
+    Py_DECREF(seq);
+    return ret;
+}
+
+/* Returns (w, h), the smallest size that holds the pixmap of each of `pages`
+of `doc` transformed by `ctm`, for JM_render_pages_nogil(). */
+PyObject* JM_bound_pages(
+        mupdf::FzDocument& doc,
+        PyObject* pages,
+        PyObject* ctm
+        )
+{
+    std::vector<int> pnos = JM_page_numbers(pages);
+    fz_matrix matrix = JM_matrix_from_py(ctm);
+    int w = 0;
+    int h = 0;
+    {
+        JM_allow_threads allow_threads;
+        fz_context* ctx = mupdf::internal_context_get();
+        fz_page* page = NULL;
+        fz_var(page);
+        fz_try(ctx) {
+            for (int pno: pnos)
+            {
+                page = fz_load_page(ctx, doc.m_internal, pno);
+                fz_irect irect = fz_round_rect(fz_transform_rect(fz_bound_page(ctx, page), matrix));
+                fz_drop_page(ctx, page);
+                page = NULL;
+                w = fz_maxi(w, irect.x1 - irect.x0);
+                h = fz_maxi(h, irect.y1 - irect.y0);
+            }
+        }
+        fz_catch(ctx) {
+            fz_drop_page(ctx, page);
+            mupdf::internal_throw_exception(ctx);
+        }
+    }
+    return Py_BuildValue("ii", w, h);
+}
+
+/* State shared by the threads of JM_render_pages_nogil(). */
+struct jm_render_pages
+{
+    fz_document* doc;
+    std::vector<int> pages;
+    fz_matrix matrix;
+    fz_colorspace* cs;
+    int alpha;
+    int annots;
+    unsigned char* arena;
+    int w;
+    int h;
+    int n;
+    bool use_lists;         // interpret into display lists, for threads
+    std::mutex doc_lock;    // serialises use of `doc`
+    std::atomic<int> next;
+};
+
+/* Renders pages of `r`, taking the next one from r.next until none are left,
+using the calling thread's fz_context. With r.use_lists, the document is only
+used while holding r.doc_lock, to interpret each page into a display list; the
+list is then rasterised without the lock. */
+static void JM_render_pages_jobs(jm_render_pages& r)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    int count = (int) r.pages.size();
+    size_t slot = (size_t) r.w * r.h * r.n;
+    fz_page* page = NULL;
+    fz_display_list* list = NULL;
+    fz_pixmap* pix = NULL;
+    fz_device* dev = NULL;
+    fz_var(page);
+    fz_var(list);
+    fz_var(pix);
+    fz_var(dev);
+    fz_try(ctx) {
+        for (int i = r.next++; i < count; i = r.next++)
+        {
+            fz_rect rect;
+            if (r.use_lists)
+            {
+                r.doc_lock.lock();
+                fz_try(ctx) {
+                    page = fz_load_page(ctx, r.doc, r.pages[i]);
+                    rect = fz_bound_page(ctx, page);
+                    if (r.annots)
+                        list = fz_new_display_list_from_page(ctx, page);
+                    else
+                        list = fz_new_display_list_from_page_contents(ctx, page);
+                    fz_drop_page(ctx, page);
+                    page = NULL;
+                }
+                fz_catch(ctx) {
+                    fz_drop_page(ctx, page);
+                    page = NULL;
+                    r.doc_lock.unlock();
+                    fz_rethrow(ctx);
+                }
+                r.doc_lock.unlock();
+            }
+            else
+            {
+                page = fz_load_page(ctx, r.doc, r.pages[i]);
+                rect = fz_bound_page(ctx, page);
+            }
+
+            /* The page's top left corner goes to the top left corner of its
+            slot, and it is clipped to the slot. The rest of the slot is only
+            cleared. */
+            fz_irect irect = fz_round_rect(fz_transform_rect(rect, r.matrix));
+            pix = fz_new_pixmap_with_data(ctx, r.cs, r.w, r.h, NULL, r.alpha, r.w * r.n, r.arena + i * slot);
+            pix->x = irect.x0;
+            pix->y = irect.y0;
+            if (r.alpha)
+                fz_clear_pixmap(ctx, pix);
+            else
+                fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+            dev = fz_new_draw_device_with_bbox(ctx, r.matrix, pix, &irect);
+            if (list)
+                fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
+            else if (r.annots)
+                fz_run_page(ctx, page, dev, fz_identity, NULL);
+            else
+                fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
+            fz_close_device(ctx, dev);
+            fz_drop_device(ctx, dev);
+            dev = NULL;
+            fz_drop_pixmap(ctx, pix);
+            pix = NULL;
+            fz_drop_display_list(ctx, list);
+            list = NULL;
+            fz_drop_page(ctx, page);
+            page = NULL;
+        }
+    }
+    fz_catch(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_display_list(ctx, list);
+        fz_drop_page(ctx, page);
+        /* No point in the other threads carrying on. */
+        r.next = count;
+        mupdf::internal_throw_exception(ctx);
+    }
+}
+
+/* Renders `pages` of `doc` with the GIL released, into consecutive slots of
+w * h * n bytes of writable buffer `out`, for Document.render_pages().
+
+Pages are rendered by up to `threads` threads, each using its own clone of the
+fz_context. The document is not thread-safe, so with more than one thread,
+pages are interpreted into display lists one at a time, and only rasterised
+concurrently. `threads` is ignored if MUPDF_mt_ctx=0. */
+void JM_render_pages_nogil(
+        mupdf::FzDocument& doc,
+        PyObject* pages,
+        PyObject* ctm,
+        mupdf::FzColorspace& cs,
+        int alpha,
+        int annots,
+        PyObject* out,
+        int w,
+        int h,
+        int threads
+        )
+{
+    if (!JM_mt_ctx())
+        threads = 1;
+    jm_render_pages r;
+    r.doc = doc.m_internal;
+    r.pages = JM_page_numbers(pages);
+    r.matrix = JM_matrix_from_py(ctm);
+    r.cs = cs.m_internal;
+    r.alpha = alpha;
+    r.annots = annots;
+    r.w = w;
+    r.h = h;
+    r.next = 0;
+    int count = (int) r.pages.size();
+    if (threads > count)
+        threads = count;
+    if (threads < 1)
+        threads = 1;
+    r.use_lists = threads > 1;
+    /* Released after allow_threads has restored the GIL. */
+    JM_writable_buffer outbuf(out);
+    if (!outbuf.m_valid)
+        throw std::runtime_error("out: no buffer");
+    if (outbuf.m_view.itemsize != 1 || !PyBuffer_IsContiguous(&outbuf.m_view, 'C'))
+        throw std::runtime_error("out: not contiguous bytes");
+    r.n = fz_colorspace_n(mupdf::internal_context_get(), r.cs) + alpha;
+    if (w < 0 || h < 0 || outbuf.m_view.len < (Py_ssize_t) count * w * h * r.n)
+        throw std::runtime_error("out: buffer is too small");
+    r.arena = (unsigned char*) outbuf.m_view.buf;
+    JM_allow_threads allow_threads;
+    /* Pages are handed out one at a time. */
+    JM_run_on_threads(threads, [&](int)
+    {
+        JM_render_pages_jobs(r);
+    });
+}
+
+/* State of JM_page_stream_text(): the text or words of the lines seen so
+far. Filled by jm_text_stream_line() while the GIL is released, so it must
+not touch Python objects. */
+struct jm_stream_word
+{
+    fz_rect bbox;
+    int block_n;
+    int line_n;
+    int word_n;
+    size_t start;   // location of the word's text in jm_text_stream::text
+    size_t len;
+};
+
+struct jm_text_stream
+{
+    int words = 0;                      // collect words instead of text
+    fz_rect rect = fz_infinite_rect;    // skip chars not overlapping this
+    std::vector<int> delimiters;        // extra word delimiters
+    fz_buffer* text = nullptr;          // escaped text, as JM_append_rune()
+    std::vector<jm_stream_word> word_list;
+    fz_rect wbbox = fz_empty_rect;      // bbox of the current word
+    int block_n = -1;
+    int line_n = -1;
+    int failed = 0;
+    PyObject* callback = nullptr;       // if set, called with each line's words
+    PyObject* error_type = nullptr;     // Python error raised by `callback`
+    PyObject* error_value = nullptr;
+    PyObject* error_traceback = nullptr;
+};
+
+static int jm_stream_is_delimiter(jm_text_stream* ts, int c)
+{
+    if (c <= 32 || c == 160) return 1;  // a standard delimiter
+    for (int d: ts->delimiters)
+    {
+        if (d == c) return 1;
+    }
+    return 0;
+}
+
+/* Returns a list of the collected words, as TextPage.extractWORDS(). Needs
+the GIL. */
+static PyObject* jm_stream_words_list(jm_text_stream* ts)
+{
+    PyObject* lines = PyList_New(0);
+    for (jm_stream_word& w: ts->word_list)
+    {
+        PyObject* s = PyUnicode_DecodeRawUnicodeEscape(
+                (const char*) ts->text->data + w.start,
+                (Py_ssize_t) w.len,
+                "replace"
+                );
+        if (!s)
+        {
+            PyErr_Clear();
+            s = PyUnicode_FromString("");
+        }
+        PyObject* litem = Py_BuildValue(
+                "ffffOiii",
+                w.bbox.x0,
+                w.bbox.y0,
+                w.bbox.x1,
+                w.bbox.y1,
+                s,
+                w.block_n,
+                w.line_n,
+                w.word_n
+                );
+        LIST_APPEND_DROP(lines, litem);
+        Py_DECREF(s);
+    }
+    return lines;
+}
+
+/* Passes the words collected so far to ts->callback and forgets them. Called
+at the end of a line, so no word is in progress. Returns 0 if the callback
+raised; its error is then kept in `ts`. */
+static int jm_stream_flush_words(jm_text_stream* ts)
+{
+    int ok = 1;
+    PyGILState_STATE state = PyGILState_Ensure();
+    PyObject* words = jm_stream_words_list(ts);
+    PyObject* result = PyObject_CallFunctionObjArgs(ts->callback, words, NULL);
+    if (!result)
+    {
+        PyErr_Fetch(&ts->error_type, &ts->error_value, &ts->error_traceback);
+        ok = 0;
+    }
+    Py_XDECREF(result);
+    Py_DECREF(words);
+    PyGILState_Release(state);
+    ts->word_list.clear();
+    ts->text->len = 0;
+    return ok;
+}
+
+/* Appends one line in the same way as JM_print_stext_page_as_text() or
+extractWORDS() would. */
+static void jm_text_stream_line(fz_context* ctx, void* arg, int block_n, fz_stext_line* line)
+{
+    jm_text_stream* ts = (jm_text_stream*) arg;
+    if (block_n != ts->block_n)
+    {
+        ts->block_n = block_n;
+        ts->line_n = -1;
+    }
+    ts->line_n++;
+    int infinite = fz_is_infinite_rect(ts->rect);
+    // We are called from C code, so C++ exceptions must not escape.
+    try
+    {
+        if (!ts->words)
+        {
+            int last_char = 0;
+            for (fz_stext_char* ch = line->first_char; ch; ch = ch->next)
+            {
+                if (infinite || JM_rects_overlap(ts->rect, JM_char_bbox(line, ch)))
+                {
+                    last_char = ch->c;
+                    JM_append_rune(ts->text, last_char);
+                }
+            }
+            if (last_char != 10 && last_char > 0)
+            {
+                mupdf::ll_fz_append_byte(ts->text, 10);
+            }
+            return;
+        }
+        int word_n = 0;             // word counter per line
+        size_t start = ts->text->len;
+        size_t buflen = 0;          // char counter
+        for (fz_stext_char* ch = line->first_char; ch; ch = ch->next)
+        {
+            fz_rect cbbox = JM_char_bbox(line, ch);
+            if (!infinite && !JM_rects_overlap(ts->rect, cbbox))
+            {
+                continue;
+            }
+            if (jm_stream_is_delimiter(ts, ch->c))
+            {
+                if (buflen == 0)
+                {
+                    continue;  // skip delimiters at line start
+                }
+                if (!fz_is_empty_rect(ts->wbbox))
+                {
+                    ts->word_list.push_back({ts->wbbox, block_n, ts->line_n, word_n++, start, ts->text->len - start});
+                    ts->wbbox = fz_empty_rect;
+                    start = ts->text->len;
+                }
+                ts->text->len = start;  // drop the word
+                buflen = 0;
+                continue;
+            }
+            JM_append_rune(ts->text, ch->c);
+            buflen++;
+            ts->wbbox = fz_union_rect(ts->wbbox, cbbox);
+        }
+        if (buflen && !fz_is_empty_rect(ts->wbbox))
+        {
+            ts->word_list.push_back({ts->wbbox, block_n, ts->line_n, word_n++, start, ts->text->len - start});
+            ts->wbbox = fz_empty_rect;
+        }
+        else
+        {
+            ts->text->len = start;
+        }
+    }
+    catch (...)
+    {
+        ts->failed = 1;
+    }
+    if (ts->failed)
+    {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot collect page text");
+    }
+    if (ts->callback && !ts->word_list.empty() && !jm_stream_flush_words(ts))
+    {
+        fz_throw(ctx, FZ_ERROR_ABORT, "text callback raised an exception");
+    }
+}
+
+/* Returns the text of a page like TextPage.extractText(), or if `words` is
+true a list of words like TextPage.extractWORDS(), without making a TextPage.
+Lines are handed over by a streaming stext device as soon as they are
+complete. The page is interpreted with the GIL released.
+
+If `callback` is not None and `words` is true, the words are not collected:
+instead `callback` is called with the list of words of each line as soon as
+the line is complete, so memory use does not grow with the amount of text on
+the page, and None is returned. An exception raised by `callback` stops the
+interpretation and is passed on. */
+PyObject* JM_page_stream_text(
+        mupdf::FzPage& self,
+        PyObject* clip,
+        int flags,
+        PyObject* delimiters,
+        int words,
+        PyObject* callback
+        )
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_page* page = self.m_internal;
+    jm_text_stream ts;
+    ts.words = words;
+    if (words && callback && callback != Py_None)
+    {
+        ts.callback = callback;
+    }
+    if (words && delimiters && PyObject_IsTrue(delimiters) == 1 && PySequence_Check(delimiters))
+    {
+        PyObject* delims = PySequence_Tuple(delimiters);
+        if (!delims)
+        {
+            PyErr_Clear();
+        }
+        for (Py_ssize_t i = 0; delims && i < PyTuple_GET_SIZE(delims); i++)
+        {
+            PyObject* item = PyTuple_GET_ITEM(delims, i);
+            if (PyUnicode_Check(item) && PyUnicode_GET_LENGTH(item) == 1)
+            {
+                ts.delimiters.push_back((int) PyUnicode_READ_CHAR(item, 0));
+            }
+        }
+        Py_XDECREF(delims);
+    }
+    // Default to page's rect if `clip` not specified, as page_get_textpage().
+    ts.rect = (clip == Py_None) ? mupdf::ll_fz_bound_page(page) : JM_rect_from_py(clip);
+    mupdf::FzBuffer text = mupdf::fz_new_buffer(1024);
+    ts.text = text.m_internal;
+
+    fz_stext_options options;
+    memset(&options, 0, sizeof options);
+    options.flags = flags;
+    {
+        JM_allow_threads allow_threads;
+        fz_device* dev = nullptr;
+        fz_var(dev);
+        fz_try(ctx)
+        {
+            dev = fz_new_stext_stream_device(ctx, ts.rect, &options, jm_text_stream_line, &ts);
+            fz_run_page(ctx, page, dev, fz_identity, nullptr);
+            fz_close_device(ctx, dev);
+        }
+        fz_always(ctx)
+        {
+            fz_drop_device(ctx, dev);
+        }
+        fz_catch(ctx)
+        {
+            if (!ts.error_type)
+            {
+                mupdf::internal_throw_exception(ctx);
+            }
+        }
+    }
+
+    if (ts.error_type)
+    {
+        PyErr_Restore(ts.error_type, ts.error_value, ts.error_traceback);
+        return NULL;
+    }
+    if (!words)
+    {
+        return JM_EscapeStrFromBuffer(ts.text);
+    }
+    if (ts.callback)
+    {
+        Py_RETURN_NONE;
+    }
+    return jm_stream_words_list(&ts);
+}
+
+// return extension for pymupdf image type
+const char *JM_image_extension(int type)
+{
+    switch (type) {
+        case(FZ_IMAGE_RAW): return "raw";
+        case(FZ_IMAGE_FLATE): return "flate";
+        case(FZ_IMAGE_LZW): return "lzw";
+        case(FZ_IMAGE_RLD): return "rld";
+        case(FZ_IMAGE_BMP): return "bmp";
+        case(FZ_IMAGE_GIF): return "gif";
+        case(FZ_IMAGE_JBIG2): return "jb2";
+        case(FZ_IMAGE_JPEG): return "jpeg";
+        case(FZ_IMAGE_JPX): return "jpx";
+        case(FZ_IMAGE_JXR): return "jxr";
+        case(FZ_IMAGE_PNG): return "png";
+        case(FZ_IMAGE_PNM): return "pnm";
+        case(FZ_IMAGE_TIFF): return "tiff";
+        default: return "n/a";
+    }
+}
+
+void JM_make_image_block(fz_stext_block *block, PyObject *block_dict)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_image *image = block->u.i.image;
+    fz_buffer *buf = NULL, *freebuf = NULL;
+    fz_compressed_buffer *buffer = fz_compressed_image_buffer(ctx, image);
+    fz_var(buf);
+    fz_var(freebuf);
+    int n = fz_colorspace_n(ctx, image->colorspace);
+    int w = image->w;
+    int h = image->h;
+    const char *ext = NULL;
+    int type = FZ_IMAGE_UNKNOWN;
+    if (buffer)
+        type = buffer->params.type;
+    if (type < FZ_IMAGE_BMP || type == FZ_IMAGE_JBIG2)
+        type = FZ_IMAGE_UNKNOWN;
+    PyObject *bytes = NULL;
+    fz_var(bytes);
+    fz_try(ctx) {
+        if (buffer && type != FZ_IMAGE_UNKNOWN) {
+            buf = buffer->buffer;
+            ext = JM_image_extension(type);
+        } else {
+            buf = freebuf = fz_new_buffer_from_image_as_png(ctx, image, fz_default_color_params);
+            ext = "png";
+        }
+        bytes = JM_BinFromBuffer(buf);
+    }
+    fz_always(ctx) {
+        if (!bytes)
+            bytes = PyBytes_FromString("");
+        DICT_SETITEM_DROP(block_dict, dictkey_width,
+                        Py_BuildValue("i", w));
+        DICT_SETITEM_DROP(block_dict, dictkey_height,
+                        Py_BuildValue("i", h));
+        DICT_SETITEM_DROP(block_dict, dictkey_ext,
+                        Py_BuildValue("s", ext));
+        DICT_SETITEM_DROP(block_dict, dictkey_colorspace,
+                        Py_BuildValue("i", n));
+        DICT_SETITEM_DROP(block_dict, dictkey_xres,
+                        Py_BuildValue("i", image->xres));
+        DICT_SETITEM_DROP(block_dict, dictkey_yres,
+                        Py_BuildValue("i", image->xres));
+        DICT_SETITEM_DROP(block_dict, dictkey_bpc,
+                        Py_BuildValue("i", (int) image->bpc));
+        DICT_SETITEM_DROP(block_dict, dictkey_matrix,
+                        JM_py_from_matrix(block->u.i.transform));
+        DICT_SETITEM_DROP(block_dict, dictkey_size,
+                        Py_BuildValue("n", PyBytes_Size(bytes)));
+        DICT_SETITEM_DROP(block_dict, dictkey_image, bytes);
+
+        fz_drop_buffer(ctx, freebuf);
+    }
+    fz_catch(ctx) {;}
+    return;
+}
+
+static void JM_make_text_block(fz_stext_block *block, PyObject *block_dict, int raw, fz_buffer *buff, fz_rect tp_rect)
+{
+    fz_stext_line *line;
+    PyObject *line_list = PyList_New(0), *line_dict;
+    fz_rect block_rect = fz_empty_rect;
+    for (line = block->u.t.first_line; line; line = line->next) {
+        if (fz_is_empty_rect(fz_intersect_rect(tp_rect, line->bbox)) &&
+            !fz_is_infinite_rect(tp_rect)) {
+            continue;
+        }
+        line_dict = PyDict_New();
+        mupdf::FzStextLine line2(line);
+        mupdf::FzBuffer buff2( mupdf::ll_fz_keep_buffer( buff));
+        mupdf::FzRect tp_rect2( tp_rect);
+        mupdf::FzRect line_rect2 = JM_make_spanlist(
+                line_dict,
+                line2,
+                raw,
+                buff2,
+                tp_rect2
+                );
+        fz_rect& line_rect = *line_rect2.internal();
+        block_rect = fz_union_rect(block_rect, line_rect);
+        DICT_SETITEM_DROP(line_dict, dictkey_wmode,
+                    Py_BuildValue("i", line->wmode));
+        DICT_SETITEM_DROP(line_dict, dictkey_dir, JM_py_from_point(line->dir));
+        DICT_SETITEM_DROP(line_dict, dictkey_bbox,
+                    JM_py_from_rect(line_rect));
+        LIST_APPEND_DROP(line_list, line_dict);
+    }
+    DICT_SETITEM_DROP(block_dict, dictkey_bbox, JM_py_from_rect(block_rect));
+    DICT_SETITEM_DROP(block_dict, dictkey_lines, line_list);
+    return;
+}
+
+void JM_make_textpage_dict(fz_stext_page *tp, PyObject *page_dict, int raw)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_stext_block *block;
+    fz_buffer *text_buffer = fz_new_buffer(ctx, 128);
+    PyObject *block_dict, *block_list = PyList_New(0);
+    fz_rect tp_rect = tp->mediabox;
+    int block_n = -1;
+    for (block = tp->first_block; block; block = block->next) {
+        block_n++;
+        if (!fz_contains_rect(tp_rect, block->bbox) &&
+            !fz_is_infinite_rect(tp_rect) &&
+            block->type == FZ_STEXT_BLOCK_IMAGE) {
+            continue;
+        }
+        if (!fz_is_infinite_rect(tp_rect) &&
+            fz_is_empty_rect(fz_intersect_rect(tp_rect, block->bbox))) {
+            continue;
+        }
+
+        block_dict = PyDict_New();
+        DICT_SETITEM_DROP(block_dict, dictkey_number, Py_BuildValue("i", block_n));
+        DICT_SETITEM_DROP(block_dict, dictkey_type, Py_BuildValue("i", block->type));
+        if (block->type == FZ_STEXT_BLOCK_IMAGE) {
+            DICT_SETITEM_DROP(block_dict, dictkey_bbox, JM_py_from_rect(block->bbox));
+            JM_make_image_block(block, block_dict);
+        } else {
+            JM_make_text_block(block, block_dict, raw, text_buffer, tp_rect);
+        }
+
+        LIST_APPEND_DROP(block_list, block_dict);
+    }
+    DICT_SETITEM_DROP(page_dict, dictkey_blocks, block_list);
+    fz_drop_buffer(ctx, text_buffer);
+}
+
+//-----------------------------------------------------------------
+// Export the characters of a text page as columns: one bytes object per
+// property, holding a C array with an item per character. Characters are
+// selected and grouped into spans like in JM_make_textpage_dict(raw=1).
+//-----------------------------------------------------------------
+template <typename T>
+static PyObject *JM_column_bytes(const std::vector<T>& v)
+{
+    return PyBytes_FromStringAndSize((const char *) v.data(), v.size() * sizeof(T));
+}
+
+PyObject *JM_stext_page_columns(fz_stext_page *tp)
+{
+    std::vector<uint32_t> c;
+    std::vector<float> x0, y0, x1, y1, quad, ox, oy, dx, dy, size;
+    std::vector<int32_t> font, flags, color, block_no, line_no, span_no;
+    std::vector<std::string> fonts;
+    fz_rect tp_rect = tp->mediabox;
+    int infinite = fz_is_infinite_rect(tp_rect);
+    int block_n = -1;
+    for (fz_stext_block *block = tp->first_block; block; block = block->next)
+    {
+        block_n++;
+        if (block->type != FZ_STEXT_BLOCK_TEXT)
+            continue;
+        if (!infinite && fz_is_empty_rect(fz_intersect_rect(tp_rect, block->bbox)))
+            continue;
+        int line_n = -1;
+        for (fz_stext_line *line = block->u.t.first_line; line; line = line->next)
+        {
+            line_n++;
+            if (!infinite && fz_is_empty_rect(fz_intersect_rect(tp_rect, line->bbox)))
+                continue;
+            int span_n = -1;
+            float old_size = -1;
+            int old_flags = -1, old_color = -1;
+            const char *old_font = "";
+            int font_n = -1;
+            for (fz_stext_char *ch = line->first_char; ch; ch = ch->next)
+            {
+                fz_rect r = JM_char_bbox(line, ch);
+                if (!infinite && !JM_rects_overlap(tp_rect, r))
+                    continue;
+                int f = JM_char_font_flags(ch->font, line, ch);
+                const char *fontname = JM_font_name(ch->font);
+                if (ch->size != old_size || f != old_flags || ch->color != old_color
+                        || strcmp(fontname, old_font) != 0)
+                {
+                    span_n++;
+                    old_size = ch->size;
+                    old_flags = f;
+                    old_color = ch->color;
+                    if (strcmp(fontname, old_font) != 0)
+                    {
+                        auto it = std::find(fonts.begin(), fonts.end(), fontname);
+                        font_n = (int) (it - fonts.begin());
+                        if (it == fonts.end())
+                            fonts.push_back(fontname);
+                    }
+                    old_font = fontname;
+                }
+                fz_quad q = JM_char_quad(line, ch);
+                c.push_back(ch->c);
+                x0.push_back(r.x0);
+                y0.push_back(r.y0);
+                x1.push_back(r.x1);
+                y1.push_back(r.y1);
+                quad.insert(quad.end(), {
+                        q.ul.x, q.ul.y, q.ur.x, q.ur.y,
+                        q.ll.x, q.ll.y, q.lr.x, q.lr.y});
+                ox.push_back(ch->origin.x);
+                oy.push_back(ch->origin.y);
+                dx.push_back(line->dir.x);
+                dy.push_back(line->dir.y);
+                font.push_back(font_n);
+                size.push_back(ch->size);
+                flags.push_back(f);
+                color.push_back(ch->color);
+                block_no.push_back(block_n);
+                line_no.push_back(line_n);
+                span_no.push_back(span_n);
+            }
+        }
+    }
+
+    PyObject *font_list = PyList_New(0);
+    for (const std::string& name : fonts)
+    {
+        LIST_APPEND_DROP(font_list, JM_EscapeStrFromStr(name.c_str()));
+    }
+    PyObject *rc = PyDict_New();
+    DICT_SETITEMSTR_DROP(rc, "count", Py_BuildValue("n", (Py_ssize_t) c.size()));
+    DICT_SETITEMSTR_DROP(rc, "fonts", font_list);
+    DICT_SETITEMSTR_DROP(rc, "c", JM_column_bytes(c));
+    DICT_SETITEMSTR_DROP(rc, "x0", JM_column_bytes(x0));
+    DICT_SETITEMSTR_DROP(rc, "y0", JM_column_bytes(y0));
+    DICT_SETITEMSTR_DROP(rc, "x1", JM_column_bytes(x1));
+    DICT_SETITEMSTR_DROP(rc, "y1", JM_column_bytes(y1));
+    DICT_SETITEMSTR_DROP(rc, "quad", JM_column_bytes(quad));
+    DICT_SETITEMSTR_DROP(rc, "ox", JM_column_bytes(ox));
+    DICT_SETITEMSTR_DROP(rc, "oy", JM_column_bytes(oy));
+    DICT_SETITEMSTR_DROP(rc, "dx", JM_column_bytes(dx));
+    DICT_SETITEMSTR_DROP(rc, "dy", JM_column_bytes(dy));
+    DICT_SETITEMSTR_DROP(rc, "font", JM_column_bytes(font));
+    DICT_SETITEMSTR_DROP(rc, "size", JM_column_bytes(size));
+    DICT_SETITEMSTR_DROP(rc, "flags", JM_column_bytes(flags));
+    DICT_SETITEMSTR_DROP(rc, "color", JM_column_bytes(color));
+    DICT_SETITEMSTR_DROP(rc, "block", JM_column_bytes(block_no));
+    DICT_SETITEMSTR_DROP(rc, "line", JM_column_bytes(line_no));
+    DICT_SETITEMSTR_DROP(rc, "span", JM_column_bytes(span_no));
+    return rc;
+}
+
+//-----------------------------------------------------------------
+// Geometric core of table detection in table.py. These functions give the
+// same results as the Python functions edges_to_intersections(),
+// intersections_to_cells() and the grouping step of cells_to_tables(),
+// including the order of items. They keep no state between calls.
+//-----------------------------------------------------------------
+static double jm_table_key(PyObject *obj, const char *key)
+{
+    PyObject *item = PyDict_Check(obj) ? PyDict_GetItemString(obj, key) : NULL;
+    double d = item ? PyFloat_AsDouble(item) : 0;
+    if (!item || PyErr_Occurred())
+    {
+        PyErr_Clear();
+        throw std::runtime_error(std::string("bad table edge: no float '") + key + "'");
+    }
+    return d;
+}
+
+static double jm_table_item(PyObject *seq, Py_ssize_t i)
+{
+    double d;
+    if (jm_float_item(seq, i, &d))
+    {
+        throw std::runtime_error("bad table cell: not a sequence of floats");
+    }
+    return d;
+}
+
+struct jm_table_edge
+{
+    PyObject *obj;  // borrowed
+    double x0, x1, top, bottom;
+};
+
+// Return list of the items of a sequence, raising on error.
+static PyObject *jm_table_list(PyObject *seq)
+{
+    PyObject *list = PySequence_List(seq);
+    if (!list)
+    {
+        PyErr_Clear();
+        throw std::runtime_error("bad table argument: not a sequence");
+    }
+    return list;
+}
+
+PyObject *JM_edges_to_intersections(PyObject *edges, double x_tolerance, double y_tolerance)
+{
+    std::vector<jm_table_edge> v, h;
+    PyObject *list = jm_table_list(edges);
+    PyObject *intersections = NULL;
+    try
+    {
+        for (Py_ssize_t i = 0; i < PyList_GET_SIZE(list); i++)
+        {
+            PyObject *edge = PyList_GET_ITEM(list, i);
+            PyObject *o = PyDict_Check(edge) ? PyDict_GetItemString(edge, "orientation") : NULL;
+            if (!o || !PyUnicode_Check(o))
+            {
+                throw std::runtime_error("bad table edge: no orientation");
+            }
+            if (PyUnicode_CompareWithASCIIString(o, "v") == 0)
+            {
+                v.push_back({edge,
+                        jm_table_key(edge, "x0"), 0,
+                        jm_table_key(edge, "top"), jm_table_key(edge, "bottom")});
+            }
+            else if (PyUnicode_CompareWithASCIIString(o, "h") == 0)
+            {
+                h.push_back({edge,
+                        jm_table_key(edge, "x0"), jm_table_key(edge, "x1"),
+                        jm_table_key(edge, "top"), 0});
+            }
+        }
+        std::stable_sort(v.begin(), v.end(), [](const jm_table_edge& a, const jm_table_edge& b) {
+            return a.x0 < b.x0 || (a.x0 == b.x0 && a.top < b.top);
+        });
+        std::stable_sort(h.begin(), h.end(), [](const jm_table_edge& a, const jm_table_edge& b) {
+            return a.top < b.top || (a.top == b.top && a.x0 < b.x0);
+        });
+
+        intersections = PyDict_New();
+        for (const jm_table_edge& ve : v)
+        {
+            // Horizontal edges are sorted by top, so those passing both
+            // vertical tests are a contiguous range. Both tests are
+            // monotonic in h.top, which makes the range exact.
+            auto it = std::partition_point(h.begin(), h.end(), [&](const jm_table_edge& he) {
+                return !(ve.top <= he.top + y_tolerance);
+            });
+            for (; it != h.end() && ve.bottom >= it->top - y_tolerance; ++it)
+            {
+                const jm_table_edge& he = *it;
+                if (!(ve.x0 >= he.x0 - x_tolerance && ve.x0 <= he.x1 + x_tolerance))
+                {
+                    continue;
+                }
+                PyObject *vertex = Py_BuildValue("OO",
+                        PyDict_GetItemString(ve.obj, "x0"),
+                        PyDict_GetItemString(he.obj, "top"));
+                PyObject *item = PyDict_GetItem(intersections, vertex);
+                if (!item)
+                {
+                    item = PyDict_New();
+                    DICT_SETITEMSTR_DROP(item, "v", PyList_New(0));
+                    DICT_SETITEMSTR_DROP(item, "h", PyList_New(0));
+                    PyDict_SetItem(intersections, vertex, item);
+                    Py_DECREF(item);
+                }
+                Py_DECREF(vertex);
+                PyList_Append(PyDict_GetItemString(item, "v"), ve.obj);
+                PyList_Append(PyDict_GetItemString(item, "h"), he.obj);
+            }
+        }
+    }
+    catch (...)
+    {
+        Py_DECREF(list);
+        Py_XDECREF(intersections);
+        throw;
+    }
+    Py_DECREF(list);
+    return intersections;
+}
+
+PyObject *JM_intersections_to_cells(PyObject *intersections)
+{
+    if (!PyDict_Check(intersections))
+    {
+        throw std::runtime_error("bad intersections: not a dict");
+    }
+    PyObject *points = PyDict_Keys(intersections);
+    if (!points || PyList_Sort(points) < 0)
+    {
+        Py_XDECREF(points);
+        PyErr_Clear();
+        throw std::runtime_error("bad intersections: cannot sort points");
+    }
+    PyObject *cells = PyList_New(0);
+    try
+    {
+        typedef std::array<double, 4> bbox;
+        typedef std::pair<double, double> point;
+        Py_ssize_t n = PyList_GET_SIZE(points);
+        std::vector<point> pts(n);
+        std::vector<std::vector<int>> v_ids(n), h_ids(n);
+        std::map<bbox, int> bbox_ids;
+        std::map<point, Py_ssize_t> pt_index;
+        std::map<double, std::vector<Py_ssize_t>> rows;  // points by y
+
+        // Edges are compared by their bbox, so map each bbox to an id.
+        auto edge_ids = [&](PyObject *edges, std::vector<int>& ids) {
+            for (Py_ssize_t k = 0; k < PySequence_Size(edges); k++)
+            {
+                PyObject *edge = PySequence_ITEM(edges, k);
+                bbox b;
+                try
+                {
+                    b = {jm_table_key(edge, "x0"), jm_table_key(edge, "top"),
+                            jm_table_key(edge, "x1"), jm_table_key(edge, "bottom")};
+                }
+                catch (...)
+                {
+                    Py_XDECREF(edge);
+                    throw;
+                }
+                Py_DECREF(edge);
+                auto r = bbox_ids.insert(std::make_pair(b, (int) bbox_ids.size()));
+                ids.push_back(r.first->second);
+            }
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        };
+        for (Py_ssize_t i = 0; i < n; i++)
+        {
+            PyObject *key = PyList_GET_ITEM(points, i);
+            PyObject *item = PyDict_GetItem(intersections, key);
+            PyObject *v = PyDict_Check(item) ? PyDict_GetItemString(item, "v") : NULL;
+            PyObject *h = PyDict_Check(item) ? PyDict_GetItemString(item, "h") : NULL;
+            if (!v || !h)
+            {
+                throw std::runtime_error("bad intersections: no 'v' or 'h' edges");
+            }
+            pts[i] = point(jm_table_item(key, 0), jm_table_item(key, 1));
+            edge_ids(v, v_ids[i]);
+            edge_ids(h, h_ids[i]);
+            pt_index[pts[i]] = i;
+            rows[pts[i].second].push_back(i);
+        }
+
+        auto common = [](const std::vector<int>& a, const std::vector<int>& b) {
+            auto i = a.begin();
+            auto j = b.begin();
+            while (i != a.end() && j != b.end())
+            {
+                if (*i < *j) ++i;
+                else if (*j < *i) ++j;
+                else return true;
+            }
+            return false;
+        };
+        auto edge_connects = [&](Py_ssize_t p1, Py_ssize_t p2) {
+            if (pts[p1].first == pts[p2].first && common(v_ids[p1], v_ids[p2]))
+                return true;
+            if (pts[p1].second == pts[p2].second && common(h_ids[p1], h_ids[p2]))
+                return true;
+            return false;
+        };
+
+        for (Py_ssize_t i = 0; i < n - 1; i++)
+        {
+            // Points are sorted by x, then y: those directly below follow
+            // this one. Those directly right are in its row.
+            const std::vector<Py_ssize_t>& row = rows[pts[i].second];
+            auto right_begin = std::upper_bound(row.begin(), row.end(), i);
+            bool found = false;
+            for (Py_ssize_t below = i + 1; below < n && pts[below].first == pts[i].first && !found; below++)
+            {
+                if (!edge_connects(i, below))
+                    continue;
+                for (auto r = right_begin; r != row.end(); ++r)
+                {
+                    Py_ssize_t right = *r;
+                    if (!edge_connects(i, right))
+                        continue;
+                    auto br = pt_index.find(point(pts[right].first, pts[below].second));
+                    if (br != pt_index.end()
+                            && edge_connects(br->second, right)
+                            && edge_connects(br->second, below))
+                    {
+                        PyObject *pt = PyList_GET_ITEM(points, i);
+                        PyObject *right_pt = PyList_GET_ITEM(points, right);
+                        PyObject *below_pt = PyList_GET_ITEM(points, below);
+                        LIST_APPEND_DROP(cells, Py_BuildValue("OOOO",
+                                PyTuple_GET_ITEM(pt, 0), PyTuple_GET_ITEM(pt, 1),
+                                PyTuple_GET_ITEM(right_pt, 0), PyTuple_GET_ITEM(below_pt, 1)));
+                        found = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        Py_DECREF(points);
+        Py_DECREF(cells);
+        throw;
+    }
+    Py_DECREF(points);
+    return cells;
+}
+
+PyObject *JM_cells_to_table_groups(PyObject *cells)
+{
+    typedef std::pair<double, double> point;
+    PyObject *list = jm_table_list(cells);
+    PyObject *tables = PyList_New(0);
+    try
+    {
+        Py_ssize_t n = PyList_GET_SIZE(list);
+        std::vector<std::array<point, 4>> corners(n);
+        for (Py_ssize_t i = 0; i < n; i++)
+        {
+            PyObject *cell = PyList_GET_ITEM(list, i);
+            double x0 = jm_table_item(cell, 0), top = jm_table_item(cell, 1);
+            double x1 = jm_table_item(cell, 2), bottom = jm_table_item(cell, 3);
+            corners[i] = {point(x0, top), point(x0, bottom), point(x1, top), point(x1, bottom)};
+        }
+
+        // Repeatedly pass over the remaining cells, adding those which share
+        // a corner with the current group, until a pass adds none.
+        std::vector<Py_ssize_t> remaining(n);
+        for (Py_ssize_t i = 0; i < n; i++)
+            remaining[i] = i;
+        std::set<point> current_corners;
+        std::vector<Py_ssize_t> current;
+        auto flush = [&]() {
+            PyObject *group = PyList_New(0);
+            for (Py_ssize_t i : current)
+            {
+                PyList_Append(group, PyList_GET_ITEM(list, i));
+            }
+            LIST_APPEND_DROP(tables, group);
+            current.clear();
+            current_corners.clear();
+        };
+        while (!remaining.empty())
+        {
+            size_t initial = current.size();
+            std::vector<Py_ssize_t> rest;
+            for (Py_ssize_t i : remaining)
+            {
+                bool touches = current.empty();
+                for (int k = 0; k < 4 && !touches; k++)
+                {
+                    touches = current_corners.count(corners[i][k]) > 0;
+                }
+                if (touches)
+                {
+                    current_corners.insert(corners[i].begin(), corners[i].end());
+                    current.push_back(i);
+                }
+                else
+                {
+                    rest.push_back(i);
+                }
+            }
+            remaining.swap(rest);
+            if (current.size() == initial)
+            {
+                flush();
+            }
+        }
+        if (!current.empty())
+        {
+            flush();
+        }
+    }
+    catch (...)
+    {
+        Py_DECREF(list);
+        Py_DECREF(tables);
+        throw;
+    }
+    Py_DECREF(list);
+    return tables;
+}
+
+//-----------------------------------------------------------------
+// get one pixel as a list
+//-----------------------------------------------------------------
+PyObject *pixmap_pixel(fz_pixmap* pm, int x, int y)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    PyObject *p = NULL;
+    if (0
+            || x < 0
+            || x >= pm->w
+            || y < 0
+            || y >= pm->h
+            )
+    {
+        throw std::range_error( MSG_PIXEL_OUTSIDE);
+    }
+    int n = pm->n;
+    int stride = fz_pixmap_stride(ctx, pm);
+    int i = stride * y + n * x;
+    p = PyTuple_New(n);
+    for (int j = 0; j < n; j++)
+    {
+        PyTuple_SET_ITEM(p, j, Py_BuildValue("i", pm->samples[i + j]));
+    }
+    return p;
+}
+
+int pixmap_n(mupdf::FzPixmap& pixmap)
+{
+    return mupdf::fz_pixmap_components( pixmap);
+}
+
+static int
+JM_INT_ITEM(PyObject *obj, Py_ssize_t idx, int *result)
+{
+    PyObject *temp = PySequence_ITEM(obj, idx);
+    if (!temp) return 1;
+    if (PyLong_Check(temp)) {
+        *result = (int) PyLong_AsLong(temp);
+        Py_DECREF(temp);
+    } else if (PyFloat_Check(temp)) {
+        *result = (int) PyFloat_AsDouble(temp);
         Py_DECREF(temp);
     } else {
         Py_DECREF(temp);
@@ -3923,6 +5607,203 @@ no_more_matches:;
     return quads;
 }
 
+
+//-----------------------------------------------------------------------------
+// Search for many needles at once. The needles are compiled once by
+// JM_new_search_needles() and can then be used for any number of pages.
+//-----------------------------------------------------------------------------
+fz_search_needles *JM_new_search_needles(PyObject *needles)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_search_needles *nd = NULL;
+    std::vector<std::string> strings;
+    std::vector<const char *> ptrs;
+    Py_ssize_t i, n = PySequence_Size(needles);
+
+    if (n < 0) {
+        PyErr_Clear();
+        throw std::runtime_error("needles must be a sequence of str");
+    }
+    for (i = 0; i < n; i++) {
+        PyObject *item = PySequence_ITEM(needles, i);
+        const char *text = item ? PyUnicode_AsUTF8(item) : NULL;
+        if (!text) {
+            Py_XDECREF(item);
+            PyErr_Clear();
+            throw std::runtime_error("needles must be a sequence of str");
+        }
+        strings.push_back(text);
+        Py_DECREF(item);
+    }
+    for (i = 0; i < n; i++) {
+        ptrs.push_back(strings[i].c_str());
+    }
+    fz_try(ctx)
+        nd = fz_new_search_needles(ctx, (int) n, ptrs.data());
+    fz_catch(ctx)
+        mupdf::internal_throw_exception(ctx);
+    return nd;
+}
+
+void JM_drop_search_needles(fz_search_needles *needles)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    fz_drop_search_needles(ctx, needles);
+}
+
+struct needle_hits
+{
+    PyObject *hits;
+    PyObject *quads;  // quads of the current hit, owned by hits
+    fz_quad last;
+    float hfuzz, vfuzz;
+};
+
+static void on_needle_hit_char(fz_context *ctx, void *arg, int needle, fz_stext_line *line, fz_stext_char *ch, int is_at_start)
+{
+    struct needle_hits *h = (struct needle_hits *) arg;
+    float vfuzz = ch->size * h->vfuzz;
+    float hfuzz = ch->size * h->hfuzz;
+    fz_quad ch_quad = JM_char_quad(line, ch);
+    if (is_at_start) {
+        h->quads = PyList_New(0);
+        LIST_APPEND_DROP(h->hits, Py_BuildValue("iN", needle, h->quads));
+    }
+    else if (hdist(&line->dir, &h->last.lr, &ch_quad.ll) < hfuzz
+        && vdist(&line->dir, &h->last.lr, &ch_quad.ll) < vfuzz
+        && hdist(&line->dir, &h->last.ur, &ch_quad.ul) < hfuzz
+        && vdist(&line->dir, &h->last.ur, &ch_quad.ul) < vfuzz)
+    {
+        h->last.ur = ch_quad.ur;
+        h->last.lr = ch_quad.lr;
+        PyList_SetItem(h->quads, PyList_Size(h->quads) - 1, JM_py_from_quad(h->last));
+        return;
+    }
+    h->last = ch_quad;
+    LIST_APPEND_DROP(h->quads, JM_py_from_quad(ch_quad));
+}
+
+//-----------------------------------------------------------------------------
+// Returns a list of (needle, quads) items, one per hit, in the order in
+// which the hits end on the page.
+//-----------------------------------------------------------------------------
+PyObject *JM_search_stext_page_needles(fz_stext_page *page, fz_search_needles *needles)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    struct needle_hits h;
+
+    h.hits = PyList_New(0);
+    h.quads = NULL;
+    h.hfuzz = 0.2f; /* merge kerns but not large gaps */
+    h.vfuzz = 0.1f;
+    fz_try(ctx)
+        fz_match_stext_page_needles(ctx, page, needles, page->mediabox, on_needle_hit_char, &h);
+    fz_catch(ctx) {
+        Py_DECREF(h.hits);
+        mupdf::internal_throw_exception(ctx);
+    }
+    return h.hits;
+}
+
+static inline int is_search_space(int c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == 0xA0 || c == 0x2028 || c == 0x2029;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the set of words on a page, as seen by JM_search_stext_page_needles:
+// runs of characters between white space and line breaks.
+//-----------------------------------------------------------------------------
+PyObject *JM_stext_page_words(fz_stext_page *page)
+{
+    fz_rect area = page->mediabox;
+    int infinite = fz_is_infinite_rect(area);
+    PyObject *words = PySet_New(NULL);
+    std::string word;
+
+    for (fz_stext_block *block = page->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
+        for (fz_stext_line *line = block->u.t.first_line; line; line = line->next) {
+            for (fz_stext_char *ch = line->first_char; ch; ch = ch->next) {
+                if (!infinite && fz_is_empty_rect(fz_intersect_rect(fz_rect_from_quad(ch->quad), area))) {
+                    continue;
+                }
+                if (is_search_space(ch->c)) {
+                    if (!word.empty()) {
+                        SET_ADD_DROP(words, PyUnicode_DecodeUTF8(word.data(), word.size(), "replace"));
+                        word.clear();
+                    }
+                    continue;
+                }
+                char utf[FZ_UTFMAX];
+                word.append(utf, fz_runetochar(utf, ch->c));
+            }
+            if (!word.empty()) {
+                SET_ADD_DROP(words, PyUnicode_DecodeUTF8(word.data(), word.size(), "replace"));
+                word.clear();
+            }
+        }
+    }
+    return words;
+}
+
+struct needle_words
+{
+    PyObject *result;
+    std::vector<size_t> *starts;
+    std::vector<Py_ssize_t> *last;
+};
+
+static void on_needle_word(fz_context *ctx, void *arg, int needle, size_t start, size_t end)
+{
+    struct needle_words *nw = (struct needle_words *) arg;
+    Py_ssize_t word = std::upper_bound(nw->starts->begin(), nw->starts->end(), start) - nw->starts->begin() - 1;
+    if ((*nw->last)[needle] == word) return;
+    (*nw->last)[needle] = word;
+    LIST_APPEND_DROP(PyList_GET_ITEM(nw->result, needle), PyLong_FromSsize_t(word));
+}
+
+//-----------------------------------------------------------------------------
+// For each needle, the indices of the words in 'words' containing it.
+//-----------------------------------------------------------------------------
+PyObject *JM_search_needles_in_words(fz_search_needles *needles, PyObject *words)
+{
+    fz_context* ctx = mupdf::internal_context_get();
+    std::string text;
+    std::vector<size_t> starts;
+    Py_ssize_t i, n = PySequence_Size(words);
+    int count = fz_count_search_needles(ctx, needles);
+    std::vector<Py_ssize_t> last(count, -1);
+    struct needle_words nw;
+
+    for (i = 0; i < n; i++) {
+        PyObject *item = PySequence_ITEM(words, i);
+        const char *word = item ? PyUnicode_AsUTF8(item) : NULL;
+        if (!word) {
+            Py_XDECREF(item);
+            PyErr_Clear();
+            throw std::runtime_error("words must be a sequence of str");
+        }
+        starts.push_back(text.size());
+        text.append(word);
+        text.push_back('\n');
+        Py_DECREF(item);
+    }
+    nw.result = PyList_New(count);
+    for (i = 0; i < count; i++) {
+        PyList_SET_ITEM(nw.result, i, PyList_New(0));
+    }
+    nw.starts = &starts;
+    nw.last = &last;
+    fz_try(ctx)
+        fz_match_string_needles(ctx, needles, text.c_str(), on_needle_word, &nw);
+    fz_catch(ctx) {
+        Py_DECREF(nw.result);
+        mupdf::internal_throw_exception(ctx);
+    }
+    return nw.result;
+}
+
 /* MuPDF-1.23.x has an incorrect and unusable
 fz_new_image_from_compressed_buffer() wrapper that thinks the `decode` and
 `colorkey` args are out-params. So we provide an alternative wrapper where
@@ -4069,11 +5950,86 @@ fz_stext_page* page_get_textpage(
         PyObject* matrix
         );
 
+fz_pixmap* JM_pixmap_from_display_list_nogil(
+        mupdf::FzDisplayList& list,
+        PyObject* ctm,
+        mupdf::FzColorspace& cs,
+        int alpha,
+        PyObject* clip,
+        int threads=1,
+        int hints=0,
+        PyObject* out=Py_None
+        );
+
+PyObject* JM_pixmap_buffer(mupdf::FzPixmap& pixmap, int flat, PyObject* owner=Py_None);
+int JM_pixmap_buffer_exports(PyObject* buffer);
+
+fz_pixmap* JM_scale_pixmap_nogil(
+        mupdf::FzPixmap& src,
+        float w,
+        float h,
+        PyObject* clip,
+        int threads=1
+        );
+
+fz_stext_page* JM_new_stext_page_from_display_list_nogil(
+        mupdf::FzDisplayList& list,
+        int flags
+        );
+
+int JM_prefetch_obj_stms(
+        mupdf::PdfDocument& pdf,
+        int threads=1
+        );
+
+void JM_rewrite_images(
+        mupdf::PdfDocument& pdf,
+        mupdf::PdfImageRewriterOptions& opts,
+        int threads=1
+        );
+
+PyObject* JM_bound_pages(
+        mupdf::FzDocument& doc,
+        PyObject* pages,
+        PyObject* ctm
+        );
+
+void JM_render_pages_nogil(
+        mupdf::FzDocument& doc,
+        PyObject* pages,
+        PyObject* ctm,
+        mupdf::FzColorspace& cs,
+        int alpha,
+        int annots,
+        PyObject* out,
+        int w,
+        int h,
+        int threads=1
+        );
+
+PyObject* JM_page_stream_text(
+        mupdf::FzPage& self,
+        PyObject* clip,
+        int flags,
+        PyObject* delimiters,
+        int words,
+        PyObject* callback=NULL
+        );
+
 void JM_make_textpage_dict(fz_stext_page *tp, PyObject *page_dict, int raw);
+PyObject *JM_stext_page_columns(fz_stext_page *tp);
+PyObject *JM_edges_to_intersections(PyObject *edges, double x_tolerance, double y_tolerance);
+PyObject *JM_intersections_to_cells(PyObject *intersections);
+PyObject *JM_cells_to_table_groups(PyObject *cells);
 PyObject *pixmap_pixel(fz_pixmap* pm, int x, int y);
 int pixmap_n(mupdf::FzPixmap& pixmap);
 
 PyObject* JM_search_stext_page(fz_stext_page *page, const char *needle);
+fz_search_needles *JM_new_search_needles(PyObject *needles);
+void JM_drop_search_needles(fz_search_needles *needles);
+PyObject *JM_search_stext_page_needles(fz_stext_page *page, fz_search_needles *needles);
+PyObject *JM_stext_page_words(fz_stext_page *page);
+PyObject *JM_search_needles_in_words(fz_search_needles *needles, PyObject *words);
 
 PyObject *set_pixel(fz_pixmap* pm, int x, int y, PyObject *color);
 
@@ -92,8 +92,13 @@ from . import (
     sRGB_to_pdf,
     Point,
     message,
+    extra,
+    g_use_extra,
 )
 
+# Characters, edges and text page of the most recent find_tables() call.
+# Only kept for compatibility: table detection itself passes them around
+# explicitly.
 EDGES = []  # vector graphics from PyMuPDF
 CHARS = []  # text characters from PyMuPDF
 TEXTPAGE = None
@@ -1098,6 +1103,8 @@ def edges_to_intersections(edges, x_tolerance=1, y_tolerance=1) -> dict:
     Given a list of edges, return the points at which they intersect
     within `tolerance` pixels.
     """
+    if g_use_extra:
+        return extra.JM_edges_to_intersections(edges, x_tolerance, y_tolerance)
     intersections = {}
     v_edges, h_edges = [
         list(filter(lambda x: x["orientation"] == o, edges)) for o in ("v", "h")
@@ -1134,6 +1141,8 @@ def intersections_to_cells(intersections):
     and a list of edge objects as values. The edge objects should correspond
     to the edges that touch the intersection.
     """
+    if g_use_extra:
+        return extra.JM_intersections_to_cells(intersections)
 
     def edge_connects(p1, p2) -> bool:
         def edges_to_set(edges):
@@ -1187,11 +1196,50 @@ def intersections_to_cells(intersections):
     return list(filter(None, cell_gen))
 
 
-def cells_to_tables(page, cells) -> list:
+def cells_to_tables(page, cells, textpage=None) -> list:
     """
     Given a list of bounding boxes (`cells`), return a list of tables that
     hold those cells most simply (and contiguously).
     """
+    if textpage is None:
+        textpage = TEXTPAGE
+    if g_use_extra:
+        tables = extra.JM_cells_to_table_groups(cells)
+    else:
+        tables = cells_to_table_groups(cells)
+
+    # PyMuPDF modification:
+    # Remove tables without text or having only 1 column
+    for i in range(len(tables) - 1, -1, -1):
+        r = EMPTY_RECT()
+        x1_vals = set()
+        x0_vals = set()
+        for c in tables[i]:
+            r |= c
+            x1_vals.add(c[2])
+            x0_vals.add(c[0])
+        if (
+            len(x1_vals) < 2
+            or len(x0_vals) < 2
+            or white_spaces.issuperset(
+                page.get_textbox(
+                    r,
+                    textpage=textpage,
+                )
+            )
+        ):
+            del tables[i]
+
+    # Sort the tables top-to-bottom-left-to-right based on the value of the
+    # topmost-and-then-leftmost coordinate of a table.
+    _sorted = sorted(tables, key=lambda t: min((c[1], c[0]) for c in t))
+    return _sorted
+
+
+def cells_to_table_groups(cells) -> list:
+    """
+    Group cells (bounding boxes) into tables of cells connected by corners.
+    """
 
     def bbox_to_corners(bbox) -> tuple:
         x0, top, x1, bottom = bbox
@@ -1240,33 +1288,7 @@ def cells_to_tables(page, cells) -> list:
     if len(current_cells):
         # ... store it.
         tables.append(list(current_cells))
-
-    # PyMuPDF modification:
-    # Remove tables without text or having only 1 column
-    for i in range(len(tables) - 1, -1, -1):
-        r = EMPTY_RECT()
-        x1_vals = set()
-        x0_vals = set()
-        for c in tables[i]:
-            r |= c
-            x1_vals.add(c[2])
-            x0_vals.add(c[0])
-        if (
-            len(x1_vals) < 2
-            or len(x0_vals) < 2
-            or white_spaces.issuperset(
-                page.get_textbox(
-                    r,
-                    textpage=TEXTPAGE,
-                )
-            )
-        ):
-            del tables[i]
-
-    # Sort the tables top-to-bottom-left-to-right based on the value of the
-    # topmost-and-then-leftmost coordinate of a table.
-    _sorted = sorted(tables, key=lambda t: min((c[1], c[0]) for c in t))
-    return _sorted
+    return tables
 
 
 class CellGroup:
@@ -1296,9 +1318,10 @@ class TableHeader:
 
 class Table:
     from typing import Optional
-    def __init__(self, page, cells,exclusion_zone:Optional[Sequence]=None):
+    def __init__(self, page, cells,exclusion_zone:Optional[Sequence]=None, chars=None):
         self.page = page
         self.cells = cells
+        self.chars = chars
         self.header = self._get_header()  # PyMuPDF extension
         self.exclusion_zone=[fitz.Rect(i) for i in exclusion_zone] if exclusion_zone else None
     @property
@@ -1334,19 +1357,22 @@ class Table:
         return max([len(r.cells) for r in self.rows])
 
     def extract(self, markdown=False, **kwargs) -> list:
-        chars = CHARS
+        # Compute char midpoints once, not once per row and cell.
+        chars = [
+            ((char["x0"] + char["x1"]) / 2, (char["top"] + char["bottom"]) / 2, char)
+            for char in (CHARS if self.chars is None else self.chars)
+        ]
         table_arr = []
-        def char_in_bbox(char, bbox) -> bool:
-            v_mid = (char["top"] + char["bottom"]) / 2
-            h_mid = (char["x0"] + char["x1"]) / 2
+        def chars_in_bbox(chars, bbox) -> list:
             x0, top, x1, bottom = bbox
-            return bool(
-                (h_mid >= x0) and (h_mid < x1) and (v_mid >= top) and (v_mid < bottom)
-            )
+            return [
+                item for item in chars
+                if x0 <= item[0] < x1 and top <= item[1] < bottom
+            ]
 
         for row in self.rows:
             arr = []
-            row_chars = [char for char in chars if char_in_bbox(char, row.bbox)]
+            row_chars = chars_in_bbox(chars, row.bbox)
 
             for cell in row.cells:
                 if cell is None:
@@ -1357,7 +1383,7 @@ class Table:
                     
                 else:
                     cell_chars = [
-                        char for char in row_chars if char_in_bbox(char, cell)
+                        item[2] for item in chars_in_bbox(row_chars, cell)
                     ]
 
                     if len(cell_chars):
@@ -1744,9 +1770,12 @@ class TableFinder:
     https://github.com/tabulapdf/tabula-extractor/issues/16
     """
 
-    def __init__(self, page, settings=None):
+    def __init__(self, page, settings=None, chars=None, edges=None, textpage=None):
         self.page = page
         self.settings = TableSettings.resolve(settings)
+        self.chars = CHARS if chars is None else chars
+        self.page_edges = EDGES if edges is None else edges
+        self.textpage = TEXTPAGE if textpage is None else textpage
         self.edges = self.get_edges()
         self.intersections = edges_to_intersections(
             self.edges,
@@ -1755,8 +1784,8 @@ class TableFinder:
         )
         self.cells = intersections_to_cells(self.intersections)
         self.tables = [
-            Table(self.page, cell_group)
-            for cell_group in cells_to_tables(self.page, self.cells)
+            Table(self.page, cell_group, chars=self.chars)
+            for cell_group in cells_to_tables(self.page, self.cells, self.textpage)
         ]
 
     def get_edges(self) -> list:
@@ -1778,7 +1807,7 @@ class TableFinder:
         h_strat = settings.horizontal_strategy
 
         if v_strat == "text" or h_strat == "text":
-            words = extract_words(CHARS, **(settings.text_settings or {}))
+            words = extract_words(self.chars, **(settings.text_settings or {}))
         else:
             words = []
 
@@ -1801,9 +1830,9 @@ class TableFinder:
                 )
 
         if v_strat == "lines":
-            v_base = filter_edges(EDGES, "v")
+            v_base = filter_edges(self.page_edges, "v")
         elif v_strat == "lines_strict":
-            v_base = filter_edges(EDGES, "v", edge_type="line")
+            v_base = filter_edges(self.page_edges, "v", edge_type="line")
         elif v_strat == "text":
             v_base = words_to_edges_v(words, word_threshold=settings.min_words_vertical)
         elif v_strat == "explicit":
@@ -1832,9 +1861,9 @@ class TableFinder:
                 )
 
         if h_strat == "lines":
-            h_base = filter_edges(EDGES, "h")
+            h_base = filter_edges(self.page_edges, "h")
         elif h_strat == "lines_strict":
-            h_base = filter_edges(EDGES, "h", edge_type="line")
+            h_base = filter_edges(self.page_edges, "h", edge_type="line")
         elif h_strat == "text":
             h_base = words_to_edges_h(
                 words, word_threshold=settings.min_words_horizontal
@@ -1871,10 +1900,10 @@ class TableFinder:
 Start of PyMuPDF interface code.
 The following functions are executed when "page.find_tables()" is called.
 
-* make_chars: Fills the CHARS list with text character information extracted
-              via "rawdict" text extraction. Items in CHARS are formatted
+* make_chars: Returns the CHARS list with text character information extracted
+              via TextPage.extractCOLUMNS(). Items in CHARS are formatted
               as expected by the table code.
-* make_edges: Fills the EDGES list with vector graphic information extracted
+* make_edges: Returns the EDGES list with vector graphic information extracted
               via "get_drawings". Items in EDGES are formatted as expected
               by the table code.
 
@@ -1886,71 +1915,126 @@ page information themselves.
 
 
 # -----------------------------------------------------------------------------
-# Extract all page characters to fill the CHARS list
+# Extract all page characters for the CHARS list
 # -----------------------------------------------------------------------------
 def make_chars(page, clip=None):
-    """Extract text as "rawdict" to fill CHARS."""
-    global CHARS, TEXTPAGE
+    """Extract text characters as columns.
+
+    Returns the list of characters and the text page.
+    """
+    chars = []
     page_number = page.number + 1
     page_height = page.rect.height
     ctm = page.transformation_matrix
-    TEXTPAGE = page.get_textpage(clip=clip, flags=TEXTFLAGS_TEXT)
-    blocks = page.get_text("rawdict", textpage=TEXTPAGE)["blocks"]
+    textpage = page.get_textpage(clip=clip, flags=TEXTFLAGS_TEXT)
+    cols = textpage.extractCOLUMNS()
+    count = cols["count"]
+    if not count:
+        return chars, textpage
+    # Columns are converted to lists once: indexing a list is much faster
+    # than indexing a memoryview.
+    c_col = cols["c"].tolist()
+    x0_col = cols["x0"].tolist()
+    y0_col = cols["y0"].tolist()
+    x1_col = cols["x1"].tolist()
+    y1_col = cols["y1"].tolist()
+    ox_col = cols["ox"].tolist()
+    oy_col = cols["oy"].tolist()
+    fonts = cols["fonts"]
+    font_col = cols["font"].tolist()
+    size_col = cols["size"].tolist()
+    color_col = cols["color"].tolist()
+    line_col = list(zip(cols["block"].tolist(), cols["line"].tolist()))
+    span_col = cols["span"].tolist()
+    dx_col = cols["dx"].tolist()
+    dy_col = cols["dy"].tolist()
     doctop_base = page_height * page.number
-    for block in blocks:
-        for line in block["lines"]:
-            ldir = line["dir"]  # = (cosine, sine) of angle
-            ldir = (round(ldir[0], 4), round(ldir[1], 4))
-            matrix = Matrix(ldir[0], -ldir[1], ldir[1], ldir[0], 0, 0)
-            if ldir[1] == 0:
-                upright = True
-            else:
-                upright = False
-            for span in sorted(line["spans"], key=lambda s: s["bbox"][0]):
-                fontname = span["font"]
-                fontsize = span["size"]
-                color = sRGB_to_pdf(span["color"])
-                for char in sorted(span["chars"], key=lambda c: c["bbox"][0]):
-                    bbox = Rect(char["bbox"])
-                    bbox_ctm = bbox * ctm
-                    origin = Point(char["origin"]) * ctm
-                    matrix.e = origin.x
-                    matrix.f = origin.y
-                    text = char["c"]
-                    char_dict = {
-                        "adv": bbox.x1 - bbox.x0 if upright else bbox.y1 - bbox.y0,
-                        "bottom": bbox.y1,
-                        "doctop": bbox.y0 + doctop_base,
-                        "fontname": fontname,
-                        "height": bbox.y1 - bbox.y0,
-                        "matrix": tuple(matrix),
-                        "ncs": "DeviceRGB",
-                        "non_stroking_color": color,
-                        "non_stroking_pattern": None,
-                        "object_type": "char",
-                        "page_number": page_number,
-                        "size": fontsize if upright else bbox.y1 - bbox.y0,
-                        "stroking_color": color,
-                        "stroking_pattern": None,
-                        "text": text,
-                        "top": bbox.y0,
-                        "upright": upright,
-                        "width": bbox.x1 - bbox.x0,
-                        "x0": bbox.x0,
-                        "x1": bbox.x1,
-                        "y0": bbox_ctm.y0,
-                        "y1": bbox_ctm.y1,
-                    }
-                    CHARS.append(char_dict)
+
+    def is_empty(i):
+        return x0_col[i] >= x1_col[i] or y0_col[i] >= y1_col[i]
+
+    def line_spans(start, stop):
+        """Split a line into spans, ordered like "rawdict" spans sorted by
+        their bbox, dropping a trailing span with an empty bbox."""
+        spans = []
+        i = start
+        while i < stop:
+            j = i + 1
+            while j < stop and span_col[j] == span_col[i]:
+                j += 1
+            # The span bbox is the union of non-empty char bboxes, or the
+            # first char bbox if all are empty.
+            nonempty = [x0_col[k] for k in range(i, j) if not is_empty(k)]
+            if nonempty:
+                spans.append((min(nonempty), i, j))
+            elif j < stop:
+                spans.append((x0_col[i], i, j))
+            i = j
+        spans.sort(key=itemgetter(0))
+        return spans
+
+    i = 0
+    while i < count:
+        stop = i + 1
+        while stop < count and line_col[stop] == line_col[i]:
+            stop += 1
+        ldir = (round(dx_col[i], 4), round(dy_col[i], 4))  # = (cosine, sine) of angle
+        matrix = Matrix(ldir[0], -ldir[1], ldir[1], ldir[0], 0, 0)
+        if ldir[1] == 0:
+            upright = True
+        else:
+            upright = False
+        for _, span_start, span_stop in line_spans(i, stop):
+            fontname = fonts[font_col[span_start]]
+            fontsize = size_col[span_start]
+            color = sRGB_to_pdf(color_col[span_start])
+            for k in sorted(range(span_start, span_stop), key=x0_col.__getitem__):
+                bbox = Rect(x0_col[k], y0_col[k], x1_col[k], y1_col[k])
+                bbox_ctm = bbox * ctm
+                origin = Point(ox_col[k], oy_col[k]) * ctm
+                matrix.e = origin.x
+                matrix.f = origin.y
+                text = chr(c_col[k])
+                char_dict = {
+                    "adv": bbox.x1 - bbox.x0 if upright else bbox.y1 - bbox.y0,
+                    "bottom": bbox.y1,
+                    "doctop": bbox.y0 + doctop_base,
+                    "fontname": fontname,
+                    "height": bbox.y1 - bbox.y0,
+                    "matrix": tuple(matrix),
+                    "ncs": "DeviceRGB",
+                    "non_stroking_color": color,
+                    "non_stroking_pattern": None,
+                    "object_type": "char",
+                    "page_number": page_number,
+                    "size": fontsize if upright else bbox.y1 - bbox.y0,
+                    "stroking_color": color,
+                    "stroking_pattern": None,
+                    "text": text,
+                    "top": bbox.y0,
+                    "upright": upright,
+                    "width": bbox.x1 - bbox.x0,
+                    "x0": bbox.x0,
+                    "x1": bbox.x1,
+                    "y0": bbox_ctm.y0,
+                    "y1": bbox_ctm.y1,
+                }
+                chars.append(char_dict)
+        i = stop
+    return chars, textpage
 
 
 # ------------------------------------------------------------------------
-# Extract all page vector graphics to fill the EDGES list.
+# Extract all page vector graphics for the EDGES list.
 # We are ignoring Bézier curves completely and are converting everything
 # else to lines.
 # ------------------------------------------------------------------------
-def make_edges(page, clip=None, tset=None, add_lines=None):
-    global EDGES
+def make_edges(page, clip=None, tset=None, add_lines=None, textpage=None):
+    """Return the list of edges for table detection.
+
+    The text page is used to ignore vector graphics without text.
+    """
+    edges = []
     snap_x = tset.snap_x_tolerance
     snap_y = tset.snap_y_tolerance
     lines_strict = (
@@ -2038,7 +2122,7 @@ def make_edges(page, clip=None, tset=None, add_lines=None):
                         repeat = True  # keep checking the rest
 
             # move rect 0 over to result list if there is some text in it
-            if not white_spaces.issuperset(page.get_textbox(prect0, textpage=TEXTPAGE)):
+            if not white_spaces.issuperset(page.get_textbox(prect0, textpage=textpage)):
                 # contains text, so accept it as a table bbox candidate
                 new_rects.append(prect0)
             del prects[0]  # remove from rect list
@@ -2122,7 +2206,7 @@ def make_edges(page, clip=None, tset=None, add_lines=None):
                 p1, p2 = i[1:]
                 line_dict = make_line(p, p1, p2, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
             elif i[0] == "re":  # a rectangle: decompose into 4 lines
                 rect = i[1].normalize()  # rectangle itself
@@ -2136,7 +2220,7 @@ def make_edges(page, clip=None, tset=None, add_lines=None):
                     p2 = Point(x, rect.y1)
                     line_dict = make_line(p, p1, p2, clip)
                     if line_dict:
-                        EDGES.append(line_to_edge(line_dict))
+                        edges.append(line_to_edge(line_dict))
                     continue
 
                 if rect.height <= snap_y:  # simulates a horizontal line
@@ -2145,24 +2229,24 @@ def make_edges(page, clip=None, tset=None, add_lines=None):
                     p2 = Point(rect.x1, y)
                     line_dict = make_line(p, p1, p2, clip)
                     if line_dict:
-                        EDGES.append(line_to_edge(line_dict))
+                        edges.append(line_to_edge(line_dict))
                     continue
 
                 line_dict = make_line(p, rect.tl, rect.bl, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
                 line_dict = make_line(p, rect.bl, rect.br, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
                 line_dict = make_line(p, rect.br, rect.tr, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
                 line_dict = make_line(p, rect.tr, rect.tl, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
             else:  # must be a quad
                 # we convert it into (up to) 4 lines
@@ -2170,37 +2254,37 @@ def make_edges(page, clip=None, tset=None, add_lines=None):
 
                 line_dict = make_line(p, ul, ll, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
                 line_dict = make_line(p, ll, lr, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
                 line_dict = make_line(p, lr, ur, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
                 line_dict = make_line(p, ur, ul, clip)
                 if line_dict:
-                    EDGES.append(line_to_edge(line_dict))
+                    edges.append(line_to_edge(line_dict))
 
     path = {"color": (0, 0, 0), "fill": None, "width": 1}
     for bbox in bboxes:  # add the border lines for all enveloping bboxes
         line_dict = make_line(path, bbox.tl, bbox.tr, clip)
         if line_dict:
-            EDGES.append(line_to_edge(line_dict))
+            edges.append(line_to_edge(line_dict))
 
         line_dict = make_line(path, bbox.bl, bbox.br, clip)
         if line_dict:
-            EDGES.append(line_to_edge(line_dict))
+            edges.append(line_to_edge(line_dict))
 
         line_dict = make_line(path, bbox.tl, bbox.bl, clip)
         if line_dict:
-            EDGES.append(line_to_edge(line_dict))
+            edges.append(line_to_edge(line_dict))
 
         line_dict = make_line(path, bbox.tr, bbox.br, clip)
         if line_dict:
-            EDGES.append(line_to_edge(line_dict))
+            edges.append(line_to_edge(line_dict))
 
     if add_lines is not None:  # add user-specified lines
         assert isinstance(add_lines, (tuple, list))
@@ -2211,7 +2295,8 @@ def make_edges(page, clip=None, tset=None, add_lines=None):
         p2 = Point(p2)
         line_dict = make_line(path, p1, p2, clip)
         if line_dict:
-            EDGES.append(line_to_edge(line_dict))
+            edges.append(line_to_edge(line_dict))
+    return edges
 
 
 def page_rotation_set0(page):
@@ -2296,9 +2381,7 @@ def find_tables(
     strategy=None,  # offer abbreviation
     add_lines=None,  # optional user-specified lines
 ):
-    global CHARS, EDGES
-    CHARS = []
-    EDGES = []
+    global CHARS, EDGES, TEXTPAGE
     old_small = bool(TOOLS.set_small_glyph_heights())  # save old value
     TOOLS.set_small_glyph_heights(True)  # we need minimum bboxes
     if page.rotation != 0:
@@ -2346,11 +2429,14 @@ def find_tables(
     tset = TableSettings.resolve(settings=settings)
     page.table_settings = tset
 
-    make_chars(page, clip=clip)  # create character list of page
-    make_edges(
-        page, clip=clip, tset=tset, add_lines=add_lines
+    chars, textpage = make_chars(page, clip=clip)  # create character list of page
+    edges = make_edges(
+        page, clip=clip, tset=tset, add_lines=add_lines, textpage=textpage
     )  # create lines and curves
-    tables = TableFinder(page, settings=tset)
+    tables = TableFinder(
+        page, settings=tset, chars=chars, edges=edges, textpage=textpage
+    )
+    CHARS, EDGES, TEXTPAGE = chars, edges, textpage
 
     TOOLS.set_small_glyph_heights(old_small)
     if old_xref is not None:
@@ -744,7 +744,8 @@ def get_text(
     This is a unifying wrapper for various methods of the pymupdf.TextPage class.
 
     Args:
-        option: (str) text, words, blocks, html, dict, json, rawdict, xhtml or xml.
+        option: (str) text, words, blocks, html, dict, json, rawdict, columns,
+            xhtml or xml.
         clip: (rect-like) restrict output to this area.
         flags: bit switches to e.g. exclude images or decompose ligatures.
         textpage: reuse this pymupdf.TextPage and make no new one. If specified,
@@ -767,6 +768,7 @@ def get_text(
         "rawdict": pymupdf.TEXTFLAGS_RAWDICT,
         "words": pymupdf.TEXTFLAGS_WORDS,
         "blocks": pymupdf.TEXTFLAGS_BLOCKS,
+        "columns": pymupdf.TEXTFLAGS_RAWDICT,
     }
     option = option.lower()
     if option not in formats:
@@ -812,6 +814,8 @@ def get_text(
         t = tp.extractDICT(cb=cb, sort=sort)
     elif option == "rawdict":
         t = tp.extractRAWDICT(cb=cb, sort=sort)
+    elif option == "columns":
+        t = tp.extractCOLUMNS()
     elif option == "html":
         t = tp.extractHTML()
     elif option == "xml":
@@ -841,7 +845,8 @@ def get_page_text(
         Convenience function calling page.get_text().
     Args:
         pno: page number
-        option: (str) text, words, blocks, html, dict, json, rawdict, xhtml or xml.
+        option: (str) text, words, blocks, html, dict, json, rawdict, columns,
+            xhtml or xml.
     Returns:
         output from page.TextPage().
     """
@@ -856,6 +861,9 @@ def get_pixmap(
         clip: rect_like=None,
         alpha: bool=False,
         annots: bool=True,
+        threads: int=1,
+        preview: bool=False,
+        out=None,
         ) -> pymupdf.Pixmap:
     """Create pixmap of page.
 
@@ -866,6 +874,13 @@ def get_pixmap(
         clip: (irect-like) restrict rendering to this area.
         alpha: (bool) whether to include alpha channel
         annots: (bool) whether to also render annotations
+        threads: (int) render horizontal bands of the page with this many
+            threads.
+        preview: (bool) draw images from quick, coarse decodes. The image
+            areas are listed in the pixmap's preview_rects, for redrawing
+            at full quality with Page.refine_pixmap().
+        out: (buffer) render into this writable buffer, e.g. a numpy uint8
+            array of shape (height, width, n), instead of new memory.
     """
     if dpi:
         zoom = dpi / 72
@@ -882,13 +897,39 @@ def get_pixmap(
         raise ValueError("unsupported colorspace")
 
     dl = page.get_displaylist(annots=annots)
-    pix = dl.get_pixmap(matrix=matrix, colorspace=colorspace, alpha=alpha, clip=clip)
+    pix = dl.get_pixmap(matrix=matrix, colorspace=colorspace, alpha=alpha, clip=clip, threads=threads, preview=preview, out=out)
     dl = None
     if dpi:
         pix.set_dpi(dpi, dpi)
     return pix
 
 
+def refine_pixmap(page: pymupdf.Page, pixmap: pymupdf.Pixmap) -> None:
+    """Redraw the images of a preview pixmap at full quality.
+
+    Args:
+        pixmap: a pixmap made by page.get_pixmap(preview=True). The areas in
+            its preview_rects are drawn again in place, with images decoded
+            at full resolution, and preview_rects is emptied.
+    """
+    pymupdf.CheckParent(page)
+    preview = getattr(pixmap, "_preview", None)
+    if not preview:
+        return
+    dl, matrix = preview
+    imatrix = ~matrix
+    for r in pixmap.preview_rects:
+        tile = dl.get_pixmap(
+                matrix=matrix,
+                colorspace=pixmap.colorspace,
+                alpha=pixmap.alpha,
+                clip=pymupdf.Rect(r) * imatrix,
+                )
+        pixmap.copy(tile, r & tile.irect)
+    pixmap.preview_rects = []
+    pixmap._preview = None
+
+
 def get_page_pixmap(
     doc: pymupdf.Document,
     pno: int,
@@ -1259,3 +1259,221 @@ def test_3654():
     wt = pymupdf.TOOLS.mupdf_warnings()
     assert wt == 'dropping unclosed output'
 
+
+def test_garbage_dedupe():
+    '''
+    Check that garbage=3/4 collapses duplicate objects, and time ez_save() on a
+    synthetic file with many objects.
+    '''
+    import time
+    n = 100 * 1000
+    doc = pymupdf.open()
+    doc.new_page()
+    xrefs = list()
+    for i in range(n):
+        xref = doc.get_new_xref()
+        # Half the objects are duplicates of some earlier object.
+        doc.update_object(xref, f'<</Type/Test/Value {i % (n // 2)}/Name(x{i % (n // 2) % 7})>>')
+        xrefs.append(xref)
+    stream_xrefs = list()
+    for i in range(4):
+        xref = doc.get_new_xref()
+        doc.update_object(xref, '<<>>')
+        doc.update_stream(xref, b'q Q' if i % 2 else b'Q q')
+        stream_xrefs.append(xref)
+    refs = ' '.join(f'{xref} 0 R' for xref in xrefs + stream_xrefs)
+    doc.xref_set_key(doc.pdf_catalog(), 'Test', f'[{refs}]')
+    
+    path = os.path.abspath(f'{__file__}/../../tests/test_garbage_dedupe.pdf')
+    t = time.time()
+    doc.ez_save(path, garbage=4)
+    t = time.time() - t
+    print(f'test_garbage_dedupe(): {n=} ez_save(garbage=4): {t:.2f}s')
+    
+    doc2 = pymupdf.open(path)
+    refs = doc2.xref_get_key(doc2.pdf_catalog(), 'Test')[1]
+    refs = refs[1:-1].split()[::3]
+    assert len(refs) == n + 4
+    assert len(set(refs[:n])) == n // 2
+    # Streams with identical dictionaries but different content are kept.
+    assert len(set(refs[n:])) == 2
+
+
+def test_store_threads():
+    '''
+    Stress MuPDF's store from several threads sharing one Document, and report
+    the store's hit rate. Lock wait times can be obtained by building MuPDF
+    with FITZ_DEBUG_LOCKING_TIMES.
+    '''
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/resources/2.pdf')
+    with pymupdf.open(path) as doc:
+        page_count = len(doc)
+    # Render every page several times so that images are found in the store.
+    pages = list(range(page_count)) * 4
+    
+    def render(displaylist):
+        pixmap = displaylist.get_pixmap(matrix=pymupdf.Matrix(1, 1))
+        return pixmap.irect
+    
+    hits0, misses0, evictions0 = pymupdf.mupdf.fz_store_stats()
+    for concurrency in 1, 8:
+        t = time.time()
+        irects = pymupdf.apply_pages(
+                path,
+                render,
+                pages=pages,
+                method='threads',
+                concurrency=concurrency,
+                )
+        t = time.time() - t
+        hits, misses, evictions = pymupdf.mupdf.fz_store_stats()
+        lookups = (hits - hits0) + (misses - misses0)
+        hit_rate = (hits - hits0) / lookups if lookups else 0
+        print(
+                f'test_store_threads(): {concurrency=} {len(pages)=}: {t:.2f}s'
+                f' lookups={lookups} {hit_rate=:.2f} evictions={evictions - evictions0}'
+                )
+        hits0, misses0, evictions0 = hits, misses, evictions
+        assert len(irects) == len(pages)
+
+
+def test_glyph_cache():
+    '''
+    Check glyph cache size control and statistics.
+    '''
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/resources/2.pdf')
+    size0 = pymupdf.TOOLS.glyph_cache_size()
+    assert size0 == 1024 * 1024
+    try:
+        for size in 16 * 1024, size0, 16 * size0:
+            assert pymupdf.TOOLS.glyph_cache_size(size) == size
+            pymupdf.TOOLS.glyph_cache_empty()
+            stats0 = pymupdf.TOOLS.glyph_cache_stats()
+            t = time.time()
+            with pymupdf.open(path) as doc:
+                for page in doc:
+                    page.get_pixmap(dpi=150)
+            t = time.time() - t
+            stats = pymupdf.TOOLS.glyph_cache_stats()
+            stats = {k: stats[k] - stats0[k] for k in stats}
+            print(f'test_glyph_cache(): {size=}: {t:.2f}s {stats=}')
+            if size < size0:
+                assert stats['evictions'] > 0
+            else:
+                assert stats['hits'] > stats['misses']
+    finally:
+        pymupdf.TOOLS.glyph_cache_size(size0)
+
+
+def test_objstm_lazy():
+    '''
+    Objects in object streams are parsed one at a time as they are needed, so
+    loading one page of a large file with object streams should be quick and
+    give the same results as loading every page.
+    '''
+    import time
+    count = 5000
+    with pymupdf.open() as document:
+        for i in range(count):
+            page = document.new_page()
+            page.insert_text((72, 72), f'page {i}')
+        data = document.tobytes(garbage=1, use_objstms=1)
+    print(f'test_objstm_lazy(): {count} pages, {len(data)} bytes.')
+    
+    t = time.time()
+    with pymupdf.open(stream=data) as document:
+        text = document[count - 1].get_text()
+    t_one = time.time() - t
+    assert text.strip() == f'page {count - 1}'
+    
+    t = time.time()
+    with pymupdf.open(stream=data) as document:
+        texts = [page.get_text().strip() for page in document]
+    t_all = time.time() - t
+    assert texts == [f'page {i}' for i in range(count)]
+    print(f'test_objstm_lazy(): one page: {t_one:.3f}s, all pages: {t_all:.3f}s.')
+
+
+def test_file_mapping():
+    '''
+    Compare opening and rendering a 1000 page file when MuPDF memory-maps it
+    (the default where available) and when it reads it through stdio.
+    '''
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/test_file_mapping_out.pdf')
+    with pymupdf.open() as document:
+        for i in range(1000):
+            page = document.new_page()
+            page.insert_text((72, 72), f'page {i}')
+            page.draw_rect((100, 100, 300, 200), color=(1, 0, 0), fill=(0, 0, 1))
+        document.save(path, garbage=1, use_objstms=1)
+    
+    mapping = pymupdf.mupdf.fz_file_mapping()
+    digests = list()
+    try:
+        for enable in 0, 1:
+            pymupdf.mupdf.fz_set_file_mapping(enable)
+            t = time.time()
+            with pymupdf.open(path) as document:
+                digest = [page.get_pixmap(dpi=36).digest for page in document]
+            t = time.time() - t
+            print(f'test_file_mapping(): mapping={pymupdf.mupdf.fz_file_mapping()}: {t:.3f}s')
+            digests.append(digest)
+    finally:
+        pymupdf.mupdf.fz_set_file_mapping(mapping)
+    assert digests[0] == digests[1]
+
+
+def test_save_threads():
+    '''
+    Saving with `threads` decompresses object streams up front, and must give
+    the same output as saving without.
+    '''
+    import time
+    count = 5000
+    with pymupdf.open() as document:
+        for i in range(count):
+            page = document.new_page()
+            page.insert_text((72, 72), f'page {i}')
+        data = document.tobytes(garbage=1, deflate=True, use_objstms=1)
+    outs = dict()
+    for threads in 1, 4:
+        with pymupdf.open(stream=data) as document:
+            t = time.time()
+            outs[threads] = document.tobytes(garbage=3, no_new_id=True, threads=threads)
+            t = time.time() - t
+        print(f'test_save_threads(): {threads=}: {t:.3f}s')
+    assert outs[4] == outs[1]
+    with pymupdf.open(stream=outs[4]) as document:
+        assert document.page_count == count
+        assert document[count - 1].get_text().strip() == f'page {count - 1}'
+
+
+def test_rewrite_images():
+    '''
+    Recompressing images with several threads must give the same document as
+    with one, and images shown twice are resampled for the larger use.
+    '''
+    import time
+    jpg = os.path.abspath(f'{__file__}/../../tests/resources/nur-ruhig.jpg')
+    png = os.path.abspath(f'{__file__}/../../tests/resources/img-transparent.png')
+    with pymupdf.open() as document:
+        for i in range(10):
+            page = document.new_page()
+            page.insert_image((50, 50, 100, 100), filename=jpg)
+            page.insert_image((100, 100, 300, 300), filename=jpg)
+            page.insert_image((300, 300, 400, 400), filename=png)
+        data = document.tobytes(garbage=3, deflate=True)
+    outs = dict()
+    for threads in 1, 4:
+        with pymupdf.open(stream=data) as document:
+            t = time.time()
+            document.rewrite_images(dpi_threshold=100, dpi_target=72, quality=60, threads=threads)
+            t = time.time() - t
+            outs[threads] = document.tobytes(garbage=3, deflate=True, no_new_id=True)
+            widths = sorted(set(document.xref_get_key(i[0], 'Width')[1] for i in document[0].get_images()))
+        print(f'test_rewrite_images(): {threads=}: {t:.3f}s, {len(data)} => {len(outs[threads])} bytes, {widths=}')
+    assert outs[4] == outs[1]
+    assert len(outs[1]) < len(data)
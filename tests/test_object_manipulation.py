@@ -72,3 +72,45 @@ def test_valid_name():
         assert str(e) == "bad 'value'"
         error_generated = True
     assert error_generated
+
+
+def test_large_dict():
+    """Lookups in large dictionaries use a hash index which must be kept in
+    step with insertions, replacements, deletions and sorting."""
+    if not hasattr(pymupdf, "mupdf"):
+        print("test_large_dict(): not running on classic.")
+        return
+    import time
+    mupdf = pymupdf.mupdf
+    doc = pymupdf.open()
+    pdf = pymupdf._as_pdf_document(doc)
+    obj = mupdf.pdf_new_dict(pdf, 4)
+    expected = dict()
+
+    def check():
+        for key, value in expected.items():
+            assert mupdf.pdf_to_int(mupdf.pdf_dict_gets(obj, key)) == value
+        assert mupdf.pdf_dict_len(obj) == len(expected)
+
+    for i in range(300):
+        key = "Type" if i == 50 else f"F{i}"
+        mupdf.pdf_dict_puts(obj, key, mupdf.pdf_new_int(i))
+        expected[key] = i
+        if i % 7 == 0:
+            mupdf.pdf_dict_dels(obj, f"F{i // 2}")
+            expected.pop(f"F{i // 2}", None)
+        if i % 11 == 0:
+            mupdf.pdf_dict_puts(obj, key, mupdf.pdf_new_int(2 * i))
+            expected[key] = 2 * i
+        if i % 10 == 0:
+            check()
+    check()
+    assert mupdf.pdf_to_int(mupdf.pdf_dict_get(obj, pymupdf.PDF_NAME("Type"))) == 50
+    assert not mupdf.pdf_dict_gets(obj, "Missing").m_internal
+
+    t = time.time()
+    for _ in range(100):
+        for key in expected:
+            mupdf.pdf_dict_gets(obj, key)
+    t = time.time() - t
+    print(f"test_large_dict(): {100 * len(expected)} lookups: {t:.3f}s")
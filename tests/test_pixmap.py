@@ -7,6 +7,7 @@ Pixmap tests
 
 import pymupdf
 
+import gc
 import os
 import platform
 import sys
@@ -356,3 +357,367 @@ def test_3493():
     else:
         assert out1 != out0
     assert out2 == out0
+
+
+def test_pixmap_threads():
+    '''
+    Check banded rendering with multiple threads, and show timings.
+    '''
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/resources/2.pdf')
+    document = pymupdf.open(path)
+    page = document[0]
+    ts = dict()
+    pixmaps = dict()
+    for threads in 1, 4:
+        t = time.time()
+        pixmaps[threads] = page.get_pixmap(dpi=300, threads=threads)
+        ts[threads] = time.time() - t
+        print(f'{threads=}: {ts[threads]:.3f}s')
+    pix1, pix4 = pixmaps[1], pixmaps[4]
+    assert pix4.irect == pix1.irect
+    # Anti-aliasing at band boundaries can differ slightly.
+    s1 = pix1.samples
+    s4 = pix4.samples
+    stride = pix1.stride
+    diff_rows = sum(s1[i:i+stride] != s4[i:i+stride] for i in range(0, len(s1), stride))
+    print(f'{diff_rows=}')
+    assert diff_rows < pix1.height / 100
+
+
+def test_pixmap_simd():
+    '''
+    Check that MuPDF's vectorised compositing routines give exactly the same
+    pixels as the plain C ones, and show timings.
+    '''
+    import time
+    if not pymupdf.mupdf.fz_paint_simd():
+        print('test_pixmap_simd(): SIMD compositing not available.')
+        return
+    paths = [
+            os.path.abspath(f'{__file__}/../../tests/resources/{name}')
+            for name in ('2.pdf', 'chinese-tables.pdf')
+            ]
+    try:
+        for path in paths:
+            with pymupdf.open(path) as document:
+                for page in list(document)[:3]:
+                    for colorspace, alpha in (
+                            (pymupdf.csRGB, False),
+                            (pymupdf.csRGB, True),
+                            (pymupdf.csGRAY, True),
+                            (pymupdf.csCMYK, False),
+                            ):
+                        samples = list()
+                        for simd in 0, 1:
+                            pymupdf.mupdf.fz_set_paint_simd(simd)
+                            t = time.time()
+                            pixmap = page.get_pixmap(dpi=150, colorspace=colorspace, alpha=alpha)
+                            t = time.time() - t
+                            print(f'{os.path.basename(path)} page {page.number} {colorspace.name} {alpha=} {simd=}: {t:.3f}s')
+                            samples.append(pixmap.samples)
+                        assert samples[0] == samples[1]
+    finally:
+        pymupdf.mupdf.fz_set_paint_simd(1)
+
+
+def test_pixmap_scale():
+    '''
+    Benchmark typical 300 to 72 dpi reductions with Pixmap.scale(), with and
+    without the vectorised scalers and with several threads. All must give
+    exactly the same pixels.
+    '''
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/resources/2.pdf')
+    simds = (0, 1) if pymupdf.mupdf.fz_paint_simd() else (0,)
+    try:
+        with pymupdf.open(path) as document:
+            page = document[0]
+            for colorspace in pymupdf.csGRAY, pymupdf.csRGB, pymupdf.csCMYK:
+                pixmap = page.get_pixmap(dpi=300, colorspace=colorspace)
+                width = pixmap.width * 72 / 300
+                height = pixmap.height * 72 / 300
+                samples = list()
+                for simd in simds:
+                    pymupdf.mupdf.fz_set_paint_simd(simd)
+                    for threads in 1, 4:
+                        t = time.time()
+                        for i in range(5):
+                            small = pixmap.scale(width, height, threads=threads)
+                        t = (time.time() - t) / 5
+                        print(f'{colorspace.name} {pixmap.width}x{pixmap.height} => {small.width}x{small.height} {simd=} {threads=}: {t:.4f}s')
+                        samples.append(small.samples)
+                for s in samples[1:]:
+                    assert s == samples[0]
+    finally:
+        pymupdf.mupdf.fz_set_paint_simd(1)
+
+
+def test_displaylist_index():
+    '''
+    Benchmark rendering a page full of drawings as 256x256 tiles at high zoom,
+    with and without a spatial index on the display list. Both must give
+    exactly the same pixels.
+    '''
+    import time
+    document = pymupdf.open()
+    page = document.new_page()
+    for y in range(0, 800, 8):
+        for x in range(0, 600, 8):
+            color = ((x % 256) / 255, (y % 256) / 255, 0.5)
+            page.draw_rect((x, y, x + 6, y + 6), color=color, fill=color)
+            if (x + y) % 64 == 0:
+                page.insert_text((x, y + 6), 'x', fontsize=6)
+    zoom = 8
+    matrix = pymupdf.Matrix(zoom, zoom)
+    bounds = page.rect * matrix
+    tiles = list()
+    for y in range(0, int(bounds.height), 256):
+        for x in range(0, int(bounds.width), 256):
+            tiles.append(pymupdf.IRect(x, y, x + 256, y + 256))
+    tiles = tiles[::7]
+    samples = list()
+    for indexed in False, True:
+        displaylist = page.get_displaylist()
+        if indexed:
+            displaylist.build_index()
+        t = time.time()
+        samples.append([displaylist.get_pixmap(matrix=matrix, clip=tile).samples for tile in tiles])
+        t = time.time() - t
+        print(f'{len(tiles)} tiles {indexed=}: {t:.3f}s')
+    assert samples[0] == samples[1]
+
+
+def test_displaylist_tobytes():
+    '''
+    Round-trip display lists of pages with text, images and vector graphics
+    through DisplayList.tobytes() and DisplayList.frombytes(). Also compares
+    the time to load a serialized list with the time to interpret the page.
+    '''
+    import time
+    t_interpret = 0
+    t_load = 0
+    for name in '2201.00069.pdf', 'test_2645_1.pdf', 'img-transparent.png':
+        path = os.path.join(scriptdir, 'resources', name)
+        with pymupdf.open(path) as document:
+            for page in document:
+                t = time.time()
+                displaylist = page.get_displaylist()
+                t_interpret += time.time() - t
+                data = displaylist.tobytes()
+                t = time.time()
+                displaylist2 = pymupdf.DisplayList.frombytes(data)
+                t_load += time.time() - t
+                assert displaylist2.rect == displaylist.rect
+                pixmap = displaylist.get_pixmap()
+                pixmap2 = displaylist2.get_pixmap()
+                assert pixmap2.samples == pixmap.samples
+    print(f'interpret: {t_interpret:.3f}s, load: {t_load:.3f}s')
+    try:
+        pymupdf.DisplayList.frombytes(b'not a display list')
+    except Exception as e:
+        print(f'Received expected exception: {e}')
+    else:
+        assert 0, 'Expected exception'
+
+
+def test_pixmap_jpeg_tiles():
+    '''
+    Rendering a page in tiles lets MuPDF reuse the JPEG scanlines decoded
+    for the previous tile, or resume decoding where it stopped. Check the
+    tiles come out the same whatever order they are drawn in, and the same
+    as the corresponding part of the whole page decoded from scratch.
+    '''
+    document = pymupdf.open()
+    page = document.new_page(width=439, height=501)
+    page.insert_image(page.rect, filename=imgfile)
+    tiles = [
+            pymupdf.Rect(x, y, x + 110, y + 50) & page.rect
+            for y in range(0, 501, 50)
+            for x in range(0, 439, 110)
+            ]
+
+    pymupdf.TOOLS.store_shrink(100)
+    full = page.get_pixmap()
+    n = full.n
+
+    def cut(irect):
+        return b''.join(
+                full.samples[y * full.stride + irect.x0 * n : y * full.stride + irect.x1 * n]
+                for y in range(irect.y0, irect.y1)
+                )
+
+    def render(order):
+        pymupdf.TOOLS.store_shrink(100)
+        tiles_samples = dict()
+        for i in order:
+            pix = page.get_pixmap(clip=tiles[i])
+            assert pix.stride == pix.width * n
+            assert pix.samples == cut(pix.irect), f'{i=} {pix.irect=}'
+            tiles_samples[i] = pix.samples
+        return tiles_samples
+
+    forward = render(range(len(tiles)))
+    backward = render(reversed(range(len(tiles))))
+    assert forward == backward
+
+
+def test_pixmap_preview():
+    '''
+    Render a page with coarse image decodes first, then refine it. The
+    refined pixmap should match a normal rendering far more closely than the
+    preview does.
+    '''
+    document = pymupdf.open()
+    page = document.new_page(width=439, height=501)
+    page.insert_image(page.rect, filename=imgfile)
+    page.insert_text((50, 50), 'Preview', fontsize=30)
+
+    def difference(a, b):
+        assert a.irect == b.irect
+        return sum(abs(x - y) for x, y in zip(a.samples, b.samples)) / len(a.samples)
+
+    full = page.get_pixmap()
+    pymupdf.TOOLS.store_shrink(100)
+    preview = page.get_pixmap(preview=True)
+    assert preview.preview_rects == [page.rect.irect]
+    d_preview = difference(preview, full)
+    page.refine_pixmap(preview)
+    assert preview.preview_rects == []
+    d_refined = difference(preview, full)
+    print(f'{d_preview=} {d_refined=}')
+    assert d_refined < d_preview
+    assert d_refined < 1
+
+
+def test_pixmap_buffer():
+    '''
+    Export pixmap samples without copying, and render into a caller-provided
+    buffer.
+    '''
+    document = pymupdf.open()
+    page = document.new_page(width=101, height=53)
+    page.insert_text((10, 30), 'Buffer', fontsize=20)
+    pix = page.get_pixmap()
+    expected = pix.samples
+    w, h, n = pix.width, pix.height, pix.n
+    assert n == 3
+
+    # The memoryview keeps the samples alive.
+    mv = pix.samples_mv
+    del pix
+    gc.collect()
+    assert bytes(mv) == expected
+
+    # The samples cannot be reallocated while they are exported.
+    pix = page.get_pixmap()
+    if pymupdf.g_use_extra:
+        mv = pix.samples_mv
+        with pytest.raises(BufferError):
+            pix.shrink(1)
+        assert bytes(mv) == expected
+        del mv
+    pix.shrink(1)
+    assert (pix.width, pix.height) == ((w + 1) // 2, (h + 1) // 2)
+    assert len(pix.samples_mv) == pix.width * pix.height * n
+    if sys.version_info >= (3, 12):
+        assert memoryview(pix).shape == (pix.height, pix.width, n)
+
+    # Render RGB without alpha into a bytearray.
+    out = bytearray(h * w * n)
+    pix = page.get_pixmap(out=out)
+    assert pix.irect == (0, 0, w, h)
+    assert bytes(out) == expected
+    interface = pix.__array_interface__
+    assert interface['shape'] == (h, w, n)
+    assert interface['data'][0] == pix.samples_ptr
+    if sys.version_info >= (3, 12):
+        view = memoryview(pix)
+        assert view.shape == (h, w, n)
+        assert view[1, 2, 0] == expected[(1 * w + 2) * n]
+        del view
+
+    # The pixmap keeps `out` exported, so it cannot be reallocated.
+    with pytest.raises(BufferError):
+        del out[:]
+    with pytest.raises(BufferError):
+        out.extend(b'x')
+    mv = pix.samples_mv
+    del pix
+    gc.collect()
+    with pytest.raises(BufferError):
+        del out[:]
+    del mv
+    gc.collect()
+    del out[:]
+
+    with pytest.raises(Exception):
+        page.get_pixmap(out=bytearray(h * w * n - 1))
+    with pytest.raises(Exception):
+        page.get_pixmap(out=bytes(h * w * n))
+
+    try:
+        import numpy
+    except ImportError:
+        return
+    pix = page.get_pixmap()
+    assert numpy.asarray(pix).tobytes() == expected
+    if not pymupdf.g_use_extra:
+        # Only the native renderer supports padded rows.
+        return
+    # Render into a slice of a larger array, so rows are padded.
+    canvas = numpy.zeros((h + 2, w + 5, n), dtype=numpy.uint8)
+    pix = page.get_pixmap(out=canvas[1:-1, 2:-3])
+    assert canvas[1:-1, 2:-3].tobytes() == expected
+    assert not canvas[0].any() and not canvas[:, :2].any() and not canvas[:, -3:].any()
+    assert numpy.asarray(pix).tobytes() == expected
+    assert pix.samples == expected
+    with pytest.raises(ValueError):
+        pix.shrink(1)
+
+    # A slice that ends where the array's memory ends: the flat export must
+    # not include padding after the last row.
+    canvas = numpy.zeros((h, w + 5, n), dtype=numpy.uint8)
+    pix = page.get_pixmap(out=canvas[:, 5:])
+    assert len(pix.samples_mv) == pix.stride * (h - 1) + w * n
+    assert pix.samples == expected
+
+
+def test_render_pages():
+    '''
+    Render pages of different sizes into one buffer, with and without
+    threads, and compare with Page.get_pixmap().
+    '''
+    document = pymupdf.open()
+    for i, (width, height) in enumerate([(200, 300), (300, 200), (150, 150)]):
+        page = document.new_page(width=width, height=height)
+        page.insert_text((20, 50), f'Page {i}', fontsize=24)
+    pages = [2, 0, 1]
+    matrix = pymupdf.Matrix(0.5, 0.5)
+    for threads in (1, 3):
+        buffer, shape = document.render_pages(pages, matrix=matrix, threads=threads)
+        assert shape == (3, 150, 150, 3)
+        assert len(buffer) == 3 * 150 * 150 * 3
+        _, h, w, n = shape
+        for i, pno in enumerate(pages):
+            pix = document[pno].get_pixmap(matrix=matrix)
+            slot = buffer[i * h * w * n : (i + 1) * h * w * n]
+            for y in range(h):
+                row = slot[y * w * n : (y + 1) * w * n]
+                if y < pix.height:
+                    expected = pix.samples[y * pix.stride : y * pix.stride + min(w, pix.width) * n]
+                    expected += b'\xff' * (w * n - len(expected))
+                else:
+                    expected = b'\xff' * (w * n)
+                assert row == expected, f'{threads=} {pno=} {y=}'
+
+    # Render into a caller's buffer.
+    out = bytearray(2 * 150 * 100 * 1)
+    buffer, shape = document.render_pages([0, 0], matrix=matrix, colorspace='gray', out=out)
+    assert buffer is out
+    assert shape == (2, 150, 100, 1)
+    assert out[:15000] == out[15000:] == document[0].get_pixmap(matrix=matrix, colorspace='gray').samples
+    with pytest.raises(Exception):
+        document.render_pages(matrix=matrix, out=bytearray(10))
+    with pytest.raises(ValueError):
+        document.render_pages([3])
@@ -308,3 +308,47 @@ def test_dotted_grid():
     assert t0.row_count, t0.col_count == (11, 12)
     assert t1.row_count, t1.col_count == (25, 11)
     assert t2.row_count, t2.col_count == (1, 10)
+
+
+def test_native_geometry():
+    """Compare and time native and Python table geometry.
+
+    find_tables() uses native code for finding intersections, cells and
+    tables, if available. Both must give identical results.
+    """
+    import time
+
+    table = pymupdf.table
+    if not table.g_use_extra:
+        print("Native table geometry not in use")
+        return
+    names = (
+        "chinese-tables.pdf",
+        "test_2979.pdf",
+        "test_3062.pdf",
+        "strict-yes-no.pdf",
+        "small-table.pdf",
+        "test_3179.pdf",
+        "battery-file-22.pdf",
+        "dotted-gridlines.pdf",
+    )
+    times = {True: 0, False: 0}
+    for name in names:
+        doc = pymupdf.open(os.path.join(scriptdir, "resources", name))
+        for page in doc:
+            results = {}
+            for native in (True, False):
+                table.g_use_extra = native
+                try:
+                    t = time.time()
+                    tabs = page.find_tables()
+                    times[native] += time.time() - t
+                finally:
+                    table.g_use_extra = True
+                results[native] = (
+                    list(tabs.intersections.items()),
+                    tabs.cells,
+                    [(tab.bbox, tab.cells, tab.extract()) for tab in tabs],
+                )
+            assert results[True] == results[False], f"{name} page {page.number}"
+    print(f"find_tables(): native {times[True]:.3f}s, Python {times[False]:.3f}s")
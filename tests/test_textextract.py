@@ -312,6 +312,14 @@ def test_document_text():
         print(f'{method}: {concurrency=} {t=} ({t0/t:.2f}x) {llen(texts)=}', flush=1)
         assert texts == texts0
     
+    if hasattr(pymupdf, 'mupdf'):
+        method = 'threads'
+        t = time.time()
+        texts = pymupdf.get_text(path, concurrency=concurrency, method=method, _stats=_stats)
+        t = time.time() - t
+        print(f'{method}: {concurrency=} {t=} ({t0/t:.2f}x) {llen(texts)=}', flush=1)
+        assert texts == texts0
+    
     if _stats:
         pymupdf._log_items_clear()
 
@@ -329,3 +337,116 @@ def test_3594():
         # We expect MuPDF warnings.
         wt = pymupdf.TOOLS.mupdf_warnings()
         assert wt
+
+
+def test_columns():
+    """Check TextPage.extractCOLUMNS() against extractRAWDICT()."""
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/resources/mupdf_explored.pdf')
+    with pymupdf.open(path) as document:
+        page = document[0]
+        tp = page.get_textpage(flags=pymupdf.TEXTFLAGS_RAWDICT)
+        t = time.time()
+        rawdict = tp.extractRAWDICT()
+        t_rawdict = time.time() - t
+        t = time.time()
+        cols = page.get_text("columns", textpage=tp)
+        t_columns = time.time() - t
+        print(f'extractRAWDICT(): {t_rawdict:.4f}s, extractCOLUMNS(): {t_columns:.4f}s')
+
+        chars = []
+        for block in rawdict["blocks"]:
+            for line in block.get("lines", []):
+                for span in line["spans"]:
+                    for char in span["chars"]:
+                        chars.append((block["number"], line["dir"], span, char))
+        assert cols["count"] == len(chars) > 0
+        for name, _ in pymupdf._stext_columns:
+            n = 8 if name == "quad" else 1
+            assert len(cols[name]) == n * cols["count"]
+        for i, (block_n, ldir, span, char) in enumerate(chars):
+            assert cols["block"][i] == block_n
+            assert chr(cols["c"][i]) == char["c"]
+            bbox = (cols["x0"][i], cols["y0"][i], cols["x1"][i], cols["y1"][i])
+            assert bbox == char["bbox"]
+            assert (cols["ox"][i], cols["oy"][i]) == char["origin"]
+            assert (cols["dx"][i], cols["dy"][i]) == ldir
+            assert cols["fonts"][cols["font"][i]] == span["font"]
+            assert cols["size"][i] == span["size"]
+            assert cols["flags"][i] == span["flags"]
+            assert cols["color"][i] == span["color"]
+
+
+def test_compact_stext():
+    """Compare memory and speed of compact and normal text pages."""
+    import time
+    mupdf = getattr(pymupdf, 'mupdf', None)
+    if not hasattr(mupdf, 'll_fz_new_compact_stext_page'):
+        print('No compact text pages in this MuPDF')
+        return
+    path = os.path.abspath(f'{__file__}/../../tests/resources/mupdf_explored.pdf')
+    sizes = [0, 0, 0]
+    times = [0, 0]
+    with pymupdf.open(path) as document:
+        for page in document:
+            tp = page.get_textpage()
+            stext = tp.this.m_internal
+            sizes[0] += mupdf.ll_fz_pool_size(stext.pool)
+            for i, flags in enumerate((0, mupdf.FZ_COMPACT_STEXT_QUANTIZE)):
+                t = time.time()
+                compact = mupdf.ll_fz_new_compact_stext_page(stext, flags)
+                times[0] += time.time() - t
+                sizes[i + 1] += mupdf.ll_fz_compact_stext_page_size(compact)
+                # Existing functions work with the expanded page.
+                t = time.time()
+                expanded = pymupdf.TextPage(mupdf.FzStextPage(
+                        mupdf.ll_fz_new_stext_page_from_compact(compact)))
+                times[1] += time.time() - t
+                mupdf.ll_fz_drop_compact_stext_page(compact)
+                assert expanded.extractText() == tp.extractText()
+                if not flags:
+                    assert expanded.extractRAWDICT() == tp.extractRAWDICT()
+    print(f'text page memory: {sizes[0]}, compact: {sizes[1]}, quantized: {sizes[2]}')
+    print(f'compact: {times[0]:.4f}s, expand: {times[1]:.4f}s')
+    assert sizes[2] < sizes[1] < sizes[0]
+
+
+def test_iter_text():
+    """Check streamed text extraction against get_text()."""
+    import time
+    path = os.path.abspath(f'{__file__}/../../tests/resources/mupdf_explored.pdf')
+    with pymupdf.open(path) as document:
+        t = time.time()
+        texts = [page.get_text() for page in document]
+        t_text = time.time() - t
+        t = time.time()
+        streamed = list(document.iter_text())
+        t_iter = time.time() - t
+        print(f'get_text(): {t_text:.4f}s, iter_text(): {t_iter:.4f}s')
+        assert streamed == texts
+        assert list(document.iter_text(pages=[1, 0])) == texts[1::-1]
+
+        for page in document:
+            assert list(page.iter_words()) == page.get_text("words")
+            delimiters = ".,;:"
+            clip = page.rect / 2
+            assert (list(page.iter_words(clip=clip, delimiters=delimiters))
+                    == page.get_text("words", clip=clip, delimiters=delimiters))
+
+        # Stop iterating early.
+        page = document[0]
+        expected = page.get_text("words")
+        words = page.iter_words()
+        assert next(words) == expected[0]
+        words.close()
+        assert list(page.iter_words()) == expected
+
+        # Use the document while iterating.
+        page.set_rotation(90)
+        rotated = []
+        for word in page.iter_words():
+            assert page.rotation == 90
+            document[1].get_text()
+            rotated.append(word)
+        assert rotated == expected
+        page.set_rotation(0)
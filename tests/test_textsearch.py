@@ -6,8 +6,20 @@ rectangle with the searched text.
 "test_search2":
 Text search with 'clip' parameter - clip rectangle contains two occurrences
 of searched text. Confirm search locations are inside clip.
+
+"test_search_many":
+Search for many strings at once with Document.search() and compare with
+Page.search_for(), with and without the search index.
+
+"test_search_many_order":
+Document.search() reports one item per occurrence, in the order in which
+occurrences end on the page, also without the native multi-needle search.
+
+"test_search_index_update":
+The search index of Document.search() is discarded when the document changes.
 """
 import os
+import time
 
 import pymupdf
 
@@ -35,3 +47,78 @@ def test_search2():
     assert len(rl) == 2
     for r in rl:
         assert r in clip
+
+
+def test_search_many():
+    doc = pymupdf.open(filename2)
+    words = set()
+    for page in doc:
+        words.update(w[4] for w in page.get_text("words"))
+    needles = sorted(words)[:200] + ["the", "of the", "pymupdf", "no-such-text"]
+
+    t = time.time()
+    expected = []
+    for page in doc:
+        for i, needle in enumerate(needles):
+            for rect in page.search_for(needle):
+                expected.append((page.number, i, rect))
+    t_single = time.time() - t
+
+    def flatten(hits):
+        return sorted(
+            (pno, i, tuple(r)) for pno, i, areas in hits for r in areas
+        )
+
+    t = time.time()
+    hits = doc.search(needles)
+    t_many = time.time() - t
+    print(f"search_for(): {t_single:.3f}s, Document.search(): {t_many:.3f}s")
+    assert all(type(r) is pymupdf.Rect for _, _, areas in hits for r in areas)
+    got = flatten(hits)
+    assert len(got) == len(expected)
+    for (pno, i, r), (pno2, i2, r2) in zip(got, sorted((p, i, tuple(r)) for p, i, r in expected)):
+        assert (pno, i) == (pno2, i2)
+        assert max(abs(a - b) for a, b in zip(r, r2)) < 1e-3
+
+    # The index must not change results, only skip pages.
+    assert flatten(doc.search(needles, index=True)) == got
+    assert flatten(doc.search(needles, index=True)) == got
+    assert doc.search(["no-such-text"], index=True) == []
+
+
+def test_search_many_order(monkeypatch):
+    doc = pymupdf.open()
+    page = doc.new_page()
+    page.insert_text((50, 50), "one two three")
+    page.insert_text((50, 70), "four one two")
+    needles = ["two", "one two", "three four", "one"]
+    expected = [(3, 1), (1, 1), (0, 1), (2, 2), (3, 1), (1, 1), (0, 1)]
+
+    def check():
+        hits = doc.search(needles)
+        assert [(i, len(areas)) for pno, i, areas in hits] == expected
+        assert all(pno == 0 for pno, i, areas in hits)
+
+    check()
+    monkeypatch.setattr(pymupdf, "g_use_extra", False)
+    check()
+
+
+def test_search_index_update():
+    doc = pymupdf.open()
+    page = doc.new_page()
+    page.insert_text((50, 50), "alpha beta")
+    assert len(doc.search(["alpha"], index=True)) == 1
+    assert doc.search(["gamma"], index=True) == []
+
+    page.insert_text((50, 70), "gamma")
+    assert len(doc.search(["gamma"], index=True)) == 1
+
+    page.add_redact_annot(page.search_for("alpha")[0])
+    page.apply_redactions()
+    assert doc.search(["alpha"], index=True) == []
+    assert len(doc.search(["beta"], index=True)) == 1
+
+    xref = page.get_contents()[0]
+    doc.update_stream(xref, b"BT /helv 11 Tf 50 100 Td (delta) Tj ET")
+    assert len(doc.search(["delta"], index=True)) == 1